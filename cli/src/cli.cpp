@@ -25,6 +25,7 @@
 #include "util.h"
 #include "version.h"
 #include "makecommand.h"
+#include "watchcommand.h"
 #include <QCommandLineParser>
 
 int cliMain(int argc, char *argv[])
@@ -44,6 +45,8 @@ int cliMain(int argc, char *argv[])
     parser.addOptions({
         {QStringList{"timeout", "t"}, "Sets timeout for one-shot commands.", "seconds", "5"},
         {QStringList{"debug", "d"}, "Prints debug logs to stderr."},
+        {QStringList{"format"}, "Output format for watch: text or ndjson.", "format", "text"},
+        {QStringList{"filter"}, "Properties printed by watch in ndjson format (comma-separated).", "properties"},
         // Use our own "help" option rather than the built-in one - Qt stops
         // parsing when it encounters the built-in option, we need it to keep
         // parsing in case --unstable was given too.
@@ -103,6 +106,8 @@ int cliMain(int argc, char *argv[])
         return CliExitCode::InvalidArgs;
     }
     CliTimeout::setTimeout(std::chrono::seconds{timeoutSec});
+    WatchCommand::setOptions(parser.value(QStringLiteral("format")),
+                             parser.value(QStringLiteral("filter")).split(QLatin1Char(','), QString::SkipEmptyParts));
 
     auto cmdArgs = parser.positionalArguments();
     if(cmdArgs.empty())
@@ -115,6 +120,19 @@ int cliMain(int argc, char *argv[])
     try
     {
         auto &command = getCommand(parser.isSet("unstable"), cmdArgs.front());
+        // --format and --filter only apply to watch; don't silently ignore
+        // them for other commands
+        if(!dynamic_cast<WatchCommand*>(&command))
+        {
+            for(const auto &option : {QStringLiteral("format"), QStringLiteral("filter")})
+            {
+                if(parser.isSet(option))
+                {
+                    errln() << "Option --" + option << "is only valid for watch";
+                    return CliExitCode::InvalidArgs;
+                }
+            }
+        }
         return command.exec(cmdArgs, app);
     }
     catch(const Error &err)
@@ -21,8 +21,8 @@
 
 #include "cliclient.h"
 
-CliClient::CliClient()
-    : _connection{nullptr}
+CliClient::CliClient(DaemonConnection::SyncMode syncMode)
+    : _connection{nullptr, syncMode}
 {
     _connection.connectToDaemon();
 
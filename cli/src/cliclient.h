@@ -31,7 +31,10 @@ class CliClient : public QObject
     Q_OBJECT
 
 public:
-    CliClient();
+    // Commands that only call a daemon method can use a query-only
+    // connection, which doesn't wait for the daemon's state.  See
+    // DaemonConnection::SyncMode.
+    explicit CliClient(DaemonConnection::SyncMode syncMode = DaemonConnection::SyncMode::Subscribe);
 
 public:
     DaemonConnection &connection() {return _connection;}
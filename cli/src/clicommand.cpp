@@ -132,7 +132,8 @@ QJsonValue CliCommand::execOneShot(QCoreApplication &app,
                                    const QString &rpcMethod,
                                    const QJsonArray &rpcArgs)
 {
-    CliClient client;
+    // One-shot commands don't use the daemon state
+    CliClient client{DaemonConnection::SyncMode::QueryOnly};
 
     // We don't have to reference this later, just hang onto the Async here so
     // it's kept alive until either it completes or we abort.
@@ -98,8 +98,9 @@ protected:
     // any parameters are given)
     void checkNoParams(const QStringList &params);
 
-    // Execute a one-shot command.  Connects to the daemon, then issues a daemon
-    // RPC with the name and arguments specified.  If the RPC completes
+    // Execute a one-shot command.  Connects to the daemon (without waiting for
+    // its state), then issues a daemon RPC with the name and arguments
+    // specified.  If the RPC completes
     // successfully, this returns the QJsonValue returned by the daemon - the
     // caller can print this to stdout if needed.  If the RPC does not complete,
     // this prints diagnostics if needed and throws an Error.
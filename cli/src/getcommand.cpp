@@ -155,7 +155,11 @@ namespace
     {
     public:
         static QString renderLocation(const QSharedPointer<ServerLocation> &pLocation);
-        static QString renderValue(CliClient &client, const QString &type);
+        static QString renderValue(const DaemonSettings &settings,
+                                   const DaemonState &state, const QString &type);
+        // Get the daemon properties used by renderValue() for a type, as
+        // "<object>.<property>" names for the getProperties RPC
+        static QStringList valueProperties(const QString &type);
 
     public:
         ValuePrinter(CliClient &client, QString type);
@@ -186,14 +190,16 @@ namespace
         {
             if(_lastValue.isEmpty())
             {
-                _lastValue = renderValue(client, _type);
+                _lastValue = renderValue(client.connection().settings,
+                                         client.connection().state, _type);
                 outln() << _lastValue;
             }
         });
 
         connectValueSignals(client, [&client, this]()
         {
-            QString newValue = renderValue(client, _type);
+            QString newValue = renderValue(client.connection().settings,
+                                           client.connection().state, _type);
             // Print only if the value has actually changed
             // (particularly important for 'monitor region', since the
             // chosenLocation property also contains the region latency and
@@ -213,23 +219,24 @@ namespace
         return GetSetValue::getRegionCliName(pLocation);
     }
 
-    QString ValuePrinter::renderValue(CliClient &client, const QString &type)
+    QString ValuePrinter::renderValue(const DaemonSettings &settings,
+                                      const DaemonState &state, const QString &type)
     {
         if(type == GetSetType::connectionState)
         {
-            return client.connection().state.connectionState();
+            return state.connectionState();
         }
         else if(type == GetSetType::debugLogging)
         {
             // The debugLogging setting is actually an arbitrary set of filters,
             // but any non-null value (even an empty array) enables disk logging
             // and is considered "on".
-            bool enabled = !client.connection().settings.debugLogging().isNull();
+            bool enabled = !settings.debugLogging().isNull();
             return GetSetValue::getBooleanText(enabled);
         }
         else if(type == GetSetType::portForward)
         {
-            int forwardedPort = client.connection().state.forwardedPort();
+            int forwardedPort = state.forwardedPort();
             // For special values, write the state name
             const auto &metaEnum = QMetaEnum::fromType<DaemonState::PortForwardState>();
             const char *name = metaEnum.valueToKey(forwardedPort);
@@ -242,11 +249,11 @@ namespace
             // Print the chosen location from DaemonState; this includes the
             // name and results in invalid choices being treated as 'auto'
             // (which is what the daemon does)
-            return renderLocation(client.connection().state.vpnLocations().chosenLocation());
+            return renderLocation(state.vpnLocations().chosenLocation());
         }
         else if(type == GetSetType::vpnIp)
         {
-            const auto &ip = client.connection().state.externalVpnIp();
+            const auto &ip = state.externalVpnIp();
             // If the address isn't unknown, print Unknown
             if(ip.isEmpty())
                 return QStringLiteral("Unknown");
@@ -260,6 +267,28 @@ namespace
         }
     }
 
+    QStringList ValuePrinter::valueProperties(const QString &type)
+    {
+        if(type == GetSetType::connectionState)
+            return {QStringLiteral("state.connectionState")};
+        else if(type == GetSetType::debugLogging)
+            return {QStringLiteral("settings.debugLogging")};
+        else if(type == GetSetType::portForward)
+            return {QStringLiteral("state.forwardedPort")};
+        else if(type == GetSetType::region)
+            return {QStringLiteral("state.vpnLocations")};
+        else if(type == GetSetType::regions)
+            return {QStringLiteral("state.groupedLocations")};
+        else if(type == GetSetType::vpnIp)
+            return {QStringLiteral("state.externalVpnIp")};
+        else
+        {
+            // exec() prevents this by checking the type with checkParams()
+            Q_ASSERT(false);
+            return {};
+        }
+    }
+
     // Connect the property change signals corresponding to the properties used
     // by printValue
     template<class MonitorFunctor>
@@ -333,35 +362,35 @@ int GetCommand::exec(const QStringList &params, QCoreApplication &app)
 {
     checkParams(params, _getSupportedTypes);
 
-    CliClient client;
-    CliTimeout timeout{app};
-    QObject localConnState{};
+    // Fetch just the properties needed for this type - this doesn't wait for
+    // the daemon to send its entire state
+    QJsonValue result = execOneShot(app, QStringLiteral("getProperties"),
+        {QJsonArray::fromStringList(ValuePrinter::valueProperties(params[1]))});
 
-    QObject::connect(&client, &CliClient::firstConnected, &localConnState, [&]()
+    DaemonSettings settings;
+    DaemonState state;
+    settings.assign(result.toObject().value(QStringLiteral("settings")).toObject());
+    state.assign(result.toObject().value(QStringLiteral("state")).toObject());
+
+    // Handle types only supported by 'get' specifically
+    if(params[1] == GetSetType::regions)
     {
-        // Handle types only supported by 'get' specifically
-        if(params[1] == GetSetType::regions)
+        // Print locations in the default order they're listed in the
+        // client - by country and latency
+        outln() << ValuePrinter::renderLocation({});  // Auto
+        for(const auto &country : state.groupedLocations())
         {
-            // Print locations in the default order they're listed in the
-            // client - by country and latency
-            const auto &groupedLocations = client.connection().state.groupedLocations();
-            outln() << ValuePrinter::renderLocation({});  // Auto
-            for(const auto &country : groupedLocations)
+            for(const auto &pLocation : country.locations())
             {
-                for(const auto &pLocation : country.locations())
-                {
-                    if(pLocation)
-                        outln() << ValuePrinter::renderLocation(pLocation);
-                }
+                if(pLocation)
+                    outln() << ValuePrinter::renderLocation(pLocation);
             }
         }
-        else
-            outln() << ValuePrinter::renderValue(client, params[1]);
-
-        app.exit(CliExitCode::Success);
-    });
+    }
+    else
+        outln() << ValuePrinter::renderValue(settings, state, params[1]);
 
-    return app.exec();
+    return CliExitCode::Success;
 }
 
 
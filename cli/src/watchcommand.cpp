@@ -64,22 +64,92 @@ const std::unordered_set<QString> JsonChangePrinter::propertyBlacklist{
     QStringLiteral("groupedLocations")
 };
 
+namespace
+{
+    const QString watchFormatText{QStringLiteral("text")};
+    const QString watchFormatNdjson{QStringLiteral("ndjson")};
+}
+
+QString WatchCommand::_format{watchFormatText};
+QStringList WatchCommand::_filter;
+
+void WatchCommand::setOptions(QString format, QStringList filter)
+{
+    _format = std::move(format);
+    _filter = std::move(filter);
+}
+
 void WatchCommand::printHelp(const QString &name)
 {
-    outln() << "usage:" << name;
+    outln() << "usage:" << name << "[--format ndjson [--filter <properties>]]";
     outln() << "Monitors the PIA daemon for changes in settings, state, or data";
     outln() << "When a connection is established, prints the initial changes from the default state";
     outln() << "When a change is received, a line is printed of the form:";
     outln() << "  <group>: <change-object>";
     outln() << "  - group: Group where change occurred: settings, state, or data";
     outln() << "  - change-object: JSON object containing changed properties";
+    outln() << "With --format ndjson, each change is printed as one JSON object per line:";
+    outln() << "  {\"seq\":<n>,\"time\":<ms>,\"<group>\":<change-object>,...}";
+    outln() << "  - seq: Sequence number, starts from 1 for each daemon connection";
+    outln() << "  - time: Monotonic timestamp in milliseconds";
+    outln() << "  The first line contains the current values.";
+    outln() << "--filter selects the properties to print, separated by commas (like";
+    outln() << "state.connectionState,state.bytesReceived).  A group name selects all of its";
+    outln() << "properties.  Properties that aren't selected aren't sent by the daemon.";
     outln() << "This command continues to run until terminated.";
 }
 
+int WatchCommand::execNdjson(QCoreApplication &app)
+{
+    CliClient client{DaemonConnection::SyncMode::QueryOnly};
+
+    QObject localConnState{};
+    Async<void> watchResult;
+
+    QObject::connect(&client.connection(), &DaemonConnection::watchEventReceived,
+                     &localConnState, [](const QJsonObject &event)
+    {
+        outln() << QJsonDocument{event}.toJson(QJsonDocument::JsonFormat::Compact);
+    });
+
+    // Start watching each time the daemon connection is established (the
+    // daemon may restart, which restarts the sequence numbers)
+    QObject::connect(&client.connection(), &DaemonConnection::connectedChanged,
+                     &localConnState, [&](bool connected)
+    {
+        if(!connected)
+            return;
+        watchResult = client.connection().call(QStringLiteral("watch"),
+                                                {QJsonArray::fromStringList(_filter)})
+            ->next(&localConnState, [&](const Error &error, const QJsonValue &)
+            {
+                if(error)
+                    app.exit(traceRpcError(error));
+            });
+    });
+
+    return app.exec();
+}
+
 int WatchCommand::exec(const QStringList &params, QCoreApplication &app)
 {
     checkNoParams(params);
 
+    if(_format == watchFormatNdjson)
+        return execNdjson(app);
+
+    if(_format != watchFormatText)
+    {
+        errln() << "Unknown format:" << _format << "- expected" << watchFormatText
+            << "or" << watchFormatNdjson;
+        throw Error{HERE, Error::Code::CliInvalidArgs};
+    }
+    if(!_filter.isEmpty())
+    {
+        errln() << "--filter requires --format" << watchFormatNdjson;
+        throw Error{HERE, Error::Code::CliInvalidArgs};
+    }
+
     CliClient client;
 
     QObject localConnState{};
@@ -23,9 +23,24 @@
 #define WATCHCOMMAND_H
 
 #include "clicommand.h"
+#include <QStringList>
 
 class WatchCommand : public CliCommand
 {
+private:
+    static QString _format;
+    static QStringList _filter;
+
+public:
+    // Set the --format and --filter options specified on the command line.
+    // They're checked when the command is executed.
+    static void setOptions(QString format, QStringList filter);
+
+private:
+    // Stream watch events from the daemon as newline-delimited JSON - the
+    // daemon applies the filter
+    int execNdjson(QCoreApplication &app);
+
 public:
     virtual void printHelp(const QString &name) override;
     virtual int exec(const QStringList &params, QCoreApplication &app) override;
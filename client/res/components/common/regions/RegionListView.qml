@@ -27,6 +27,7 @@ import "../../settings/stores"
 import "qrc:/javascript/keyutil.js" as KeyUtil
 import "qrc:/javascript/util.js" as Util
 import PIA.NativeAcc 1.0 as NativeAcc
+import PIA.RegionListModel 1.0
 
 // RegionListView is used to select a region from the list of available regions.
 // It's used to select the VPN region, as well as the Shadowsocks region.
@@ -145,11 +146,17 @@ Rectangle {
       }
       Repeater {
         id: regionsRepeater
-        model: displayRegionsArray
+        // The model diffs each new displayRegionsArray against the current
+        // rows, so delegates are kept when regions are re-sorted or their
+        // latencies change
+        model: RegionListModel {
+          id: regionsModel
+          regions: displayRegionsArray
+        }
         delegate: RegionDelegate {
-          region: modelData.region
-          regionCountry: modelData.regionCountry
-          regionChildren: modelData.regionChildren
+          region: model.region
+          regionCountry: model.regionCountry
+          regionChildren: model.regionChildren
           portForwardEnabled: regionListView.portForwardEnabled
           serviceLocations: regionListView.serviceLocations
           canFavorite: regionListView.canFavorite
@@ -512,8 +519,10 @@ Rectangle {
   // choices must have 'false').
   property var accessibilityTable: {
     // This calculation depends on regionRepeater.children - itemAt() does not
-    // add this dependency.
+    // add this dependency.  The items are also kept when rows move or change,
+    // so depend on the model's revision too.
     var childrenDependency = regionsRepeater.children
+    var modelDependency = regionsModel.revision
 
     var table = []
 
@@ -528,9 +537,8 @@ Rectangle {
     // NativeAcc.Table.rows.
     //
     // This also gives it a good way to access regionItem.expanded (which stores
-    // the 'expanded' state, although this should probably move out of the items
-    // themselves eventually, since this causes it to reset whenever the array
-    // is rebuilt.
+    // the 'expanded' state - this is kept as long as the row stays in the
+    // model, since RegionListModel keeps the delegates).
     for(var i=0; i<regionsRepeater.count; ++i) {
       var regionItem = regionsRepeater.itemAt(i)
       if(!regionItem)
@@ -36,7 +36,6 @@ QtObject {
   readonly property var connectingConfig: NativeDaemon.state.connectingConfig
   readonly property var connectedConfig: NativeDaemon.state.connectedConfig
   readonly property var groupedLocations: NativeDaemon.state.groupedLocations
-  readonly property var intervalMeasurements: NativeDaemon.state.intervalMeasurements
   readonly property var splitTunnelSupportErrors: NativeDaemon.state.splitTunnelSupportErrors
   readonly property double connectionTimestamp: NativeDaemon.state.connectionTimestamp
   readonly property double openVpnAuthFailed: NativeDaemon.state.openVpnAuthFailed
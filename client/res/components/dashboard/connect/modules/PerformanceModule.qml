@@ -19,7 +19,6 @@
 import QtQuick 2.9
 import QtQuick.Controls 2.3
 import QtQuick.Window 2.3
-import QtQuick.Layouts 1.3
 import "../../../../javascript/app.js" as App
 import "../../../common"
 import "../../../core"
@@ -27,6 +26,7 @@ import "../../../daemon"
 import "../../../theme"
 import PIA.NativeHelpers 1.0
 import PIA.NativeAcc 1.0 as NativeAcc
+import PIA.BandwidthChart 1.0
 
 MovableModule {
   id: performanceModule
@@ -38,24 +38,16 @@ MovableModule {
   tileName: uiTr("Performance tile")
   NativeAcc.Group.name: tileName
 
-  readonly property double maxOnChart: {
-    // The maximum on the chart must be at least 1 so we can divide by it to
-    // scale the bars.  This works correctly if all bars have height 0; they use
-    // the 1-pixel minimum height.
-    var max = 1
-    for(var i=0; i<Daemon.state.intervalMeasurements.length; ++i)
-      max = Math.max(max, Daemon.state.intervalMeasurements[i].received)
-    return max
-  }
-  readonly property int limitItems: 32
+  // The recent measurements - this holds exactly the points shown in the chart
+  // and tracks their maximum as points are added.
+  readonly property var intervals: BandwidthChart.measurements
+
+  // The maximum on the chart must be at least 1 so we can divide by it to
+  // scale the bars.  This works correctly if all bars have height 0; they use
+  // the 1-pixel minimum height.
+  readonly property double maxOnChart: Math.max(1, intervals.maxReceived)
+  readonly property int limitItems: intervals.capacity
   readonly property int barWidth: 8
-  // The last measurement from intervalMeasurements if any measurement is
-  // available, undefined if no measurement is available.
-  readonly property var lastInterval: {
-    if(Daemon.state.intervalMeasurements.length > 0)
-      return Daemon.state.intervalMeasurements[Daemon.state.intervalMeasurements.length-1]
-    // otherwise, undefined
-  }
 
   // Length of an interval in seconds
   readonly property int intervalSec: 5
@@ -179,10 +171,11 @@ MovableModule {
       }
     }
 
-    // The bars are laid out statically (they don't depend on the interval
-    // measurements model) so we don't get new cursor-enter events when the
-    // measurements change.
-    RowLayout {
+    // The bars are created from the measurements model - a new measurement
+    // adds one bar and removes the oldest, and the other bars just move left.
+    // Hover is tracked by position over the whole chart rather than by each
+    // bar, so moving the bars doesn't generate new cursor-enter events.
+    Item {
       id: barsList
 
       anchors.horizontalCenter: parent.horizontalCenter
@@ -190,20 +183,23 @@ MovableModule {
       // Leave space for the bandwidth indicator above
       height: 0.7 * parent.height
       width: limitItems * barWidth
-      layoutDirection: Qt.RightToLeft
-      spacing: 0
 
-      readonly property int visibleBarCount: Math.min(Daemon.state.intervalMeasurements.length, limitItems)
+      readonly property int visibleBarCount: Math.min(intervals.count, limitItems)
 
-      // The bar that's hovered by the cursor, if any
-      readonly property var cursorBarIndex: {
+      // The bar that's hovered by the cursor, if any.  Bars are indexed by
+      // age - 0 is the newest bar (the last measurement, at the right edge).
+      readonly property int cursorBarIndex: {
+        if(!hoverWatch.containsMouse)
+          return -1
+        var barIndex = Math.floor((width - hoverWatch.mouseX) / barWidth)
         // Only bars that actually show data can be pointed
-        for(var i=0; i<visibleBarCount && i<barsRepeater.count; ++i) {
-          var bar = barsRepeater.itemAt(i)
-          if(bar.barHovered)
-            return i
-        }
-        return -1
+        return (barIndex >= 0 && barIndex < visibleBarCount) ? barIndex : -1
+      }
+      // When a new bar becomes hovered, treat that as a cursor input, clear
+      // the keyboard highlight if it's active
+      onCursorBarIndexChanged: {
+        if(cursorBarIndex >= 0)
+          keyboardBarIndex = -1
       }
 
       // The index of the bar that was last highlighted with the keyboard
@@ -221,41 +217,39 @@ MovableModule {
         return cursorBarIndex
       }
 
+      // Incremented when bars are added or removed - the bar at each index
+      // changes when they shift, even though the count stays the same
+      property int barsShifted: 0
+
       // The actual bar that's highlighted
-      readonly property var highlightBar: barsRepeater.itemAt(highlightBarIndex)
+      readonly property var highlightBar: {
+        var shiftDependency = barsShifted
+        if(highlightBarIndex < 0 || highlightBarIndex >= visibleBarCount)
+          return null
+        return barsRepeater.itemAt(intervals.count - 1 - highlightBarIndex)
+      }
 
       Repeater {
         id: barsRepeater
-        model: limitItems
+        model: intervals
+        onItemAdded: ++barsList.barsShifted
+        onItemRemoved: ++barsList.barsShifted
 
         Item {
           id: intervalBar
-          Layout.fillHeight: true
+          // Model rows are oldest first; barIndex=0 is the newest bar
+          readonly property int barIndex: intervals.count - 1 - index
+          x: barsList.width - (barIndex + 1) * barWidth
+          height: barsList.height
           width: barWidth
 
-          // index=0 is the newest bar (the last measurement, at the right edge)
-          readonly property var measurement: {
-            var intervalIndex = Daemon.state.intervalMeasurements.length - 1 - index
-            if(intervalIndex >= 0 && intervalIndex < Daemon.state.intervalMeasurements.length)
-              return Daemon.state.intervalMeasurements[intervalIndex]
-            // Otherwise undefined
-          }
-
-          property alias barHovered: hoverWatch.containsMouse
-          readonly property double bytesReceived: measurement ? measurement.received : 0
+          readonly property double bytesReceived: model.received
 
-          // Show only when there's actually a measurement for this position
-          readonly property bool hasMeasurement: !!measurement
-
-          readonly property int secondsAgo: (index+1) * intervalSec
+          readonly property int secondsAgo: (barIndex+1) * intervalSec
           readonly property int nameMinutePart: Math.floor(secondsAgo / 60)
           readonly property int nameSecondPart: secondsAgo % 60
 
           NativeAcc.ValueText.name: {
-            // No annotation if there's no measurement for this interval
-            if(!hasMeasurement)
-              return ''
-
             // qsTr() supports a plural disambiguation, but we haven't verified
             // whether this works with OneSky, and here we have two values to
             // negotiate anyway.  Only a few combinations are actually valid
@@ -298,37 +292,31 @@ MovableModule {
             return uiTr("%1 download speed").arg(speed)
           }
 
-          MouseArea {
-            id: hoverWatch
-            hoverEnabled: true
-            anchors.fill: parent
-            // Propagate clicks to the background
-            propagateComposedEvents: true
-            // When a new bar becomes hovered, treat that as a cursor input, clear
-            // the keyboard highlight if it's active
-            onEntered: {
-              if(measurement)
-                barsList.keyboardBarIndex = -1
-            }
-            // When the chart is clicked, grab focus so keyboard events will
-            // work as expected
-            onClicked: {
-              if(measurement)
-                barsList.keyboardBarIndex = -1
-              chartWrapper.forceActiveFocus(Qt.MouseFocusReason)
-            }
-          }
           Rectangle {
-            color: index === barsList.highlightBarIndex ? Theme.dashboard.performanceChartBarActive : Theme.dashboard.performanceChartBarInactive
+            color: barIndex === barsList.highlightBarIndex ? Theme.dashboard.performanceChartBarActive : Theme.dashboard.performanceChartBarInactive
             // Show at least 1 px for each bar
             height: Math.max(1, parent.height * bytesReceived / maxOnChart)
             width: barWidth / 2
             x: barWidth / 4
             y: parent.height - height
-            visible: hasMeasurement
           }
         }
       }
+
+      MouseArea {
+        id: hoverWatch
+        hoverEnabled: true
+        anchors.fill: parent
+        // Propagate clicks to the background
+        propagateComposedEvents: true
+        // When the chart is clicked, grab focus so keyboard events will
+        // work as expected
+        onClicked: {
+          if(barsList.cursorBarIndex >= 0)
+            barsList.keyboardBarIndex = -1
+          chartWrapper.forceActiveFocus(Qt.MouseFocusReason)
+        }
+      }
     }
 
     Keys.onPressed: {
@@ -382,7 +370,7 @@ MovableModule {
     id: currentDownload
     x: 36
     y: 128
-    text: lastInterval ? formatMbps(lastInterval.received) : '---'
+    text: intervals.count > 0 ? formatMbps(intervals.lastReceived) : '---'
     label: downloadArrow.label
     color: Theme.dashboard.performanceChartText
   }
@@ -403,7 +391,7 @@ MovableModule {
     id: currentUpload
     x: 135
     y: 128
-    text: lastInterval ? formatMbps(lastInterval.sent) : '---'
+    text: intervals.count > 0 ? formatMbps(intervals.lastSent) : '---'
     label: uploadArrow.label
     color: Theme.dashboard.performanceChartText
   }
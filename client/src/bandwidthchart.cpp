@@ -0,0 +1,156 @@
+// Copyright (c) 2019 London Trust Media Incorporated
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#line SOURCE_FILE("bandwidthchart.cpp")
+
+#include "bandwidthchart.h"
+#include "bandwidthhistory.h"
+#include <algorithm>
+
+BandwidthTierModel::BandwidthTierModel(int capacity, QObject *pParent)
+    : QAbstractListModel{pParent}, _capacity{capacity}
+{
+    Q_ASSERT(_capacity > 0);
+}
+
+void BandwidthTierModel::removeOldest()
+{
+    Q_ASSERT(!_points.empty());
+    beginRemoveRows({}, 0, 0);
+    if(!_maxReceived.empty() && _maxReceived.front() == _points.front().received)
+        _maxReceived.pop_front();
+    _points.pop_front();
+    endRemoveRows();
+}
+
+void BandwidthTierModel::appendPoints(const QJsonArray &points)
+{
+    // Only the newest points could be kept (this happens when the daemon sends
+    // the whole history)
+    int first = std::max(0, points.size() - _capacity);
+    bool changed = false;
+    for(int i = first; i < points.size(); ++i)
+    {
+        QJsonObject pointObj = points.at(i).toObject();
+        Point point{static_cast<quint64>(pointObj.value(QStringLiteral("seq")).toDouble()),
+                    static_cast<qint64>(pointObj.value(QStringLiteral("timestamp")).toDouble()),
+                    pointObj.value(QStringLiteral("received")).toDouble(),
+                    pointObj.value(QStringLiteral("sent")).toDouble()};
+        if(!_points.empty() && point.seq <= _points.back().seq)
+            continue;
+
+        if(count() == _capacity)
+            removeOldest();
+
+        beginInsertRows({}, count(), count());
+        _points.push_back(point);
+        while(!_maxReceived.empty() && _maxReceived.back() < point.received)
+            _maxReceived.pop_back();
+        _maxReceived.push_back(point.received);
+        endInsertRows();
+        changed = true;
+    }
+
+    if(changed)
+        emit pointsChanged();
+}
+
+void BandwidthTierModel::clear()
+{
+    if(_points.empty())
+        return;
+    beginResetModel();
+    _points.clear();
+    _maxReceived.clear();
+    endResetModel();
+    emit pointsChanged();
+}
+
+int BandwidthTierModel::rowCount(const QModelIndex &parent) const
+{
+    if(parent.isValid())
+        return 0;
+    return count();
+}
+
+QVariant BandwidthTierModel::data(const QModelIndex &index, int role) const
+{
+    if(!index.isValid() || index.row() < 0 || index.row() >= count())
+        return {};
+
+    const Point &point = _points[static_cast<std::size_t>(index.row())];
+    switch(role)
+    {
+        case TimestampRole:
+            return static_cast<double>(point.timestamp);
+        case ReceivedRole:
+            return point.received;
+        case SentRole:
+            return point.sent;
+        default:
+            return {};
+    }
+}
+
+QHash<int, QByteArray> BandwidthTierModel::roleNames() const
+{
+    return {
+        {TimestampRole, QByteArrayLiteral("timestamp")},
+        {ReceivedRole, QByteArrayLiteral("received")},
+        {SentRole, QByteArrayLiteral("sent")}
+    };
+}
+
+BandwidthChart::BandwidthChart(DaemonConnection &daemonConnection)
+    : _measurements{MeasurementsCapacity},
+      _minutes{static_cast<int>(BandwidthHistory::capacity(BandwidthHistory::Minutes))},
+      _hours{static_cast<int>(BandwidthHistory::capacity(BandwidthHistory::Hours))},
+      _generation{-1}
+{
+    connect(&daemonConnection, &DaemonConnection::bandwidthReceived, this,
+            &BandwidthChart::bandwidthReceived);
+    // The daemon sends the whole history when we reconnect (which might be a
+    // new daemon), so start over when the connection is lost
+    connect(&daemonConnection, &DaemonConnection::connectedChanged, this,
+            [this](bool connected){if(!connected) clear();});
+}
+
+void BandwidthChart::bandwidthReceived(const QJsonObject &points)
+{
+    qint64 generation = static_cast<qint64>(points.value(QStringLiteral("generation")).toDouble());
+    // A new generation means the daemon cleared its history
+    if(generation != _generation)
+    {
+        clear();
+        _generation = generation;
+    }
+
+    using Tier = BandwidthHistory::Tier;
+    _measurements.appendPoints(points.value(BandwidthHistory::tierName(Tier::Measurements)).toArray());
+    _minutes.appendPoints(points.value(BandwidthHistory::tierName(Tier::Minutes)).toArray());
+    _hours.appendPoints(points.value(BandwidthHistory::tierName(Tier::Hours)).toArray());
+}
+
+void BandwidthChart::clear()
+{
+    _measurements.clear();
+    _minutes.clear();
+    _hours.clear();
+    _generation = -1;
+}
@@ -0,0 +1,135 @@
+// Copyright (c) 2019 London Trust Media Incorporated
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#line HEADER_FILE("bandwidthchart.h")
+
+#ifndef BANDWIDTHCHART_H
+#define BANDWIDTHCHART_H
+
+#include "daemonconnection.h"
+#include <QAbstractListModel>
+#include <deque>
+
+// BandwidthTierModel holds the most recent bandwidth points from one tier of
+// the daemon's BandwidthHistory, up to a fixed capacity.  Points are only
+// appended (dropping the oldest when full), and the maximum 'received' value
+// is maintained incrementally, so charts don't have to rescan the points for
+// each update.
+class BandwidthTierModel : public QAbstractListModel
+{
+    Q_OBJECT
+    CLASS_LOGGING_CATEGORY("bandwidthchart")
+
+public:
+    enum Role
+    {
+        TimestampRole = Qt::UserRole,
+        ReceivedRole,
+        SentRole,
+    };
+
+    struct Point
+    {
+        quint64 seq;
+        qint64 timestamp;
+        double received, sent;
+    };
+
+    // Number of points currently in the model
+    Q_PROPERTY(int count READ count NOTIFY pointsChanged)
+    // Maximum number of points kept
+    Q_PROPERTY(int capacity READ capacity CONSTANT)
+    // Maximum 'received' value of the points in the model (0 if empty)
+    Q_PROPERTY(double maxReceived READ maxReceived NOTIFY pointsChanged)
+    // 'received' and 'sent' of the newest point (0 if empty)
+    Q_PROPERTY(double lastReceived READ lastReceived NOTIFY pointsChanged)
+    Q_PROPERTY(double lastSent READ lastSent NOTIFY pointsChanged)
+
+public:
+    explicit BandwidthTierModel(int capacity, QObject *pParent = nullptr);
+
+public:
+    // Append points in sequence order.  Points that aren't newer than the
+    // last point are ignored (the daemon resends the full history when a
+    // client connects).
+    void appendPoints(const QJsonArray &points);
+    void clear();
+
+    int count() const {return static_cast<int>(_points.size());}
+    int capacity() const {return _capacity;}
+    double maxReceived() const {return _maxReceived.empty() ? 0 : _maxReceived.front();}
+    double lastReceived() const {return _points.empty() ? 0 : _points.back().received;}
+    double lastSent() const {return _points.empty() ? 0 : _points.back().sent;}
+
+    virtual int rowCount(const QModelIndex &parent = {}) const override;
+    virtual QVariant data(const QModelIndex &index, int role) const override;
+    virtual QHash<int, QByteArray> roleNames() const override;
+
+signals:
+    void pointsChanged();
+
+private:
+    void removeOldest();
+
+private:
+    int _capacity;
+    std::deque<Point> _points;
+    // Candidates for the maximum received value - decreasing, and in the
+    // same order as the points they came from, so the front is the maximum
+    // and it's dropped when that point is removed.
+    std::deque<double> _maxReceived;
+};
+
+// BandwidthChart receives the bandwidth history from the daemon and exposes
+// it to QML as a model for each tier.
+class BandwidthChart : public QObject
+{
+    Q_OBJECT
+    CLASS_LOGGING_CATEGORY("bandwidthchart")
+
+public:
+    // Capacity of the measurements model - just what the performance chart
+    // shows
+    static const int MeasurementsCapacity = 32;
+
+    // Per-measurement points, minute points, and hour points
+    Q_PROPERTY(BandwidthTierModel *measurements READ measurements CONSTANT)
+    Q_PROPERTY(BandwidthTierModel *minutes READ minutes CONSTANT)
+    Q_PROPERTY(BandwidthTierModel *hours READ hours CONSTANT)
+
+public:
+    explicit BandwidthChart(DaemonConnection &daemonConnection);
+
+private:
+    void bandwidthReceived(const QJsonObject &points);
+    void clear();
+
+public:
+    BandwidthTierModel *measurements() {return &_measurements;}
+    BandwidthTierModel *minutes() {return &_minutes;}
+    BandwidthTierModel *hours() {return &_hours;}
+
+private:
+    BandwidthTierModel _measurements, _minutes, _hours;
+    // The daemon's history generation for the current points; -1 if none
+    // have been received
+    qint64 _generation;
+};
+
+#endif
@@ -33,6 +33,7 @@
 #include "windowmaxsize.h"
 #include "clipboard.h"
 #include "flexvalidator.h"
+#include "regionlistmodel.h"
 #include "path_interface.h"
 #include "semversion.h"
 #include "version.h"
@@ -513,6 +514,7 @@ Client::Client(bool hasExistingSettingsFile, const QJsonObject &initialSettings,
     , _daemonInterface{_daemon}
     , _nativeHelpers{}
     , _preConnectStatus{*_daemon}
+    , _bandwidthChart{*_daemon}
     , _clientInterface{hasExistingSettingsFile, initialSettings, gfxMode,
                        quietLaunch}
     , _qmlContext{_engine}
@@ -523,6 +525,10 @@ Client::Client(bool hasExistingSettingsFile, const QJsonObject &initialSettings,
     QQmlEngine::setObjectOwnership(&_daemonInterface, QQmlEngine::ObjectOwnership::CppOwnership);
     QQmlEngine::setObjectOwnership(&_nativeHelpers, QQmlEngine::ObjectOwnership::CppOwnership);
     QQmlEngine::setObjectOwnership(&_preConnectStatus, QQmlEngine::ObjectOwnership::CppOwnership);
+    QQmlEngine::setObjectOwnership(&_bandwidthChart, QQmlEngine::ObjectOwnership::CppOwnership);
+    QQmlEngine::setObjectOwnership(_bandwidthChart.seconds(), QQmlEngine::ObjectOwnership::CppOwnership);
+    QQmlEngine::setObjectOwnership(_bandwidthChart.minutes(), QQmlEngine::ObjectOwnership::CppOwnership);
+    QQmlEngine::setObjectOwnership(_bandwidthChart.hours(), QQmlEngine::ObjectOwnership::CppOwnership);
     QQmlEngine::setObjectOwnership(&_clientInterface, QQmlEngine::ObjectOwnership::CppOwnership);
 
     // Install _qmlContext as the global context for all QML code
@@ -553,6 +559,7 @@ Client::Client(bool hasExistingSettingsFile, const QJsonObject &initialSettings,
     qmlRegisterType<FocusCue>("PIA.FocusCue", 1, 0, "FocusCue");
     qmlRegisterType<DragHandle>("PIA.DragHandle", 1, 0, "DragHandle");
     qmlRegisterType<FlexValidator>("PIA.FlexValidator", 1, 0, "FlexValidator");
+    qmlRegisterType<RegionListModel>("PIA.RegionListModel", 1, 0, "RegionListModel");
 
     qmlRegisterSingletonType<DaemonInterface>("PIA.NativeDaemon", 1, 0, "NativeDaemon",
         [](auto, auto) -> QObject* {return &Client::instance()->_daemonInterface;});
@@ -560,6 +567,9 @@ Client::Client(bool hasExistingSettingsFile, const QJsonObject &initialSettings,
         [](auto, auto) -> QObject* {return &Client::instance()->_nativeHelpers;});
     qmlRegisterSingletonType<PreConnectStatus>("PIA.PreConnectStatus", 1, 0, "PreConnectStatus",
         [](auto, auto) -> QObject* {return &Client::instance()->_preConnectStatus;});
+    qmlRegisterSingletonType<BandwidthChart>("PIA.BandwidthChart", 1, 0, "BandwidthChart",
+        [](auto, auto) -> QObject* {return &Client::instance()->_bandwidthChart;});
+    qmlRegisterType<BandwidthTierModel>(); // Not instantiated by QML.
     qmlRegisterSingletonType<ClientInterface>("PIA.NativeClient", 1, 0, "NativeClient",
         [](auto, auto) -> QObject* {return &Client::instance()->_clientInterface;});
     qmlRegisterSingletonType<Clipboard>("PIA.Clipboard", 1, 0, "Clipboard",
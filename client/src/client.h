@@ -29,6 +29,7 @@
 #include "settings.h"
 #include "nativehelpers.h"
 #include "preconnectstatus.h"
+#include "bandwidthchart.h"
 
 #include <QFontDatabase>
 #include <QObject>
@@ -272,6 +273,7 @@ protected:
     DaemonInterface _daemonInterface;
     NativeHelpers _nativeHelpers;
     PreConnectStatus _preConnectStatus;
+    BandwidthChart _bandwidthChart;
     ClientInterface _clientInterface;
     QQmlApplicationEngine _engine;
 private:
@@ -20,20 +20,752 @@
 #line SOURCE_FILE("linux_appscanner.cpp")
 
 #include "linux_appscanner.h"
+#include "path.h"
+#include <QDir>
+#include <QDateTime>
+#include <QDirIterator>
 #include <QFileInfo>
+#include <QIcon>
+#include <QJsonDocument>
+#include <QLocale>
+#include <QSaveFile>
+#include <QSet>
+#include <QStandardPaths>
+#include <QUrl>
+#include <algorithm>
+
+namespace
+{
+    const QString desktopEntryGroup{QStringLiteral("[Desktop Entry]")};
+    const QString desktopFileSuffix{QStringLiteral(".desktop")};
+
+    // Cache file in ClientDataDir, and its version - bump this if the cached
+    // fields or how they're parsed change
+    const QString appScanCacheFile{QStringLiteral("appscan.json")};
+    const int appScanCacheVersion{1};
+
+    // Wait this long after a change in an applications directory before
+    // rescanning it
+    const std::chrono::milliseconds appScanRescanDelay{1000};
+
+    // Pixmap cache limit in KB
+    const int appIconCacheLimit{8 * 1024};
+    const QSize appIconDefaultSize{40, 40};
+
+    // Launchers that run another program - the daemon sees the launcher (or
+    // a sandbox helper), not the app, so these can't be used for an app's
+    // rule.
+    const QStringList appLauncherWrappers{
+        QStringLiteral("flatpak"),
+        QStringLiteral("snap"),
+        QStringLiteral("sh"),
+        QStringLiteral("bash"),
+        QStringLiteral("dash")
+    };
+
+    // Names and icons of the scanned applications by path.  Written by
+    // LinuxAppScanner and read by LinuxAppIconProvider and getLinuxAppName().
+    struct LinuxAppInfo
+    {
+        QString name;
+        QString icon;
+    };
+    struct LinuxAppRegistry
+    {
+        QMutex mutex;
+        QHash<QString, LinuxAppInfo> apps;
+        int revision{0};
+    };
+    LinuxAppRegistry &linuxAppRegistry()
+    {
+        static LinuxAppRegistry registry;
+        return registry;
+    }
+
+    // Apply the general string escapes from the desktop entry spec
+    QString unescapeDesktopValue(const QString &value)
+    {
+        if(!value.contains(QLatin1Char('\\')))
+            return value;
+
+        QString result;
+        result.reserve(value.size());
+        for(int i=0; i<value.size(); ++i)
+        {
+            QChar c = value[i];
+            if(c != QLatin1Char('\\') || i+1 >= value.size())
+            {
+                result.push_back(c);
+                continue;
+            }
+            QChar next = value[++i];
+            switch(next.unicode())
+            {
+                case 's':
+                    result.push_back(QLatin1Char(' '));
+                    break;
+                case 'n':
+                    result.push_back(QLatin1Char('\n'));
+                    break;
+                case 't':
+                    result.push_back(QLatin1Char('\t'));
+                    break;
+                case 'r':
+                    result.push_back(QLatin1Char('\r'));
+                    break;
+                case '\\':
+                    result.push_back(QLatin1Char('\\'));
+                    break;
+                default:
+                    // Not a general escape - keep it, the Exec quoting rules
+                    // have their own escapes
+                    result.push_back(c);
+                    result.push_back(next);
+                    break;
+            }
+        }
+        return result;
+    }
+
+    bool isTrue(const QString &value)
+    {
+        return value == QStringLiteral("true");
+    }
+}
+
+QJsonObject LinuxDesktopEntry::toJsonObject() const
+{
+    return {
+        {QStringLiteral("filePath"), filePath},
+        {QStringLiteral("modified"), static_cast<double>(modified)},
+        {QStringLiteral("size"), static_cast<double>(size)},
+        {QStringLiteral("visible"), visible},
+        {QStringLiteral("name"), name},
+        {QStringLiteral("icon"), icon},
+        {QStringLiteral("exec"), exec}
+    };
+}
+
+LinuxDesktopEntry LinuxDesktopEntry::fromJsonObject(const QJsonObject &obj)
+{
+    LinuxDesktopEntry entry;
+    entry.filePath = obj.value(QStringLiteral("filePath")).toString();
+    entry.modified = static_cast<qint64>(obj.value(QStringLiteral("modified")).toDouble());
+    entry.size = static_cast<qint64>(obj.value(QStringLiteral("size")).toDouble());
+    entry.visible = obj.value(QStringLiteral("visible")).toBool();
+    entry.name = obj.value(QStringLiteral("name")).toString();
+    entry.icon = obj.value(QStringLiteral("icon")).toString();
+    entry.exec = obj.value(QStringLiteral("exec")).toString();
+    return entry;
+}
+
+bool parseLinuxDesktopEntry(const QByteArray &data, const QStringList &locales,
+                            LinuxDesktopEntry &entry)
+{
+    bool inEntryGroup = false;
+    bool foundEntryGroup = false;
+    QHash<QString, QString> values;
+
+    const auto lines = data.split('\n');
+    for(const auto &lineData : lines)
+    {
+        QString line = QString::fromUtf8(lineData).trimmed();
+        if(line.isEmpty() || line.startsWith(QLatin1Char('#')))
+            continue;
+        if(line.startsWith(QLatin1Char('[')))
+        {
+            // Only the Desktop Entry group matters; actions, etc. are in
+            // other groups
+            inEntryGroup = (line == desktopEntryGroup);
+            foundEntryGroup = foundEntryGroup || inEntryGroup;
+            continue;
+        }
+        if(!inEntryGroup)
+            continue;
+
+        int equals = line.indexOf(QLatin1Char('='));
+        if(equals <= 0)
+            continue;
+        QString key = line.left(equals).trimmed();
+        // The first occurrence of a key wins
+        if(!values.contains(key))
+            values.insert(key, unescapeDesktopValue(line.mid(equals+1).trimmed()));
+    }
+
+    if(!foundEntryGroup)
+        return false;
+
+    auto localized = [&](const QString &key)
+    {
+        for(const auto &locale : locales)
+        {
+            auto itValue = values.find(key + QLatin1Char('[') + locale + QLatin1Char(']'));
+            if(itValue != values.end())
+                return itValue.value();
+        }
+        return values.value(key);
+    };
+
+    entry.name = localized(QStringLiteral("Name"));
+    entry.icon = values.value(QStringLiteral("Icon"));
+    entry.exec = values.value(QStringLiteral("Exec"));
+    entry.visible = values.value(QStringLiteral("Type")) == QStringLiteral("Application") &&
+        !isTrue(values.value(QStringLiteral("NoDisplay"))) &&
+        !isTrue(values.value(QStringLiteral("Hidden"))) &&
+        !entry.name.isEmpty() && !entry.exec.isEmpty();
+    return true;
+}
+
+QStringList splitLinuxDesktopExec(const QString &exec)
+{
+    QStringList args;
+    QString arg;
+    bool haveArg = false, inQuote = false;
+    for(int i=0; i<exec.size(); ++i)
+    {
+        QChar c = exec[i];
+        if(inQuote)
+        {
+            if(c == QLatin1Char('\\') && i+1 < exec.size() &&
+               QStringLiteral("\"`$\\").contains(exec[i+1]))
+            {
+                arg.push_back(exec[++i]);
+            }
+            else if(c == QLatin1Char('"'))
+                inQuote = false;
+            else
+                arg.push_back(c);
+        }
+        else if(c == QLatin1Char(' ') || c == QLatin1Char('\t'))
+        {
+            if(haveArg)
+                args.push_back(arg);
+            arg.clear();
+            haveArg = false;
+        }
+        else if(c == QLatin1Char('"'))
+        {
+            inQuote = true;
+            haveArg = true;
+        }
+        else
+        {
+            // Field codes - %% is a literal '%', the rest are removed
+            if(c == QLatin1Char('%') && i+1 < exec.size())
+            {
+                QChar code = exec[++i];
+                if(code == QLatin1Char('%'))
+                    arg.push_back(code);
+                // If the argument was just a field code, it's dropped
+                // entirely (haveArg isn't set)
+                continue;
+            }
+            arg.push_back(c);
+            haveArg = true;
+        }
+    }
+    if(haveArg)
+        args.push_back(arg);
+    return args;
+}
+
+QString resolveLinuxDesktopExec(const QString &exec)
+{
+    QStringList args = splitLinuxDesktopExec(exec);
+    int program = 0;
+    // Skip 'env [options] [VAR=value...]'
+    if(!args.isEmpty() && QFileInfo{args[0]}.fileName() == QStringLiteral("env"))
+    {
+        program = 1;
+        while(program < args.size() &&
+              (args[program].contains(QLatin1Char('=')) || args[program].startsWith(QLatin1Char('-'))))
+        {
+            ++program;
+        }
+    }
+    if(program >= args.size())
+        return {};
+
+    QString executable = args[program];
+    if(!executable.startsWith(QLatin1Char('/')))
+    {
+        // Relative paths with a directory aren't meaningful here
+        if(executable.contains(QLatin1Char('/')))
+            return {};
+        executable = QStandardPaths::findExecutable(executable);
+        if(executable.isEmpty())
+            return {};
+    }
+
+    QFileInfo executableInfo{executable};
+    QString target = executableInfo.canonicalFilePath();
+    if(target.isEmpty() || !QFileInfo{target}.isExecutable())
+        return {};
+    if(appLauncherWrappers.contains(QFileInfo{target}.fileName()))
+        return {};
+    return target;
+}
+
+QString getLinuxAppIconName(const QString &path)
+{
+    LinuxAppRegistry &registry = linuxAppRegistry();
+    QMutexLocker lock{&registry.mutex};
+    return registry.apps.value(path).icon;
+}
+
+QString findLinuxIconFile(const QString &iconName)
+{
+    static const QStringList iconDirs{
+        QStringLiteral("icons/hicolor/scalable/apps/"),
+        QStringLiteral("icons/hicolor/256x256/apps/"),
+        QStringLiteral("icons/hicolor/128x128/apps/"),
+        QStringLiteral("icons/hicolor/64x64/apps/"),
+        QStringLiteral("icons/hicolor/48x48/apps/"),
+        QStringLiteral("icons/hicolor/32x32/apps/"),
+        QStringLiteral("pixmaps/")
+    };
+    static const QStringList extensions{
+        QStringLiteral(".svg"), QStringLiteral(".png"), QStringLiteral(".xpm"),
+        // Some entries incorrectly include the extension in the icon name
+        QString{}
+    };
+
+    const auto dataDirs = QStandardPaths::standardLocations(QStandardPaths::GenericDataLocation);
+    for(const auto &dataDir : dataDirs)
+    {
+        for(const auto &iconDir : iconDirs)
+        {
+            for(const auto &extension : extensions)
+            {
+                QString iconPath = dataDir + QLatin1Char('/') + iconDir + iconName + extension;
+                if(QFileInfo::exists(iconPath))
+                    return iconPath;
+            }
+        }
+    }
+    return {};
+}
+
+LinuxAppIconProvider::LinuxAppIconProvider()
+    : QQuickImageProvider{QQuickImageProvider::Pixmap},
+      _pixmaps{appIconCacheLimit}, _iconRevision{-1}
+{
+}
+
+QPixmap LinuxAppIconProvider::loadPixmap(const QString &path, const QSize &size)
+{
+    QString iconName = getLinuxAppIconName(path);
+    // For paths that aren't scanned apps (like executables the user browsed
+    // to), the executable name is often also the icon name
+    if(iconName.isEmpty())
+        iconName = QFileInfo{path}.fileName();
+
+    QIcon icon;
+    if(iconName.startsWith(QLatin1Char('/')))
+        icon = QIcon{iconName};
+    else
+    {
+        icon = QIcon::fromTheme(iconName);
+        if(icon.isNull())
+        {
+            QString iconFile = findLinuxIconFile(iconName);
+            if(!iconFile.isEmpty())
+                icon = QIcon{iconFile};
+        }
+    }
+    if(icon.isNull())
+        icon = QIcon::fromTheme(QStringLiteral("application-x-executable"));
+    return icon.pixmap(size);
+}
+
+QPixmap LinuxAppIconProvider::requestPixmap(const QString &id, QSize *pSize,
+                                            const QSize &requestedSize)
+{
+    // Qt doesn't decode the id after extracting it from the URI
+    QString path = QUrl::fromPercentEncoding(id.toUtf8());
+    QSize size{requestedSize.width() > 0 ? requestedSize.width() : appIconDefaultSize.width(),
+               requestedSize.height() > 0 ? requestedSize.height() : appIconDefaultSize.height()};
+    if(pSize)
+        *pSize = size;
+
+    QString key = QStringLiteral("%1x%2:%3").arg(size.width()).arg(size.height()).arg(path);
+
+    QMutexLocker lock{&_mutex};
+    int revision;
+    {
+        LinuxAppRegistry &registry = linuxAppRegistry();
+        QMutexLocker registryLock{&registry.mutex};
+        revision = registry.revision;
+    }
+    // If the apps were rescanned, icons might have changed
+    if(revision != _iconRevision)
+    {
+        _pixmaps.clear();
+        _iconRevision = revision;
+    }
+
+    if(QPixmap *pCached = _pixmaps.object(key))
+        return *pCached;
+
+    QPixmap pixmap = loadPixmap(path, size);
+    int costKb = std::max(1, pixmap.width() * pixmap.height() * 4 / 1024);
+    _pixmaps.insert(key, new QPixmap{pixmap}, costKb);
+    return pixmap;
+}
+
+LinuxAppScanner::DirScan LinuxAppScanner::scanDirectory(const QString &path,
+                                                        const QHash<QString, LinuxDesktopEntry> &cached,
+                                                        const QStringList &locales)
+{
+    DirScan result;
+    QDir root{path};
+    if(!root.exists())
+    {
+        // Watch the nearest existing parent, so we notice if the directory
+        // is created
+        QDir parent{path};
+        while(!parent.exists() && parent.cdUp())
+            ;
+        if(parent.exists())
+            result.directories.push_back(parent.absolutePath());
+        return result;
+    }
+
+    result.directories.push_back(root.absolutePath());
+    QDirIterator dirIt{path, QDir::Dirs|QDir::NoDotAndDotDot,
+                       QDirIterator::Subdirectories|QDirIterator::FollowSymlinks};
+    while(dirIt.hasNext())
+        result.directories.push_back(dirIt.next());
+
+    int parsed = 0;
+    QDirIterator fileIt{path, {QStringLiteral("*") + desktopFileSuffix}, QDir::Files,
+                        QDirIterator::Subdirectories|QDirIterator::FollowSymlinks};
+    while(fileIt.hasNext())
+    {
+        // The result would be discarded anyway
+        if(WorkerPool::cancellationRequested())
+            return {};
+
+        QString filePath = fileIt.next();
+        QFileInfo fileInfo = fileIt.fileInfo();
+        qint64 modified = fileInfo.lastModified().toMSecsSinceEpoch();
+        qint64 size = fileInfo.size();
+
+        LinuxDesktopEntry entry;
+        auto itCached = cached.find(filePath);
+        if(itCached != cached.end() && itCached->modified == modified &&
+           itCached->size == size)
+        {
+            entry = itCached.value();
+        }
+        else
+        {
+            QFile file{filePath};
+            if(!file.open(QIODevice::ReadOnly) ||
+               !parseLinuxDesktopEntry(file.readAll(), locales, entry))
+            {
+                continue;
+            }
+            entry.filePath = filePath;
+            entry.modified = modified;
+            entry.size = size;
+            ++parsed;
+        }
+
+        // Resolve the target even for cached entries - the executable found on
+        // PATH (or the symlink it points to) can change without the .desktop
+        // file changing
+        if(entry.visible)
+            entry.target = resolveLinuxDesktopExec(entry.exec);
+
+        entry.fileId = root.relativeFilePath(filePath);
+        entry.fileId.replace(QLatin1Char('/'), QLatin1Char('-'));
+        result.entries.push_back(std::move(entry));
+    }
+
+    qInfo() << "Scanned" << path << "-" << result.entries.size() << "entries,"
+        << parsed << "parsed";
+    return result;
+}
 
 LinuxAppScanner::LinuxAppScanner()
+    : _started{false}, _scanRequested{false}
+{
+    // Localized keys are looked up by language and country, then just by
+    // language
+    QString localeName = QLocale::system().name();
+    if(localeName != QStringLiteral("C"))
+    {
+        _locales.push_back(localeName);
+        int underscore = localeName.indexOf(QLatin1Char('_'));
+        if(underscore > 0)
+            _locales.push_back(localeName.left(underscore));
+    }
+
+    _rescanTimer.setSingleShot(true);
+    _rescanTimer.setInterval(appScanRescanDelay);
+    connect(&_rescanTimer, &QTimer::timeout, this, &LinuxAppScanner::rescanDirtyDirs);
+    connect(&_watcher, &QFileSystemWatcher::directoryChanged, this,
+            &LinuxAppScanner::directoryChanged);
+}
+
+void LinuxAppScanner::loadCache()
+{
+    QFile cacheFile{Path::ClientDataDir / appScanCacheFile};
+    if(!cacheFile.open(QIODevice::ReadOnly))
+        return;     // No cache yet
+
+    QJsonObject cache = QJsonDocument::fromJson(cacheFile.readAll()).object();
+    if(cache.value(QStringLiteral("version")).toInt() != appScanCacheVersion ||
+       cache.value(QStringLiteral("locales")).toVariant().toStringList() != _locales)
+    {
+        qInfo() << "Ignoring app scan cache from a different version or locale";
+        return;
+    }
+
+    const auto entries = cache.value(QStringLiteral("entries")).toArray();
+    for(const auto &entryValue : entries)
+    {
+        LinuxDesktopEntry entry{LinuxDesktopEntry::fromJsonObject(entryValue.toObject())};
+        if(!entry.filePath.isEmpty())
+            _cachedEntries.insert(entry.filePath, std::move(entry));
+    }
+    qInfo() << "Loaded" << _cachedEntries.size() << "cached desktop entries";
+}
+
+void LinuxAppScanner::saveCache()
+{
+    QJsonArray entries;
+    for(const auto &dataDir : _dataDirs)
+    {
+        for(const auto &entry : dataDir.entries)
+            entries.push_back(entry.toJsonObject());
+    }
+    QJsonObject cache{
+        {QStringLiteral("version"), appScanCacheVersion},
+        {QStringLiteral("locales"), QJsonArray::fromStringList(_locales)},
+        {QStringLiteral("entries"), entries}
+    };
+
+    // Write it on the worker pool, it doesn't need to hold up anything.  (Keep
+    // the task until it finishes - abandoning it would cancel the write.)
+    _workerPool.run([cache]()
+        {
+            QSaveFile cacheFile{Path::ClientDataDir.mkpath() / appScanCacheFile};
+            if(!cacheFile.open(QIODevice::WriteOnly) ||
+               cacheFile.write(QJsonDocument{cache}.toJson(QJsonDocument::Compact)) < 0 ||
+               !cacheFile.commit())
+            {
+                qWarning() << "Unable to write app scan cache";
+            }
+        }, WorkerPool::LowPriority)->runUntilFinished(this);
+}
+
+void LinuxAppScanner::startDirScan(std::size_t index)
 {
+    DataDir &dataDir = _dataDirs[index];
+    // Replace a scan that's still running, it might have missed the change
+    if(dataDir.pScan)
+    {
+        dataDir.pScan->cancel();
+        dataDir.pScan.abandon();
+    }
 
+    QHash<QString, LinuxDesktopEntry> cached;
+    QString prefix = dataDir.path + QLatin1Char('/');
+    for(auto itEntry = _cachedEntries.begin(); itEntry != _cachedEntries.end(); ++itEntry)
+    {
+        if(itEntry.key().startsWith(prefix))
+            cached.insert(itEntry.key(), itEntry.value());
+    }
+
+    dataDir.scanning = true;
+    QString path = dataDir.path;
+    QStringList locales = _locales;
+    dataDir.pScan = _workerPool.run([path, cached, locales]()
+        {
+            return scanDirectory(path, cached, locales);
+        });
+    dataDir.pScan->notify(this, [this, index](const Error &error, const DirScan &result)
+        {
+            if(error)
+            {
+                // Canceled - a newer scan replaced this one
+                if(error.code() == Error::TaskRejected)
+                    return;
+                qWarning() << "Unable to scan" << _dataDirs[index].path << "-" << error;
+                dirScanFinished(index, {});
+                return;
+            }
+            dirScanFinished(index, result);
+        });
+}
+
+void LinuxAppScanner::dirScanFinished(std::size_t index, const DirScan &result)
+{
+    DataDir &dataDir = _dataDirs[index];
+    dataDir.entries = result.entries;
+    dataDir.scanned = true;
+    dataDir.scanning = false;
+
+    // Update the cached entries for this directory
+    QString prefix = dataDir.path + QLatin1Char('/');
+    for(auto itEntry = _cachedEntries.begin(); itEntry != _cachedEntries.end(); )
+    {
+        if(itEntry.key().startsWith(prefix))
+            itEntry = _cachedEntries.erase(itEntry);
+        else
+            ++itEntry;
+    }
+    for(const auto &entry : dataDir.entries)
+        _cachedEntries.insert(entry.filePath, entry);
+
+    // Watch any new subdirectories (removed directories are dropped
+    // automatically)
+    QStringList watched = _watcher.directories();
+    QStringList newDirs;
+    for(const auto &directory : result.directories)
+    {
+        if(!watched.contains(directory))
+            newDirs.push_back(directory);
+    }
+    if(!newDirs.isEmpty())
+        _watcher.addPaths(newDirs);
+
+    bool allScanned = std::all_of(_dataDirs.begin(), _dataDirs.end(),
+                                  [](const DataDir &dir){return dir.scanned && !dir.scanning;});
+    if(allScanned)
+    {
+        saveCache();
+        updateApplications();
+    }
+}
+
+void LinuxAppScanner::directoryChanged(const QString &path)
+{
+    QString pathPrefix = path + QLatin1Char('/');
+    for(std::size_t i = 0; i < _dataDirs.size(); ++i)
+    {
+        const QString &dataDirPath = _dataDirs[i].path;
+        // The change is in this data directory, or it's a parent that we're
+        // watching because the data directory doesn't exist
+        if(path == dataDirPath || path.startsWith(dataDirPath + QLatin1Char('/')) ||
+           dataDirPath.startsWith(pathPrefix))
+        {
+            _dirtyDirs[i] = true;
+        }
+    }
+    _rescanTimer.start();
+}
+
+void LinuxAppScanner::rescanDirtyDirs()
+{
+    for(std::size_t i = 0; i < _dataDirs.size(); ++i)
+    {
+        if(_dirtyDirs[i])
+        {
+            _dirtyDirs[i] = false;
+            qInfo() << "Rescanning" << _dataDirs[i].path << "due to changes";
+            startDirScan(i);
+        }
+    }
+}
+
+void LinuxAppScanner::updateApplications()
+{
+    // Merge the data directories - the first entry with a given file ID
+    // wins, even if it's not visible.
+    QSet<QString> seenIds;
+    std::vector<const LinuxDesktopEntry*> visibleEntries;
+    for(const auto &dataDir : _dataDirs)
+    {
+        for(const auto &entry : dataDir.entries)
+        {
+            if(seenIds.contains(entry.fileId))
+                continue;
+            seenIds.insert(entry.fileId);
+            if(entry.visible && !entry.target.isEmpty())
+                visibleEntries.push_back(&entry);
+        }
+    }
+
+    std::sort(visibleEntries.begin(), visibleEntries.end(),
+              [](const LinuxDesktopEntry *pFirst, const LinuxDesktopEntry *pSecond)
+              {
+                  return pFirst->name.compare(pSecond->name, Qt::CaseInsensitive) < 0;
+              });
+
+    // Apps are identified by their executable, so only show one entry for
+    // each executable
+    QHash<QString, LinuxAppInfo> apps;
+    QJsonArray applications;
+    for(const auto &pEntry : visibleEntries)
+    {
+        if(apps.contains(pEntry->target))
+            continue;
+        apps.insert(pEntry->target, {pEntry->name, pEntry->icon});
+        applications.push_back(SystemApplication{pEntry->target, pEntry->name, {}}.toJsonObject());
+    }
+
+    {
+        LinuxAppRegistry &registry = linuxAppRegistry();
+        QMutexLocker lock{&registry.mutex};
+        registry.apps = std::move(apps);
+        ++registry.revision;
+    }
+
+    if(_scanRequested || applications != _applications)
+    {
+        qInfo() << "Found" << applications.size() << "applications";
+        _applications = std::move(applications);
+        _scanRequested = false;
+        emit applicationScanComplete(_applications);
+    }
 }
 
 void LinuxAppScanner::scanApplications()
 {
+    _scanRequested = true;
+
+    if(!_started)
+    {
+        _started = true;
+        loadCache();
+        QStringList paths = QStandardPaths::standardLocations(QStandardPaths::ApplicationsLocation);
+        paths.removeDuplicates();
+        for(const auto &path : paths)
+            _dataDirs.push_back({QDir::cleanPath(path), {}, false, false, {}});
+        _dirtyDirs.assign(_dataDirs.size(), false);
+
+        if(_dataDirs.empty())
+        {
+            qWarning() << "No application directories found";
+            updateApplications();
+            return;
+        }
+
+        for(std::size_t i = 0; i < _dataDirs.size(); ++i)
+            startDirScan(i);
+        return;
+    }
 
+    // The directories are watched, so unless a rescan is still running, the
+    // results are current
+    bool scanning = std::any_of(_dataDirs.begin(), _dataDirs.end(),
+                                [](const DataDir &dir){return dir.scanning;});
+    if(!scanning)
+        updateApplications();
 }
 
 QString getLinuxAppName(const QString &path)
 {
+    {
+        LinuxAppRegistry &registry = linuxAppRegistry();
+        QMutexLocker lock{&registry.mutex};
+        auto itApp = registry.apps.find(path);
+        if(itApp != registry.apps.end())
+            return itApp->name;
+    }
     QFileInfo fi(path);
     return fi.fileName();
 }
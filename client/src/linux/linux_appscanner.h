@@ -23,18 +23,166 @@
 #define LINUX_APPSCANNER_H
 
 #include "../appscanner.h"
+#include "workerpool.h"
+#include <QCache>
+#include <QFileSystemWatcher>
+#include <QMutex>
+#include <QTimer>
+#include <vector>
 
+// A parsed XDG .desktop file
+struct LinuxDesktopEntry
+{
+    // Absolute path to the .desktop file, and its modification time and size
+    // (used to check whether a cached entry is still valid)
+    QString filePath;
+    qint64 modified{0};
+    qint64 size{0};
+    // Desktop file ID - the path relative to the data directory, with '/'
+    // replaced by '-'.  Entries in earlier data directories override entries
+    // with the same ID in later directories.
+    QString fileId;
+    // Whether this entry should be shown - it's an application and isn't
+    // hidden.  (Entries that aren't shown still override other entries.)
+    bool visible{false};
+    // Name (localized if possible), icon name or path, and Exec line
+    QString name;
+    QString icon;
+    QString exec;
+    // The executable resolved from Exec (absolute, canonical), or empty if it
+    // couldn't be resolved.  Not cached; this is resolved again on each scan.
+    QString target;
+
+    QJsonObject toJsonObject() const;
+    static LinuxDesktopEntry fromJsonObject(const QJsonObject &obj);
+};
+
+// Parse the contents of a .desktop file.  'locales' are the locale names to
+// look for in localized keys, most specific first (like "de_DE", "de").
+// Returns false if the data aren't a valid desktop entry.  The file path,
+// size, modified time, and file ID aren't set.
+bool parseLinuxDesktopEntry(const QByteArray &data, const QStringList &locales,
+                            LinuxDesktopEntry &entry);
+
+// Split a desktop entry Exec value into arguments, following the quoting
+// rules of the desktop entry spec.  Field codes (%f, %U, etc.) are removed.
+QStringList splitLinuxDesktopExec(const QString &exec);
+
+// Find the executable run by a desktop entry Exec value - skips an 'env'
+// prefix, searches PATH, and resolves symlinks (the daemon matches processes
+// by their canonical executable path).  Returns an empty string if it can't
+// be resolved.
+QString resolveLinuxDesktopExec(const QString &exec);
+
+// Icon name or path for an application path from the last scan; empty if
+// the path isn't a scanned application
+QString getLinuxAppIconName(const QString &path);
+// Find an icon file in the hicolor theme or the pixmaps directories (for
+// desktops where Qt doesn't know the icon theme); empty if there isn't one
+QString findLinuxIconFile(const QString &iconName);
+
+// Provides app icons from the icon theme for "image://appicon/<path>", with
+// a size-keyed pixmap cache
+class LinuxAppIconProvider : public QQuickImageProvider
+{
+public:
+    LinuxAppIconProvider();
+
+private:
+    QPixmap loadPixmap(const QString &path, const QSize &size);
+
+public:
+    QPixmap requestPixmap(const QString &id, QSize *pSize,
+                          const QSize &requestedSize) override;
+
+private:
+    // QQuickImageProvider says requestPixmap() could be called from multiple
+    // threads
+    QMutex _mutex;
+    // Pixmaps by "<size>:<path>", cost is in KB
+    QCache<QString, QPixmap> _pixmaps;
+    // Revision of the icon names that _pixmaps were loaded with
+    int _iconRevision;
+};
+
+// LinuxAppScanner finds applications from the XDG .desktop files in the data
+// directories (XDG_DATA_HOME and XDG_DATA_DIRS).
+//
+// The directories are scanned in parallel on a WorkerPool.  Parsed entries
+// are cached on disk, so after the first run, only .desktop files that
+// changed are parsed.  The directories are watched after the first scan, and
+// only directories that change are rescanned - later scan requests are
+// answered from memory.
 class LinuxAppScanner : public AppScanner
 {
     Q_OBJECT
+    CLASS_LOGGING_CATEGORY("linux.appscanner")
+
+private:
+    // Result of scanning one data directory
+    struct DirScan
+    {
+        std::vector<LinuxDesktopEntry> entries;
+        // The directories scanned, to be watched (inotify isn't recursive)
+        QStringList directories;
+    };
+
+    struct DataDir
+    {
+        QString path;
+        // The entries found the last time this directory was scanned
+        std::vector<LinuxDesktopEntry> entries;
+        // Whether the directory has been scanned, and whether a scan is in
+        // progress
+        bool scanned;
+        bool scanning;
+        // Last scan started, if any
+        Async<WorkerPool::JobTask<DirScan>> pScan;
+    };
+
+    // Scan a data directory on a worker thread.  'cached' are the cached
+    // entries by file path, they're reused if the file hasn't changed.
+    static DirScan scanDirectory(const QString &path,
+                                 const QHash<QString, LinuxDesktopEntry> &cached,
+                                 const QStringList &locales);
 
 public:
     LinuxAppScanner();
 
+private:
+    void loadCache();
+    void saveCache();
+    void startDirScan(std::size_t index);
+    void dirScanFinished(std::size_t index, const DirScan &result);
+    void directoryChanged(const QString &path);
+    void rescanDirtyDirs();
+    // Merge the entries from all data directories and emit the result if
+    // it's complete and it changed (or if a scan was requested)
+    void updateApplications();
+
 public:
     virtual void scanApplications() override;
+
+private:
+    WorkerPool _workerPool;
+    QStringList _locales;
+    std::vector<DataDir> _dataDirs;
+    // Entries loaded from the disk cache, by file path.  Entries from new
+    // scans are added as they complete.
+    QHash<QString, LinuxDesktopEntry> _cachedEntries;
+    QFileSystemWatcher _watcher;
+    // Changes are batched - package installs change many files at once
+    QTimer _rescanTimer;
+    std::vector<bool> _dirtyDirs;
+    // Whether the data directories have been found and scanned
+    bool _started;
+    // Whether the caller is waiting for applicationScanComplete()
+    bool _scanRequested;
+    QJsonArray _applications;
 };
 
+// Get the name of an application - the desktop entry name for scanned
+// applications, or the file name otherwise
 QString getLinuxAppName(const QString &path);
 bool validateLinuxCustomPath (const QString &path);
 
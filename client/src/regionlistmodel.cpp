@@ -0,0 +1,211 @@
+// Copyright (c) 2019 London Trust Media Incorporated
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#line SOURCE_FILE("regionlistmodel.cpp")
+
+#include "regionlistmodel.h"
+#include <QSet>
+
+namespace
+{
+    const QString regionListRegionKey{QStringLiteral("region")};
+    const QString regionListCountryKey{QStringLiteral("regionCountry")};
+    const QString regionListChildrenKey{QStringLiteral("regionChildren")};
+}
+
+QString RegionListModel::rowKey(const QVariantMap &data)
+{
+    QString regionId = data.value(regionListRegionKey).toMap()
+        .value(QStringLiteral("id")).toString();
+    if(!regionId.isEmpty())
+        return regionId;
+    // Country group - location IDs never contain '/', so this can't collide
+    // with a single region
+    return data.value(regionListCountryKey).toString() + QStringLiteral("/");
+}
+
+int RegionListModel::findRow(const QString &key, int first) const
+{
+    // There are only a few hundred rows at most, a linear search is fine
+    for(std::size_t i = static_cast<std::size_t>(first); i < _rows.size(); ++i)
+    {
+        if(_rows[i].key == key)
+            return static_cast<int>(i);
+    }
+    return -1;
+}
+
+void RegionListModel::resetRows(std::vector<Row> newRows)
+{
+    beginResetModel();
+    _rows = std::move(newRows);
+    endResetModel();
+}
+
+int RegionListModel::rowCount(const QModelIndex &parent) const
+{
+    if(parent.isValid())
+        return 0;
+    return static_cast<int>(_rows.size());
+}
+
+QVariant RegionListModel::data(const QModelIndex &index, int role) const
+{
+    if(!index.isValid() || index.row() < 0 || index.row() >= rowCount())
+        return {};
+
+    const Row &row = _rows[static_cast<std::size_t>(index.row())];
+    switch(role)
+    {
+        case RegionRole:
+            return row.data.value(regionListRegionKey);
+        case RegionCountryRole:
+            return row.data.value(regionListCountryKey);
+        case RegionChildrenRole:
+            return row.data.value(regionListChildrenKey);
+        case RowKeyRole:
+            return row.key;
+        default:
+            return {};
+    }
+}
+
+QHash<int, QByteArray> RegionListModel::roleNames() const
+{
+    return {
+        {RegionRole, QByteArrayLiteral("region")},
+        {RegionCountryRole, QByteArrayLiteral("regionCountry")},
+        {RegionChildrenRole, QByteArrayLiteral("regionChildren")},
+        {RowKeyRole, QByteArrayLiteral("rowKey")}
+    };
+}
+
+QVariantList RegionListModel::regions() const
+{
+    QVariantList regions;
+    regions.reserve(rowCount());
+    for(const auto &row : _rows)
+        regions.push_back(row.data);
+    return regions;
+}
+
+void RegionListModel::setRegions(const QVariantList &regions)
+{
+    std::vector<Row> newRows;
+    newRows.reserve(static_cast<std::size_t>(regions.size()));
+    QSet<QString> newKeys;
+    newKeys.reserve(regions.size());
+    bool uniqueKeys = true;
+    for(const auto &region : regions)
+    {
+        QVariantMap data{region.toMap()};
+        QString key{rowKey(data)};
+        if(newKeys.contains(key))
+            uniqueKeys = false;
+        newKeys.insert(key);
+        newRows.push_back({std::move(key), std::move(data)});
+    }
+
+    // Rows are identified by key, so duplicates can't be diffed.  This
+    // shouldn't happen, but if it does, just reset.
+    if(!uniqueKeys)
+    {
+        qWarning() << "Region list contains duplicate rows, resetting model";
+        resetRows(std::move(newRows));
+        ++_revision;
+        emit regionsChanged();
+        emit revisionChanged();
+        return;
+    }
+
+    bool changed = false;
+
+    // Remove rows that no longer exist, from the end so the indices of
+    // earlier rows are still valid.  Adjacent rows are removed together.
+    int last = rowCount() - 1;
+    while(last >= 0)
+    {
+        if(newKeys.contains(_rows[static_cast<std::size_t>(last)].key))
+        {
+            --last;
+            continue;
+        }
+        int first = last;
+        while(first > 0 && !newKeys.contains(_rows[static_cast<std::size_t>(first-1)].key))
+            --first;
+        beginRemoveRows({}, first, last);
+        _rows.erase(_rows.begin() + first, _rows.begin() + last + 1);
+        endRemoveRows();
+        changed = true;
+        last = first - 1;
+    }
+
+    // Now all current rows exist in the new rows.  Walk the new rows, moving
+    // or inserting current rows to match.  Rows before 'pos' are final, so a
+    // row is only ever moved up.
+    for(std::size_t pos = 0; pos < newRows.size(); ++pos)
+    {
+        Row &newRow = newRows[pos];
+        int posIdx = static_cast<int>(pos);
+        int current = findRow(newRow.key, posIdx);
+        if(current < 0)
+        {
+            beginInsertRows({}, posIdx, posIdx);
+            _rows.insert(_rows.begin() + posIdx, std::move(newRow));
+            endInsertRows();
+            changed = true;
+            continue;
+        }
+
+        if(current != posIdx)
+        {
+            beginMoveRows({}, current, current, {}, posIdx);
+            Row moved{std::move(_rows[static_cast<std::size_t>(current)])};
+            _rows.erase(_rows.begin() + current);
+            _rows.insert(_rows.begin() + posIdx, std::move(moved));
+            endMoveRows();
+            changed = true;
+        }
+
+        Row &row = _rows[pos];
+        if(row.data != newRow.data)
+        {
+            QVector<int> changedRoles;
+            if(row.data.value(regionListRegionKey) != newRow.data.value(regionListRegionKey))
+                changedRoles.push_back(RegionRole);
+            if(row.data.value(regionListCountryKey) != newRow.data.value(regionListCountryKey))
+                changedRoles.push_back(RegionCountryRole);
+            if(row.data.value(regionListChildrenKey) != newRow.data.value(regionListChildrenKey))
+                changedRoles.push_back(RegionChildrenRole);
+            row.data = std::move(newRow.data);
+            QModelIndex rowIndex{index(posIdx)};
+            emit dataChanged(rowIndex, rowIndex, changedRoles);
+            changed = true;
+        }
+    }
+
+    Q_ASSERT(_rows.size() == newRows.size());
+
+    if(changed)
+    {
+        ++_revision;
+        emit regionsChanged();
+        emit revisionChanged();
+    }
+}
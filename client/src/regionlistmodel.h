@@ -0,0 +1,102 @@
+// Copyright (c) 2019 London Trust Media Incorporated
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#line HEADER_FILE("regionlistmodel.h")
+
+#ifndef REGIONLISTMODEL_H
+#define REGIONLISTMODEL_H
+
+#include <QAbstractListModel>
+#include <QVariantList>
+#include <QVariantMap>
+#include <vector>
+
+// RegionListModel is the model for the region list in RegionListView.
+//
+// RegionListView still builds the displayed rows in JS (filtering, sorting, and
+// grouping depend on QML-side state like the search term and translated
+// names), but instead of handing a new array to the Repeater - which destroys
+// and recreates every delegate - it assigns the array to this model.  The
+// model diffs it against the current rows and emits the minimal
+// insert/remove/move/dataChanged signals, so existing delegates are kept.
+// This matters because the daemon resends the whole grouped locations list
+// for every latency update.
+//
+// Each row is an object with 'region', 'regionCountry', and 'regionChildren'
+// (see RegionListView.buildRegionArray()), which are exposed as roles.  Rows
+// are identified by the single region's ID, or by the country code for a
+// country group, so a row keeps its delegate (and its expanded state, etc.)
+// when it moves or its data change.
+class RegionListModel : public QAbstractListModel
+{
+    Q_OBJECT
+    CLASS_LOGGING_CATEGORY("regionlistmodel")
+
+public:
+    enum Role
+    {
+        RegionRole = Qt::UserRole,
+        RegionCountryRole,
+        RegionChildrenRole,
+        RowKeyRole,
+    };
+
+    // The rows to display.  Setting this updates the model incrementally.
+    Q_PROPERTY(QVariantList regions READ regions WRITE setRegions NOTIFY regionsChanged)
+    // Incremented whenever the rows change in any way.  Bindings that walk the
+    // Repeater's items can depend on this, since the items themselves are
+    // kept when the rows change.
+    Q_PROPERTY(int revision READ revision NOTIFY revisionChanged)
+
+public:
+    using QAbstractListModel::QAbstractListModel;
+
+private:
+    struct Row
+    {
+        QString key;
+        QVariantMap data;
+    };
+
+    static QString rowKey(const QVariantMap &data);
+    // Find the current row with the given key, searching from 'first'.
+    // Returns -1 if there isn't one.
+    int findRow(const QString &key, int first) const;
+    // Replace all rows; used when the new rows can't be diffed
+    void resetRows(std::vector<Row> newRows);
+
+public:
+    virtual int rowCount(const QModelIndex &parent = {}) const override;
+    virtual QVariant data(const QModelIndex &index, int role) const override;
+    virtual QHash<int, QByteArray> roleNames() const override;
+
+    QVariantList regions() const;
+    void setRegions(const QVariantList &regions);
+    int revision() const {return _revision;}
+
+signals:
+    void regionsChanged();
+    void revisionChanged();
+
+private:
+    std::vector<Row> _rows;
+    int _revision{0};
+};
+
+#endif
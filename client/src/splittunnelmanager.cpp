@@ -42,6 +42,8 @@ void SplitTunnelManager::installImageHandler(QQmlApplicationEngine *engine)
     engine->addImageProvider(QStringLiteral("appicon"), new MacAppIconProvider);
 #elif defined(Q_OS_WIN)
     engine->addImageProvider(QStringLiteral("appicon"), createWinAppIconProvider().release());
+#elif defined(Q_OS_LINUX)
+    engine->addImageProvider(QStringLiteral("appicon"), new LinuxAppIconProvider);
 #else
     engine->addImageProvider(QStringLiteral("appicon"), new DummyAppIconProvider);
 #endif
@@ -21,13 +21,16 @@
 
 #include "daemonconnection.h"
 
-DaemonConnection::DaemonConnection(QObject* parent)
+DaemonConnection::DaemonConnection(QObject* parent, SyncMode syncMode)
     : QObject(parent)
     , _ipc(nullptr)
+    , _syncMode(syncMode)
     , _connected(false)
 {
     _rpc = new ClientSideInterface(&_methods, this);
     _methods.add({ QStringLiteral("data"), this, &DaemonConnection::RPC_data });
+    _methods.add({ QStringLiteral("bandwidth"), this, &DaemonConnection::RPC_bandwidth });
+    _methods.add({ QStringLiteral("watch"), this, &DaemonConnection::RPC_watch });
     _connectionTimer.setSingleShot(true);
     connect(&_connectionTimer, &QTimer::timeout, this, [this]() {
         if (!_connected) socketError(QStringLiteral("Timeout waiting for daemon connection"));
@@ -69,7 +72,7 @@ void DaemonConnection::connectToDaemon()
 
     _ipc = new ThreadedLocalIPCConnection(this);
 
-    connect(_ipc, &IPCConnection::connected, this, &DaemonConnection::socketConnected);
+    connect(_ipc, &IPCConnection::connected, this, &DaemonConnection::ipcConnected);
     connect(_ipc, &IPCConnection::disconnected, this, &DaemonConnection::socketDisconnected);
     connect(_ipc, &IPCConnection::error, this, &DaemonConnection::socketError);
 
@@ -80,6 +83,22 @@ void DaemonConnection::connectToDaemon()
     _ipc->connectToServer();
 }
 
+void DaemonConnection::ipcConnected(qintptr socketFd)
+{
+    emit socketConnected(socketFd);
+
+    if (_syncMode == SyncMode::Subscribe)
+    {
+        // We're connected once the daemon sends its state (RPC_data())
+        _rpc->postWithParams(QStringLiteral("subscribe"), {});
+    }
+    else if (!_connected)
+    {
+        _connectionTimer.stop();
+        emit connectedChanged(_connected = true);
+    }
+}
+
 void DaemonConnection::RPC_data(const QJsonObject &data)
 {
     QJsonObject::const_iterator it;
@@ -99,6 +118,16 @@ void DaemonConnection::RPC_data(const QJsonObject &data)
     }
 }
 
+void DaemonConnection::RPC_bandwidth(const QJsonObject &points)
+{
+    emit bandwidthReceived(points);
+}
+
+void DaemonConnection::RPC_watch(const QJsonObject &event)
+{
+    emit watchEventReceived(event);
+}
+
 void DaemonConnection::RPC_error(const QJsonObject& errorObject)
 {
     Error e(errorObject);
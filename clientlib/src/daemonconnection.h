@@ -34,7 +34,20 @@ class CLIENTLIB_EXPORT DaemonConnection : public QObject
 {
     Q_OBJECT
 public:
-    explicit DaemonConnection(QObject* parent = nullptr);
+    // Subscribed connections receive the daemon's state, and are connected
+    // once the state has been received.  Query-only connections don't receive
+    // any state (data, account, settings, and state remain empty) - they're
+    // connected as soon as the socket is connected, and can only call methods
+    // like getProperties.
+    enum class SyncMode
+    {
+        Subscribe,
+        QueryOnly,
+    };
+
+public:
+    explicit DaemonConnection(QObject* parent = nullptr,
+                              SyncMode syncMode = SyncMode::Subscribe);
     ~DaemonConnection();
 
     void connectToDaemon();
@@ -74,9 +87,12 @@ public slots:
 
 protected slots:
     void RPC_data(const QJsonObject& data);
+    void RPC_bandwidth(const QJsonObject& points);
+    void RPC_watch(const QJsonObject& event);
     void RPC_error(const QJsonObject& errorObject);
 
 protected slots:
+    void ipcConnected(qintptr socketFd);
     void socketDisconnected();
     void socketError(const QString& errorString);
 
@@ -88,12 +104,20 @@ signals:
     void socketConnected(qintptr socketFd);
     void connectedChanged(bool isConnected);
     void error(const Error& error);
+    // New bandwidth history points from the daemon - see
+    // BandwidthHistory::toJson().  When the daemon connection is established,
+    // this includes the whole history.
+    void bandwidthReceived(const QJsonObject &points);
+    // A change in properties watched with the daemon's watch method.  The
+    // event is passed as received from the daemon, see Daemon::RPC_watch().
+    void watchEventReceived(const QJsonObject &event);
 
 private:
     LocalMethodRegistry _methods;
     ClientIPCConnection* _ipc;
     ClientSideInterface* _rpc;
     QTimer _connectionTimer;
+    SyncMode _syncMode;
     bool _connected;
 };
 
@@ -18,9 +18,34 @@
 
 #include "apibase.h"
 #include "brand.h"
+#include <algorithm>
+#include <tuple>
+
+namespace
+{
+    // Weight of each new sample in the response time and error rate EWMAs
+    const double healthEwmaWeight{0.3};
+    // Response time assumed for a base that hasn't responded yet.  This is
+    // pessimistic so bases that have responded are preferred.
+    const double unmeasuredResponseMsec{1000.0};
+    // Score penalty for a base that's always failing - the error rate is
+    // weighted by this.
+    const double errorRatePenaltyMsec{2000.0};
+    // Consecutive failures that open the circuit breaker, and the cooldown
+    // applied (doubling for each further failure, up to the max)
+    const unsigned cooldownFailures{3};
+    const std::chrono::seconds initialCooldown{30};
+    const std::chrono::minutes maxCooldown{5};
+    // Limits for the hedge delay, and the delay used when no response times
+    // are known yet
+    const std::chrono::milliseconds minHedgeDelay{250};
+    const std::chrono::milliseconds maxHedgeDelay{2000};
+    const std::chrono::milliseconds defaultHedgeDelay{1000};
+}
 
 ApiBaseData::ApiBaseData(std::vector<QString> baseUris)
-    : _baseUris{std::move(baseUris)}, _nextStartIndex{0}
+    : _baseUris{std::move(baseUris)}, _nextStartIndex{0},
+      _recentResponseMsec{}, _recentResponseCount{0}, _nextRecentResponse{0}
 {
     // Ensure each URI ends with a slash
     for(auto &uri : _baseUris)
@@ -28,6 +53,7 @@ ApiBaseData::ApiBaseData(std::vector<QString> baseUris)
         if(!uri.endsWith('/'))
             uri.append('/');
     }
+    _health.resize(_baseUris.size(), {-1.0, 0.0, 0, {}});
 }
 
 const QString &ApiBaseData::getUri(unsigned index)
@@ -36,12 +62,106 @@ const QString &ApiBaseData::getUri(unsigned index)
     return _baseUris[index];
 }
 
-void ApiBaseData::attemptSucceeded(unsigned successIndex)
+double ApiBaseData::getScore(unsigned index) const
+{
+    Q_ASSERT(index < _health.size());   // Guaranteed by caller
+    const BaseHealth &health = _health[index];
+    double responseMsec = health.responseMsec >= 0 ? health.responseMsec : unmeasuredResponseMsec;
+    return responseMsec + health.errorRate * errorRatePenaltyMsec;
+}
+
+std::vector<unsigned> ApiBaseData::getAttemptOrder() const
+{
+    // Bases in cooldown go last, then order by score.  Ties go to the last
+    // successful base, then to the order the bases were given in.
+    //
+    // Rank each base once before sorting - the cooldown check depends on the
+    // current time, so it can't be evaluated by the comparator.
+    using Rank = std::tuple<bool, double, bool, unsigned>;
+    auto now = std::chrono::steady_clock::now();
+    std::vector<Rank> ranks;
+    ranks.reserve(_baseUris.size());
+    for(unsigned i=0; i<_baseUris.size(); ++i)
+    {
+        ranks.emplace_back(_health[i].cooldownEnd > now, getScore(i),
+                           i != _nextStartIndex, i);
+    }
+    std::sort(ranks.begin(), ranks.end());
+
+    std::vector<unsigned> order;
+    order.reserve(ranks.size());
+    for(const auto &rank : ranks)
+        order.push_back(std::get<3>(rank));
+    return order;
+}
+
+bool ApiBaseData::inCooldown(unsigned index) const
+{
+    Q_ASSERT(index < _health.size());   // Guaranteed by caller
+    return _health[index].cooldownEnd > std::chrono::steady_clock::now();
+}
+
+std::chrono::milliseconds ApiBaseData::getHedgeDelay() const
+{
+    if(!_recentResponseCount)
+        return defaultHedgeDelay;
+
+    std::vector<qint64> times{_recentResponseMsec.begin(),
+                              _recentResponseMsec.begin() + _recentResponseCount};
+    auto p95 = times.begin() + (times.size() * 95 / 100);
+    if(p95 == times.end())
+        --p95;
+    std::nth_element(times.begin(), p95, times.end());
+    return std::max(minHedgeDelay, std::min(maxHedgeDelay, std::chrono::milliseconds{*p95}));
+}
+
+void ApiBaseData::attemptSucceeded(unsigned successIndex, std::chrono::milliseconds time)
 {
     Q_ASSERT(successIndex < _baseUris.size());  // Guaranteed by caller
+    attemptResponded(successIndex, time);
     _nextStartIndex = successIndex;
 }
 
+void ApiBaseData::attemptResponded(unsigned index, std::chrono::milliseconds time)
+{
+    Q_ASSERT(index < _health.size());   // Guaranteed by caller
+    BaseHealth &health = _health[index];
+    double responseMsec = static_cast<double>(time.count());
+    if(health.responseMsec < 0)
+        health.responseMsec = responseMsec;
+    else
+        health.responseMsec += healthEwmaWeight * (responseMsec - health.responseMsec);
+    health.errorRate -= healthEwmaWeight * health.errorRate;
+    if(health.cooldownEnd != std::chrono::steady_clock::time_point{})
+        qInfo() << "API base" << _baseUris[index] << "responded, ending cooldown";
+    health.consecutiveFailures = 0;
+    health.cooldownEnd = {};
+
+    _recentResponseMsec[_nextRecentResponse] = time.count();
+    _nextRecentResponse = (_nextRecentResponse + 1) % _recentResponseMsec.size();
+    if(_recentResponseCount < _recentResponseMsec.size())
+        ++_recentResponseCount;
+}
+
+void ApiBaseData::attemptFailed(unsigned index)
+{
+    Q_ASSERT(index < _health.size());   // Guaranteed by caller
+    BaseHealth &health = _health[index];
+    health.errorRate += healthEwmaWeight * (1.0 - health.errorRate);
+    ++health.consecutiveFailures;
+    if(health.consecutiveFailures >= cooldownFailures)
+    {
+        // Double the cooldown for each failure past the threshold
+        unsigned doublings = std::min(health.consecutiveFailures - cooldownFailures, 4u);
+        std::chrono::milliseconds cooldown = initialCooldown * (1 << doublings);
+        cooldown = std::min<std::chrono::milliseconds>(cooldown, maxCooldown);
+        health.cooldownEnd = std::chrono::steady_clock::now() + cooldown;
+        qInfo() << "API base" << _baseUris[index] << "failed"
+            << health.consecutiveFailures << "times, cooling down for"
+            << traceMsec(cooldown);
+    }
+}
+
 ApiBase::ApiBase(std::vector<QString> baseUris)
     : _pData{new ApiBaseData{std::move(baseUris)}}
 {
@@ -60,27 +180,54 @@ unsigned ApiBase::getUriCount() const
 }
 
 ApiBaseSequence::ApiBaseSequence(QSharedPointer<ApiBaseData> pData)
-    : _pData{std::move(pData)}
+    : _pData{std::move(pData)}, _nextPosition{0}
 {
     Q_ASSERT(_pData);   // Guaranteed by caller
+    _order = _pData->getAttemptOrder();
+}
 
-    // Back up _nextBaseUri relative to the start so getNextUri() can increment
-    // it normally
-    unsigned startIndex = _pData->getNextStartIndex();
-    _currentBaseUri = startIndex ? startIndex-1 : _pData->getUriCount()-1;
+unsigned ApiBaseSequence::getNextBase()
+{
+    Q_ASSERT(!_order.empty());  // Class invariant
+    unsigned base = _order[_nextPosition];
+    _nextPosition = (_nextPosition + 1) % _order.size();
+    return base;
+}
+
+const QString &ApiBaseSequence::getUri(unsigned base) const
+{
+    Q_ASSERT(_pData);   // Class invariant
+    return _pData->getUri(base);
+}
+
+bool ApiBaseSequence::canHedge() const
+{
+    Q_ASSERT(_pData);   // Class invariant
+    return _order.size() > 1 && !_pData->inCooldown(_order[_nextPosition]);
+}
+
+std::chrono::milliseconds ApiBaseSequence::getHedgeDelay() const
+{
+    Q_ASSERT(_pData);   // Class invariant
+    return _pData->getHedgeDelay();
+}
+
+void ApiBaseSequence::attemptSucceeded(unsigned base, std::chrono::milliseconds time)
+{
+    Q_ASSERT(_pData);   // Class invariant
+    _pData->attemptSucceeded(base, time);
 }
 
-const QString &ApiBaseSequence::getNextUri()
+void ApiBaseSequence::attemptResponded(unsigned base, std::chrono::milliseconds time)
 {
     Q_ASSERT(_pData);   // Class invariant
-    _currentBaseUri = (_currentBaseUri + 1) % _pData->getUriCount();
-    return _pData->getUri(_currentBaseUri);
+    _pData->attemptResponded(base, time);
 }
 
-void ApiBaseSequence::attemptSucceeded()
+void ApiBaseSequence::attemptFailed(unsigned base)
 {
     Q_ASSERT(_pData);   // Class invariant
-    _pData->attemptSucceeded(_currentBaseUri);
+    _pData->attemptFailed(base);
 }
 
 namespace ApiBases
@@ -23,44 +23,104 @@
 #define APIBASE_H
 
 #include <QSharedPointer>
+#include <array>
+#include <chrono>
 #include <vector>
 
-// Data used by both ApiBase and ApiBaseSequence - the actual base URIs and the
-// last successful one.
+// Data used by both ApiBase and ApiBaseSequence - the actual base URIs, the
+// health of each one, and the last successful one.
+//
+// The health of each base is scored from an EWMA of its response time and its
+// recent error rate.  A base that fails several times in a row is put in a
+// cooldown (a circuit breaker), it's only tried after the other bases until
+// it responds again.
+//
 // Note that this is not currently thread-safe; all API requests of any kind are
 // handled on the main thread.
 class COMMON_EXPORT ApiBaseData
 {
+    CLASS_LOGGING_CATEGORY("apibase")
+
+private:
+    struct BaseHealth
+    {
+        // EWMA of response times in milliseconds, negative if the base
+        // hasn't responded yet
+        double responseMsec;
+        // EWMA of failures (0 = no recent failures, 1 = only failures)
+        double errorRate;
+        unsigned consecutiveFailures;
+        // If the circuit breaker is open, the time that it closes again
+        std::chrono::steady_clock::time_point cooldownEnd;
+    };
+
 public:
     ApiBaseData(std::vector<QString> baseUris);
 
 public:
-    unsigned getNextStartIndex() const {return _nextStartIndex;}
     unsigned getUriCount() const {return _baseUris.size();}
     const QString &getUri(unsigned index);
-    void attemptSucceeded(unsigned successIndex);
+    // Get the order in which the bases should be attempted, best first.
+    std::vector<unsigned> getAttemptOrder() const;
+    // Check whether a base is in its circuit-breaker cooldown
+    bool inCooldown(unsigned index) const;
+    // Delay used to send a hedged request to another base - the 95th
+    // percentile of recent response times
+    std::chrono::milliseconds getHedgeDelay() const;
+
+    // A request to a base succeeded - records its response time and makes it
+    // the preferred base among equally healthy ones.
+    void attemptSucceeded(unsigned successIndex, std::chrono::milliseconds time);
+    // A base responded, but the request wasn't successful (such as an auth
+    // error).  The base is healthy, but it isn't preferred.
+    void attemptResponded(unsigned index, std::chrono::milliseconds time);
+    // A request to a base failed (network error, timeout, rate limiting)
+    void attemptFailed(unsigned index);
+
+private:
+    // Score a base for getAttemptOrder() - lower is better
+    double getScore(unsigned index) const;
 
 private:
     std::vector<QString> _baseUris;
+    std::vector<BaseHealth> _health;
     unsigned _nextStartIndex;
+    // Recent response times (for any base), used for the hedge delay
+    std::array<qint64, 32> _recentResponseMsec;
+    unsigned _recentResponseCount, _nextRecentResponse;
 };
 
-// ApiBaseSequence keeps track of which base URI in an ApiBase was last used
-// and returns each URI in sequence for subsequent attempts.
-// If a request succeeds, it updates the last successful URI in ApiBase.
+// ApiBaseSequence returns the base URIs of an ApiBase in order of their health
+// for subsequent attempts of a request.  The result of each attempt updates
+// the health of the base in ApiBase.
 class COMMON_EXPORT ApiBaseSequence
 {
 public:
     ApiBaseSequence(QSharedPointer<ApiBaseData> pData);
 
 public:
-    const QString &getNextUri();
-    void attemptSucceeded();
+    // Get the next base to attempt.  After each base has been returned, this
+    // starts over from the best base.  The base index is used to get the URI
+    // and report the result.
+    unsigned getNextBase();
+    const QString &getUri(unsigned base) const;
+
+    // Check whether a hedged request could be sent now - true if there's
+    // another base and it isn't in cooldown.  The hedged request uses the next
+    // base from getNextBase().
+    bool canHedge() const;
+    std::chrono::milliseconds getHedgeDelay() const;
+
+    void attemptSucceeded(unsigned base, std::chrono::milliseconds time);
+    void attemptResponded(unsigned base, std::chrono::milliseconds time);
+    void attemptFailed(unsigned base);
 
 private:
     const QSharedPointer<ApiBaseData> _pData;
-    // Index of the base URI currently being attempted
-    unsigned _currentBaseUri;
+    // Order of the bases for this sequence, determined when it's created
+    std::vector<unsigned> _order;
+    // Position of the next base in _order
+    unsigned _nextPosition;
 };
 
 // ApiBase describes a set of API base URIs, and it keeps track of the last one
@@ -72,8 +132,9 @@ public:
 
 public:
     // Get an ApiBaseSequence for a new request attempt.  It will start with the
-    // URI base that most recently succeeded.  If a request succeeds, it updates
-    // the last successful URI base for later attempts.
+    // healthiest URI base (the one that most recently succeeded if they're
+    // equally healthy).  The results of its attempts update the health of the
+    // bases for later attempts.
     ApiBaseSequence beginAttempt();
     unsigned getUriCount() const;
 
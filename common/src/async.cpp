@@ -22,6 +22,97 @@
 #include "async.h"
 
 #include <QMutex>
+#include <new>
+
+namespace
+{
+    // Task allocations are rounded up to a multiple of this size, and each
+    // size up to taskPoolMaxSize has its own free list.  Larger tasks use the
+    // global heap.
+    const std::size_t taskPoolGranularity{16};
+    const std::size_t taskPoolMaxSize{512};
+    const std::size_t taskPoolClasses{taskPoolMaxSize / taskPoolGranularity};
+    // Limit on the free blocks kept for each size on each thread
+    const unsigned taskPoolMaxFree{256};
+
+    // Free blocks are linked through their first bytes
+    struct TaskPoolBlock
+    {
+        TaskPoolBlock *pNext;
+    };
+
+    class TaskPool
+    {
+    public:
+        ~TaskPool()
+        {
+            for(auto pBlock : _pFree)
+            {
+                while(pBlock)
+                {
+                    TaskPoolBlock *pNext = pBlock->pNext;
+                    ::operator delete(pBlock);
+                    pBlock = pNext;
+                }
+            }
+        }
+
+    public:
+        void *allocate(std::size_t sizeClass)
+        {
+            TaskPoolBlock *pBlock = _pFree[sizeClass];
+            if(!pBlock)
+            {
+                ++_misses;
+                return ::operator new((sizeClass + 1) * taskPoolGranularity);
+            }
+            ++_hits;
+            _pFree[sizeClass] = pBlock->pNext;
+            --_freeCount[sizeClass];
+            return pBlock;
+        }
+
+        void release(void *ptr, std::size_t sizeClass)
+        {
+            if(_freeCount[sizeClass] >= taskPoolMaxFree)
+            {
+                ::operator delete(ptr);
+                return;
+            }
+            TaskPoolBlock *pBlock = new(ptr) TaskPoolBlock{_pFree[sizeClass]};
+            _pFree[sizeClass] = pBlock;
+            ++_freeCount[sizeClass];
+        }
+
+        quint64 hits() const {return _hits;}
+        quint64 misses() const {return _misses;}
+
+    private:
+        TaskPoolBlock *_pFree[taskPoolClasses]{};
+        unsigned _freeCount[taskPoolClasses]{};
+        // Allocations that reused a free block, or had to use the global heap
+        quint64 _hits{0}, _misses{0};
+    };
+
+    // The pool for the current thread.  This is a plain pointer so it can
+    // still be checked after the pool is destroyed during thread exit; tasks
+    // freed after that go back to the global heap.
+    thread_local TaskPool *pThreadTaskPool{nullptr};
+    struct TaskPoolOwner
+    {
+        ~TaskPoolOwner()
+        {
+            delete pThreadTaskPool;
+            pThreadTaskPool = nullptr;
+        }
+    };
+    thread_local TaskPoolOwner threadTaskPoolOwner;
+
+    std::size_t taskPoolSizeClass(std::size_t size)
+    {
+        return (size + taskPoolGranularity - 1) / taskPoolGranularity - 1;
+    }
+}
 
 // If we guarantee that all Tasks will be owned/managed by the main thread, this mutex is unnecessary
 static QMutex g_taskMutex;
@@ -90,8 +181,46 @@ void BaseTask::destructorCheck()
     }
 }
 
+void* BaseTask::operator new(std::size_t size)
+{
+    if(size == 0 || size > taskPoolMaxSize)
+        return ::operator new(size);
+    if(!pThreadTaskPool)
+    {
+        // Referring to the owner constructs it for this thread, so the pool
+        // is destroyed when the thread exits
+        Q_UNUSED(&threadTaskPoolOwner);
+        pThreadTaskPool = new TaskPool{};
+    }
+    return pThreadTaskPool->allocate(taskPoolSizeClass(size));
+}
+
+void BaseTask::operator delete(void* ptr, std::size_t size)
+{
+    // Tasks can be freed on a different thread than the one that allocated
+    // them; the block just moves to this thread's pool.
+    if(!ptr)
+        return;
+    if(size == 0 || size > taskPoolMaxSize || !pThreadTaskPool)
+        ::operator delete(ptr);
+    else
+        pThreadTaskPool->release(ptr, taskPoolSizeClass(size));
+}
+
+quint64 BaseTask::getTaskPoolHits()
+{
+    return pThreadTaskPool ? pThreadTaskPool->hits() : 0;
+}
+
+quint64 BaseTask::getTaskPoolMisses()
+{
+    return pThreadTaskPool ? pThreadTaskPool->misses() : 0;
+}
+
 void BaseTask::disconnectDependents()
 {
+    if (!(_state & Connected))
+        return;
     disconnect(this, &BaseTask::finished, nullptr, nullptr);
     // Note: At this point, we may have been destroyed as a result of
     // the last reference being released. This is why it's important
@@ -330,11 +330,25 @@ private:
     // Disconnects any listeners on the finished signal. This will release
     // the references those listeners are holding, which in turn can delete
     // ourselves, so this is only called last in any function.
+    //
+    // If nothing was ever connected (the common case for tasks that are
+    // resolved immediately), there's nothing to disconnect and this returns
+    // without going through the signal machinery.
     void disconnectDependents();
 
 public:
     virtual ~BaseTask() override;
 
+    // Tasks are allocated and freed very frequently, so they're allocated
+    // from small per-thread pools instead of the global heap.
+    static void* operator new(std::size_t size);
+    static void operator delete(void* ptr, std::size_t size);
+
+    // Mainly for testing: the number of task allocations on this thread that
+    // reused a pooled block (hits) or had to allocate a new one (misses).
+    // Tasks larger than the pooled sizes aren't counted.
+    static quint64 getTaskPoolHits();
+    static quint64 getTaskPoolMisses();
     // Mainly for testing: resets the counter for "naming" tasks.
     static void resetTaskIndex();
     // Get the number of live tasks.
@@ -0,0 +1,219 @@
+// Copyright (c) 2019 London Trust Media Incorporated
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#line HEADER_FILE("asynccoroutine.h")
+
+#ifndef ASYNCCOROUTINE_H
+#define ASYNCCOROUTINE_H
+#pragma once
+
+#include "async.h"
+
+// Coroutine support for Async<T>.
+//
+// With a compiler that supports C++20 coroutines, a function returning
+// Async<T> can be written as a coroutine, and it can co_await other Asyncs:
+//
+//   Async<QJsonObject> loadInfo()
+//   {
+//       QJsonDocument doc = co_await fetchDocument();
+//       co_return doc.object();
+//   }
+//
+// - The coroutine starts running immediately when called, like an ordinary
+//   function returning an Async.
+// - co_await on a finished Async continues immediately; otherwise the
+//   coroutine is resumed when the awaited task finishes, on the thread of
+//   the coroutine's own task (the thread that called it).
+// - If the awaited task rejects, co_await throws its Error.  Errors and
+//   exceptions that escape the coroutine reject its task, like exceptions
+//   thrown in a then() callback.
+// - The coroutine frame belongs to its task - if the task is abandoned while
+//   the coroutine is suspended, the frame is destroyed and the coroutine is
+//   never resumed.
+//
+// Each co_await is just a connection to the awaited task's finished()
+// signal; there's no intermediate Task or closure for each step like a
+// then() chain has.
+//
+// ASYNC_COROUTINES is defined if coroutines are supported.  Until all
+// platforms build as C++20, code using this must also have a then()-based
+// implementation.  The asynccoroutine test is built as C++20 so this is
+// compiled and tested on all platforms in the meantime.
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+#if __has_include(<coroutine>)
+#define ASYNC_COROUTINES
+#endif
+#endif
+
+#ifdef ASYNC_COROUTINES
+
+#include <coroutine>
+#include <exception>
+
+namespace impl {
+
+    // The task returned by a coroutine; owns the coroutine frame while the
+    // coroutine is suspended
+    template<typename Result>
+    class CoroutineTask : public Task<Result>
+    {
+    public:
+        CoroutineTask() = default;
+        virtual ~CoroutineTask() override
+        {
+            // Abandoned while suspended - the coroutine will never resume
+            if (_handle)
+                _handle.destroy();
+        }
+
+        std::coroutine_handle<> _handle;
+    };
+
+    template<typename Result>
+    class AsyncPromiseBase
+    {
+    public:
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        // The frame is destroyed when the coroutine completes
+        std::suspend_never final_suspend() noexcept { return {}; }
+
+        void unhandled_exception()
+        {
+            auto keepAlive = finishTask();
+            GUARD_WITH(keepAlive->reject, throw);
+        }
+
+        CoroutineTask<Result>* task() const { return _pTask; }
+
+    protected:
+        template<class Promise>
+        Async<Result> createTask(Promise& promise)
+        {
+            auto task = Async<CoroutineTask<Result>>::create();
+            _pTask = task.get();
+            _pTask->_handle = std::coroutine_handle<Promise>::from_promise(promise);
+            return Async<Result>{QSharedPointer<Task<Result>>{std::move(task)}};
+        }
+
+        // The coroutine is finishing.  The task no longer owns the frame, and
+        // it's kept alive until it has been resolved or rejected.
+        QSharedPointer<Task<Result>> finishTask()
+        {
+            _pTask->_handle = {};
+            return _pTask->sharedFromThis();
+        }
+
+    private:
+        CoroutineTask<Result>* _pTask{nullptr};
+    };
+
+    template<typename Result>
+    class AsyncPromise : public AsyncPromiseBase<Result>
+    {
+    public:
+        Async<Result> get_return_object() { return this->createTask(*this); }
+        template<typename Value>
+        void return_value(Value&& value)
+        {
+            auto keepAlive = this->finishTask();
+            keepAlive->resolve(std::forward<Value>(value));
+        }
+    };
+
+    template<>
+    class AsyncPromise<void> : public AsyncPromiseBase<void>
+    {
+    public:
+        Async<void> get_return_object() { return this->createTask(*this); }
+        void return_void()
+        {
+            auto keepAlive = this->finishTask();
+            keepAlive->resolve();
+        }
+    };
+
+    template<typename Result>
+    class AsyncAwaiterBase
+    {
+    public:
+        explicit AsyncAwaiterBase(QSharedPointer<Task<Result>> task) : _task{std::move(task)} {}
+
+        bool await_ready() const { return _task->isFinished(); }
+
+        // Only coroutines returning Async can co_await an Async, the
+        // coroutine is resumed in the context of its own task.
+        template<typename Promise>
+        void await_suspend(std::coroutine_handle<Promise> handle)
+        {
+            // Note that if the awaited task finishes in the meantime, the
+            // coroutine may be resumed before this returns.
+            _task->notify(handle.promise().task(), [handle](auto&&...) { handle.resume(); });
+        }
+
+    protected:
+        void throwIfRejected() const
+        {
+            if (_task->isRejected())
+                throw _task->error();
+        }
+
+    protected:
+        QSharedPointer<Task<Result>> _task;
+    };
+
+    template<typename Result>
+    class AsyncAwaiter : public AsyncAwaiterBase<Result>
+    {
+    public:
+        using AsyncAwaiterBase<Result>::AsyncAwaiterBase;
+        Result await_resume() const
+        {
+            this->throwIfRejected();
+            return this->_task->result();
+        }
+    };
+
+    template<>
+    class AsyncAwaiter<void> : public AsyncAwaiterBase<void>
+    {
+    public:
+        using AsyncAwaiterBase<void>::AsyncAwaiterBase;
+        void await_resume() const { throwIfRejected(); }
+    };
+
+}
+
+namespace std {
+    template<typename Result, typename... Args>
+    struct coroutine_traits<Async<Result, Result, Task<Result>>, Args...>
+    {
+        using promise_type = impl::AsyncPromise<Result>;
+    };
+}
+
+template<typename Type, typename Result, class Class>
+inline impl::AsyncAwaiter<Result> operator co_await(const Async<Type, Result, Class>& task)
+{
+    return impl::AsyncAwaiter<Result>{task};
+}
+
+#endif // ASYNC_COROUTINES
+
+#endif
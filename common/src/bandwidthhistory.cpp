@@ -0,0 +1,167 @@
+// Copyright (c) 2019 London Trust Media Incorporated
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#line SOURCE_FILE("bandwidthhistory.cpp")
+
+#include "bandwidthhistory.h"
+
+namespace
+{
+    // Capacities - 30 minutes of measurements (OpenVPN reports every 5
+    // seconds), 12 hours of minutes, and a week of hours.
+    const std::array<std::size_t, BandwidthHistory::TierCount> bandwidthTierCapacity{{360, 720, 168}};
+}
+
+void BandwidthHistory::Ring::push(const Point &point)
+{
+    if(_count < _points.size())
+    {
+        _points[(_first + _count) % _points.size()] = point;
+        ++_count;
+    }
+    else
+    {
+        // Full - overwrite the oldest point
+        _points[_first] = point;
+        _first = (_first + 1) % _points.size();
+    }
+}
+
+qint64 BandwidthHistory::bucketMsec(Tier tier)
+{
+    switch(tier)
+    {
+        default:
+        case Measurements:
+            return 0;
+        case Minutes:
+            return 60 * 1000;
+        case Hours:
+            return 60 * 60 * 1000;
+    }
+}
+
+QString BandwidthHistory::tierName(Tier tier)
+{
+    switch(tier)
+    {
+        default:
+        case Measurements:
+            return QStringLiteral("measurements");
+        case Minutes:
+            return QStringLiteral("minutes");
+        case Hours:
+            return QStringLiteral("hours");
+    }
+}
+
+std::size_t BandwidthHistory::capacity(Tier tier)
+{
+    return bandwidthTierCapacity[tier];
+}
+
+BandwidthHistory::BandwidthHistory()
+    : _tiers{{Ring{bandwidthTierCapacity[Measurements]}, Ring{bandwidthTierCapacity[Minutes]},
+              Ring{bandwidthTierCapacity[Hours]}}},
+      _nextSeq{1}, _generation{0}
+{
+    for(auto &bucket : _buckets)
+        bucket = {-1, 0, 0};
+}
+
+void BandwidthHistory::commit(Tier tier, qint64 timestamp, quint64 received, quint64 sent)
+{
+    _tiers[tier].push({_nextSeq, timestamp, received, sent});
+    ++_nextSeq;
+}
+
+void BandwidthHistory::accumulate(Tier tier, qint64 timestamp, quint64 received, quint64 sent)
+{
+    Bucket &bucket = _buckets[tier];
+    qint64 index = timestamp / bucketMsec(tier);
+    // If this measurement is in a new bucket, the current one is complete.
+    // (If the clock somehow went backward, just keep adding to the current
+    // bucket.)
+    if(bucket.index >= 0 && index > bucket.index)
+    {
+        commit(tier, bucket.index * bucketMsec(tier), bucket.received, bucket.sent);
+        bucket = {-1, 0, 0};
+    }
+    if(bucket.index < 0)
+        bucket.index = index;
+    bucket.received += received;
+    bucket.sent += sent;
+}
+
+void BandwidthHistory::append(qint64 timestamp, quint64 received, quint64 sent)
+{
+    commit(Measurements, timestamp, received, sent);
+    accumulate(Minutes, timestamp, received, sent);
+    accumulate(Hours, timestamp, received, sent);
+}
+
+void BandwidthHistory::clear()
+{
+    for(auto &tier : _tiers)
+        tier.clear();
+    for(auto &bucket : _buckets)
+        bucket = {-1, 0, 0};
+    ++_generation;
+    // _nextSeq keeps counting, so sequence numbers are never reused
+}
+
+auto BandwidthHistory::lastSequences() const -> Sequences
+{
+    Sequences sequences{};
+    for(int tier = 0; tier < TierCount; ++tier)
+    {
+        const Ring &ring = _tiers[tier];
+        if(ring.size() > 0)
+            sequences[tier] = ring[ring.size()-1].seq;
+    }
+    return sequences;
+}
+
+QJsonObject BandwidthHistory::toJson(const Sequences &afterSeq) const
+{
+    QJsonObject json;
+    json.insert(QStringLiteral("generation"), static_cast<double>(_generation));
+    for(int tier = 0; tier < TierCount; ++tier)
+    {
+        const Ring &ring = _tiers[tier];
+        // Points are in sequence order, find the first new one from the end
+        std::size_t first = ring.size();
+        while(first > 0 && ring[first-1].seq > afterSeq[tier])
+            --first;
+
+        QJsonArray points;
+        for(std::size_t i = first; i < ring.size(); ++i)
+        {
+            const Point &point = ring[i];
+            points.push_back(QJsonObject{
+                {QStringLiteral("seq"), static_cast<double>(point.seq)},
+                {QStringLiteral("timestamp"), static_cast<double>(point.timestamp)},
+                {QStringLiteral("received"), static_cast<double>(point.received)},
+                {QStringLiteral("sent"), static_cast<double>(point.sent)}
+            });
+        }
+        json.insert(tierName(static_cast<Tier>(tier)), points);
+    }
+    return json;
+}
@@ -0,0 +1,144 @@
+// Copyright (c) 2019 London Trust Media Incorporated
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#line HEADER_FILE("bandwidthhistory.h")
+
+#ifndef BANDWIDTHHISTORY_H
+#define BANDWIDTHHISTORY_H
+#pragma once
+
+#include <QJsonArray>
+#include <QJsonObject>
+#include <array>
+#include <vector>
+
+// BandwidthHistory stores VPN throughput measurements at three resolutions,
+// each in a fixed-capacity ring buffer, so a long history can be kept without
+// unbounded memory:
+// - Measurements: one point per measurement, as they're reported (OpenVPN
+//   reports every 5 seconds)
+// - Minutes: measurements summed over 1-minute buckets
+// - Hours: measurements summed over 1-hour buckets
+//
+// Points are only ever appended to a tier (a minute or hour point is added
+// once its bucket is complete), and each point has a sequence number that
+// increases across the life of the history, so clients can be sent just the
+// points they don't have yet (see toJson()).
+//
+// clear() starts a new generation - clients replace their points when they
+// see a new generation.
+class COMMON_EXPORT BandwidthHistory
+{
+public:
+    enum Tier
+    {
+        Measurements,
+        Minutes,
+        Hours,
+        TierCount
+    };
+
+    struct Point
+    {
+        quint64 seq;
+        // Monotonic timestamp (ms) - time of the measurement for
+        // Measurements, or the start of the bucket for Minutes/Hours
+        qint64 timestamp;
+        // Bytes received and sent during this point
+        quint64 received, sent;
+    };
+
+    using Sequences = std::array<quint64, TierCount>;
+
+private:
+    // Fixed-capacity ring of points - the oldest point is overwritten when
+    // it's full.
+    class Ring
+    {
+    public:
+        explicit Ring(std::size_t capacity) : _points(capacity) {}
+
+        std::size_t size() const {return _count;}
+        std::size_t capacity() const {return _points.size();}
+        // Oldest point is at 0
+        const Point &operator[](std::size_t i) const
+        {
+            return _points[(_first + i) % _points.size()];
+        }
+        void push(const Point &point);
+        void clear() {_first = 0; _count = 0;}
+
+    private:
+        std::vector<Point> _points;
+        std::size_t _first{0}, _count{0};
+    };
+
+    // A bucket being accumulated for the Minutes or Hours tier
+    struct Bucket
+    {
+        qint64 index;   // timestamp / bucket length; -1 if empty
+        quint64 received, sent;
+    };
+
+public:
+    // Length of the Minutes and Hours buckets in milliseconds (0 for
+    // Measurements, which aren't bucketed)
+    static qint64 bucketMsec(Tier tier);
+    // Name of a tier in JSON
+    static QString tierName(Tier tier);
+    // Maximum number of points kept in each tier
+    static std::size_t capacity(Tier tier);
+
+public:
+    BandwidthHistory();
+
+public:
+    // Add a measurement taken at 'timestamp' (monotonic ms)
+    void append(qint64 timestamp, quint64 received, quint64 sent);
+    // Discard all points and start a new generation
+    void clear();
+
+    quint64 generation() const {return _generation;}
+    std::size_t size(Tier tier) const {return _tiers[tier].size();}
+    // Get a point; oldest is at 0
+    const Point &at(Tier tier, std::size_t i) const {return _tiers[tier][i];}
+    // Sequence number of the last point in each tier (0 if there haven't been
+    // any points yet)
+    Sequences lastSequences() const;
+
+    // Get the points after the given sequence numbers, as:
+    // {"generation": n, "measurements": [...], "minutes": [...], "hours": [...]}
+    // Each point is {"seq": n, "timestamp": ms, "received": n, "sent": n}.
+    // Pass {} to get all points.
+    QJsonObject toJson(const Sequences &afterSeq) const;
+
+private:
+    void commit(Tier tier, qint64 timestamp, quint64 received, quint64 sent);
+    void accumulate(Tier tier, qint64 timestamp, quint64 received, quint64 sent);
+
+private:
+    std::array<Ring, TierCount> _tiers;
+    // Buckets being accumulated for Minutes and Hours (Measurements isn't
+    // used)
+    std::array<Bucket, TierCount> _buckets;
+    quint64 _nextSeq;
+    quint64 _generation;
+};
+
+#endif
@@ -0,0 +1,294 @@
+// Copyright (c) 2019 London Trust Media Incorporated
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#line SOURCE_FILE("builtin/binarylog.cpp")
+
+#include "binarylog.h"
+
+#include <QDateTime>
+
+const QByteArray BinaryLog::fileMagic{"PIALOGB1"};
+
+bool BinaryLog::isBinaryLog(const QByteArray &data)
+{
+    return data.startsWith(fileMagic);
+}
+
+namespace
+{
+    void writeVarint(QByteArray &out, quint64 value)
+    {
+        while(value >= 0x80)
+        {
+            out.append(static_cast<char>((value & 0x7F) | 0x80));
+            value >>= 7;
+        }
+        out.append(static_cast<char>(value));
+    }
+
+    quint64 zigzag(qint64 value)
+    {
+        return (static_cast<quint64>(value) << 1) ^ static_cast<quint64>(value >> 63);
+    }
+
+    qint64 unzigzag(quint64 value)
+    {
+        return static_cast<qint64>(value >> 1) ^ -static_cast<qint64>(value & 1);
+    }
+
+    void writeString(QByteArray &out, const QByteArray &utf8)
+    {
+        writeVarint(out, static_cast<quint64>(utf8.size()));
+        out.append(utf8);
+    }
+
+    // Reads values from binary log data; any read past the end of the data
+    // sets the error flag and returns an empty value.
+    class BinaryLogReader
+    {
+    public:
+        BinaryLogReader(const QByteArray &data, int pos)
+            : _data{data}, _pos{pos}, _error{false}
+        {}
+
+    public:
+        bool atEnd() const {return _pos >= _data.size();}
+        bool error() const {return _error;}
+        int pos() const {return _pos;}
+
+        quint8 readByte()
+        {
+            if(atEnd())
+            {
+                _error = true;
+                return 0;
+            }
+            return static_cast<quint8>(_data[_pos++]);
+        }
+
+        quint64 readVarint()
+        {
+            quint64 value = 0;
+            for(int shift = 0; shift < 64; shift += 7)
+            {
+                quint8 byte = readByte();
+                if(_error)
+                    return 0;
+                value |= static_cast<quint64>(byte & 0x7F) << shift;
+                if(!(byte & 0x80))
+                    return value;
+            }
+            // Too long for 64 bits
+            _error = true;
+            return 0;
+        }
+
+        QByteArray readString()
+        {
+            quint64 length = readVarint();
+            if(_error || length > static_cast<quint64>(_data.size() - _pos))
+            {
+                _error = true;
+                return {};
+            }
+            QByteArray value = _data.mid(_pos, static_cast<int>(length));
+            _pos += static_cast<int>(length);
+            return value;
+        }
+
+    private:
+        const QByteArray &_data;
+        int _pos;
+        bool _error;
+    };
+
+    const char *binaryMsgTypeText(quint8 type)
+    {
+        switch(type)
+        {
+        case QtFatalMsg:    return "[fatal]";
+        case QtCriticalMsg: return "[critical]";
+        case QtWarningMsg:  return "[warning]";
+        case QtInfoMsg:     return "[info]";
+        case QtDebugMsg:    return "[debug]";
+        default:            return "[??]";
+        }
+    }
+}
+
+void BinaryLogEncoder::startSession(QByteArray &out, qint64 timeMs, const QString &version)
+{
+    _categories.clear();
+    _sites.clear();
+    _lastTimeMs = timeMs;
+
+    out.append(static_cast<char>(BinaryLog::Session));
+    writeVarint(out, static_cast<quint64>(timeMs));
+    writeString(out, version.toUtf8());
+}
+
+int BinaryLogEncoder::findSite(const char *category, const char *file, int line) const
+{
+    // Look up with raw data, nothing is allocated for known sites
+    SiteKey key{{QByteArray::fromRawData(category, static_cast<int>(qstrlen(category))),
+                 QByteArray::fromRawData(file, static_cast<int>(qstrlen(file)))},
+                line};
+    return _sites.value(key, -1);
+}
+
+int BinaryLogEncoder::defineSite(QByteArray &out, const char *category, const char *file,
+                                 int line, const QString &renderedFile)
+{
+    QByteArray categoryName{category};
+    auto itCategory = _categories.find(categoryName);
+    if(itCategory == _categories.end())
+    {
+        itCategory = _categories.insert(categoryName, _categories.size());
+        out.append(static_cast<char>(BinaryLog::Category));
+        writeVarint(out, static_cast<quint64>(itCategory.value()));
+        writeString(out, categoryName);
+    }
+
+    int siteId = _sites.size();
+    _sites.insert({{categoryName, QByteArray{file}}, line}, siteId);
+
+    out.append(static_cast<char>(BinaryLog::Site));
+    writeVarint(out, static_cast<quint64>(siteId));
+    writeVarint(out, static_cast<quint64>(itCategory.value()));
+    writeString(out, renderedFile.toUtf8());
+    writeVarint(out, static_cast<quint64>(line > 0 ? line : 0));
+    return siteId;
+}
+
+void BinaryLogEncoder::appendMessage(QByteArray &out, int siteId, qint64 timeMs,
+                                     quint8 type, quint16 tid, const QString &msg)
+{
+    out.append(static_cast<char>(BinaryLog::Message));
+    writeVarint(out, static_cast<quint64>(siteId));
+    out.append(static_cast<char>(type));
+    writeVarint(out, tid);
+    writeVarint(out, zigzag(timeMs - _lastTimeMs));
+    _lastTimeMs = timeMs;
+    writeVarint(out, 1);
+    out.append(static_cast<char>(BinaryLog::StringArg));
+    writeString(out, msg.toUtf8());
+}
+
+bool BinaryLogDecoder::decode(const QByteArray &data, QByteArray &text)
+{
+    if(!BinaryLog::isBinaryLog(data))
+        return false;
+
+    QHash<quint64, QByteArray> categories;
+    // Rendered "[category][file:line]" for each site
+    QHash<quint64, QByteArray> sites;
+    qint64 timeMs = 0;
+    bool anySession = false;
+
+    BinaryLogReader reader{data, BinaryLog::fileMagic.size()};
+    while(!reader.atEnd())
+    {
+        quint8 recordType = reader.readByte();
+        switch(recordType)
+        {
+        case BinaryLog::Session:
+        {
+            timeMs = static_cast<qint64>(reader.readVarint());
+            reader.readString();    // Version, not rendered
+            categories.clear();
+            sites.clear();
+            // The text log separates sessions with blank lines
+            if(anySession)
+                text.append("\n\n\n");
+            anySession = true;
+            break;
+        }
+        case BinaryLog::Category:
+        {
+            quint64 id = reader.readVarint();
+            categories.insert(id, reader.readString());
+            break;
+        }
+        case BinaryLog::Site:
+        {
+            quint64 id = reader.readVarint();
+            QByteArray category = categories.value(reader.readVarint());
+            QByteArray file = reader.readString();
+            quint64 line = reader.readVarint();
+
+            QByteArray siteText;
+            if(!category.isEmpty())
+                siteText += '[' + category + ']';
+            if(!file.isEmpty())
+            {
+                siteText += '[' + file;
+                if(line)
+                    siteText += ':' + QByteArray::number(line);
+                siteText += ']';
+            }
+            sites.insert(id, siteText);
+            break;
+        }
+        case BinaryLog::Message:
+        {
+            QByteArray siteText = sites.value(reader.readVarint());
+            quint8 type = reader.readByte();
+            quint64 tid = reader.readVarint();
+            timeMs += unzigzag(reader.readVarint());
+            quint64 argCount = reader.readVarint();
+
+            QByteArray msg;
+            for(quint64 i=0; i<argCount && !reader.error(); ++i)
+            {
+                if(i > 0)
+                    msg += ' ';
+                quint8 argType = reader.readByte();
+                if(argType == BinaryLog::StringArg)
+                    msg += reader.readString();
+                else
+                    return false;   // Unknown argument type, can't continue
+            }
+            if(reader.error())
+                return false;
+
+            QByteArray prefix = QDateTime::fromMSecsSinceEpoch(timeMs, Qt::UTC)
+                .toString(QStringLiteral("[yyyy-MM-dd hh:mm:ss.zzz]")).toLatin1();
+            prefix += '[' + QByteArray::number(tid, 16).rightJustified(4, '0') + ']';
+            prefix += siteText;
+            prefix += binaryMsgTypeText(type);
+
+            for(const auto &line : msg.split('\n'))
+            {
+                text += prefix;
+                text += ' ';
+                text += line;
+                text += '\n';
+            }
+            break;
+        }
+        default:
+            return false;
+        }
+
+        if(reader.error())
+            return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,128 @@
+// Copyright (c) 2019 London Trust Media Incorporated
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#line HEADER_FILE("builtin/binarylog.h")
+
+#ifndef BUILTIN_BINARYLOG_H
+#define BUILTIN_BINARYLOG_H
+#pragma once
+
+#include <QByteArray>
+#include <QHash>
+#include <QPair>
+#include <QString>
+
+// Binary log format
+//
+// When binary logging is enabled, the log file contains compact binary records
+// instead of formatted text.  The message prefix (timestamp, thread,
+// category, source location, type) is never rendered to text; categories and
+// source locations ("sites") are written once per session and referred to by
+// ID afterward, and timestamps are stored as deltas.  This is both smaller
+// and cheaper to write than the text format.  BinaryLogDecoder renders the
+// records back to exactly the text format written by the logger.
+//
+// The message text itself is not deferred - Qt's message handler only
+// receives the finished string, which was already formatted by QDebug on the
+// logging thread.  Each message is stored as a single StringArg; only the
+// prefix is saved by this format.
+//
+// A binary log file begins with BinaryLog::fileMagic, followed by records.
+// Each record begins with a one-byte RecordType.  All integers are unsigned
+// LEB128 varints unless noted; strings are a varint byte length followed by
+// UTF-8 data.
+//
+// - Session: start time (ms since epoch), version string.  Resets all IDs and
+//   the time base.  Each log session (and each generation after a rotation)
+//   begins with a session record.
+// - Category: ID, name
+// - Site: ID, category ID, file, line
+// - Message: site ID, message type, thread ID, time delta from the previous
+//   record (ms, zigzag-encoded), argument count, arguments.  Each argument is
+//   an ArgType byte followed by the value.  Arguments are rendered separated
+//   by spaces.  The encoder always writes one StringArg containing the
+//   formatted message; the count allows other argument types to be decoded
+//   if they're ever added.
+namespace BinaryLog
+{
+    // Identifies a binary log file
+    extern COMMON_EXPORT const QByteArray fileMagic;
+
+    enum RecordType : quint8
+    {
+        Session = 1,
+        Category = 2,
+        Site = 3,
+        Message = 4,
+    };
+
+    enum ArgType : quint8
+    {
+        StringArg = 1,
+    };
+
+    // Check whether data (the beginning of a file) is a binary log
+    COMMON_EXPORT bool isBinaryLog(const QByteArray &data);
+}
+
+// Encodes log records.  The encoder keeps track of the categories and sites
+// that have been written in the current session.
+class COMMON_EXPORT BinaryLogEncoder
+{
+public:
+    BinaryLogEncoder() : _lastTimeMs{0} {}
+
+public:
+    // Start a new session (at the beginning of a file, a new log session, or
+    // after rotating).  Resets all categories and sites.
+    void startSession(QByteArray &out, qint64 timeMs, const QString &version);
+
+    // Find a site that was already defined in this session, returns -1 if
+    // the site hasn't been defined yet.
+    int findSite(const char *category, const char *file, int line) const;
+
+    // Define a new site.  renderedFile is the file name as it should appear
+    // in the rendered log.  Returns the site ID.
+    int defineSite(QByteArray &out, const char *category, const char *file,
+                   int line, const QString &renderedFile);
+
+    // Append a message for a site defined in this session.
+    void appendMessage(QByteArray &out, int siteId, qint64 timeMs,
+                       quint8 type, quint16 tid, const QString &msg);
+
+private:
+    using SiteKey = QPair<QPair<QByteArray, QByteArray>, int>;
+
+    QHash<QByteArray, int> _categories;
+    QHash<SiteKey, int> _sites;
+    qint64 _lastTimeMs;
+};
+
+// Decodes binary logs to the text log format.
+class COMMON_EXPORT BinaryLogDecoder
+{
+public:
+    // Decode binary log data (beginning with BinaryLog::fileMagic) and append
+    // the rendered text to text.  If the data is malformed or truncated (such
+    // as a log that was being written when it was copied), the text decoded up
+    // to that point is kept, and this returns false.
+    static bool decode(const QByteArray &data, QByteArray &text);
+};
+
+#endif // BUILTIN_BINARYLOG_H
@@ -20,6 +20,7 @@
 #line SOURCE_FILE("builtin/logging.cpp")
 
 #include "logging.h"
+#include "binarylog.h"
 #include "error.h"
 #include "path.h"
 #include "util.h"
@@ -30,12 +31,19 @@
 #include <QDir>
 #include <QFile>
 #include <QFileSystemWatcher>
+#include <QHash>
 #include <QMutex>
 #include <QMutexLocker>
+#include <QRegularExpression>
 #include <QTextStream>
 #include <QThread>
+#include <QWaitCondition>
 
+#include <algorithm>
+#include <atomic>
 #include <cstdlib>
+#include <memory>
+#include <vector>
 
 
 #if defined(QT_DEBUG) && defined(Q_OS_WIN)
@@ -47,11 +55,372 @@ namespace
 {
     QMutex g_logMutex(QMutex::Recursive);
     QDateTime g_startTime;
+    qint64 g_startTimeMs = 0;
     bool g_logToStdErr = false;
 }
 
-// The log limit in bytes
-const qint64 logFileLimit = 4000000;
+// A message captured by the logging handler.  Everything needed to format the
+// message later is captured on the logging thread; formatting and writing
+// happen on the log writer thread.
+struct LogRecord
+{
+    LogRecord() : timeMs{0}, type{QtDebugMsg}, tid{0}, line{0}, category{}, file{} {}
+    LogRecord(QtMsgType type, const QMessageLogContext &context, const QString &msg);
+
+    // Time in milliseconds since the epoch (UTC)
+    qint64 timeMs;
+    QtMsgType type;
+    // Abbreviated thread ID
+    quint16 tid;
+    int line;
+    // The category and file name are copied - they're usually static strings,
+    // but QML messages and dynamic categories may not outlive the call.  They
+    // are truncated if they're too long.
+    char category[48];
+    char file[200];
+    QString msg;
+};
+
+LogRecord::LogRecord(QtMsgType type, const QMessageLogContext &context, const QString &msg)
+    : timeMs{QDateTime::currentMSecsSinceEpoch()}, type{type}, tid{0},
+      line{context.line}, category{}, file{}, msg{msg}
+{
+    auto threadId = reinterpret_cast<quintptr>(QThread::currentThreadId());
+    threadId ^= threadId >> 16;
+#if QT_POINTER_SIZE > 4
+    threadId ^= threadId >> 32;
+#endif
+    tid = static_cast<quint16>(threadId);
+
+    if(context.category)
+        qstrncpy(category, context.category, sizeof(category));
+    if(context.file)
+        qstrncpy(file, context.file, sizeof(file));
+}
+
+// Bounded multi-producer, single-consumer ring buffer of LogRecords.
+//
+// Producers claim a slot with a CAS on the enqueue position and publish it by
+// advancing the slot's sequence number, so logging threads never take a lock.
+// There's only one consumer at a time (AsyncLogWriter serializes draining), so
+// the dequeue position isn't atomic.
+class LogRingBuffer
+{
+public:
+    enum : std::size_t { Capacity = 2048 };
+
+private:
+    struct Slot
+    {
+        std::atomic<std::size_t> sequence;
+        LogRecord record;
+    };
+
+public:
+    LogRingBuffer()
+        : _slots{new Slot[Capacity]}, _enqueuePos{0}, _dequeuePos{0}
+    {
+        for(std::size_t i=0; i<Capacity; ++i)
+            _slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+public:
+    // Add a record - returns false if the buffer is full.  Thread-safe.
+    bool push(LogRecord &&record)
+    {
+        std::size_t pos = _enqueuePos.load(std::memory_order_relaxed);
+        Slot *pSlot;
+        while(true)
+        {
+            pSlot = &_slots[pos % Capacity];
+            std::size_t seq = pSlot->sequence.load(std::memory_order_acquire);
+            auto diff = static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos);
+            if(diff == 0)
+            {
+                if(_enqueuePos.compare_exchange_weak(pos, pos+1, std::memory_order_relaxed))
+                    break;
+            }
+            else if(diff < 0)
+                return false;   // Full
+            else
+                pos = _enqueuePos.load(std::memory_order_relaxed);
+        }
+
+        pSlot->record = std::move(record);
+        pSlot->sequence.store(pos+1, std::memory_order_release);
+        return true;
+    }
+
+    // Take the next record - returns false if the buffer is empty.  Only one
+    // thread may consume at a time.
+    bool pop(LogRecord &record)
+    {
+        Slot &slot = _slots[_dequeuePos % Capacity];
+        std::size_t seq = slot.sequence.load(std::memory_order_acquire);
+        if(seq != _dequeuePos+1)
+            return false;   // Empty (or the producer hasn't published it yet)
+
+        record = std::move(slot.record);
+        slot.sequence.store(_dequeuePos + Capacity, std::memory_order_release);
+        ++_dequeuePos;
+        return true;
+    }
+
+private:
+    std::unique_ptr<Slot[]> _slots;
+    std::atomic<std::size_t> _enqueuePos;
+    std::size_t _dequeuePos;
+};
+
+// Formats log records into the log file and debug output formats.  Caches the
+// formatted date/time for the current second, since consecutive messages are
+// almost always logged in the same second.
+class LogFormatter
+{
+public:
+    LogFormatter() : _cachedSecond{-1} {}
+
+public:
+    // Append the lines for a record in the log file format
+    void appendLogLines(const LogRecord &record, QString &lines);
+    // Append the lines for a record in the debug output format
+    void appendOutputLines(const LogRecord &record, QString &lines);
+
+private:
+    void appendLogFilePrefix(const LogRecord &record, QString &prefix);
+    void appendDebugOutputPrefix(const LogRecord &record, QString &prefix);
+
+private:
+    qint64 _cachedSecond;
+    QString _cachedSecondText;
+};
+
+// AsyncLogWriter formats and writes log records on a background thread.
+//
+// The logging handler just captures a LogRecord and pushes it into the ring
+// buffer.  The writer wakes up periodically, or when enough records are
+// pending, and writes everything queued as one batch with one flush.
+//
+// Logging threads never wait for the writer.  If the buffer is full, the
+// writer is woken and the message is dropped and counted; the writer logs how
+// many messages were dropped.
+//
+// Fatal messages are written synchronously - flushSync() drains the buffer on
+// the calling thread before the fatal message is written, so nothing queued
+// is lost when the process aborts.
+class AsyncLogWriter : public QThread
+{
+public:
+    // Maximum time records wait in the buffer before being written
+    enum : unsigned long { FlushIntervalMs = 200 };
+    // Wake the writer early when this many records are pending
+    enum : std::size_t { WakeThreshold = 256 };
+
+public:
+    AsyncLogWriter() : _running{false}, _stopping{false}, _suspended{false},
+                       _pending{0}, _dropped{0}, _reportedDropped{0} {}
+    ~AsyncLogWriter() override {stopWriter();}
+
+public:
+    void startWriter();
+    // Stop the writer thread after writing everything queued
+    void stopWriter();
+    // Queue a record.  Returns false if the writer isn't running, in which
+    // case the caller should write the record synchronously.
+    bool enqueue(LogRecord &&record);
+    // Write everything that's queued on the calling thread, followed by
+    // pRecord (if given).  Used for fatal messages and when the writer isn't
+    // running.
+    void flushSync(const LogRecord *pRecord);
+    // Suspend or resume writing on the writer thread.  While suspended,
+    // records stay in the buffer until flushSync() or until the writer is
+    // resumed.
+    void setSuspended(bool suspended);
+
+    quint64 dropped() const {return _dropped.load(std::memory_order_relaxed);}
+
+protected:
+    virtual void run() override;
+
+private:
+    // Drain the buffer and write it as one batch.  Caller must hold
+    // _drainMutex.
+    void drain(const LogRecord *pExtraRecord);
+    // Wake the writer thread.  The wake is signaled while holding _wakeMutex,
+    // so it can't be lost between the writer's check of _pending and its
+    // wait.
+    void wakeWriter();
+
+private:
+    LogRingBuffer _buffer;
+    LogFormatter _formatter;
+    // Records drained for the current batch; reused to avoid reallocating
+    std::vector<LogRecord> _batch;
+    std::atomic<bool> _running, _stopping, _suspended;
+    std::atomic<std::size_t> _pending;
+    std::atomic<quint64> _dropped;
+    // Number of drops already reported in the log; used by the drain thread
+    quint64 _reportedDropped;
+    // Held while draining and writing - only one thread consumes the buffer
+    // at a time, and the formatter's cache is protected by this too.
+    QMutex _drainMutex;
+    QMutex _wakeMutex;
+    QWaitCondition _wake;
+};
+
+// Per-category token-bucket rate limiting.
+//
+// Each rule limits a category (or categories matching a prefix ending in '*')
+// to a number of messages per interval - "openvpn.mgmt=100/10" allows bursts
+// of up to 100 messages, refilling at 10 messages per second.  Messages over
+// the limit are suppressed; the number suppressed is logged when the category
+// is allowed to log again, or every SummaryIntervalMs while it is throttled.
+// The writer thread also collects summaries that are due (and all pending
+// summaries when it stops), so counts aren't lost when a throttled category
+// goes quiet.
+//
+// Critical and fatal messages are never suppressed.
+//
+// This is checked on the logging thread before the message is queued, so
+// suppressed messages cost very little.  When no rules are set, this is just
+// an atomic load.
+class LogRateLimiter
+{
+public:
+    // Interval between summaries while a category is being throttled
+    enum : qint64 { SummaryIntervalMs = 10000 };
+
+    struct Rule
+    {
+        // Category name or prefix
+        QByteArray category;
+        bool prefix;
+        int messages;
+        int seconds;
+        QString text;
+    };
+
+public:
+    LogRateLimiter() : _enabled{false}, _suppressed{0} {}
+
+public:
+    // Parse a rule; returns false if it's not valid
+    static bool parseRule(const QString &text, Rule &rule);
+
+    void setRules(std::vector<Rule> rules);
+
+    // Check whether a record can be logged.  If a summary of suppressed
+    // messages should be logged, summaryRecord is filled in (otherwise its msg
+    // is left empty).
+    bool check(const LogRecord &record, LogRecord &summaryRecord);
+
+    // Append summaries for throttled categories that haven't been summarized
+    // for SummaryIntervalMs - or all categories with suppressed messages if
+    // 'all' is set.
+    void takeSummaries(qint64 timeMs, bool all, std::vector<LogRecord> &summaries);
+
+    quint64 suppressed() const {return _suppressed.load(std::memory_order_relaxed);}
+
+private:
+    struct Bucket
+    {
+        // Not limited if there's no matching rule
+        bool limited;
+        double capacity;
+        double refillPerMs;
+        double tokens;
+        qint64 lastRefillMs;
+        quint64 suppressed;
+        qint64 lastSummaryMs;
+        QString ruleText;
+    };
+
+    Bucket createBucket(const QByteArray &category, qint64 timeMs) const;
+    void fillSummary(const char *category, qint64 timeMs, Bucket &bucket,
+                     LogRecord &summaryRecord) const;
+
+private:
+    std::atomic<bool> _enabled;
+    std::atomic<quint64> _suppressed;
+    QMutex _mutex;
+    std::vector<Rule> _rules;
+    QHash<QByteArray, Bucket> _buckets;
+};
+
+namespace
+{
+    // Defined before g_logWriter - the writer is destroyed (and flushed)
+    // first.
+    LogRateLimiter g_logRateLimiter;
+    // Defined after the globals above, so it's destroyed (and flushed) before
+    // them.
+    AsyncLogWriter g_logWriter;
+}
+
+// The default log limit in bytes (see Logger::setLogLimits())
+const qint64 logFileLimit = 3000000;
+// The total size of the compressed log history in bytes (not including the
+// log file and old file).  The log file, old file, and history together stay
+// within the 8 MB used by the log and old files before history was kept.
+const qint64 logHistoryBudget = 2000000;
+// Suffix of compressed log history generations
+const QString logHistorySuffix = QStringLiteral(".z");
+// Suffix of a compressed generation that's still being written
+const QString logHistoryPartSuffix = QStringLiteral(".part");
+
+// Log history
+//
+// When the log file is rotated, the previous old file becomes a history
+// generation named "<log file>.<UTC timestamp>".  Generations are compressed
+// with qCompress() in the background (adding logHistorySuffix), and the oldest
+// ones are removed to keep the total within the budget.  Text logs
+// compress very well, so this keeps much more history than the old file alone.
+class LogHistory
+{
+public:
+    // Path for a new (uncompressed) generation of a log file
+    static QString newGenerationPath(const QString &logFilePath);
+    // All generations of a log file, newest first.  Includes generations that
+    // haven't been compressed yet.
+    static QStringList generations(const QString &logFilePath);
+    // Compress pending generations and remove the oldest generations that
+    // exceed the budget (in bytes).
+    static void archive(const QString &logFilePath, qint64 budget);
+    // Remove all generations
+    static void remove(const QString &logFilePath);
+};
+
+// Runs LogHistory::archive() on a background thread when the log is rotated.
+//
+// This thread doesn't log - the logger may be destroyed (holding g_logMutex)
+// while it's running.  Archiving is best-effort; anything left over is
+// retried on the next rotation or log session.
+class LogArchiveThread : public QThread
+{
+public:
+    LogArchiveThread(const QString &logFilePath)
+        : _logFilePath{logFilePath}, _budget{logHistoryBudget},
+          _requested{false}, _active{false}
+    {}
+    ~LogArchiveThread() override {cancel();}
+
+public:
+    // Archive the log history in the background
+    void archive();
+    // Cancel any further archiving and wait for the thread to finish
+    void cancel();
+    // Set the history budget used by the next archive pass
+    void setBudget(qint64 budget) {_budget.store(budget);}
+
+protected:
+    virtual void run() override;
+
+private:
+    const QString _logFilePath;
+    std::atomic<qint64> _budget;
+    QMutex _mutex;
+    bool _requested, _active;
+};
 
 class LoggerPrivate
 {
@@ -65,6 +434,12 @@ class LoggerPrivate
 
     QFile logFile;
     qint64 logSize;
+    // Size at which the log file is rotated
+    qint64 fileLimit;
+    // Whether the log file is written in the binary format (see binarylog.h)
+    bool binaryFormat;
+    BinaryLogEncoder encoder;
+    LogArchiveThread archiveThread;
     QStringList filters;
     QFileSystemWatcher watcher;
     Path logFilePath;
@@ -83,8 +458,14 @@ class LoggerPrivate
     void removeDebugFile();
     // Attempt to open the log file for writing
     bool openLogFile(bool newSession = true);
-    // Helper to write a pre-formatted chunk of lines to the log file
-    void writeToLogFile(const QString& lines);
+    // Move the log file to the old file.  Any existing old file is moved to
+    // the log history.  Returns false if the old file can't be replaced.
+    bool moveToOldFile();
+    // Format or encode a batch of records and write them to the log file
+    void writeRecordsToLogFile(const std::vector<LogRecord> &records, LogFormatter &formatter);
+    // Helper to write a chunk of formatted lines or binary records to the log
+    // file, rotating it if it's full
+    void writeToLogFile(const QByteArray &data);
 
     // Wipe log file and backup log file if exists
     void wipeLogFile();
@@ -119,10 +500,13 @@ void Logger::initialize(bool logToStdErr)
     g_logMutex.lock();
 
     g_startTime = QDateTime::currentDateTimeUtc();
+    g_startTimeMs = g_startTime.toMSecsSinceEpoch();
     g_logToStdErr = logToStdErr;
     qInstallMessageHandler(loggingHandler);
 
     g_logMutex.unlock();
+
+    g_logWriter.startWriter();
 }
 
 void Logger::enableStdErr(bool logToStdErr)
@@ -150,7 +534,74 @@ Logger::Logger(const Path &logFilePath)
 
 Logger::~Logger()
 {
+    // Write everything that's queued while we can still write to the file.
+    // Any messages logged after this are written synchronously.
+    g_logWriter.stopWriter();
+
+    QMutexLocker lock{&g_logMutex};
     delete d_ptr;
+    d_ptr = nullptr;
+}
+
+void Logger::setBinaryFormat(bool binaryFormat)
+{
+    Q_D(Logger);
+    QMutexLocker lock{&g_logMutex};
+    if(d->binaryFormat == binaryFormat)
+        return;
+
+    d->binaryFormat = binaryFormat;
+    // Reopen the log file in the new format (this moves the existing file to
+    // the old file, since it can't be appended to).
+    if(d->logFile.isOpen())
+    {
+        d->logFile.close();
+        d->openLogFile(false);
+    }
+    qInfo() << "Log file format is now" << (binaryFormat ? "binary" : "text");
+}
+
+void Logger::setLogLimits(qint64 fileLimit, qint64 historyBudget)
+{
+    Q_D(Logger);
+    QMutexLocker lock{&g_logMutex};
+    d->fileLimit = fileLimit;
+    d->archiveThread.setBudget(historyBudget);
+}
+
+void Logger::setRateLimits(const QStringList &rules)
+{
+    std::vector<LogRateLimiter::Rule> parsedRules;
+    parsedRules.reserve(rules.size());
+    for(const auto &ruleText : rules)
+    {
+        LogRateLimiter::Rule rule;
+        if(LogRateLimiter::parseRule(ruleText, rule))
+            parsedRules.push_back(std::move(rule));
+        else
+            qWarning() << "Ignoring invalid log rate limit rule:" << ruleText;
+    }
+    g_logRateLimiter.setRules(std::move(parsedRules));
+}
+
+quint64 Logger::suppressedMessages()
+{
+    return g_logRateLimiter.suppressed();
+}
+
+quint64 Logger::droppedMessages()
+{
+    return g_logWriter.dropped();
+}
+
+void Logger::flushPending()
+{
+    g_logWriter.flushSync(nullptr);
+}
+
+void Logger::suspendWriter(bool suspended)
+{
+    g_logWriter.setSuspended(suspended);
 }
 
 bool Logger::logToFile() const
@@ -227,6 +678,9 @@ void Logger::configure(bool logToFile, const QStringList& filters)
 LoggerPrivate::LoggerPrivate(Logger* logger, const Path &logFilePath)
     : q_ptr(logger)
     , logSize(0)
+    , fileLimit(logFileLimit)
+    , binaryFormat(false)
+    , archiveThread{logFilePath}
     , logFilePath{logFilePath}
 {
     QLoggingCategory::setFilterRules(disabledFilters + filters.join('\n'));
@@ -338,59 +792,151 @@ void LoggerPrivate::removeDebugFile()
     }
 }
 
+// Render a source file name as it appears in the log
+static QString renderFileName(const char* file)
+{
+    if (!file || !file[0])
+        return {};
+#ifdef QT_DEBUG
+    static QRegExp re("^(common|client|daemon)/src/");
+    return QDir(Path::SourceRootDir).relativeFilePath(QLatin1String(file)).replace(re, {});
+#else
+    return QLatin1String(file);
+#endif
+}
+
 bool LoggerPrivate::openLogFile(bool newSession)
 {
     logFile.setFileName(logFilePath);
-    if (logFile.open(QFile::WriteOnly | QFile::Append | QFile::Text))
+
+    // An existing log file can only be appended to in the same format.  When
+    // starting a new session, continue in the existing file's format - the
+    // format is configured later by setBinaryFormat(), which moves the file
+    // out of the way if it actually changed.  Otherwise, move it out of the
+    // way now.
+    if (logFile.size() > 0)
+    {
+        QFile existingFile{logFilePath};
+        if (existingFile.open(QFile::ReadOnly))
+        {
+            bool existingBinary = BinaryLog::isBinaryLog(existingFile.read(BinaryLog::fileMagic.size()));
+            existingFile.close();
+            if (newSession)
+                binaryFormat = existingBinary;
+            else if (existingBinary != binaryFormat)
+                moveToOldFile();
+        }
+    }
+
+    // Binary logs can't be opened in text mode, newlines would be translated
+    QIODevice::OpenMode openMode = QFile::WriteOnly | QFile::Append;
+    if (!binaryFormat)
+        openMode |= QFile::Text;
+
+    if (logFile.open(openMode))
     {
         logSize = logFile.size();
+        if (binaryFormat)
+        {
+            // Each file (including a new file after rotating) starts a new
+            // binary session, so it can be decoded on its own.
+            QByteArray header;
+            if (logSize == 0)
+                header = BinaryLog::fileMagic;
+            encoder.startSession(header, QDateTime::currentMSecsSinceEpoch(),
+                                 QStringLiteral(PIA_VERSION));
+            logFile.write(header);
+            logFile.flush();
+            logSize += header.size();
+        }
+        else if (newSession && logSize != 0)
+        {
+            logFile.write("\n\n\n");
+            logFile.flush();
+            logSize = logFile.size();
+        }
         if (newSession)
         {
-            if (logSize != 0)
-            {
-                {
-                    QTextStream s(&logFile);
-                    s << endl << endl << endl;
-                }
-                logSize = logFile.size();
-            }
             qInfo() << "Starting log session (v" PIA_VERSION ")";
+            // Finish archiving anything left over from the last session
+            archiveThread.archive();
         }
         return true;
     }
     return false;
 }
 
-void LoggerPrivate::writeToLogFile(const QString& lines)
+bool LoggerPrivate::moveToOldFile()
+{
+    Path oldFilePath = logFilePath + oldFileSuffix;
+    QFileInfo oldFileInfo(oldFilePath);
+
+    if(oldFileInfo.exists()) {
+        // Move the old file to the history to be compressed.  If that isn't
+        // possible, just replace it.
+        if(QFile::rename(oldFilePath, LogHistory::newGenerationPath(logFilePath))) {
+            archiveThread.archive();
+        }
+        else if(!oldFileInfo.isWritable() || !QFile::remove(oldFilePath)) {
+            return false;
+        }
+    }
+    // Copy the file to the old file
+    // This also automatically closes the old file
+    return logFile.rename(oldFilePath);
+}
+
+void LoggerPrivate::writeRecordsToLogFile(const std::vector<LogRecord> &records, LogFormatter &formatter)
+{
+    if (!logFile.isOpen())
+        return;
+
+    if (binaryFormat)
+    {
+        QByteArray data;
+        for (const auto &record : records)
+        {
+            int siteId = encoder.findSite(record.category, record.file, record.line);
+            if (siteId < 0)
+            {
+                siteId = encoder.defineSite(data, record.category, record.file,
+                                            record.line, renderFileName(record.file));
+            }
+            encoder.appendMessage(data, siteId, record.timeMs,
+                                  static_cast<quint8>(record.type), record.tid,
+                                  record.msg);
+        }
+        writeToLogFile(data);
+    }
+    else
+    {
+        QString lines;
+        for (const auto &record : records)
+            formatter.appendLogLines(record, lines);
+        writeToLogFile(lines.toUtf8());
+    }
+}
+
+void LoggerPrivate::writeToLogFile(const QByteArray &data)
 {
     if (logFile.isOpen())
     {
-        QTextStream(&logFile) << lines;
+        logFile.write(data);
         logFile.flush();
-        logSize += lines.size();
-
-        if(logSize > logFileLimit) {
-            Path oldFilePath = logFilePath + oldFileSuffix;
-            QFileInfo oldFileInfo(oldFilePath);
-
-            if(oldFileInfo.exists()) {
-                if(oldFileInfo.isWritable()) {
-                    QFile::remove(oldFilePath);
-                }
-                else {
-                    // If we cannot create a new backup file, or it cannot
-                    // be deleted, clear the existing file.
+        logSize += data.size();
+
+        if(logSize > fileLimit) {
+            // If the old file can't be replaced, move the log file directly to
+            // the history.  Only if that fails too, clear the existing file.
+            if(!moveToOldFile()) {
+                if(logFile.rename(LogHistory::newGenerationPath(logFilePath)))
+                    archiveThread.archive();
+                else
                     logFile.resize(0);
-                    logFile.seek(0);
-                    logSize = 0;
-                    return;
-                }
             }
-            // Copy the file to the old file
-            // This also automatically closes the old file
-            logFile.rename(oldFilePath);
 
             // Create and use a new log file
+            logFile.close();
             openLogFile(false);
         }
     }
@@ -409,144 +955,648 @@ void LoggerPrivate::wipeLogFile()
     if(QFile::exists(oldFilePath)) {
         QFile::remove(oldFilePath);
     }
+    archiveThread.cancel();
+    LogHistory::remove(logFilePath);
 }
 
+QString LogHistory::newGenerationPath(const QString &logFilePath)
+{
+    // If the log was rotated more than once in the same millisecond, use the
+    // next free timestamp so an existing generation isn't replaced
+    QDateTime time = QDateTime::currentDateTimeUtc();
+    QString path;
+    do
+    {
+        path = logFilePath + '.' + time.toString(QStringLiteral("yyyyMMdd-hhmmsszzz"));
+        time = time.addMSecs(1);
+    }
+    while(QFile::exists(path) || QFile::exists(path + logHistorySuffix));
+    return path;
+}
 
+QStringList LogHistory::generations(const QString &logFilePath)
+{
+    QFileInfo logFileInfo{logFilePath};
+    QDir logDir = logFileInfo.dir();
+    QRegularExpression generationRegex{QStringLiteral("^") +
+        QRegularExpression::escape(logFileInfo.fileName()) +
+        QStringLiteral("\\.\\d{8}-\\d{9}(") +
+        QRegularExpression::escape(logHistorySuffix) + QStringLiteral(")?$")};
+
+    // Sorting by name sorts by time, reverse it to get the newest first
+    const auto &entries = logDir.entryList({logFileInfo.fileName() + QStringLiteral(".*")},
+                                           QDir::Files, QDir::Name | QDir::Reversed);
+    QStringList result;
+    for(const auto &entry : entries)
+    {
+        if(!generationRegex.match(entry).hasMatch())
+            continue;
+        // If a generation was just compressed, the uncompressed file may
+        // still exist briefly, skip it.
+        if(!entry.endsWith(logHistorySuffix) && logDir.exists(entry + logHistorySuffix))
+            continue;
+        result.push_back(logDir.filePath(entry));
+    }
+    return result;
+}
 
-static void renderMsgType(QTextStream& s, QtMsgType type)
+void LogHistory::archive(const QString &logFilePath, qint64 budget)
 {
-    switch (type)
+    QFileInfo logFileInfo{logFilePath};
+    QDir logDir = logFileInfo.dir();
+
+    // Remove partial generations left over if archiving was interrupted
+    const auto &partials = logDir.entryList({logFileInfo.fileName() + QStringLiteral(".*") + logHistoryPartSuffix},
+                                            QDir::Files);
+    for(const auto &partial : partials)
+        logDir.remove(partial);
+
+    qint64 totalSize = 0;
+    bool overBudget = false;
+    for(QString generation : generations(logFilePath))
     {
-    case QtFatalMsg:    s << "[fatal]"; break;
-    case QtCriticalMsg: s << "[critical]"; break;
-    case QtWarningMsg:  s << "[warning]"; break;
-    case QtInfoMsg:     s << "[info]"; break;
-    case QtDebugMsg:    s << "[debug]"; break;
-    default:            s << "[??]"; break;
+        // Once the budget is reached, remove everything older
+        if(overBudget)
+        {
+            QFile::remove(generation);
+            continue;
+        }
+
+        if(!generation.endsWith(logHistorySuffix))
+        {
+            QFile pendingFile{generation};
+            if(!pendingFile.open(QFile::ReadOnly))
+                continue;
+            QByteArray compressed = qCompress(pendingFile.readAll(), 9);
+            pendingFile.close();
+
+            // Write to a partial file first so an interrupted write never
+            // leaves a corrupt generation
+            QString compressedPath = generation + logHistorySuffix;
+            QFile partFile{compressedPath + logHistoryPartSuffix};
+            if(!partFile.open(QFile::WriteOnly | QFile::Truncate) ||
+               partFile.write(compressed) != compressed.size())
+            {
+                partFile.remove();
+                continue;
+            }
+            partFile.close();
+            if(!partFile.rename(compressedPath))
+            {
+                partFile.remove();
+                continue;
+            }
+            pendingFile.remove();
+            generation = compressedPath;
+        }
+
+        qint64 size = QFileInfo{generation}.size();
+        if(totalSize + size > budget)
+        {
+            QFile::remove(generation);
+            overBudget = true;
+        }
+        else
+            totalSize += size;
     }
 }
 
-static void renderLocation(QTextStream& s, const char* file, int line)
+void LogHistory::remove(const QString &logFilePath)
+{
+    for(const auto &generation : generations(logFilePath))
+        QFile::remove(generation);
+}
+
+void LogArchiveThread::archive()
 {
-    if (file)
+    QMutexLocker lock{&_mutex};
+    _requested = true;
+    if(!_active)
     {
-        s << '[';
-    #ifdef QT_DEBUG
-        static QRegExp re("^(common|client|daemon)/src/");
-        s << QDir(Path::SourceRootDir).relativeFilePath(QLatin1String(file)).replace(re, {});
-    #else
-        s << QLatin1String(file);
-    #endif
-        if (line)
-            s << ':' << line;
-        s << ']';
+        _active = true;
+        // If the thread was finishing up its last run, wait for it to exit
+        // before restarting it.  It no longer needs _mutex at this point.
+        wait();
+        start(QThread::LowPriority);
     }
 }
 
-static QString buildLogFilePrefix(QDateTime now, QtMsgType type,
-                                  const QMessageLogContext &context)
+void LogArchiveThread::cancel()
 {
-    QString prefix;
-    QTextStream s(&prefix, QIODevice::WriteOnly);
+    {
+        QMutexLocker lock{&_mutex};
+        _requested = false;
+    }
+    wait();
+}
 
-    auto tid = reinterpret_cast<quintptr>(QThread::currentThreadId());
-    tid ^= tid >> 16;
-#if QT_POINTER_SIZE > 4
-    tid ^= tid >> 32;
-#endif
-    char tidHex[8];
-    std::sprintf(tidHex, "%04x", (quint16)tid);
+void LogArchiveThread::run()
+{
+    while(true)
+    {
+        {
+            QMutexLocker lock{&_mutex};
+            if(!_requested)
+            {
+                _active = false;
+                return;
+            }
+            _requested = false;
+        }
+        LogHistory::archive(_logFilePath, _budget.load());
+    }
+}
+
+QStringList Logger::logHistoryFiles(const QString &logFilePath)
+{
+    return LogHistory::generations(logFilePath);
+}
+
+QByteArray Logger::readLogHistoryFile(const QString &historyFilePath)
+{
+    QFile historyFile{historyFilePath};
+    if(!historyFile.open(QFile::ReadOnly))
+        return {};
+    // Generations that haven't been compressed yet are read as-is
+    if(!historyFilePath.endsWith(logHistorySuffix))
+        return historyFile.readAll();
+    return qUncompress(historyFile.readAll());
+}
 
-    s << now.toString("[yyyy-MM-dd hh:mm:ss.zzz]");
 
-    s << '[' << tidHex << ']';
-    if (context.category)
-        s << '[' << QLatin1String(context.category) << ']';
-    renderLocation(s, context.file, context.line);
-    renderMsgType(s, type);
 
-    return prefix;
+static QLatin1String msgTypeText(QtMsgType type)
+{
+    switch (type)
+    {
+    case QtFatalMsg:    return QLatin1String{"[fatal]"};
+    case QtCriticalMsg: return QLatin1String{"[critical]"};
+    case QtWarningMsg:  return QLatin1String{"[warning]"};
+    case QtInfoMsg:     return QLatin1String{"[info]"};
+    case QtDebugMsg:    return QLatin1String{"[debug]"};
+    default:            return QLatin1String{"[??]"};
+    }
 }
 
-static QString buildDebugOutputPrefix(QDateTime now, QtMsgType type,
-                                      const QMessageLogContext &context)
+static void renderLocation(QString& s, const char* file, int line)
 {
-    QString prefix;
-    QTextStream s{&prefix, QIODevice::WriteOnly};
+    if (file && file[0])
+    {
+        s += '[';
+        s += renderFileName(file);
+        if (line)
+        {
+            s += ':';
+            s += QString::number(line);
+        }
+        s += ']';
+    }
+}
+
+static void appendPadded(QString &s, qint64 value, int width)
+{
+    s += QString::number(value).rightJustified(width, '0');
+}
+
+void LogFormatter::appendLogFilePrefix(const LogRecord &record, QString &prefix)
+{
+    // Formatting the date is relatively expensive; reuse it for the same
+    // second.  (Times before the epoch don't occur in practice.)
+    qint64 second = record.timeMs / 1000;
+    if(second != _cachedSecond)
+    {
+        _cachedSecond = second;
+        _cachedSecondText = QDateTime::fromMSecsSinceEpoch(second * 1000, Qt::UTC)
+            .toString(QStringLiteral("[yyyy-MM-dd hh:mm:ss."));
+    }
+    prefix += _cachedSecondText;
+    appendPadded(prefix, record.timeMs % 1000, 3);
+    prefix += ']';
+
+    prefix += '[';
+    prefix += QString::number(record.tid, 16).rightJustified(4, '0');
+    prefix += ']';
+    if (record.category[0])
+    {
+        prefix += '[';
+        prefix += QLatin1String{record.category};
+        prefix += ']';
+    }
+    renderLocation(prefix, record.file, record.line);
+    prefix += msgTypeText(record.type);
+}
 
+void LogFormatter::appendDebugOutputPrefix(const LogRecord &record, QString &prefix)
+{
     // Log time since start of process instead of clock time
-    qint64 time = g_startTime.msecsTo(now);
+    qint64 time = record.timeMs - g_startTimeMs;
     int milliseconds = time % 1000; time /= 1000;
     int seconds = time % 60; time /= 60;
     int minutes = time % 60; time /= 60;
     int hours = time;
 
+    prefix += QLatin1String{"[+"};
     if (hours)
-        s << '[' << '+' << hours << ':' << right << qSetPadChar('0') << qSetFieldWidth(2) << minutes << qSetFieldWidth(0) << ':' << qSetFieldWidth(2) << seconds << qSetFieldWidth(0) << '.' << qSetFieldWidth(3) << milliseconds << reset << ']';
+    {
+        prefix += QString::number(hours);
+        prefix += ':';
+        appendPadded(prefix, minutes, 2);
+        prefix += ':';
+        appendPadded(prefix, seconds, 2);
+    }
     else if (minutes)
-        s << '[' << '+' << minutes << ':' << right << qSetPadChar('0') << qSetFieldWidth(2) << seconds << qSetFieldWidth(0) << '.' << qSetFieldWidth(3) << milliseconds << reset << ']';
+    {
+        prefix += QString::number(minutes);
+        prefix += ':';
+        appendPadded(prefix, seconds, 2);
+    }
     else
-        s << '[' << '+' << seconds << '.' << right << qSetPadChar('0') << qSetFieldWidth(3) << milliseconds << reset << ']';
+        prefix += QString::number(seconds);
+    prefix += '.';
+    appendPadded(prefix, milliseconds, 3);
+    prefix += ']';
 
-    if (context.category)
-        s << '[' << QLatin1String(context.category) << ']';
-    renderLocation(s, context.file, context.line);
-    renderMsgType(s, type);
+    if (record.category[0])
+    {
+        prefix += '[';
+        prefix += QLatin1String{record.category};
+        prefix += ']';
+    }
+    renderLocation(prefix, record.file, record.line);
+    prefix += msgTypeText(record.type);
+}
 
-    return prefix;
+void LogFormatter::appendLogLines(const LogRecord &record, QString &lines)
+{
+    QString prefix;
+    appendLogFilePrefix(record, prefix);
+    for (const auto& line : record.msg.splitRef('\n'))
+    {
+        lines += prefix;
+        lines += ' ';
+        lines += line;
+        lines += '\n';
+    }
 }
 
-void Logger::loggingHandler(QtMsgType type, const QMessageLogContext &context, const QString &msg)
+void LogFormatter::appendOutputLines(const LogRecord &record, QString &lines)
 {
-    // Override with simpler endl; gets converted by text file handling anyway
-    const char endl = '\n';
+    QString prefix;
+    appendDebugOutputPrefix(record, prefix);
+    for (const auto& line : record.msg.splitRef('\n'))
+    {
+        lines += prefix;
+        lines += ' ';
+        lines += line;
+        lines += '\n';
+    }
+}
 
-    QDateTime now{QDateTime::currentDateTimeUtc()};
-    QString logPrefix{buildLogFilePrefix(now, type, context)};
-    QString outputPrefix{buildDebugOutputPrefix(now, type, context)};
+void Logger::writeLogRecords(const std::vector<LogRecord> &records, LogFormatter &formatter)
+{
+    QMutexLocker lock{&g_logMutex};
 
-    QString logLines;
-    QString outputLines;
+    // Debug output is only formatted if it's going somewhere
+    bool toDebugger = false;
+#if defined(QT_DEBUG) && defined(Q_OS_WIN)
+    toDebugger = isDebuggerPresent();
+#endif
+    if (toDebugger || g_logToStdErr)
     {
-        QTextStream logStream(&logLines, QIODevice::WriteOnly);
-        QTextStream outputStream(&outputLines, QIODevice::WriteOnly);
-        for (const auto& line : msg.splitRef('\n'))
+        QString outputLines;
+        for (const auto &record : records)
+            formatter.appendOutputLines(record, outputLines);
+#if defined(QT_DEBUG) && defined(Q_OS_WIN)
+        if (toDebugger)
         {
-            logStream << logPrefix << ' ' << line << endl;
-            outputStream << outputPrefix << ' ' << line << endl;
+            ::OutputDebugStringW(qUtf16Printable(outputLines));
+        }
+        else
+#endif
+        {
+            QTextStream(stderr, QIODevice::WriteOnly) << outputLines;
         }
     }
 
     Logger* self = Logger::instance();
     LoggerPrivate* const d = self ? self->d_func() : nullptr;
+    if (d)
+        d->writeRecordsToLogFile(records, formatter);
+}
 
-    g_logMutex.lock();
+bool LogRateLimiter::parseRule(const QString &text, Rule &rule)
+{
+    // <category>=<messages>/<seconds>
+    static const QRegularExpression ruleRegex{QStringLiteral("^\\s*([^=\\s]+)\\s*=\\s*(\\d+)\\s*/\\s*(\\d+)\\s*$")};
+    auto match = ruleRegex.match(text);
+    if(!match.hasMatch())
+        return false;
+
+    QString category = match.captured(1);
+    rule.prefix = category.endsWith('*');
+    if(rule.prefix)
+        category.chop(1);
+    // Only a trailing wildcard is supported
+    if(category.contains('*'))
+        return false;
+    rule.category = category.toLatin1();
+    rule.messages = match.capturedRef(2).toInt();
+    rule.seconds = match.capturedRef(3).toInt();
+    rule.text = text.trimmed();
+    return rule.messages > 0 && rule.seconds > 0;
+}
 
-#if defined(QT_DEBUG) && defined(Q_OS_WIN)
-    if (isDebuggerPresent())
+void LogRateLimiter::setRules(std::vector<Rule> rules)
+{
+    QMutexLocker lock{&_mutex};
+    _rules = std::move(rules);
+    _buckets.clear();
+    _enabled.store(!_rules.empty(), std::memory_order_relaxed);
+}
+
+LogRateLimiter::Bucket LogRateLimiter::createBucket(const QByteArray &category, qint64 timeMs) const
+{
+    Bucket bucket{};
+    bucket.limited = false;
+    // Like filter rules, the last matching rule applies
+    for(const auto &rule : _rules)
     {
-        ::OutputDebugStringW(qUtf16Printable(outputLines));
+        if(rule.prefix ? category.startsWith(rule.category) : category == rule.category)
+        {
+            bucket.limited = true;
+            bucket.capacity = rule.messages;
+            bucket.refillPerMs = static_cast<double>(rule.messages) / (rule.seconds * 1000.0);
+            bucket.ruleText = rule.text;
+        }
     }
-    else
-#endif
+    bucket.tokens = bucket.capacity;
+    bucket.lastRefillMs = timeMs;
+    bucket.lastSummaryMs = timeMs;
+    return bucket;
+}
+
+void LogRateLimiter::fillSummary(const char *category, qint64 timeMs,
+                                 Bucket &bucket, LogRecord &summaryRecord) const
+{
+    summaryRecord.timeMs = timeMs;
+    summaryRecord.type = QtWarningMsg;
+    qstrncpy(summaryRecord.category, category, sizeof(summaryRecord.category));
+    summaryRecord.msg = QStringLiteral("%1 messages suppressed by rate limit %2")
+        .arg(bucket.suppressed).arg(bucket.ruleText);
+    bucket.suppressed = 0;
+    bucket.lastSummaryMs = timeMs;
+}
+
+bool LogRateLimiter::check(const LogRecord &record, LogRecord &summaryRecord)
+{
+    if(!_enabled.load(std::memory_order_relaxed))
+        return true;
+
+    QMutexLocker lock{&_mutex};
+
+    // Look up without allocating; only new categories allocate a key
+    QByteArray category = QByteArray::fromRawData(record.category,
+                                                  static_cast<int>(qstrlen(record.category)));
+    auto itBucket = _buckets.find(category);
+    if(itBucket == _buckets.end())
     {
-        if(g_logToStdErr)
-            QTextStream(stderr, QIODevice::WriteOnly) << outputLines;
+        QByteArray key{record.category};
+        itBucket = _buckets.insert(key, createBucket(key, record.timeMs));
     }
-    if (d)
+    Bucket &bucket = itBucket.value();
+    if(!bucket.limited)
+        return true;
+
+    // Refill the bucket for the time elapsed.  (If the clock went backward,
+    // just wait for it to catch up.)
+    if(record.timeMs > bucket.lastRefillMs)
     {
-        d->writeToLogFile(logLines);
+        bucket.tokens = std::min(bucket.capacity,
+                                 bucket.tokens + (record.timeMs - bucket.lastRefillMs) * bucket.refillPerMs);
+        bucket.lastRefillMs = record.timeMs;
     }
 
-    g_logMutex.unlock();
+    // Critical and fatal messages are always logged, they don't consume
+    // tokens
+    bool allowed = true;
+    if(record.type != QtCriticalMsg && record.type != QtFatalMsg)
+    {
+        if(bucket.tokens >= 1.0)
+            bucket.tokens -= 1.0;
+        else
+            allowed = false;
+    }
+
+    if(!allowed)
+    {
+        ++bucket.suppressed;
+        _suppressed.fetch_add(1, std::memory_order_relaxed);
+        // Summarize periodically while throttled
+        if(record.timeMs - bucket.lastSummaryMs >= SummaryIntervalMs)
+            fillSummary(record.category, record.timeMs, bucket, summaryRecord);
+    }
+    else if(bucket.suppressed)
+    {
+        // The category can log again, summarize what was suppressed first
+        fillSummary(record.category, record.timeMs, bucket, summaryRecord);
+    }
+    if(!summaryRecord.msg.isEmpty())
+        summaryRecord.tid = record.tid;
+
+    return allowed;
+}
+
+void LogRateLimiter::takeSummaries(qint64 timeMs, bool all,
+                                   std::vector<LogRecord> &summaries)
+{
+    if(!_enabled.load(std::memory_order_relaxed))
+        return;
+
+    QMutexLocker lock{&_mutex};
+    for(auto itBucket = _buckets.begin(); itBucket != _buckets.end(); ++itBucket)
+    {
+        Bucket &bucket = itBucket.value();
+        if(!bucket.suppressed)
+            continue;
+        if(all || timeMs - bucket.lastSummaryMs >= SummaryIntervalMs)
+        {
+            LogRecord summaryRecord;
+            fillSummary(itBucket.key().constData(), timeMs, bucket, summaryRecord);
+            summaries.push_back(std::move(summaryRecord));
+        }
+    }
+}
+
+void AsyncLogWriter::startWriter()
+{
+    if(_running.load())
+        return;
+    _stopping.store(false);
+    _running.store(true);
+    start();
+}
+
+void AsyncLogWriter::stopWriter()
+{
+    if(!_running.load())
+        return;
+
+    {
+        QMutexLocker lock{&_wakeMutex};
+        _stopping.store(true);
+        _wake.wakeAll();
+    }
+    wait();
+    // Messages logged from now on are written synchronously.  Anything that
+    // was queued while stopping is written by flushSync() on the next message
+    // (or here).
+    _running.store(false);
+    flushSync(nullptr);
+}
+
+bool AsyncLogWriter::enqueue(LogRecord &&record)
+{
+    if(!_running.load(std::memory_order_acquire))
+        return false;
+
+    if(!_buffer.push(std::move(record)))
+    {
+        // The buffer is full - drop the message rather than blocking the
+        // logging thread, and make sure the writer is awake to catch up.
+        _dropped.fetch_add(1, std::memory_order_relaxed);
+        wakeWriter();
+        return true;
+    }
+
+    if(_pending.fetch_add(1, std::memory_order_relaxed) + 1 == WakeThreshold)
+        wakeWriter();
+    return true;
+}
+
+void AsyncLogWriter::setSuspended(bool suspended)
+{
+    _suspended.store(suspended);
+    if(!suspended)
+        wakeWriter();
+}
+
+void AsyncLogWriter::wakeWriter()
+{
+    QMutexLocker lock{&_wakeMutex};
+    _wake.wakeOne();
+}
+
+void AsyncLogWriter::flushSync(const LogRecord *pRecord)
+{
+    // Don't wait forever - a fatal message logged by a thread that holds
+    // g_logMutex could otherwise deadlock with the writer.  In that case, the
+    // message is still written below without draining the buffer.
+    if(_drainMutex.tryLock(1000))
+    {
+        drain(pRecord);
+        _drainMutex.unlock();
+    }
+    else if(pRecord)
+    {
+        LogFormatter formatter;
+        Logger::writeLogRecords({*pRecord}, formatter);
+    }
+}
+
+void AsyncLogWriter::drain(const LogRecord *pExtraRecord)
+{
+    LogRecord record;
+    while(_buffer.pop(record))
+        _batch.push_back(std::move(record));
+    _pending.fetch_sub(_batch.size(), std::memory_order_relaxed);
+
+    quint64 dropped = _dropped.load(std::memory_order_relaxed);
+    if(dropped != _reportedDropped)
+    {
+        LogRecord dropRecord;
+        dropRecord.timeMs = QDateTime::currentMSecsSinceEpoch();
+        dropRecord.type = QtWarningMsg;
+        qstrncpy(dropRecord.category, "logger", sizeof(dropRecord.category));
+        dropRecord.msg = QStringLiteral("Log buffer full, dropped %1 messages (%2 total)")
+            .arg(dropped - _reportedDropped).arg(dropped);
+        _batch.push_back(std::move(dropRecord));
+        _reportedDropped = dropped;
+    }
+
+    // Summarize rate-limited categories that have gone quiet; when stopping,
+    // write all pending summaries.
+    g_logRateLimiter.takeSummaries(QDateTime::currentMSecsSinceEpoch(),
+                                   _stopping.load(), _batch);
+
+    if(pExtraRecord)
+        _batch.push_back(*pExtraRecord);
+
+    if(!_batch.empty())
+        Logger::writeLogRecords(_batch, _formatter);
+    _batch.clear();
+}
+
+void AsyncLogWriter::run()
+{
+    while(true)
+    {
+        bool stopping;
+        {
+            QMutexLocker lock{&_wakeMutex};
+            stopping = _stopping.load();
+            if(!stopping && (_suspended.load() ||
+                             _pending.load(std::memory_order_relaxed) < WakeThreshold))
+            {
+                _wake.wait(&_wakeMutex, FlushIntervalMs);
+            }
+            stopping = _stopping.load();
+        }
+
+        // Everything is still written when stopping, even if suspended
+        if(!stopping && _suspended.load())
+            continue;
+
+        {
+            QMutexLocker lock{&_drainMutex};
+            drain(nullptr);
+        }
+
+        if(stopping)
+            break;
+    }
+}
+
+void Logger::loggingHandler(QtMsgType type, const QMessageLogContext &context, const QString &msg)
+{
+    // Failure to queue arguments is a programming error (and hard to debug).
+    // This message is written synchronously, then asserted below.
+    bool queueArgsFailure = msg.startsWith("QObject::connect: Cannot queue arguments of type");
+
+    LogRecord record{type, context, msg};
+
+    LogRecord summaryRecord;
+    bool allowed = g_logRateLimiter.check(record, summaryRecord);
+    if (!summaryRecord.msg.isEmpty() && !g_logWriter.enqueue(std::move(summaryRecord)))
+        g_logWriter.flushSync(&summaryRecord);
+    if (!allowed)
+        return;
+
+    if (type != QtFatalMsg && !queueArgsFailure && g_logWriter.enqueue(std::move(record)))
+        return;
+
+    // Fatal message, the writer isn't running, or we're about to assert -
+    // write everything queued and this message synchronously.
+    g_logWriter.flushSync(&record);
 
-    // Failure to queue arguments is a programming error (and hard to debug),
-    // assert to provide a way to debug it.
-    Q_ASSERT(!msg.startsWith("QObject::connect: Cannot queue arguments of type"));
+    // Assert to provide a way to debug the queued argument failure, now that
+    // the message has been written.
+    Q_ASSERT(!queueArgsFailure);
 
     if (type == QtFatalMsg)
     {
         // One last extra attempt to ensure file data is flushed
+        Logger* self = Logger::instance();
+        LoggerPrivate* const d = self ? self->d_func() : nullptr;
         if (d) d->logFile.close();
         // Abort - treat this as an unclean exit.  Also gives a chance to debug
         // in debug builds (this is how failed asserts are handled).
@@ -30,6 +30,7 @@
 #include <QString>
 #include <iostream>
 #include <QDebug>
+#include <vector>
 
 struct COMMON_EXPORT CodeLocation
 {
@@ -224,6 +225,8 @@ template<typename... Args> static inline const QLoggingCategory& currentLoggingC
 
 class Path;
 class LoggerPrivate;
+struct LogRecord;
+class LogFormatter;
 
 class COMMON_EXPORT Logger;
 // See Singleton - CRTP template with static member in dynamic lib
@@ -266,10 +269,48 @@ public:
     void wipeLogFile ();
 
     Q_SLOT void configure(bool logToFile, const QStringList& filters);
+    // Write the log file in the compact binary format (see binarylog.h)
+    // instead of text.  The existing log file is moved to the old file when
+    // this changes, since it can't be appended to in a different format.
+    Q_SLOT void setBinaryFormat(bool binaryFormat);
+    // Set per-category rate limits - each rule is "<category>=<messages>/<seconds>",
+    // the category may end with '*' to match a prefix.  Messages over the
+    // limit are suppressed and counted, critical and fatal messages are never
+    // suppressed.  Invalid rules are ignored.
+    Q_SLOT void setRateLimits(const QStringList &rules);
     Q_SIGNAL void configurationChanged(bool logToFile, const QStringList& filters);
 
+    // Log messages are written asynchronously by a background thread.  This
+    // counts messages that were dropped because the writer couldn't keep up.
+    static quint64 droppedMessages();
+    // Write everything queued for the background writer now, on the calling
+    // thread.  Used by the crash handler so the messages leading up to a
+    // crash aren't lost.
+    static void flushPending();
+    // Hold queued messages in the buffer instead of writing them in the
+    // background, until resumed or flushPending() is called.  Used by the unit
+    // tests to control when messages are written.
+    static void suspendWriter(bool suspended);
+    // Number of messages suppressed by rate limits
+    static quint64 suppressedMessages();
+
+    // When the log file is rotated, the previous old file is compressed and
+    // kept as history, up to a total size budget.  Get the history files for a
+    // log file (newest first), and read a history file (decompressing it if
+    // needed).  Returns an empty array if the file can't be read.
+    static QStringList logHistoryFiles(const QString &logFilePath);
+    static QByteArray readLogHistoryFile(const QString &historyFilePath);
+    // Set the size at which the log file is rotated and the total size of the
+    // compressed history, in bytes.  The defaults are 3 MB and 2 MB; the unit
+    // tests use small limits to rotate the log quickly.
+    void setLogLimits(qint64 fileLimit, qint64 historyBudget);
+
 private:
+    friend class AsyncLogWriter;
+
     static void loggingHandler(QtMsgType type, const QMessageLogContext &context, const QString &msg);
+    // Write a batch of records to the debug output and log file
+    static void writeLogRecords(const std::vector<LogRecord> &records, LogFormatter &formatter);
 };
 
 #define g_logger (Logger::instance())
@@ -22,6 +22,7 @@
 #include "util.h"
 #include "error.h"
 #include "path.h"
+#include "logging.h"
 
 #ifdef PIA_CRASH_REPORTING
 #if defined(Q_OS_MACOS)
@@ -170,6 +171,8 @@ void setUtf8LocaleCodec()
 // - If the daemon is crashing, we might safely be able to write diagnostics,
 //   but there's currently no way to communicate the result to the client, which
 //   would actually start the support tool.
+// They do flush the log writer's queue, so the messages leading up to the
+// crash (and the dump path) are in the log file.
 #if defined(Q_OS_MAC)
 bool DumpCallback(const char *dump_dir,
                   const char *minidump_id,
@@ -178,7 +181,7 @@ bool DumpCallback(const char *dump_dir,
 
     QString path = QString::fromUtf8(dump_dir) + QLatin1String("/") + QString::fromUtf8(minidump_id) + ".dmp";
     qDebug("%s, dump path: %s\n", succeeded ? "Succeed to write minidump" : "Failed to write minidump", qPrintable(path));
-
+    Logger::flushPending();
 
     if(succeeded) {
 #ifdef PIA_CLIENT
@@ -204,6 +207,7 @@ bool DumpCallback(const wchar_t* dump_dir,
 
     QString path = QString::fromWCharArray(dump_dir) + QLatin1String("/") + QString::fromWCharArray(minidump_id) + ".dmp";
     qDebug("%s, dump path: %s\n", succeeded ? "Succeed to write minidump" : "Failed to write minidump", qPrintable(path));
+    Logger::flushPending();
 
     if(succeeded) {
         startSupportTool("crash", {});
@@ -216,6 +220,7 @@ bool DumpCallback(const google_breakpad::MinidumpDescriptor& descriptor,
                                     void* context,
                   bool succeeded) {
     qDebug("%s, dump path: %s\n", succeeded ? "Succeed to write minidump" : "Failed to write minidump", descriptor.path());
+    Logger::flushPending();
 
     if(succeeded) {
 #if defined(PIA_DAEMON)
@@ -21,10 +21,20 @@
 
 #include "jsonrefresher.h"
 #include "networktaskwithretry.h"
+#include "networkpool.h"
 #include "openssl.h"
+#include <QCryptographicHash>
 #include <QNetworkReply>
 #include <QDir>
 
+namespace
+{
+    // Properties of the validator object (see JsonRefresher::validator())
+    const QString validatorEtag{QStringLiteral("etag")};
+    const QString validatorLastModified{QStringLiteral("lastModified")};
+    const QString validatorSha256{QStringLiteral("sha256")};
+}
+
 JsonRefresher::JsonRefresher(QString name, ApiBase &apiBaseUris,
                              QString resource,
                              std::chrono::milliseconds initialInterval,
@@ -34,8 +44,8 @@ JsonRefresher::JsonRefresher(QString name, ApiBase &apiBaseUris,
       _resource{std::move(resource)},
       _initialInterval{std::move(initialInterval)},
       _refreshInterval{std::move(refreshInterval)},
-      _pNetworkManager{TestShim::create<QNetworkAccessManager>()},
-      _signatureKey{std::move(signatureKey)}
+      _pNetworkManager{NetworkPool::get()}, _pWorkerPool{nullptr},
+      _signatureKey{std::move(signatureKey)}, _parseJson{true}
 {
     connect(&_refreshTimer, &QTimer::timeout, this,
             &JsonRefresher::refreshTimerElapsed);
@@ -54,19 +64,34 @@ void JsonRefresher::refreshTimerElapsed()
         return;
     }
 
+    // If content has been loaded, only fetch it if it has changed.
+    NetworkTaskWithRetry::RawHeaders conditionalHeaders;
+    QByteArray etag = _validator.value(validatorEtag).toString().toLatin1();
+    QByteArray lastModified = _validator.value(validatorLastModified).toString().toLatin1();
+    if(!etag.isEmpty())
+        conditionalHeaders.push_back({QByteArrayLiteral("If-None-Match"), etag});
+    if(!lastModified.isEmpty())
+        conditionalHeaders.push_back({QByteArrayLiteral("If-Modified-Since"), lastModified});
+
+    // Hold the current shared manager so its connections can be reused by the
+    // next refresh
+    _pNetworkManager = NetworkPool::get();
+
     // Fetch the resource.  Try each possible base URI one time.
-    Async<QByteArray> pBodyTask = Async<QByteArray>{new NetworkTaskWithRetry{
-                                        QNetworkAccessManager::GetOperation,
-                                        _apiBaseUris, _resource,
-                                        ApiRetries::counted(_apiBaseUris.getUriCount()),
-                                        {}, {}, _pNetworkManager}};
+    auto pBodyTask = Async<NetworkTaskWithRetry>::create(QNetworkAccessManager::GetOperation,
+                                                         _apiBaseUris, _resource,
+                                                         ApiRetries::counted(_apiBaseUris.getUriCount()),
+                                                         QJsonDocument{}, QByteArray{},
+                                                         std::move(conditionalHeaders));
+    // The task is still alive when it invokes the callback below
+    const NetworkTaskWithRetry *pRequest = pBodyTask.get();
     // Use next() instead of notify() so we can abandon the task (if the
     // JsonRefresher is stopped) by dropping our reference to the outermost
     // task.
     // Note that the stored task refers to the void result of our callback, not
     // to the QByteArray result of the body task.
     _pFetchTask = pBodyTask->next(this,
-            [this](const Error& error, const QByteArray& body)
+            [this, pRequest](const Error& error, const QByteArray& body)
             {
                 // We shouldn't get this signal if we're not running; we abandon
                 // tasks when stopped.
@@ -84,13 +109,59 @@ void JsonRefresher::refreshTimerElapsed()
                 }
                 else
                 {
-                    emitReply(body);
+                    handleReply(*pRequest, body);
                 }
             });
 }
 
-QJsonDocument JsonRefresher::readReply(QByteArray responsePayload) const
+void JsonRefresher::handleReply(const NetworkTaskWithRetry &request,
+                                QByteArray responsePayload)
+{
+    if(request.replyStatus() == 304)
+    {
+        // We only send conditional requests when we have a validator, but
+        // check in case it was cleared while the request was in progress
+        if(_validator.isEmpty())
+        {
+            qWarning() << "Received unexpected 304 response for" << _name;
+            return;
+        }
+        qInfo() << _name << "has not been modified";
+        _pendingValidator = {};
+        loadSucceeded();
+        return;
+    }
+
+    QJsonObject validator
+    {
+        {validatorEtag, QString::fromLatin1(request.replyHeader(QByteArrayLiteral("ETag")))},
+        {validatorLastModified, QString::fromLatin1(request.replyHeader(QByteArrayLiteral("Last-Modified")))},
+        {validatorSha256, QString::fromLatin1(QCryptographicHash::hash(responsePayload, QCryptographicHash::Sha256).toHex())}
+    };
+
+    // The server might not support conditional requests, or the content might
+    // be served from a different API base.  If the content is identical to the
+    // last content loaded, there's no need to verify and parse it again.
+    if(!_validator.isEmpty() &&
+       validator.value(validatorSha256) == _validator.value(validatorSha256))
+    {
+        qInfo() << _name << "is unchanged";
+        // Store the new ETag/Last-Modified time if they're different
+        _pendingValidator = validator;
+        loadSucceeded();
+        return;
+    }
+
+    emitReply(std::move(responsePayload), std::move(validator));
+}
+
+auto JsonRefresher::verifyReply(const QString &name,
+                                const QByteArray &signatureKey,
+                                bool parseJson, QByteArray responsePayload)
+    -> VerifiedReply
 {
+    VerifiedReply result{false, {}, {}};
+
     // The response can optionally contain a GPG signature appended to the
     // end after a double newline. If one exists, verify that it matches
     // the supplied public key. For additional robustness though, we actually
@@ -105,58 +176,107 @@ QJsonDocument JsonRefresher::readReply(QByteArray responsePayload) const
         if (end >= 0 && end != responsePayload.length() - 1)
         {
             if (end + 2 >= responsePayload.length() || responsePayload.at(end + 1) != '\n' || responsePayload.at(end + 2) != '\n')
-                qWarning() << "Nonstandard appended data found after JSON response for" << _name;
+                qWarning() << "Nonstandard appended data found after JSON response for" << name;
             signature = QByteArray::fromBase64(responsePayload.mid(end + 1));
             responsePayload.truncate(end + 1);
         }
     }
 
     // If a key was supplied, check that there is a valid signature.
-    if (!_signatureKey.isNull())
+    if (!signatureKey.isNull())
     {
         if (signature.isEmpty())
         {
-            qError() << "Missing signature in response for" << _name;
-            return {};
+            qError() << "Missing signature in response for" << name;
+            return result;
         }
-        if (!verifySignature(_signatureKey, signature, responsePayload))
+        SignatureVerifier verifier{signatureKey};
+        verifier.update(responsePayload);
+        if (!verifier.verify(signature))
         {
             // Urgh; piaproxy.net alters content in-transit without re-signing it...
             // Make a single educated guess what the original content was.
-            if (!verifySignature(_signatureKey, signature, QByteArray(responsePayload).replace(".piaproxy.net", ".privateinternetaccess.com")))
+            SignatureVerifier proxyVerifier{signatureKey};
+            proxyVerifier.update(QByteArray(responsePayload).replace(".piaproxy.net", ".privateinternetaccess.com"));
+            if (!proxyVerifier.verify(signature))
             {
-                qError() << "Invalid signature in response for" << _name;
-                return {};
+                qError() << "Invalid signature in response for" << name;
+                return result;
             }
         }
-        qInfo() << "Verified signature in response for" << _name;
+        qInfo() << "Verified signature in response for" << name;
     }
     else if (!signature.isEmpty())
     {
-        qWarning() << "Unexpected signature found in response for" << _name;
+        qWarning() << "Unexpected signature found in response for" << name;
     }
 
-    // Parse the JSON response
-    QJsonParseError parseError;
-    const auto &jsonDoc = QJsonDocument::fromJson(responsePayload,
-                                                         &parseError);
-    if(jsonDoc.isNull())
+    if (parseJson)
     {
-        qWarning() << "Could not parse" << _name << "due to error:"
-            << parseError.error << "at position" << parseError.offset;
-        qWarning() << "Retrieved JSON:" << responsePayload;
-        return {};
+        // Parse the JSON response
+        QJsonParseError parseError;
+        result.content = QJsonDocument::fromJson(responsePayload, &parseError);
+        if(result.content.isNull())
+        {
+            qWarning() << "Could not parse" << name << "due to error:"
+                << parseError.error << "at position" << parseError.offset;
+            qWarning() << "Retrieved JSON:" << responsePayload;
+            return result;
+        }
     }
 
     // Got a result
-    return jsonDoc;
+    result.valid = true;
+    result.payload = std::move(responsePayload);
+    return result;
 }
 
-void JsonRefresher::emitReply(QByteArray responsePayload)
+void JsonRefresher::emitVerifiedReply(const VerifiedReply &reply)
 {
-    QJsonDocument doc{readReply(std::move(responsePayload))};
-    if(!doc.isNull())
-        emit contentLoaded(doc);
+    if(!reply.valid)
+        return;
+    if(_parseJson)
+        emit contentLoaded(reply.content);
+    else
+        emit payloadLoaded(reply.payload);
+}
+
+void JsonRefresher::emitReply(QByteArray responsePayload, QJsonObject validator)
+{
+    // A newer reply replaces one that's still being verified
+    if(_pVerifyTask)
+        _pVerifyTask.abandon();
+
+    _pendingValidator = std::move(validator);
+
+    if(!_pWorkerPool)
+    {
+        emitVerifiedReply(verifyReply(_name, _signatureKey, _parseJson,
+                                      std::move(responsePayload)));
+        return;
+    }
+
+    // Verify on the worker pool - the regions list is large enough that
+    // verifying and parsing it would hold up the main thread.  The job
+    // captures copies, it can't touch this object.
+    _pVerifyTask = _pWorkerPool->run(
+        [name = _name, signatureKey = _signatureKey, parseJson = _parseJson,
+         responsePayload = std::move(responsePayload)]()
+        {
+            return verifyReply(name, signatureKey, parseJson, responsePayload);
+        });
+    _pVerifyTask->notify(this, [this](const Error &error, const VerifiedReply &reply)
+        {
+            _pVerifyTask.reset();
+            if(error)
+            {
+                // Canceled by a newer reply or by shutdown
+                if(error.code() != Error::TaskRejected)
+                    qWarning() << "Unable to verify" << _name << "due to error:" << error;
+                return;
+            }
+            emitVerifiedReply(reply);
+        });
 }
 
 // This member function is a variant of start() but allows for initial data
@@ -165,8 +285,13 @@ void JsonRefresher::emitReply(QByteArray responsePayload)
 // unavailable.
 void JsonRefresher::start(const QByteArray &initialData)
 {
-    // first process the provided data
-    emitReply(initialData);
+    // Process the provided data first, synchronously, so it's emitted
+    // before any reply from the server (which could otherwise finish
+    // verifying first)
+    if(_pVerifyTask)
+        _pVerifyTask.abandon();
+    _pendingValidator = {};
+    emitVerifiedReply(verifyReply(_name, _signatureKey, _parseJson, initialData));
 
     // then start as usual
     start();
@@ -181,11 +306,16 @@ void JsonRefresher::startOrOverride(const QString &overridePath,
     if (overrideRegionFile.open(QFile::ReadOnly))
     {
         qInfo() << "Loading" << _name << "from override file";
+        QByteArray overridePayload = overrideRegionFile.readAll();
         QJsonParseError parseError;
-        const auto &jsonDoc = QJsonDocument::fromJson(overrideRegionFile.readAll(), &parseError);
+        const auto &jsonDoc = QJsonDocument::fromJson(overridePayload, &parseError);
         if(parseError.error == QJsonParseError::NoError)
         {
-            emit contentLoaded(jsonDoc);
+            _pendingValidator = {};
+            if(_parseJson)
+                emit contentLoaded(jsonDoc);
+            else
+                emit payloadLoaded(overridePayload);
             qInfo() << "Override for" << _name << "loaded successfully";
             return; // Don't start refreshes since regions are overridden
         }
@@ -200,6 +330,11 @@ void JsonRefresher::startOrOverride(const QString &overridePath,
         // servers.json and refreshes below.
     }
 
+    // Without a cache, the validator doesn't describe any content the caller
+    // has, so don't let the server skip sending it.
+    if(!haveCache)
+        setValidator({});
+
     QFile bundledRegionFile{bundledPath};
     // If a bundled file is present, and we don't have any cache yet, use it
     // as the initial data
@@ -238,6 +373,9 @@ void JsonRefresher::stop()
             _pFetchTask->abandon();
             _pFetchTask.reset();
         }
+        // Likewise for a reply that's being verified
+        if(_pVerifyTask)
+            _pVerifyTask.abandon();
     }
 }
 
@@ -276,4 +414,21 @@ void JsonRefresher::loadSucceeded()
     {
         _refreshTimer.setInterval(static_cast<int>(_refreshInterval.count()));
     }
+
+    // If the content came from the server, keep its validator.  (Content from
+    // a bundled or override file doesn't have one.)
+    if(!_pendingValidator.isEmpty())
+    {
+        setValidator(_pendingValidator);
+        _pendingValidator = {};
+    }
+}
+
+void JsonRefresher::setValidator(const QJsonObject &validator)
+{
+    if(validator != _validator)
+    {
+        _validator = validator;
+        emit validatorChanged(_validator);
+    }
 }
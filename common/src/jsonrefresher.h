@@ -25,8 +25,11 @@
 #include "apibase.h"
 #include "async.h"
 #include "testshim.h"
+#include "networktaskwithretry.h"
+#include "workerpool.h"
 #include <QObject>
 #include <QJsonDocument>
+#include <QJsonObject>
 #include <QNetworkAccessManager>
 #include <QByteArray>
 #include <QSharedPointer>
@@ -43,6 +46,15 @@
 // that URI will be the first one tried for subsequent attempts.
 //
 // The JSON payload is expected to have a GPG signature if signatureKey is set.
+//
+// Once content has been loaded, requests are conditional on the ETag or
+// Last-Modified time of that content.  If the server reports that it's not
+// modified, or returns identical content (by SHA-256 hash), the content is not
+// verified, parsed, or emitted again.  The validator describing the loaded
+// content can be persisted with the caller's cache (see validator()).
+//
+// If a WorkerPool is set, replies are verified and parsed on the pool, and
+// contentLoaded()/payloadLoaded() are emitted when that finishes.
 class COMMON_EXPORT JsonRefresher : public QObject
 {
     Q_OBJECT
@@ -58,19 +70,55 @@ public:
     ~JsonRefresher();
 
 private:
+    // Result of verifying (and possibly parsing) a reply payload
+    struct VerifiedReply
+    {
+        // Whether the payload was verified (and parsed, if requested)
+        bool valid;
+        // The payload with the signature removed
+        QByteArray payload;
+        // The parsed content, if parseJson was set
+        QJsonDocument content;
+    };
+
+private:
+    // Validate the signature of a reply payload if a signature key is given,
+    // remove the signature from the payload, and parse it if parseJson is
+    // set.  This doesn't use any state of the JsonRefresher, so it can run on
+    // a worker thread.
+    static VerifiedReply verifyReply(const QString &name,
+                                     const QByteArray &signatureKey,
+                                     bool parseJson,
+                                     QByteArray responsePayload);
+
     void refreshTimerElapsed();
-    // Read a reply payload into a QJsonDocument, including validating the
-    // signature if a key is configured on this JsonRefresher.  If the response
-    // can't be read for any reason, returns a null QJsonDocument.
-    QJsonDocument readReply(QByteArray responsePayload) const;
-    // Read a reply, and emit it to contentLoaded() if successful.
-    void emitReply(QByteArray responsePayload);
+    // Emit a verified reply to contentLoaded() or payloadLoaded(), if it's
+    // valid
+    void emitVerifiedReply(const VerifiedReply &reply);
+    // Verify a reply, and emit it to contentLoaded() or payloadLoaded() if
+    // successful.  The validator describes the payload; it's stored by
+    // loadSucceeded() if the content is accepted.
+    //
+    // With a WorkerPool, the reply is verified on the pool and emitted
+    // later.  A newer reply replaces one that's still being verified.
+    void emitReply(QByteArray responsePayload, QJsonObject validator = {});
+    // Handle a reply from a refresh request - emits the content unless it's
+    // unchanged from the content that was last loaded.
+    void handleReply(const NetworkTaskWithRetry &request, QByteArray responsePayload);
 
 public:
+    // Set a WorkerPool used to verify and parse replies.  The pool must
+    // outlive this JsonRefresher (or be cleared first).  Without a pool,
+    // replies are verified on the calling thread.
+    void setWorkerPool(WorkerPool *pWorkerPool) {_pWorkerPool = pWorkerPool;}
+
     // Start trying to load the resource.
     void start();
 
     // Start with initial data, then continue trying to load the resource as in start()
+    //
+    // The initial data are always verified synchronously, so they're emitted
+    // before any reply from the server.
     void start(const QByteArray &initialData);
     // Check for an override file, bundled seed file, and load or start the
     // refresher.  'haveCache' indicates whether the caller has an existing
@@ -85,7 +133,8 @@ public:
     void startOrOverride(const QString &overridePath,
                          const QString &bundledPath, bool haveCache);
     // Stop refreshing the resource.  If a request was in-flight, it is
-    // canceled (contentLoaded() cannot be emitted while stopped).
+    // canceled, as is a reply being verified (contentLoaded() cannot be
+    // emitted while stopped).
     void stop();
 
     bool isRunning() const;
@@ -106,9 +155,30 @@ public:
     // may be resource-specific validation done on the JSON body.
     void loadSucceeded();
 
+    // By default, the content is parsed into a QJsonDocument and emitted by
+    // contentLoaded().  A consumer that parses the content itself can turn this
+    // off to get the verified payload from payloadLoaded() instead.
+    void parseJson(bool parse) {_parseJson = parse;}
+
+    // The validator for the content that was last loaded successfully - an
+    // object containing the content's "etag", "lastModified", and "sha256"
+    // hash.  Empty if nothing has been loaded yet.
+    //
+    // A validator persisted with the caller's cache can be restored with
+    // setValidator() before starting.  If startOrOverride() is called without
+    // a cache, the validator is cleared, since it wouldn't describe any
+    // content that the caller has.
+    const QJsonObject &validator() const {return _validator;}
+    void setValidator(const QJsonObject &validator);
+
 signals:
     // Emitted any time the content of the resource is successfully loaded.
     void contentLoaded(const QJsonDocument &content);
+    // Emitted instead of contentLoaded() when parseJson() is turned off.  The
+    // signature (if any) has been verified and removed.
+    void payloadLoaded(const QByteArray &payload);
+    // Emitted when validator() changes.
+    void validatorChanged(const QJsonObject &validator);
 
 public:
     QString _name;
@@ -116,11 +186,20 @@ public:
     QString _resource;
     std::chrono::milliseconds _initialInterval, _refreshInterval;
     QTimer _refreshTimer;
+    // The shared network manager used for the last refresh - keeps its
+    // connections alive between refreshes (see NetworkPool)
     QSharedPointer<QNetworkAccessManager> _pNetworkManager;
     // If a fetch task is ongoing, it's held here.  Dropping this reference
     // abandons the task.
     Async<void> _pFetchTask;
+    // Pool used to verify replies, if set, and the verification in progress
+    WorkerPool *_pWorkerPool;
+    Async<WorkerPool::JobTask<VerifiedReply>> _pVerifyTask;
     QByteArray _signatureKey;
+    bool _parseJson;
+    // Validator for the content last loaded, and for the content emitted by
+    // contentLoaded() that hasn't been accepted by loadSucceeded() yet.
+    QJsonObject _validator, _pendingValidator;
 };
 
 #endif
@@ -55,11 +55,11 @@ void parseJsonRPCRequest(const QJsonObject &request, QString &method, QJsonArray
         params = QJsonArray();
 }
 
-Async<QJsonValue> LocalMethod::operator()(const QJsonArray &params) noexcept
+Async<QJsonValue> LocalMethod::operator()(const QJsonArray &params, QJsonValue &result) noexcept
 {
     try
     {
-        return invoke(params);
+        return invoke(params, result);
     }
     catch (const json_cast_exception&)
     {
@@ -79,16 +79,16 @@ Async<QJsonValue> LocalMethod::operator()(const QJsonArray &params) noexcept
     }
 }
 
-Async<QJsonValue> LocalMethod::invoke(const QJsonArray& params)
+Async<QJsonValue> LocalMethod::invoke(const QJsonArray& params, QJsonValue& result)
 {
     if (params.count() >= _paramCount)
-        return _fn(params);
+        return _fn(params, result);
     else if (params.count() + _defaultArguments.count() >= _paramCount)
     {
         QJsonArray amendedParams = params;
         for (int i = params.count() + _defaultArguments.count() - _paramCount; i < _defaultArguments.size(); i++)
             amendedParams.append(_defaultArguments.at(i));
-        return _fn(amendedParams);
+        return _fn(amendedParams, result);
     }
     else
         throw JsonRPCInvalidParamsError(HERE);
@@ -117,11 +117,11 @@ void LocalMethodRegistry::add(const std::initializer_list<LocalMethod> &methods)
         add(method);
 }
 
-Async<QJsonValue> LocalMethodRegistry::invoke(const QString &method, const QJsonArray &params)
+Async<QJsonValue> LocalMethodRegistry::invoke(const QString &method, const QJsonArray &params, QJsonValue &result)
 {
     auto it = _methods.find(method);
     if (it != _methods.end())
-        return (*it)(params);
+        return (*it)(params, result);
     else
         return Async<QJsonValue>::reject(JsonRPCMethodNotFoundError(HERE, method));
 }
@@ -158,8 +158,11 @@ bool LocalNotificationInterface::processRequest(const QJsonObject &request)
         {
             qWarning() << "Call request sent to Notification-only interface";
         }
-        // Note: intentionally ignoring return value; we don't care about the result
-        _registry->invoke(method, params)->runUntilFinished(this);
+        // Note: intentionally ignoring the result; if the method is
+        // asynchronous, just let it finish
+        QJsonValue result;
+        if (auto task = _registry->invoke(method, params, result))
+            task->runUntilFinished(this);
         // Signal success
         return true;
     }
@@ -202,7 +205,8 @@ bool LocalCallInterface::processRequest(const QJsonObject &request)
         parseJsonRPCRequest(request, method, params);
         // Invoke the method and watch the result
         qInfo() << "Request" << id << "- invoking RPC method" << method;
-        if (auto task = _registry->invoke(method, params))
+        QJsonValue result;
+        if (auto task = _registry->invoke(method, params, result))
         {
             // The task is kept alive by the capture of 'task', and will be
             // disposed either when it finishes, or when we are destroyed.
@@ -215,8 +219,10 @@ bool LocalCallInterface::processRequest(const QJsonObject &request)
                     respondWithResult(id, result);
             });
         }
-        else
-            throw JsonRPCInternalError(HERE, "Async method returned null");
+        // Otherwise, the method completed synchronously - respond without
+        // creating a task
+        else if (!id.isUndefined())
+            respondWithResult(id, result);
         // Signal success
         return true;
     }
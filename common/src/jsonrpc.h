@@ -43,33 +43,37 @@ COMMON_EXPORT void parseJsonRPCRequest(const QJsonObject& request, QString& meth
 
 
 // Helper type that wraps a callable of a given signature and converts the
-// result to an Async<QJsonValue> value (synchronous functions return an
-// already resolved Async<QJsonValue>; void functions resolve to Undefined).
+// result to a QJsonValue.  Synchronous functions store their result in
+// 'result' and return a null Async, so no task is created for them (void
+// functions produce Undefined).  Asynchronous functions return an
+// Async<QJsonValue> for their eventual result.
 //
 template<typename Return, typename ArgsTuple>
 struct LocalMethodWrapper
 {
     template<typename Func, size_t... I>
-    static Async<QJsonValue> invoke(Func&& func, const QJsonArray& params, std::index_sequence<I...>)
+    static Async<QJsonValue> invoke(Func&& func, const QJsonArray& params, QJsonValue& result, std::index_sequence<I...>)
     {
-        return Async<QJsonValue>::resolve(func(json_cast<std::decay_t<std::tuple_element_t<I, ArgsTuple>>>(params[I])...));
+        result = QJsonValue(func(json_cast<std::decay_t<std::tuple_element_t<I, ArgsTuple>>>(params[I])...));
+        return {};
     }
 };
 template<typename ArgsTuple>
 struct LocalMethodWrapper<void, ArgsTuple>
 {
     template<typename Func, size_t... I>
-    static Async<QJsonValue> invoke(Func&& func, const QJsonArray& params, std::index_sequence<I...>)
+    static Async<QJsonValue> invoke(Func&& func, const QJsonArray& params, QJsonValue& result, std::index_sequence<I...>)
     {
         func(json_cast<std::decay_t<std::tuple_element_t<I, ArgsTuple>>>(params[I])...);
-        return Async<QJsonValue>::resolve(QJsonValue::Undefined);
+        result = QJsonValue::Undefined;
+        return {};
     }
 };
 template<typename Return, typename ArgsTuple>
 struct LocalMethodWrapper<Async<Return>, ArgsTuple>
 {
     template<typename Func, size_t... I>
-    static Async<QJsonValue> invoke(Func&& func, const QJsonArray& params, std::index_sequence<I...>)
+    static Async<QJsonValue> invoke(Func&& func, const QJsonArray& params, QJsonValue&, std::index_sequence<I...>)
     {
         return func(json_cast<std::decay_t<std::tuple_element_t<I, ArgsTuple>>>(params[I])...)->then([](const Return& value) { return json_cast<QJsonValue>(value); });
     }
@@ -78,7 +82,7 @@ template<typename ArgsTuple>
 struct LocalMethodWrapper<Async<void>, ArgsTuple>
 {
     template<typename Func, size_t... I>
-    static Async<QJsonValue> invoke(Func&& func, const QJsonArray& params, std::index_sequence<I...>)
+    static Async<QJsonValue> invoke(Func&& func, const QJsonArray& params, QJsonValue&, std::index_sequence<I...>)
     {
         // Transform the void return to QJsonValue::Undefined
         return func(json_cast<std::decay_t<std::tuple_element_t<I, ArgsTuple>>>(params[I])...)->then([]() -> QJsonValue { return QJsonValue::Undefined; });
@@ -91,7 +95,7 @@ struct LocalMethodWrapper<Async<void>, ArgsTuple>
 //
 class COMMON_EXPORT LocalMethod
 {
-    typedef std::function<Async<QJsonValue>(const QJsonArray&)> Func;
+    typedef std::function<Async<QJsonValue>(const QJsonArray&, QJsonValue&)> Func;
 
     Func _fn;
     QString _name;
@@ -117,8 +121,10 @@ public:
     const QString& name() const { return _name; }
 
     // Invoke the registered function, catching any Errors or exceptions
-    // and converting them to rejected Async Tasks.
-    Async<QJsonValue> operator()(const QJsonArray& params) noexcept;
+    // and converting them to rejected Async Tasks.  If the function completed
+    // synchronously, its result is stored in 'result' and a null Async is
+    // returned.
+    Async<QJsonValue> operator()(const QJsonArray& params, QJsonValue& result) noexcept;
 
 private:
     // Helper function to wrap the logic to unpack and cast the QJsonArray
@@ -130,8 +136,8 @@ private:
         _paramCount = sizeof...(Args);
         // Note: Qt Creator has trouble parsing the move-initialized capture
         // variable here, so you might get incorrect syntax highlighting here.
-        _fn = [this, fn = std::move(fn)](const QJsonArray& params) -> Async<QJsonValue> {
-            return LocalMethodWrapper<Result, std::tuple<Args...>>::invoke(fn, params, std::index_sequence_for<Args...>{});
+        _fn = [this, fn = std::move(fn)](const QJsonArray& params, QJsonValue& result) -> Async<QJsonValue> {
+            return LocalMethodWrapper<Result, std::tuple<Args...>>::invoke(fn, params, result, std::index_sequence_for<Args...>{});
         };
     }
     // Helper function to deduce the signature of a functor/lambda by
@@ -142,7 +148,7 @@ private:
         wrap<Result, Args...>(std::forward<Functor>(functor));
     }
 
-    Async<QJsonValue> invoke(const QJsonArray& params);
+    Async<QJsonValue> invoke(const QJsonArray& params, QJsonValue& result);
 };
 
 
@@ -161,10 +167,13 @@ public:
     void add(const std::initializer_list<LocalMethod>& methods);
 
 public:
-    Async<QJsonValue> invoke(const QString& method, const QJsonArray& params);
+    // Invoke a method.  Like LocalMethod, a method that completes
+    // synchronously stores its result in 'result' and returns a null Async;
+    // errors are returned as a rejected Async.
+    Async<QJsonValue> invoke(const QString& method, const QJsonArray& params, QJsonValue& result);
 
 private:
-    QHash<QString, std::function<Async<QJsonValue>(const QJsonArray&)>> _methods;
+    QHash<QString, std::function<Async<QJsonValue>(const QJsonArray&, QJsonValue&)>> _methods;
 };
 
 
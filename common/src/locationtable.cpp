@@ -0,0 +1,294 @@
+// Copyright (c) 2019 London Trust Media Incorporated
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#line SOURCE_FILE("locationtable.cpp")
+
+#include "locationtable.h"
+#include <QArrayData>
+#include <QHash>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <unordered_set>
+
+namespace
+{
+    // The current table; only accessed with the std::atomic_* functions
+    std::shared_ptr<const LocationTable> locationTableCurrent{std::make_shared<const LocationTable>()};
+
+    // Heap memory used by a string's data, if it isn't shared with an earlier
+    // string in countedData
+    std::size_t locationTableStringMemory(const QString &value,
+                                          std::unordered_set<const void*> &countedData)
+    {
+        // Empty strings usually refer to the shared null data
+        if(value.isEmpty() || !countedData.insert(value.constData()).second)
+            return 0;
+        return sizeof(QArrayData) + (static_cast<std::size_t>(value.capacity()) + 1) * sizeof(QChar);
+    }
+
+    template<class T>
+    std::size_t locationTableVectorMemory(const std::vector<T> &vector)
+    {
+        return vector.capacity() * sizeof(T);
+    }
+}
+
+LocationTable::LocationTable()
+    : _pRows{std::make_shared<const Rows>()}
+{
+}
+
+LocationTable::LocationTable(const ServerLocations &locations)
+{
+    std::vector<const ServerLocation*> rowLocations;
+    rowLocations.reserve(static_cast<std::size_t>(locations.size()));
+    for(const auto &pLocation : locations)
+    {
+        if(pLocation)
+            rowLocations.push_back(pLocation.data());
+    }
+
+    auto pRows = std::make_shared<Rows>();
+    const std::size_t rows = rowLocations.size();
+    for(auto pColumn : {&pRows->id, &pRows->name, &pRows->country, &pRows->dns,
+                        &pRows->ping, &pRows->openvpnUDP, &pRows->openvpnTCP,
+                        &pRows->serial})
+    {
+        pColumn->reserve(rows);
+    }
+
+    QHash<QString, quint32> stringIndices;
+    auto intern = [&](const QString &value) -> quint32
+    {
+        auto itIndex = stringIndices.find(value);
+        if(itIndex != stringIndices.end())
+            return itIndex.value();
+        quint32 index = static_cast<quint32>(pRows->strings.size());
+        // This shares the data with the original string
+        pRows->strings.push_back(value);
+        stringIndices.insert(value, index);
+        return index;
+    };
+
+    for(const ServerLocation *pLocation : rowLocations)
+    {
+        pRows->id.push_back(intern(pLocation->id()));
+        pRows->name.push_back(intern(pLocation->name()));
+        pRows->country.push_back(intern(pLocation->country()));
+        pRows->dns.push_back(intern(pLocation->dns()));
+        pRows->ping.push_back(intern(pLocation->ping()));
+        pRows->openvpnUDP.push_back(intern(pLocation->openvpnUDP()));
+        pRows->openvpnTCP.push_back(intern(pLocation->openvpnTCP()));
+        pRows->serial.push_back(intern(pLocation->serial()));
+    }
+    pRows->strings.shrink_to_fit();
+
+    pRows->idOrder.resize(rows);
+    for(Row row = 0; row < rows; ++row)
+        pRows->idOrder[row] = row;
+    std::sort(pRows->idOrder.begin(), pRows->idOrder.end(),
+        [&pRows](Row first, Row second)
+        {
+            return pRows->strings[pRows->id[first]] < pRows->strings[pRows->id[second]];
+        });
+
+    _pRows = std::move(pRows);
+    buildVersion(locations);
+}
+
+LocationTable::LocationTable(std::shared_ptr<const Rows> pRows,
+                             const ServerLocations &locations)
+    : _pRows{std::move(pRows)}
+{
+    buildVersion(locations);
+}
+
+void LocationTable::buildVersion(const ServerLocations &locations)
+{
+    const std::size_t rows = size();
+    _flags.resize(rows);
+    _latency.resize(rows);
+    _nearestRows.resize(rows);
+    for(Row row = 0; row < rows; ++row)
+    {
+        _nearestRows[row] = row;
+
+        const auto &pLocation = locations.value(id(row));
+        if(!pLocation)
+        {
+            _flags[row] = 0;
+            _latency[row] = std::numeric_limits<double>::quiet_NaN();
+            continue;
+        }
+
+        quint8 flags = 0;
+        if(pLocation->portForward())
+            flags |= FlagPortForward;
+        if(pLocation->isSafeForAutoConnect())
+            flags |= FlagSafeForAutoConnect;
+        if(pLocation->shadowsocks())
+            flags |= FlagShadowsocks;
+        _flags[row] = flags;
+
+        const auto &latency = pLocation->latency();
+        _latency[row] = latency ? latency.get() : std::numeric_limits<double>::quiet_NaN();
+    }
+
+    std::sort(_nearestRows.begin(), _nearestRows.end(),
+        [this](Row first, Row second){return nearer(first, second);});
+}
+
+std::shared_ptr<const LocationTable> LocationTable::update(const ServerLocations &locations) const
+{
+    return std::shared_ptr<const LocationTable>{new LocationTable{_pRows, locations}};
+}
+
+bool LocationTable::nearer(Row first, Row second) const
+{
+    // Unknown latencies sort last, then compare latency, country, and ID the
+    // same way as compareEntries()
+    bool firstKnown = !std::isnan(_latency[first]);
+    bool secondKnown = !std::isnan(_latency[second]);
+    if(firstKnown != secondKnown)
+        return firstKnown;
+    if(firstKnown && _latency[first] != _latency[second])
+        return _latency[first] < _latency[second];
+
+    int countryComparison = country(first).compare(country(second), Qt::CaseSensitivity::CaseInsensitive);
+    if(countryComparison != 0)
+        return countryComparison < 0;
+
+    return id(first).compare(id(second), Qt::CaseSensitivity::CaseInsensitive) < 0;
+}
+
+auto LocationTable::find(const QString &id) const -> Row
+{
+    const auto &idOrder = _pRows->idOrder;
+    auto itRow = std::lower_bound(idOrder.begin(), idOrder.end(), id,
+        [this](Row row, const QString &value){return this->id(row) < value;});
+    if(itRow != idOrder.end() && this->id(*itRow) == id)
+        return *itRow;
+    return InvalidRow;
+}
+
+Optional<double> LocationTable::latency(Row row) const
+{
+    if(std::isnan(_latency[row]))
+        return {};
+    return _latency[row];
+}
+
+auto LocationTable::nearestSafeVpnRow(bool portForward) const -> Row
+{
+    if(_nearestRows.empty())
+    {
+        qWarning() << "There are no available Server Locations!";
+        return InvalidRow;
+    }
+
+    if(portForward)
+    {
+        auto itRow = std::find_if(_nearestRows.begin(), _nearestRows.end(),
+            [this](Row row){return this->portForward(row) && isSafeForAutoConnect(row);});
+        if(itRow != _nearestRows.end())
+            return *itRow;
+    }
+
+    auto itRow = std::find_if(_nearestRows.begin(), _nearestRows.end(),
+        [this](Row row){return isSafeForAutoConnect(row);});
+    if(itRow != _nearestRows.end())
+        return *itRow;
+
+    qWarning() << "Unable to find closest server location meeting constraints, falling back to fastest region";
+    return _nearestRows.front();
+}
+
+auto LocationTable::nearestSafeShadowsocksRow() const -> Row
+{
+    auto itRow = std::find_if(_nearestRows.begin(), _nearestRows.end(),
+        [this](Row row){return isSafeForAutoConnect(row) && hasShadowsocks(row);});
+    if(itRow != _nearestRows.end())
+        return *itRow;
+    return InvalidRow;
+}
+
+std::size_t LocationTable::memoryUsage() const
+{
+    std::size_t usage = locationTableVectorMemory(_pRows->strings);
+    std::unordered_set<const void*> countedData;
+    for(const auto &value : _pRows->strings)
+        usage += locationTableStringMemory(value, countedData);
+
+    for(auto pColumn : {&_pRows->id, &_pRows->name, &_pRows->country,
+                        &_pRows->dns, &_pRows->ping, &_pRows->openvpnUDP,
+                        &_pRows->openvpnTCP, &_pRows->serial})
+    {
+        usage += locationTableVectorMemory(*pColumn);
+    }
+    usage += locationTableVectorMemory(_pRows->idOrder);
+    return usage + versionMemoryUsage();
+}
+
+std::size_t LocationTable::versionMemoryUsage() const
+{
+    return locationTableVectorMemory(_flags) +
+        locationTableVectorMemory(_latency) +
+        locationTableVectorMemory(_nearestRows);
+}
+
+std::size_t LocationTable::estimateObjectMemory(const ServerLocations &locations)
+{
+    // Each QHash node holds the key and value, plus the next pointer and hash
+    const std::size_t nodeSize = sizeof(void*) + sizeof(uint) + sizeof(QString) +
+        sizeof(QSharedPointer<ServerLocation>);
+    // QSharedPointer's control block - reference counts and the deleter
+    const std::size_t controlBlockSize = 2 * sizeof(int) + 2 * sizeof(void*);
+
+    std::size_t usage = static_cast<std::size_t>(locations.capacity()) * sizeof(void*);
+    // Strings that share data are only counted once
+    std::unordered_set<const void*> countedData;
+    for(auto itLocation = locations.begin(); itLocation != locations.end(); ++itLocation)
+    {
+        usage += nodeSize + locationTableStringMemory(itLocation.key(), countedData);
+        const auto &pLocation = itLocation.value();
+        if(!pLocation)
+            continue;
+        usage += controlBlockSize + sizeof(ServerLocation);
+        for(const QString *pValue : {&pLocation->id(), &pLocation->name(),
+                                     &pLocation->country(), &pLocation->dns(),
+                                     &pLocation->ping(), &pLocation->openvpnUDP(),
+                                     &pLocation->openvpnTCP(), &pLocation->serial()})
+        {
+            usage += locationTableStringMemory(*pValue, countedData);
+        }
+    }
+    return usage;
+}
+
+std::shared_ptr<const LocationTable> LocationTable::current()
+{
+    return std::atomic_load(&locationTableCurrent);
+}
+
+void LocationTable::publish(std::shared_ptr<const LocationTable> pTable)
+{
+    Q_ASSERT(pTable);
+    std::atomic_store(&locationTableCurrent, std::move(pTable));
+}
@@ -0,0 +1,176 @@
+// Copyright (c) 2019 London Trust Media Incorporated
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#line HEADER_FILE("locationtable.h")
+
+#ifndef LOCATIONTABLE_H
+#define LOCATIONTABLE_H
+#pragma once
+
+#include "settings.h"
+#include <QString>
+#include <memory>
+#include <vector>
+
+// LocationTable is an immutable, compact copy of the server locations.
+//
+// ServerLocations holds a full NativeJsonObject for each region, which is
+// needed to serialize the locations to clients, but it's a poor structure for
+// lookups - each region is a separate heap object with its own strings, and
+// the nearest-location queries and grouping have to copy and sort the entire
+// set each time.
+//
+// LocationTable stores each field as a column indexed by row, and strings are
+// interned so the countries, DNS names, etc. that are shared by many regions
+// are only stored once.  The nearest-first order is computed once when the
+// table is built.
+//
+// Tables are never modified once built, so the current table can be read from
+// any thread.  The daemon publishes a new table with publish() whenever the
+// locations change, and readers get a consistent snapshot from current()
+// without copying or locking.
+//
+// The rows (the strings and the fields that come from the servers list) only
+// change when the servers list changes.  Latency and Shadowsocks changes are
+// published as a new version from update(), which shares the rows with the
+// prior version and only builds the latency, flag, and nearest-order columns.
+class COMMON_EXPORT LocationTable
+{
+    CLASS_LOGGING_CATEGORY("locationtable")
+
+public:
+    using Row = quint32;
+    enum : Row { InvalidRow = 0xFFFFFFFF };
+
+private:
+    // The columns that are shared by all versions of a table
+    struct Rows
+    {
+        // Strings referenced by the string columns; each distinct string
+        // appears once
+        std::vector<QString> strings;
+        std::vector<quint32> id, name, country, dns, ping, openvpnUDP,
+            openvpnTCP, serial;
+        // Rows sorted by ID for find()
+        std::vector<Row> idOrder;
+    };
+
+public:
+    // Create an empty table
+    LocationTable();
+    explicit LocationTable(const ServerLocations &locations);
+    LocationTable(const LocationTable &) = delete;
+    LocationTable &operator=(const LocationTable &) = delete;
+
+private:
+    // Create a new version of a table with the same rows (see update())
+    LocationTable(std::shared_ptr<const Rows> pRows,
+                  const ServerLocations &locations);
+
+public:
+    // Build a new version of this table with the latencies and Shadowsocks
+    // availability from locations.  The new version shares the rows with this
+    // table, so row numbers are the same in both.  Locations are matched by
+    // ID; locations that aren't in the table are ignored, since the rows only
+    // change when the servers list changes (build a new table for that).
+    std::shared_ptr<const LocationTable> update(const ServerLocations &locations) const;
+
+    std::size_t size() const {return _pRows->id.size();}
+    bool empty() const {return _pRows->id.empty();}
+
+    // Find a location by ID; returns InvalidRow if it doesn't exist
+    Row find(const QString &id) const;
+
+    const QString &id(Row row) const {return string(_pRows->id, row);}
+    const QString &name(Row row) const {return string(_pRows->name, row);}
+    const QString &country(Row row) const {return string(_pRows->country, row);}
+    const QString &dns(Row row) const {return string(_pRows->dns, row);}
+    const QString &ping(Row row) const {return string(_pRows->ping, row);}
+    const QString &openvpnUDP(Row row) const {return string(_pRows->openvpnUDP, row);}
+    const QString &openvpnTCP(Row row) const {return string(_pRows->openvpnTCP, row);}
+    const QString &serial(Row row) const {return string(_pRows->serial, row);}
+    bool portForward(Row row) const {return _flags[row] & FlagPortForward;}
+    bool isSafeForAutoConnect(Row row) const {return _flags[row] & FlagSafeForAutoConnect;}
+    bool hasShadowsocks(Row row) const {return _flags[row] & FlagShadowsocks;}
+    Optional<double> latency(Row row) const;
+
+    // All rows, nearest first (the same order as NearestLocations)
+    const std::vector<Row> &nearestRows() const {return _nearestRows;}
+    // Find the nearest location that's safe for 'connect auto', preferring
+    // locations with port forwarding if portForward is set.  Like
+    // NearestLocations::getNearestSafeVpnLocation(), this falls back to the
+    // nearest location if none meet those constraints.  Returns InvalidRow if
+    // the table is empty.
+    Row nearestSafeVpnRow(bool portForward) const;
+    // Find the nearest safe location with Shadowsocks, or InvalidRow if there
+    // are none.
+    Row nearestSafeShadowsocksRow() const;
+
+    // Number of distinct strings stored in the table
+    std::size_t uniqueStrings() const {return _pRows->strings.size();}
+    // Whether this table shares its rows with another version
+    bool sharesRows(const LocationTable &other) const {return _pRows == other._pRows;}
+    // Approximate heap memory used by this table, in bytes, including the
+    // rows shared with other versions
+    std::size_t memoryUsage() const;
+    // Approximate heap memory used by this version's own columns - the
+    // additional memory used by a version from update()
+    std::size_t versionMemoryUsage() const;
+    // Approximate heap memory used by a ServerLocations collection, for
+    // comparison.  This is a lower bound - it can't account for QObject's
+    // private data or signal connections.
+    static std::size_t estimateObjectMemory(const ServerLocations &locations);
+
+    // Get the current table.  Never returns nullptr (initially, this is an
+    // empty table).
+    static std::shared_ptr<const LocationTable> current();
+    // Publish a new table.  Readers that already have the previous table keep
+    // it until they release it.
+    static void publish(std::shared_ptr<const LocationTable> pTable);
+
+private:
+    enum Flag : quint8
+    {
+        FlagPortForward = 0x01,
+        FlagSafeForAutoConnect = 0x02,
+        FlagShadowsocks = 0x04,
+    };
+
+private:
+    const QString &string(const std::vector<quint32> &column, Row row) const
+    {
+        return _pRows->strings[column[row]];
+    }
+    // Set the flags and latency for each row from locations, and sort the
+    // nearest order
+    void buildVersion(const ServerLocations &locations);
+    // Compare two rows to sort them nearest-first - equivalent to
+    // compareEntries() for the locations
+    bool nearer(Row first, Row second) const;
+
+private:
+    std::shared_ptr<const Rows> _pRows;
+    // The columns specific to this version
+    std::vector<quint8> _flags;
+    // Latencies; NaN if unknown
+    std::vector<double> _latency;
+    std::vector<Row> _nearestRows;
+};
+
+#endif
@@ -0,0 +1,146 @@
+// Copyright (c) 2019 London Trust Media Incorporated
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#line SOURCE_FILE("networkpool.cpp")
+
+#include "networkpool.h"
+#include "testshim.h"
+#include <QNetworkReply>
+#include <QThread>
+#include <QThreadStorage>
+#include <atomic>
+#include <chrono>
+
+namespace
+{
+    // Attribute used to store the time a request was started (in
+    // milliseconds on the steady clock) for the handshake metrics
+    const QNetworkRequest::Attribute poolStartTimeAttribute{QNetworkRequest::User};
+
+    // The shared manager for each thread.  A weak reference is held so the
+    // manager is destroyed when it's no longer used.  The generation is the
+    // value of poolGeneration when it was created; it's retired when
+    // resetConnections() increments poolGeneration.
+    struct PoolThreadManager
+    {
+        QWeakPointer<QNetworkAccessManager> pManager;
+        quint64 generation{0};
+    };
+    QThreadStorage<PoolThreadManager> threadManagers;
+    std::atomic<quint64> poolGeneration{0};
+
+    std::atomic<quint64> poolRequests{0};
+    std::atomic<quint64> poolEncryptedRequests{0};
+    std::atomic<quint64> poolTlsHandshakes{0};
+    std::atomic<quint64> poolTlsHandshakeMsec{0};
+    std::atomic<quint64> poolHttp2Requests{0};
+
+    qint64 poolNowMsec()
+    {
+        using namespace std::chrono;
+        return duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+    }
+}
+
+QSharedPointer<QNetworkAccessManager> NetworkPool::get()
+{
+    PoolThreadManager &threadManager = threadManagers.localData();
+    quint64 generation = poolGeneration.load();
+    QSharedPointer<QNetworkAccessManager> pManager;
+    if(threadManager.generation == generation)
+        pManager = threadManager.pManager.toStrongRef();
+    if(pManager)
+        return pManager;
+
+    // Use deleteLater() - the last reference could be released by a reply's
+    // signal handler.
+    pManager.reset(TestShim::create<QNetworkAccessManager>(), &QObject::deleteLater);
+
+    // encrypted() is only emitted when a new connection completes its TLS
+    // handshake; requests that reuse an encrypted connection don't emit it.
+    QObject::connect(pManager.data(), &QNetworkAccessManager::encrypted,
+                     pManager.data(), [](QNetworkReply *pReply)
+    {
+        ++poolTlsHandshakes;
+        QVariant startTime = pReply->request().attribute(poolStartTimeAttribute);
+        if(startTime.isValid())
+            poolTlsHandshakeMsec += static_cast<quint64>(poolNowMsec() - startTime.toLongLong());
+    });
+    QObject::connect(pManager.data(), &QNetworkAccessManager::finished,
+                     pManager.data(), [](QNetworkReply *pReply)
+    {
+        ++poolRequests;
+        if(pReply->url().scheme() == QStringLiteral("https"))
+            ++poolEncryptedRequests;
+        if(pReply->attribute(QNetworkRequest::HTTP2WasUsedAttribute).toBool())
+            ++poolHttp2Requests;
+    });
+
+    threadManager.pManager = pManager.toWeakRef();
+    threadManager.generation = generation;
+
+    qInfo() << "Created shared network manager for thread" << QThread::currentThread();
+    return pManager;
+}
+
+void NetworkPool::prepareRequest(QNetworkRequest &request)
+{
+    request.setAttribute(QNetworkRequest::Http2AllowedAttribute, true);
+    request.setAttribute(poolStartTimeAttribute, poolNowMsec());
+}
+
+void NetworkPool::retire(const QSharedPointer<QNetworkAccessManager> &pManager)
+{
+    Q_ASSERT(!pManager || pManager->thread() == QThread::currentThread());
+    PoolThreadManager &threadManager = threadManagers.localData();
+    if(pManager && threadManager.pManager == pManager)
+    {
+        qInfo() << "Retiring shared network manager for thread" << QThread::currentThread();
+        threadManager.pManager.clear();
+    }
+}
+
+void NetworkPool::resetConnections()
+{
+    // Each thread creates a new manager the next time it's needed
+    ++poolGeneration;
+    qInfo() << "Retired shared network managers, new requests will use new connections";
+    traceMetrics();
+}
+
+auto NetworkPool::metrics() -> Metrics
+{
+    return {poolRequests, poolEncryptedRequests, poolTlsHandshakes,
+            poolTlsHandshakeMsec, poolHttp2Requests};
+}
+
+void NetworkPool::traceMetrics()
+{
+    Metrics current = metrics();
+    // Reused requests are HTTPS requests that didn't need a new handshake.
+    // (Handshakes can outnumber finished requests while requests are in
+    // progress.)
+    quint64 reused = current.encryptedRequests > current.tlsHandshakes ?
+        current.encryptedRequests - current.tlsHandshakes : 0;
+    qInfo() << "Network pool:" << current.requests << "requests,"
+        << current.encryptedRequests << "HTTPS," << reused << "reused encrypted connections,"
+        << current.tlsHandshakes << "TLS handshakes, average handshake"
+        << traceMsec(current.tlsHandshakes ? static_cast<qint64>(current.tlsHandshakeMsec / current.tlsHandshakes) : 0)
+        << "-" << current.http2Requests << "HTTP/2 requests";
+}
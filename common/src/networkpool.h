@@ -0,0 +1,111 @@
+// Copyright (c) 2019 London Trust Media Incorporated
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#line HEADER_FILE("networkpool.h")
+
+#ifndef NETWORKPOOL_H
+#define NETWORKPOOL_H
+#pragma once
+
+#include <QNetworkAccessManager>
+#include <QNetworkRequest>
+#include <QSharedPointer>
+
+// NetworkPool provides the QNetworkAccessManager shared by the daemon's HTTP
+// clients (API requests, JSON refreshers including the update metadata, and
+// port forwarding).
+//
+// Installer downloads are the exception - InstallerDownload uses
+// UpdateDownloader's own manager.  Its ranged segments are long-lived
+// transfers; on the shared manager they would hold several of the per-host
+// connections (below) for minutes, and API requests to the same host would
+// queue behind them.
+//
+// QNetworkAccessManager keeps idle connections alive and shares TLS sessions
+// among its connections, but only within one manager.  Sharing one manager
+// lets requests to the same host reuse connections and resume TLS sessions
+// regardless of which client sends them, and it applies the manager's
+// connections-per-host limit across all clients.
+//
+// That limit is Qt's default of 6 HTTP/1.1 connections per host (HTTP/2
+// requests are multiplexed on one connection).  Qt 5 has no public API to
+// change it, and it's deliberately left alone - the shared clients make
+// only a few short requests at a time, well under the limit, and excess
+// requests just wait for a free connection.
+//
+// Managers can only be used on the thread that created them, so there is one
+// shared manager per thread.  It's destroyed when the last client on that
+// thread releases it.
+//
+// Cached connections are discarded by retiring the manager rather than
+// clearing its connection cache, which would also break requests in progress.
+// A retired manager isn't returned by get() again; its requests in progress
+// finish normally, and it's destroyed once its clients release it.  Clients
+// should call get() for each request (or attempt) so they pick up the new
+// manager; holding a reference between requests keeps its connections
+// alive for reuse.
+class COMMON_EXPORT NetworkPool
+{
+    CLASS_LOGGING_CATEGORY("networkpool")
+
+public:
+    // Connection reuse metrics, totaled for all shared managers since startup.
+    struct Metrics
+    {
+        // Requests completed, and how many of those were HTTPS
+        quint64 requests;
+        quint64 encryptedRequests;
+        // New TLS connections (HTTPS requests that did not reuse an
+        // encrypted connection)
+        quint64 tlsHandshakes;
+        // Total time spent establishing those connections (from starting the
+        // request until the connection was encrypted)
+        quint64 tlsHandshakeMsec;
+        // Requests that were sent using HTTP/2
+        quint64 http2Requests;
+    };
+
+public:
+    // Get the shared manager for the current thread, creating it if needed.
+    // Uses TestShim::create(), so unit tests can mock the manager.
+    static QSharedPointer<QNetworkAccessManager> get();
+
+    // Prepare a request to be sent with a shared manager - allows HTTP/2 and
+    // records the start time for the handshake metrics.  Requests that aren't
+    // prepared still work, but they use HTTP/1.1 and aren't timed.
+    static void prepareRequest(QNetworkRequest &request);
+
+    // Retire a shared manager, so get() returns a new manager on its thread.
+    // Must be called on the manager's thread.  Used after a failed request,
+    // in case it failed due to a broken cached connection.  Has no effect if
+    // the manager was already retired.
+    static void retire(const QSharedPointer<QNetworkAccessManager> &pManager);
+
+    // Retire the shared managers on all threads.  Cached connections break
+    // when the VPN connects or disconnects, and using a broken connection
+    // waits for the request to time out.  New requests use new connections;
+    // requests in progress finish on the retired managers.
+    static void resetConnections();
+
+    static Metrics metrics();
+    // Log the current metrics
+    static void traceMetrics();
+};
+
+#endif
@@ -20,9 +20,12 @@
 #line SOURCE_FILE("networktaskwithretry.cpp")
 
 #include "networktaskwithretry.h"
+#include "networkpool.h"
 #include <QTimer>
+#include <QElapsedTimer>
 #include <QNetworkRequest>
 #include <QNetworkReply>
+#include <QPointer>
 
 namespace
 {
@@ -44,21 +47,30 @@ NetworkTaskWithRetry::NetworkTaskWithRetry(QNetworkAccessManager::Operation verb
                                            std::unique_ptr<ApiRetry> pRetryStrategy,
                                            const QJsonDocument &data,
                                            QByteArray authHeaderVal,
-                                           QSharedPointer<QNetworkAccessManager> pNetworkManager)
+                                           RawHeaders extraHeaders,
+                                           bool hedgeRequests)
     : _verb{std::move(verb)}, _baseUriSequence{apiBaseUris.beginAttempt()},
       _pRetryStrategy{std::move(pRetryStrategy)}, _resource{std::move(resource)},
       _data{(data.isNull() ? QByteArray() : data.toJson())},
       _authHeaderVal{std::move(authHeaderVal)},
-      _pNetworkManager{std::move(pNetworkManager)},
-      _worstRetriableError{Error::Code::ApiNetworkError}
+      _extraHeaders{std::move(extraHeaders)},
+      _hedgeRequests{hedgeRequests}, _requestsInFlight{0},
+      _worstRetriableError{Error::Code::ApiNetworkError},
+      _clearConnectionsOnRetry{false}, _replyStatus{0}
 {
-    Q_ASSERT(_pNetworkManager);
     Q_ASSERT(_pRetryStrategy);
     // Only GET and HEAD are supported right now
     Q_ASSERT(_verb == QNetworkAccessManager::Operation::GetOperation ||
              _verb == QNetworkAccessManager::Operation::PostOperation ||
              _verb == QNetworkAccessManager::Operation::HeadOperation);
 
+    // POST requests might not be idempotent, don't send them twice
+    if(_verb == QNetworkAccessManager::Operation::PostOperation)
+        _hedgeRequests = false;
+    _hedgeTimer.setSingleShot(true);
+    connect(&_hedgeTimer, &QTimer::timeout, this,
+            &NetworkTaskWithRetry::hedgeTimerElapsed);
+
     scheduleNextAttempt();
 }
 
@@ -67,10 +79,19 @@ NetworkTaskWithRetry::~NetworkTaskWithRetry()
 
 }
 
+QByteArray NetworkTaskWithRetry::replyHeader(const QByteArray &name) const
+{
+    for(const auto &header : _replyHeaders)
+    {
+        if(header.first.compare(name, Qt::CaseInsensitive) == 0)
+            return header.second;
+    }
+    return {};
+}
+
 void NetworkTaskWithRetry::scheduleNextAttempt()
 {
     Q_ASSERT(_pRetryStrategy);  // Class invariant
-    Q_ASSERT(_pNetworkManager); // Class invariant
 
     nullable_t<std::chrono::milliseconds> nextDelay = _pRetryStrategy->beginNextAttempt(_resource);
     if(!nextDelay)
@@ -86,32 +107,64 @@ void NetworkTaskWithRetry::scheduleNextAttempt()
 
 void NetworkTaskWithRetry::executeNextAttempt()
 {
-    // Clear the connection cache for every request.
+    // Use new connections when retrying a failed request.
     //
     // QNetworkManager caches connections for reuse, but if we connect or
     // disconnect from the VPN, these connections break.  If QNetworkManager
-    // uses a cached connection that's broken, we end up waiting the full
-    // 10 seconds before the request is aborted.
-    //
-    // The cost of waiting for a bad cached connection to time out is a lot
-    // higher than the cost of establishing a new connection, so clear them
-    // every time.  (There is no way to disable connection caching in
-    // QNetworkAccessManager.)
+    // uses a cached connection that's broken, we end up waiting for the
+    // request to time out.
     //
-    // In principle, we could try to do this only when the connection state
-    // changes, but it would have to be cleared any time the OpenVPNProcess
-    // state changes, which doesn't always cause a state transition in
-    // VPNConnection.  The cost of failing to clear the cache is pretty high,
-    // but the cost of clearing it an extra time is pretty small, so such an
-    // optimization probably would be too complex to make sense.
-    _pNetworkManager->clearConnectionCache();
+    // The network manager is shared by all clients (see NetworkPool), so
+    // discarding connections for every request would prevent any connection
+    // reuse.  The daemon resets the pool when the VPN connection state
+    // changes, but OpenVPNProcess state changes don't always cause a state
+    // transition in VPNConnection, so a failed attempt also retires the
+    // manager in case it was due to a broken connection.  Other clients'
+    // requests in progress on that manager aren't affected.
+    if(_clearConnectionsOnRetry)
+        NetworkPool::retire(_pNetworkManager);
+    // Get the current manager for each attempt, in case it was retired
+    _pNetworkManager = NetworkPool::get();
+
+    // Requests from prior attempts have all finished
+    _activeReplies.clear();
+    sendAttemptRequest();
+
+    // If the base is slow to respond, also send the request to the next base
+    if(_hedgeRequests && _baseUriSequence.canHedge())
+        _hedgeTimer.start(msec32(_baseUriSequence.getHedgeDelay()));
+}
+
+void NetworkTaskWithRetry::hedgeTimerElapsed()
+{
+    // Check that the attempt is still in progress and that the next base is
+    // still usable
+    if(isFinished() || !_requestsInFlight || !_baseUriSequence.canHedge())
+        return;
+
+    qInfo() << "Request for" << _resource << "is slow, sending hedged request";
+    sendAttemptRequest();
+}
+
+void NetworkTaskWithRetry::sendAttemptRequest()
+{
+    unsigned base = _baseUriSequence.getNextBase();
+    QElapsedTimer requestTime;
+    requestTime.start();
+    ++_requestsInFlight;
 
     // Handle the request
-    sendRequest()
-            ->notify(this, [this](const Error& error, const QByteArray& body) {
+    sendRequest(base)
+            ->notify(this, [this, base, requestTime](const Error& error, const QByteArray& body) {
+                auto keepAlive = sharedFromThis();
+                --_requestsInFlight;
+
+                // If another request for this attempt already finished the
+                // task, this one was aborted, ignore it.
+                if (isFinished())
+                    return;
 
-                // Release this task; it's no longer needed
-                _pNetworkReply.reset();
+                std::chrono::milliseconds time{requestTime.elapsed()};
 
                 // Check for errors
                 if (error)
@@ -119,10 +172,16 @@ void NetworkTaskWithRetry::executeNextAttempt()
                     // Auth errors can't be retried.
                     if (error.code() == Error::ApiUnauthorizedError)
                     {
+                        // The base did respond, it's healthy
+                        _baseUriSequence.attemptResponded(base, time);
+                        _hedgeTimer.stop();
                         reject(error);
+                        abortRequests();
                         return;
                     }
 
+                    _baseUriSequence.attemptFailed(base);
+
                     // A rate limiting error is worse than a network error - set the worst
                     // retriable error, but keep trying in case another API endpoint gives us
                     // 200 or 401.
@@ -134,22 +193,46 @@ void NetworkTaskWithRetry::executeNextAttempt()
                     qWarning() << "Attempt for" << _resource
                         << "failed with error" << error;
 
+                    // If a hedged request is still in progress, wait for it
+                    if (_requestsInFlight)
+                        return;
+
                     // Retry if we still have attempts left.
+                    _hedgeTimer.stop();
+                    _clearConnectionsOnRetry = true;
                     scheduleNextAttempt();
                 }
                 else
                 {
-                    _baseUriSequence.attemptSucceeded();
+                    _baseUriSequence.attemptSucceeded(base, time);
+                    _hedgeTimer.stop();
                     resolve(body);
+                    // Abort a hedged request that's still in progress
+                    abortRequests();
                 }
             });
 }
 
-Async<QByteArray> NetworkTaskWithRetry::sendRequest()
+void NetworkTaskWithRetry::abortRequests()
 {
-    QNetworkRequest request(_baseUriSequence.getNextUri() + _resource);
+    // Aborting a reply completes it synchronously, take the list first
+    auto replies = std::move(_activeReplies);
+    _activeReplies.clear();
+    for (const auto &pReply : replies)
+    {
+        if (pReply && pReply->isRunning())
+            pReply->abort();
+    }
+}
+
+Async<QByteArray> NetworkTaskWithRetry::sendRequest(unsigned base)
+{
+    QNetworkRequest request(_baseUriSequence.getUri(base) + _resource);
+    NetworkPool::prepareRequest(request);
     if (!_authHeaderVal.isEmpty())
         setAuth(request, _authHeaderVal);
+    for (const auto &header : _extraHeaders)
+        request.setRawHeader(header.first, header.second);
 
     // The URL for each request is logged to indicate if there is trouble with
     // specific API URLs, etc.  The resources we request don't contain any
@@ -182,6 +265,7 @@ Async<QByteArray> NetworkTaskWithRetry::sendRequest()
     // in (e.g. abort->finished->delete is not currently safe). This way
     // we don't have to delay the entire finished signal to stay safe.
     QSharedPointer<QNetworkReply> reply(replyPtr, &QObject::deleteLater);
+    _activeReplies.push_back(replyPtr);
 
     // Abort the request if it doesn't complete within a certain interval
     QTimer::singleShot(std::chrono::milliseconds(requestTimeout).count(), reply.get(), &QNetworkReply::abort);
@@ -189,7 +273,8 @@ Async<QByteArray> NetworkTaskWithRetry::sendRequest()
     // Create a network task that resolves to the result of the request
     auto networkTask = Async<QByteArray>::create();
     QString resource = _resource;
-    connect(reply.get(), &QNetworkReply::finished, networkTask.get(), [networkTask = networkTask.get(), reply, resource]
+    QPointer<NetworkTaskWithRetry> pThis{this};
+    connect(reply.get(), &QNetworkReply::finished, networkTask.get(), [networkTask = networkTask.get(), reply, resource, pThis]
     {
         auto keepAlive = networkTask->sharedFromThis();
 
@@ -232,6 +317,11 @@ Async<QByteArray> NetworkTaskWithRetry::sendRequest()
             return;
         }
 
+        if (pThis)
+        {
+            pThis->_replyStatus = statusCode.toInt();
+            pThis->_replyHeaders = reply->rawHeaderPairs();
+        }
         networkTask->resolve(reply->readAll());
     });
 
@@ -27,7 +27,11 @@
 #include "apiretry.h"
 #include <QJsonDocument>
 #include <QNetworkAccessManager>
+#include <QNetworkReply>
+#include <QPointer>
+#include <QTimer>
 #include <memory>
+#include <vector>
 
 // NetworkTaskWithRetry executes an API request until either it succeeds or
 // the maximum attempt count is reached.  It uses a NetworkReplyHandler for each
@@ -36,6 +40,10 @@ class COMMON_EXPORT NetworkTaskWithRetry : public Task<QByteArray>
 {
     CLASS_LOGGING_CATEGORY("apiclient")
 
+public:
+    // Raw header name/value pairs
+    using RawHeaders = QList<QPair<QByteArray, QByteArray>>;
+
 public:
     // Create NetworkTaskWithRetry with the verb and request that will be used
     // for each attempt.
@@ -51,23 +59,45 @@ public:
     // URIs and 4 max attempts, each URI could be tried twice).
     //
     // If authHeaderVal is not empty, it is applied as an authorization header
-    // to each request.
+    // to each request.  Any extraHeaders are also applied to each request.
+    //
+    // The base URIs are attempted in order of their health (see ApiBaseData).
+    // If hedgeRequests is set, an attempt that is slow to respond (slower
+    // than the ApiBase's 95th percentile response time) also sends the request
+    // to the next base, and the first response is used.  This is only done
+    // for GET and HEAD requests.
+    //
+    // Each attempt uses the current shared network manager (see NetworkPool).
     NetworkTaskWithRetry(QNetworkAccessManager::Operation verb,
                          ApiBase &apiBaseUris, QString resource,
                          std::unique_ptr<ApiRetry> pRetryStrategy,
                          const QJsonDocument &data, QByteArray authHeaderVal,
-                         QSharedPointer<QNetworkAccessManager> pNetworkManager);
+                         RawHeaders extraHeaders = {},
+                         bool hedgeRequests = false);
     ~NetworkTaskWithRetry();
 
+    // The HTTP status and response headers of the attempt that succeeded.
+    // Valid once the task has resolved.  (For example, a 304 response to a
+    // conditional request resolves with an empty body.)
+    int replyStatus() const {return _replyStatus;}
+    QByteArray replyHeader(const QByteArray &name) const;
+
 private:
     // Schedule an attempt, or reject if all attempts have been used.
     void scheduleNextAttempt();
 
     // Execute an attempt (used by scheduleNextAttempt())
     void executeNextAttempt();
+    // Send a hedged request if the attempt is still in progress
+    void hedgeTimerElapsed();
+    // Send a request to the next base for the current attempt, and handle its
+    // result
+    void sendAttemptRequest();
+    // Abort any requests still in progress
+    void abortRequests();
 
-    // Create task to issue a single request and return its body.
-    Async<QByteArray> sendRequest();
+    // Create task to issue a single request to a base and return its body.
+    Async<QByteArray> sendRequest(unsigned base);
 
 private:
     QNetworkAccessManager::Operation _verb;
@@ -76,13 +106,26 @@ private:
     QString _resource;
     QByteArray _data;
     QByteArray _authHeaderVal;
+    // Shared network manager used for the current attempt
     QSharedPointer<QNetworkAccessManager> _pNetworkManager;
-    Async<QByteArray> _pNetworkReply;
+    RawHeaders _extraHeaders;
+    bool _hedgeRequests;
+    QTimer _hedgeTimer;
+    // Number of requests in progress for the current attempt (2 if a hedged
+    // request was sent), and their replies
+    unsigned _requestsInFlight;
+    std::vector<QPointer<QNetworkReply>> _activeReplies;
     // ApiRateLimitedError is retriable but causes us to return that instead of
     // the generic error if we don't encounter an auth error.
     // This field keeps track of the worst retriable error we have seen, if we
     // fail due to all attempts failing, this is the error we return.
     Error::Code _worstRetriableError;
+    // Set after an attempt fails - the next attempt retires the network
+    // manager first, so it uses new connections.
+    bool _clearConnectionsOnRetry;
+    // Status and headers from the successful reply
+    int _replyStatus;
+    RawHeaders _replyHeaders;
 };
 
 #endif
@@ -168,17 +168,8 @@ static int (*EVP_DigestUpdate)(EVP_MD_CTX* ctx, const void* d, size_t cnt) = nul
 static int (*EVP_DigestVerifyFinal)(EVP_MD_CTX* ctx, const unsigned char* sig, size_t siglen) = nullptr;
 
 
-static bool checkOpenSSL()
+static bool loadOpenSSL()
 {
-    static bool attempted = false, successful = false;
-
-    if (successful)
-        return true;
-    if (attempted)
-        return false;
-
-    attempted = true;
-
     // This triggers Qt to load OpenSSL dynamically.
     if (!QSslSocket::supportsSsl())
         return false;
@@ -215,13 +206,19 @@ static bool checkOpenSSL()
 #undef RESOLVE_OPENSSL_FUNCTION
 #undef TRY_RESOLVE_OPENSSL_FUNCTION
 
-        successful = true;
-
         return true;
     }
     return false;
 }
 
+static bool checkOpenSSL()
+{
+    // Only attempted once.  The static initialization is thread-safe, so
+    // verifiers can be used from worker threads.
+    static const bool successful = loadOpenSSL();
+    return successful;
+}
+
 static const EVP_MD* getMD(QCryptographicHash::Algorithm algorithm)
 {
     switch (algorithm)
@@ -247,34 +244,84 @@ static EVP_PKEY* createPublicKeyFromPem(const QByteArray& pem)
     return result;
 }
 
-bool verifySignature(const QByteArray& publicKeyPem, const QByteArray& signature, const QByteArray& data, QCryptographicHash::Algorithm hashAlgorithm)
+static void printOpenSSLErrors()
+{
+    ERR_print_errors_cb([](const char* str, size_t len, void*) {
+        qWarning() << QLatin1String(str, static_cast<int>(len));
+        return 0;
+    }, nullptr);
+}
+
+SignatureVerifier::SignatureVerifier(const QByteArray& publicKeyPem, QCryptographicHash::Algorithm hashAlgorithm)
+    : _state{State::Failed}, _pKey{nullptr}, _pCtx{nullptr}
 {
     // For the time being, treat OpenSSL errors (e.g. unable to find the
     // library) as though the signature validated successfully.
-    const bool opensslError = true;
-
-    if (!checkOpenSSL()) return opensslError;
+    if (!checkOpenSSL())
+    {
+        _state = State::OpenSSLUnavailable;
+        return;
+    }
 
     auto md = getMD(hashAlgorithm);
-    if (!md) return false;
+    if (!md) return;
 
-    EVP_PKEY* pkey = createPublicKeyFromPem(publicKeyPem);
-    if (!pkey) return false;
-    AT_SCOPE_EXIT(EVP_PKEY_free(pkey));
+    _pKey = createPublicKeyFromPem(publicKeyPem);
+    if (!_pKey) return;
 
-    auto ctx = EVP_MD_CTX_create();
-    if (!ctx) return false;
-    AT_SCOPE_EXIT(EVP_MD_CTX_destroy(ctx));
+    _pCtx = EVP_MD_CTX_create();
+    if (!_pCtx) return;
 
-    if (1 == EVP_DigestVerifyInit(ctx, nullptr, md, nullptr, pkey) &&
-        1 == EVP_DigestUpdate(ctx, data.data(), static_cast<size_t>(data.size())) &&
-        1 == EVP_DigestVerifyFinal(ctx, reinterpret_cast<const unsigned char*>(signature.data()), static_cast<size_t>(signature.size())))
-        return true;
+    if (1 == EVP_DigestVerifyInit(_pCtx, nullptr, md, nullptr, _pKey))
+        _state = State::Ready;
+    else
+        printOpenSSLErrors();
+}
 
-    ERR_print_errors_cb([](const char* str, size_t len, void*) {
-        qWarning() << QLatin1String(str, static_cast<int>(len));
-        return 0;
-    }, nullptr);
+SignatureVerifier::~SignatureVerifier()
+{
+    if (_pCtx)
+        EVP_MD_CTX_destroy(_pCtx);
+    if (_pKey)
+        EVP_PKEY_free(_pKey);
+}
 
-    return false;
+void SignatureVerifier::update(const char* data, qint64 size)
+{
+    Q_ASSERT(_state != State::Finished);
+    if (_state != State::Ready || size <= 0)
+        return;
+
+    if (1 != EVP_DigestUpdate(_pCtx, data, static_cast<size_t>(size)))
+    {
+        printOpenSSLErrors();
+        _state = State::Failed;
+    }
+}
+
+bool SignatureVerifier::verify(const QByteArray& signature)
+{
+    Q_ASSERT(_state != State::Finished);
+    State state = _state;
+    _state = State::Finished;
+
+    switch (state)
+    {
+    case State::OpenSSLUnavailable:
+        return true;
+    case State::Ready:
+        if (1 == EVP_DigestVerifyFinal(_pCtx, reinterpret_cast<const unsigned char*>(signature.data()), static_cast<size_t>(signature.size())))
+            return true;
+        printOpenSSLErrors();
+        return false;
+    default:
+        return false;
+    }
+}
+
+bool verifySignature(const QByteArray& publicKeyPem, const QByteArray& signature, const QByteArray& data, QCryptographicHash::Algorithm hashAlgorithm)
+{
+    SignatureVerifier verifier{publicKeyPem, hashAlgorithm};
+    verifier.update(data);
+    return verifier.verify(signature);
 }
@@ -26,6 +26,47 @@
 #include <QByteArray>
 #include <QCryptographicHash>
 
+struct EVP_MD_CTX;
+struct EVP_PKEY;
+
+// Verify a signature over data that's provided incrementally, such as from
+// network reads or file chunks.  Construct with the key, call update() with
+// each chunk of data, then call verify() with the signature.
+//
+// OpenSSL is loaded on first use; verifiers can be used on any thread (each
+// verifier must be used by one thread at a time).
+//
+// Like verifySignature(), if OpenSSL can't be loaded at all, verify() returns
+// true.
+class COMMON_EXPORT SignatureVerifier
+{
+public:
+    explicit SignatureVerifier(const QByteArray& publicKeyPem,
+                               QCryptographicHash::Algorithm hashAlgorithm = QCryptographicHash::Sha256);
+    ~SignatureVerifier();
+    SignatureVerifier(const SignatureVerifier&) = delete;
+    SignatureVerifier& operator=(const SignatureVerifier&) = delete;
+
+    void update(const char* data, qint64 size);
+    void update(const QByteArray& data) { update(data.data(), data.size()); }
+    // Check the signature of all the data provided to update().  This can only
+    // be called once.
+    bool verify(const QByteArray& signature);
+
+private:
+    enum class State
+    {
+        Ready,
+        Failed,             // The key or hash algorithm are not valid
+        OpenSSLUnavailable, // OpenSSL couldn't be loaded
+        Finished,
+    };
+
+    State _state;
+    EVP_PKEY* _pKey;
+    EVP_MD_CTX* _pCtx;
+};
+
 bool COMMON_EXPORT verifySignature(const QByteArray& publicKeyPem, const QByteArray& signature, const QByteArray& data, QCryptographicHash::Algorithm hashAlgorithm = QCryptographicHash::Sha256);
 
 #endif // OPENSSL_H
@@ -0,0 +1,676 @@
+// Copyright (c) 2019 London Trust Media Incorporated
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#line SOURCE_FILE("serverlistparser.cpp")
+
+#include "serverlistparser.h"
+#include <limits>
+#include <utility>
+
+namespace
+{
+    // Limit on nesting of skipped values
+    const int serverListMaxDepth{64};
+
+    // Bits for the required fields of a location
+    enum ServerListField : unsigned
+    {
+        ServerListName = 0x01,
+        ServerListCountry = 0x02,
+        ServerListDns = 0x04,
+        ServerListPortForward = 0x08,
+        ServerListPing = 0x10,
+        ServerListOpenvpnUDP = 0x20,
+        ServerListOpenvpnTCP = 0x40,
+        ServerListRequiredFields = 0x7F
+    };
+
+    const std::pair<ServerListField, const char *> serverListFieldNames[]
+    {
+        {ServerListName, "name"},
+        {ServerListCountry, "country"},
+        {ServerListDns, "dns"},
+        {ServerListPortForward, "port_forward"},
+        {ServerListPing, "ping"},
+        {ServerListOpenvpnUDP, "openvpn_udp"},
+        {ServerListOpenvpnTCP, "openvpn_tcp"}
+    };
+
+    int hexDigitValue(char c)
+    {
+        if(c >= '0' && c <= '9')
+            return c - '0';
+        if(c >= 'a' && c <= 'f')
+            return c - 'a' + 10;
+        if(c >= 'A' && c <= 'F')
+            return c - 'A' + 10;
+        return -1;
+    }
+}
+
+bool ServerListParser::parse(const QByteArray &payload, ServerList &list)
+{
+    list = {};
+    ServerListParser parser{payload};
+    if(parser.parseServerList(list))
+        return true;
+
+    list.locations.clear();
+    list.autoRegions.clear();
+    list.udpPorts.clear();
+    list.tcpPorts.clear();
+    list.errors.push_back(parser._error);
+    return false;
+}
+
+ServerListParser::ServerListParser(const QByteArray &payload)
+    : _pos{payload.constData()}, _begin{payload.constData()},
+      _end{payload.constData() + payload.size()}, _failed{false}
+{
+    // Keep the capacity when the buffer is resized to 0
+    _keyBuffer.reserve(64);
+}
+
+bool ServerListParser::parseServerList(ServerList &list)
+{
+    if(!nextIsObject())
+        return fail("servers list is not an object");
+    expect('{');
+
+    bool first = true;
+    QLatin1String key;
+    while(nextMember('}', first))
+    {
+        if(!parseKey(key))
+            return false;
+
+        if(key == QLatin1String{"info"})
+        {
+            if(!parseInfo(list))
+                return false;
+        }
+        // Not locations
+        else if(key == QLatin1String{"web_ips"} || key == QLatin1String{"vpn_ports"})
+        {
+            if(!skipValue())
+                return false;
+        }
+        else
+        {
+            ServerListLocation location;
+            // The key is UTF-8 (see parseKey())
+            location.id = QString::fromUtf8(key.data(), key.size());
+            QString locationError;
+            if(!parseLocation(location, locationError))
+                return false;
+            if(locationError.isEmpty())
+                list.locations.push_back(std::move(location));
+            else
+            {
+                list.errors.push_back(QStringLiteral("Can't load location %1: %2")
+                                        .arg(location.id, locationError));
+            }
+        }
+    }
+    if(_failed)
+        return false;
+
+    skipWhitespace();
+    if(_pos != _end)
+        return fail("unexpected data after servers list");
+    return true;
+}
+
+bool ServerListParser::parseInfo(ServerList &list)
+{
+    if(!nextIsObject())
+    {
+        list.errors.push_back(QStringLiteral("info is not an object"));
+        return skipValue();
+    }
+    expect('{');
+
+    bool first = true;
+    QLatin1String key;
+    while(nextMember('}', first))
+    {
+        if(!parseKey(key))
+            return false;
+
+        if(key == QLatin1String{"auto_regions"})
+        {
+            bool valid = nextIsArray();
+            if(!valid)
+            {
+                if(!skipValue())
+                    return false;
+            }
+            else
+            {
+                expect('[');
+                bool firstRegion = true;
+                while(nextMember(']', firstRegion))
+                {
+                    QString region;
+                    if(nextIsString())
+                    {
+                        if(!parseString(region))
+                            return false;
+                        list.autoRegions.push_back(std::move(region));
+                    }
+                    else
+                    {
+                        valid = false;
+                        if(!skipValue())
+                            return false;
+                    }
+                }
+                if(_failed)
+                    return false;
+            }
+            if(!valid)
+            {
+                list.autoRegions.clear();
+                list.errors.push_back(QStringLiteral("info.auto_regions is not valid"));
+            }
+        }
+        else if(key == QLatin1String{"vpn_ports"} && nextIsObject())
+        {
+            expect('{');
+            bool firstPorts = true;
+            QLatin1String portsKey;
+            while(nextMember('}', firstPorts))
+            {
+                if(!parseKey(portsKey))
+                    return false;
+                QVector<uint> *pPorts{nullptr};
+                const char *portsName{nullptr};
+                if(portsKey == QLatin1String{"udp"})
+                {
+                    pPorts = &list.udpPorts;
+                    portsName = "udp";
+                }
+                else if(portsKey == QLatin1String{"tcp"})
+                {
+                    pPorts = &list.tcpPorts;
+                    portsName = "tcp";
+                }
+
+                if(!pPorts)
+                {
+                    if(!skipValue())
+                        return false;
+                    continue;
+                }
+
+                bool valid;
+                if(!parsePorts(*pPorts, valid))
+                    return false;
+                if(!valid)
+                {
+                    pPorts->clear();
+                    list.errors.push_back(QStringLiteral("info.vpn_ports.%1 is not valid")
+                                            .arg(QLatin1String{portsName}));
+                }
+            }
+            if(_failed)
+                return false;
+        }
+        else if(!skipValue())
+            return false;
+    }
+    return !_failed;
+}
+
+bool ServerListParser::parseLocation(ServerListLocation &location, QString &locationError)
+{
+    if(!nextIsObject())
+    {
+        locationError = QStringLiteral("not an object");
+        return skipValue();
+    }
+    expect('{');
+
+    unsigned fieldsFound = 0;
+    auto stringField = [&](QString &value, ServerListField field, QLatin1String name)
+    {
+        if(!nextIsString())
+        {
+            if(locationError.isEmpty())
+                locationError = QStringLiteral("%1 is not a string").arg(QString{name});
+            return skipValue();
+        }
+        fieldsFound |= field;
+        return parseString(value);
+    };
+
+    bool first = true;
+    QLatin1String key;
+    while(nextMember('}', first))
+    {
+        if(!parseKey(key))
+            return false;
+
+        bool ok;
+        if(key == QLatin1String{"name"})
+            ok = stringField(location.name, ServerListName, key);
+        else if(key == QLatin1String{"country"})
+            ok = stringField(location.country, ServerListCountry, key);
+        else if(key == QLatin1String{"dns"})
+            ok = stringField(location.dns, ServerListDns, key);
+        else if(key == QLatin1String{"ping"})
+            ok = stringField(location.ping, ServerListPing, key);
+        else if(key == QLatin1String{"port_forward"})
+        {
+            char next = peek();
+            if(next == 't' || next == 'f')
+            {
+                fieldsFound |= ServerListPortForward;
+                ok = parseBool(location.portForward);
+            }
+            else
+            {
+                if(locationError.isEmpty())
+                    locationError = QStringLiteral("port_forward is not a boolean");
+                ok = skipValue();
+            }
+        }
+        else if(key == QLatin1String{"openvpn_udp"} || key == QLatin1String{"openvpn_tcp"})
+        {
+            bool udp = key == QLatin1String{"openvpn_udp"};
+            bool valid;
+            ok = parseBestAddress(udp ? location.openvpnUDP : location.openvpnTCP, valid);
+            if(valid)
+                fieldsFound |= udp ? ServerListOpenvpnUDP : ServerListOpenvpnTCP;
+        }
+        // The serial is optional, it's empty if it's not a string
+        else if(key == QLatin1String{"serial"} && nextIsString())
+            ok = parseString(location.serial);
+        else
+            ok = skipValue();
+
+        if(!ok)
+            return false;
+    }
+    if(_failed)
+        return false;
+
+    if(locationError.isEmpty() && fieldsFound != ServerListRequiredFields)
+    {
+        for(const auto &fieldName : serverListFieldNames)
+        {
+            if(!(fieldsFound & fieldName.first))
+            {
+                locationError = QStringLiteral("missing %1").arg(QLatin1String{fieldName.second});
+                break;
+            }
+        }
+    }
+    return true;
+}
+
+bool ServerListParser::parsePorts(QVector<uint> &ports, bool &valid)
+{
+    valid = nextIsArray();
+    if(!valid)
+        return skipValue();
+    expect('[');
+
+    bool first = true;
+    while(nextMember(']', first))
+    {
+        uint port;
+        bool isUInt = false;
+        char next = peek();
+        if(next >= '0' && next <= '9')
+        {
+            if(!parseUInt(port))
+                return false;
+            isUInt = true;
+            // A fraction or exponent follows - not an integer
+            next = _pos < _end ? *_pos : 0;
+            if(next == '.' || next == 'e' || next == 'E')
+                isUInt = false;
+        }
+        if(!isUInt)
+        {
+            valid = false;
+            if(!skipValue())
+                return false;
+        }
+        else
+            ports.push_back(port);
+    }
+    return !_failed;
+}
+
+bool ServerListParser::parseBestAddress(QString &address, bool &valid)
+{
+    valid = false;
+    if(!nextIsObject())
+        return skipValue();
+    expect('{');
+
+    bool first = true;
+    QLatin1String key;
+    while(nextMember('}', first))
+    {
+        if(!parseKey(key))
+            return false;
+        if(key == QLatin1String{"best"} && nextIsString())
+        {
+            if(!parseString(address))
+                return false;
+            valid = true;
+        }
+        else if(!skipValue())
+            return false;
+    }
+    return !_failed;
+}
+
+bool ServerListParser::fail(const char *message)
+{
+    if(!_failed)
+    {
+        _failed = true;
+        _error = QStringLiteral("Servers list is not valid at offset %1: %2")
+                    .arg(_pos - _begin).arg(QLatin1String{message});
+    }
+    return false;
+}
+
+void ServerListParser::skipWhitespace()
+{
+    while(_pos < _end && (*_pos == ' ' || *_pos == '\n' || *_pos == '\r' || *_pos == '\t'))
+        ++_pos;
+}
+
+bool ServerListParser::expect(char c)
+{
+    if(consume(c))
+        return true;
+    char message[] = "expected ' '";
+    message[10] = c;
+    return fail(message);
+}
+
+bool ServerListParser::consume(char c)
+{
+    skipWhitespace();
+    if(_pos < _end && *_pos == c)
+    {
+        ++_pos;
+        return true;
+    }
+    return false;
+}
+
+char ServerListParser::peek()
+{
+    skipWhitespace();
+    return _pos < _end ? *_pos : 0;
+}
+
+bool ServerListParser::nextMember(char close, bool &first)
+{
+    if(_failed || consume(close))
+        return false;
+    if(first)
+        first = false;
+    else if(!expect(','))
+        return false;
+    return true;
+}
+
+bool ServerListParser::parseKey(QLatin1String &key)
+{
+    if(!expect('"'))
+        return false;
+
+    // Scan for the end of the key.  Keys almost never have escapes, so refer
+    // to the payload directly if possible.
+    const char *keyStart = _pos;
+    while(_pos < _end && *_pos != '"' && *_pos != '\\')
+    {
+        if(static_cast<unsigned char>(*_pos) < 0x20)
+            return fail("control character in string");
+        ++_pos;
+    }
+    if(_pos >= _end)
+        return fail("unterminated string");
+
+    if(*_pos == '"')
+    {
+        key = QLatin1String{keyStart, static_cast<int>(_pos - keyStart)};
+        ++_pos;
+    }
+    else
+    {
+        // Decode the escapes; back up to the opening quote
+        _pos = keyStart - 1;
+        QString decoded;
+        if(!parseString(decoded))
+            return false;
+        _keyBuffer.resize(0);
+        _keyBuffer.append(decoded.toUtf8());
+        key = QLatin1String{_keyBuffer.constData(), _keyBuffer.size()};
+    }
+
+    return expect(':');
+}
+
+bool ServerListParser::parseString(QString &value)
+{
+    if(!expect('"'))
+        return false;
+
+    bool escaped = false;
+    const char *runStart = _pos;
+    while(_pos < _end)
+    {
+        char c = *_pos;
+        if(c == '"')
+        {
+            if(escaped)
+                value.append(QString::fromUtf8(runStart, static_cast<int>(_pos - runStart)));
+            else
+                value = QString::fromUtf8(runStart, static_cast<int>(_pos - runStart));
+            ++_pos;
+            return true;
+        }
+        if(c == '\\')
+        {
+            if(!escaped)
+            {
+                value.clear();
+                escaped = true;
+            }
+            value.append(QString::fromUtf8(runStart, static_cast<int>(_pos - runStart)));
+            ++_pos;
+            if(_pos >= _end)
+                break;
+            switch(*_pos)
+            {
+                case '"': value.append(QChar{'"'}); break;
+                case '\\': value.append(QChar{'\\'}); break;
+                case '/': value.append(QChar{'/'}); break;
+                case 'b': value.append(QChar{'\b'}); break;
+                case 'f': value.append(QChar{'\f'}); break;
+                case 'n': value.append(QChar{'\n'}); break;
+                case 'r': value.append(QChar{'\r'}); break;
+                case 't': value.append(QChar{'\t'}); break;
+                case 'u':
+                {
+                    if(_end - _pos < 5)
+                        return fail("invalid unicode escape");
+                    ushort unit = 0;
+                    for(int i=1; i<=4; ++i)
+                    {
+                        int digit = hexDigitValue(_pos[i]);
+                        if(digit < 0)
+                            return fail("invalid unicode escape");
+                        unit = static_cast<ushort>((unit << 4) | digit);
+                    }
+                    // Surrogate pairs are just two escaped UTF-16 code units
+                    value.append(QChar{unit});
+                    _pos += 4;
+                    break;
+                }
+                default:
+                    return fail("invalid escape");
+            }
+            ++_pos;
+            runStart = _pos;
+            continue;
+        }
+        if(static_cast<unsigned char>(c) < 0x20)
+            return fail("control character in string");
+        ++_pos;
+    }
+    return fail("unterminated string");
+}
+
+bool ServerListParser::parseBool(bool &value)
+{
+    skipWhitespace();
+    if(_end - _pos >= 4 && qstrncmp(_pos, "true", 4) == 0)
+    {
+        _pos += 4;
+        value = true;
+        return true;
+    }
+    if(_end - _pos >= 5 && qstrncmp(_pos, "false", 5) == 0)
+    {
+        _pos += 5;
+        value = false;
+        return true;
+    }
+    return fail("expected boolean");
+}
+
+bool ServerListParser::parseUInt(uint &value)
+{
+    skipWhitespace();
+    quint64 parsed = 0;
+    const char *digitsStart = _pos;
+    while(_pos < _end && *_pos >= '0' && *_pos <= '9')
+    {
+        parsed = parsed * 10 + static_cast<quint64>(*_pos - '0');
+        if(parsed > std::numeric_limits<uint>::max())
+            return fail("number out of range");
+        ++_pos;
+    }
+    if(_pos == digitsStart)
+        return fail("expected number");
+    value = static_cast<uint>(parsed);
+    return true;
+}
+
+bool ServerListParser::skipValue(int depth)
+{
+    if(depth > serverListMaxDepth)
+        return fail("nested too deeply");
+
+    char next = peek();
+    switch(next)
+    {
+        case '"':
+            return skipString();
+        case '{':
+        {
+            ++_pos;
+            bool first = true;
+            QLatin1String key;
+            while(nextMember('}', first))
+            {
+                if(!parseKey(key) || !skipValue(depth + 1))
+                    return false;
+            }
+            return !_failed;
+        }
+        case '[':
+        {
+            ++_pos;
+            bool first = true;
+            while(nextMember(']', first))
+            {
+                if(!skipValue(depth + 1))
+                    return false;
+            }
+            return !_failed;
+        }
+        case 't':
+        case 'f':
+        {
+            bool ignored;
+            return parseBool(ignored);
+        }
+        case 'n':
+            if(_end - _pos >= 4 && qstrncmp(_pos, "null", 4) == 0)
+            {
+                _pos += 4;
+                return true;
+            }
+            return fail("invalid literal");
+        default:
+            break;
+    }
+
+    // Number - this accepts some invalid forms like "1-2", they don't affect
+    // the result since skipped values aren't used.
+    const char *numberStart = _pos;
+    bool digits = false;
+    while(_pos < _end)
+    {
+        char c = *_pos;
+        if(c >= '0' && c <= '9')
+            digits = true;
+        else if(c != '-' && c != '+' && c != '.' && c != 'e' && c != 'E')
+            break;
+        ++_pos;
+    }
+    if(!digits)
+    {
+        _pos = numberStart;
+        return fail("expected value");
+    }
+    return true;
+}
+
+bool ServerListParser::skipString()
+{
+    if(!expect('"'))
+        return false;
+    while(_pos < _end)
+    {
+        char c = *_pos;
+        if(c == '"')
+        {
+            ++_pos;
+            return true;
+        }
+        if(c == '\\')
+            ++_pos; // Skip the escaped character ('\u' digits are not quotes)
+        else if(static_cast<unsigned char>(c) < 0x20)
+            return fail("control character in string");
+        ++_pos;
+    }
+    return fail("unterminated string");
+}
@@ -0,0 +1,115 @@
+// Copyright (c) 2019 London Trust Media Incorporated
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#line HEADER_FILE("serverlistparser.h")
+
+#ifndef SERVERLISTPARSER_H
+#define SERVERLISTPARSER_H
+#pragma once
+
+#include <QByteArray>
+#include <QLatin1String>
+#include <QString>
+#include <QVector>
+#include <vector>
+
+// A location from the servers list (GET /vpninfo/servers)
+struct COMMON_EXPORT ServerListLocation
+{
+    QString id, name, country, dns, ping, openvpnUDP, openvpnTCP, serial;
+    bool portForward;
+};
+
+// The content of the servers list
+struct COMMON_EXPORT ServerList
+{
+    // The valid locations, in the order they appear
+    std::vector<ServerListLocation> locations;
+    // "info.auto_regions" - the regions that can be used with 'connect auto'
+    QVector<QString> autoRegions;
+    // "info.vpn_ports" - the supported remote ports.  Empty if they're not
+    // present or not valid.
+    QVector<uint> udpPorts, tcpPorts;
+    // Descriptions of any entries that were not valid (they were skipped)
+    std::vector<QString> errors;
+};
+
+// ServerListParser reads the servers list directly from the payload into
+// ServerListLocation records in one pass, without building a QJsonDocument.
+// Values that aren't needed are skipped without being decoded.
+//
+// Location entries that are missing fields or have the wrong types are skipped
+// and described in ServerList::errors.  If the payload isn't valid JSON, or the
+// top-level value isn't an object, parsing fails.
+class COMMON_EXPORT ServerListParser
+{
+public:
+    // Parse a servers list.  Returns false if the payload can't be parsed at
+    // all; the reason is in ServerList::errors.
+    static bool parse(const QByteArray &payload, ServerList &list);
+
+private:
+    explicit ServerListParser(const QByteArray &payload);
+
+private:
+    bool parseServerList(ServerList &list);
+    bool parseInfo(ServerList &list);
+    bool parseLocation(ServerListLocation &location, QString &locationError);
+    bool parsePorts(QVector<uint> &ports, bool &valid);
+    bool parseBestAddress(QString &address, bool &valid);
+
+    // Fail with a syntax error at the current position
+    bool fail(const char *message);
+    void skipWhitespace();
+    // Consume a specific character (after any whitespace), or fail
+    bool expect(char c);
+    // Check the next character (after any whitespace) and consume it if it
+    // matches
+    bool consume(char c);
+    // Peek at the next character after whitespace; 0 at the end
+    char peek();
+    // Begin the next member of an object or element of an array (after the
+    // opening brace/bracket).  Consumes any separating comma, and returns
+    // false when the closing brace/bracket is consumed (or on failure, check
+    // _failed).
+    bool nextMember(char close, bool &first);
+    // Parse an object member's key and the following colon.  The key refers to
+    // the payload if it has no escapes, or _keyBuffer otherwise - it's only
+    // valid until the next key is parsed.
+    bool parseKey(QLatin1String &key);
+    // Parse a string value into a QString
+    bool parseString(QString &value);
+    bool parseBool(bool &value);
+    bool parseUInt(uint &value);
+    // Skip any value.  Nesting is limited to avoid unbounded recursion.
+    bool skipValue(int depth = 0);
+    bool skipString();
+    // Check the type of the next value without consuming it
+    bool nextIsString() {return peek() == '"';}
+    bool nextIsObject() {return peek() == '{';}
+    bool nextIsArray() {return peek() == '[';}
+
+private:
+    const char *_pos, *_begin, *_end;
+    bool _failed;
+    QString _error;
+    QByteArray _keyBuffer;
+};
+
+#endif
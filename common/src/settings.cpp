@@ -21,6 +21,7 @@
 
 #include "settings.h"
 #include "brand.h"
+#include "locationtable.h"
 #include <QJsonDocument>
 #include <QRegularExpression>
 #include <QSharedPointer>
@@ -192,124 +193,89 @@ bool DaemonSettings::validateDNSSetting(const DaemonSettings::DNSSetting& settin
 #if defined(PIA_DAEMON) || defined(UNIT_TEST)
 
 ServerLocations updateServerLocations(const ServerLocations &existingLocations,
-                                      const QJsonObject &serversObj)
+                                      const ServerList &serverList)
 {
     ServerLocations newLocations;
+    newLocations.reserve(static_cast<int>(serverList.locations.size()));
 
-    // The safe regions to be used with 'connect auto'
-    QVector<QString> safeAutoRegions{};
-    try
-    {
-        safeAutoRegions = JsonCaster{serversObj["info"].toObject()["auto_regions"]};
-    }
-    catch (const std::exception &ex)
-    {
-        qWarning() << "Error loading json field auto_regions. Error:" << ex.what();
-    }
+    for(const auto &error : serverList.errors)
+        qWarning() << error;
 
-    //Each location is an attribute of the top-level JSON object.
-    //Note that we can't use a range-based for loop over serversObj, since we
-    //need its keys and values.  QJsonObject's iterator dereferences to just the
-    //value, and the iterator itself has a key() method (unlike
-    //std::map::iterator, for example, which dereferences to a pair).
-    for(auto itAttr = serversObj.begin(); itAttr != serversObj.end(); ++itAttr)
+    for(const auto &record : serverList.locations)
     {
-        // Ignore a few known extra fields to avoid spurious warnings, these are
-        // not locations.
-        if(itAttr.key() == QStringLiteral("web_ips") ||
-           itAttr.key() == QStringLiteral("vpn_ports") ||
-           itAttr.key() == QStringLiteral("info"))
+        QSharedPointer<ServerLocation> pLocation{new ServerLocation{}};
+        pLocation->id(record.id);
+        pLocation->name(record.name);
+        pLocation->country(record.country);
+        pLocation->dns(record.dns);
+        pLocation->portForward(record.portForward);
+        pLocation->openvpnUDP(record.openvpnUDP);
+        pLocation->openvpnTCP(record.openvpnTCP);
+        pLocation->ping(record.ping);
+        pLocation->serial(record.serial);
+
+        // If autoRegions is empty then there's likely a bug with the server data
+        // and we work around it by just allowing 'connect auto' access to all regions -
+        // the alternative is disallowing 'connect auto' to all regions, which is not really acceptable.
+        if (!serverList.autoRegions.empty())
         {
-            continue;
+            // This server can be used with 'connect auto' if it's found in autoRegions
+            pLocation->isSafeForAutoConnect(serverList.autoRegions.contains(record.id));
         }
-
-        //Create a ServerLocation and attempt to set all of its attributes.
-        //If any attribute isn't present, isn't the right type, etc., JsonCaster
-        //throws an exception.
-        //
-        //(We end up getting an Undefined QJsonValue when accessing the
-        //attribute, and that can't be converted to the expected type of the
-        //attribute in ServerLocation.  If the ServerLocation attribute is
-        //Optional, an Undefined is fine and becomes a null.)
-        try
+        else
         {
-            QSharedPointer<ServerLocation> pLocation;
-            //Does this location already exist?
-            auto itExisting = existingLocations.find(itAttr.key());
-            if(itExisting != existingLocations.end())
-            {
-                //Preserve the properties from the existing location.
-                //This copies the properties that we're about to overwrite too,
-                //but it's more maintainable to avoid enumerating the other
-                //properties of ServerLocation here.
-                pLocation.reset(new ServerLocation{**itExisting});
-            }
-            else
-            {
-                pLocation.reset(new ServerLocation{});
-            }
-
-            const auto &serverObj = itAttr.value().toObject();
-
-            //The 'id' is actually the name of the attribute in the original data,
-            //since they're stored as attributes of an object, not an array.
-            pLocation->id(itAttr.key());
-            pLocation->name(JsonCaster{serverObj.value(QStringLiteral("name"))});
-            pLocation->country(JsonCaster{serverObj.value(QStringLiteral("country"))});
-            pLocation->dns(JsonCaster{serverObj.value(QStringLiteral("dns"))});
-            pLocation->portForward(JsonCaster{serverObj.value(QStringLiteral("port_forward"))});
-            //The UDP and TCP connection addresses are objects in the source data,
-            //they seem to just have a "best" attribute that contains the actual
-            //connection address.
-            pLocation->openvpnUDP(JsonCaster{serverObj.value(QStringLiteral("openvpn_udp")).toObject().value(QStringLiteral("best"))});
-            pLocation->openvpnTCP(JsonCaster{serverObj.value(QStringLiteral("openvpn_tcp")).toObject().value(QStringLiteral("best"))});
-            pLocation->ping(JsonCaster{serverObj.value(QStringLiteral("ping"))});
-            pLocation->serial(serverObj.value(QStringLiteral("serial")).toString());
-
-            // If safeAutoRegions is empty then there's likely a bug with the server data
-            // and we work around it by just allowing 'connect auto' access to all regions -
-            // the alternative is disallowing 'connect auto' to all regions, which is not really acceptable.
-            if (!safeAutoRegions.empty())
-            {
-                // This server can be used with 'connect auto' if it's found in safeAutoRegions
-                pLocation->isSafeForAutoConnect(safeAutoRegions.contains(pLocation->id()));
-            }
-            else
-            {
-                // This server can be used with 'connect auto'
-                pLocation->isSafeForAutoConnect(true);
-            }
-
-            // This location is good, store it
-            newLocations.insert(itAttr.key(), pLocation);
+            // This server can be used with 'connect auto'
+            pLocation->isSafeForAutoConnect(true);
         }
-        catch(const std::exception &ex)
+
+        //Preserve the properties that don't come from the servers list from
+        //the existing location, if there is one.
+        auto itExisting = existingLocations.find(record.id);
+        if(itExisting != existingLocations.end() && *itExisting)
         {
-            qWarning() << "Can't load location" << itAttr.key()
-                << "due to error" << ex.what();
+            pLocation->shadowsocks((*itExisting)->shadowsocks());
+            pLocation->latency((*itExisting)->latency());
         }
+
+        // This location is good, store it
+        newLocations.insert(record.id, pLocation);
     }
 
     return newLocations;
 }
 
+ServerLocations updateServerLocations(const ServerLocations &existingLocations,
+                                      const QByteArray &serversPayload)
+{
+    ServerList serverList;
+    // If the payload couldn't be parsed, this logs the error and returns no
+    // locations
+    ServerListParser::parse(serversPayload, serverList);
+    return updateServerLocations(existingLocations, serverList);
+}
+
 ServerLocations updateShadowsocksLocations(const ServerLocations &existingLocations,
+                                           const LocationTable &table,
                                            const QJsonObject &shadowsocksObj)
 {
-    ServerLocations newLocations;
-
-    // Copy each existing location.  We apply the change as an entire new
+    // Start with the existing locations.  We apply the change as an entire new
     // locations list, rather than mutating the locations, because the JSON
-    // property change detection does not detect nested properties.
-    newLocations.reserve(existingLocations.size());
-    for(auto itExisting = existingLocations.begin(); itExisting != existingLocations.end(); ++itExisting)
+    // property change detection does not detect nested properties.  Only the
+    // locations that change are copied, though - the table tells us which
+    // locations have a Shadowsocks server now, and the locations in
+    // shadowsocksObj are copied below.
+    ServerLocations newLocations{existingLocations};
+    for(LocationTable::Row row = 0; row < table.size(); ++row)
     {
-        if(*itExisting)
+        if(!table.hasShadowsocks(row))
+            continue;
+        auto itLocation = newLocations.find(table.id(row));
+        if(itLocation != newLocations.end() && *itLocation)
         {
-            QSharedPointer<ServerLocation> pNewLocation{new ServerLocation{**itExisting}};
+            QSharedPointer<ServerLocation> pNewLocation{new ServerLocation{**itLocation}};
             // Wipe out the Shadowsocks server in case this region is gone.
             pNewLocation->shadowsocks({});
-            newLocations.insert(itExisting.key(), pNewLocation);
+            *itLocation = pNewLocation;
         }
     }
 
@@ -325,7 +291,8 @@ ServerLocations updateShadowsocksLocations(const ServerLocations &existingLocati
                 << "is not in the servers list, ignoring this location";
             continue;
         }
-        Q_ASSERT(*itLocation);  // Consequence of above, nullptrs not copied
+        if(!*itLocation)
+            continue;
 
         // Create a ShadowsocksServer and apply it
         try
@@ -337,9 +304,11 @@ ServerLocations updateShadowsocksLocations(const ServerLocations &existingLocati
             pSsServer->key(JsonCaster{ssRgnObj.value(QStringLiteral("key"))});
             pSsServer->cipher(JsonCaster{ssRgnObj.value(QStringLiteral("cipher"))});
 
-            // Apply the new ShadowsocksServer; we can mutate this
-            // ServerLocation because it's one that we just created above.
-            (*itLocation)->shadowsocks(pSsServer);
+            // Apply the new ShadowsocksServer to a new copy of the location;
+            // the existing one may be shared with existingLocations.
+            QSharedPointer<ServerLocation> pNewLocation{new ServerLocation{**itLocation}};
+            pNewLocation->shadowsocks(pSsServer);
+            *itLocation = pNewLocation;
         }
         catch(const std::exception &ex)
         {
@@ -381,28 +350,30 @@ bool compareEntries(const ServerLocation &first, const ServerLocation &second)
     return first.id().compare(second.id(), Qt::CaseSensitivity::CaseInsensitive) < 0;
 }
 
-QVector<CountryLocations> buildGroupedLocations(const ServerLocations &locations)
+QVector<CountryLocations> buildGroupedLocations(const LocationTable &table,
+                                                const ServerLocations &locations)
 {
-    // Group the locations by country
-    QHash<QString, QVector<QSharedPointer<ServerLocation>>> countryGroups;
-
-    for(const auto &pLocation : locations)
+    // The table's rows are already sorted nearest-first, using the same
+    // comparison as compareEntries().  Grouping them in that order puts each
+    // country's locations in order, and it puts the countries in the order of
+    // their nearest locations, so nothing has to be sorted again.
+    QHash<QString, int> countryIndices;
+    QVector<QVector<QSharedPointer<ServerLocation>>> countryGroups;
+    for(auto row : table.nearestRows())
     {
-        Q_ASSERT(pLocation);
-        countryGroups[pLocation->country().toLower()].push_back(pLocation);
-    }
-
-    // Sort each countries' locations by latency, then id
-    for(auto &group : countryGroups)
-    {
-        std::sort(group.begin(), group.end(),
-            [](const auto &pFirst, const auto &pSecond)
-            {
-                Q_ASSERT(pFirst);
-                Q_ASSERT(pSecond);
+        const auto &pLocation = locations.value(table.id(row));
+        // The table describes the locations, so this shouldn't happen
+        if(!pLocation)
+            continue;
 
-                return compareEntries(*pFirst, *pSecond);
-            });
+        auto itIndex = countryIndices.find(table.country(row).toLower());
+        if(itIndex == countryIndices.end())
+        {
+            itIndex = countryIndices.insert(table.country(row).toLower(),
+                                            countryGroups.size());
+            countryGroups.push_back({});
+        }
+        countryGroups[itIndex.value()].push_back(pLocation);
     }
 
     // Create country groups from the sorted lists
@@ -414,23 +385,6 @@ QVector<CountryLocations> buildGroupedLocations(const ServerLocations &locations
         countries.last().locations(group);
     }
 
-    // Sort the countries by their lowest latency
-    std::sort(countries.begin(), countries.end(),
-        [](const auto &first, const auto &second)
-        {
-            // Consequence of above; countries created with at least 1 location
-            Q_ASSERT(!first.locations().isEmpty());
-            Q_ASSERT(!second.locations().isEmpty());
-            // Sort by the lowest latency for each country, then country code if
-            // the latencies are the same
-            const auto &pFirstNearest = first.locations().first();
-            const auto &pSecondNearest = second.locations().first();
-
-            Q_ASSERT(pFirstNearest);
-            Q_ASSERT(pSecondNearest);
-            return compareEntries(*pFirstNearest, *pSecondNearest);
-        });
-
     return countries;
 }
 
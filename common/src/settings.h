@@ -24,6 +24,7 @@
 #pragma once
 
 #include "json.h"
+#include "serverlistparser.h"
 #include <QVector>
 
 // ShadowsocksServer describes a Shadowsocks endpoint in a location as obtained
@@ -177,37 +178,6 @@ public:
     JsonField(QVector<QSharedPointer<ServerLocation>>, locations, {})
 };
 
-// Bandwidth measurements for one measurement interval, in bytes
-class COMMON_EXPORT IntervalBandwidth : public NativeJsonObject
-{
-    Q_OBJECT
-public:
-    IntervalBandwidth() {}
-    IntervalBandwidth(quint64 receivedVal, quint64 sentVal)
-    {
-        received(receivedVal);
-        sent(sentVal);
-    }
-    IntervalBandwidth(const IntervalBandwidth &other) {*this = other;}
-    IntervalBandwidth &operator=(const IntervalBandwidth &other)
-    {
-        received(other.received());
-        sent(other.sent());
-        return *this;
-    }
-    bool operator==(const IntervalBandwidth &other) const
-    {
-        return received() == other.received() && sent() == other.sent();
-    }
-    bool operator!=(const IntervalBandwidth &other) const
-    {
-        return !(*this == other);
-    }
-
-    JsonField(quint64, received, {})
-    JsonField(quint64, sent, {})
-};
-
 // Transport settings that might vary due to automatic failover.
 class COMMON_EXPORT Transport : public NativeJsonObject
 {
@@ -321,6 +291,12 @@ public:
     JsonField(QString, betaChannelVersion, {})
     JsonField(QString, betaChannelVersionUri, {})
 
+    // Validators for the cached regions and Shadowsocks lists (see
+    // JsonRefresher::validator()), used to skip reloading them when they
+    // haven't changed.
+    JsonField(QJsonObject, regionsListValidator, {})
+    JsonField(QJsonObject, shadowsocksListValidator, {})
+
     // The supported remote ports for the VPN connection (both udp/tcp)
     JsonField(QVector<uint>, udpPorts,  QVector<uint>({1194, 8080, 9201, 53}))
     JsonField(QVector<uint>, tcpPorts,  QVector<uint>({443, 110, 80}))
@@ -515,6 +491,16 @@ public:
 
     // Specify debug logging filter rules (null = disable logging to file)
     JsonField(Optional<QStringList>, debugLogging, nullptr)
+    // Write the debug log in the compact binary format instead of text.  The
+    // support tool decodes binary logs when building a report, and
+    // pia-logdecode renders them as text.
+    JsonField(bool, binaryLogging, false)
+
+    // Per-category log rate limits, "<category>=<messages>/<seconds>" (see
+    // Logger::setRateLimits()).  These can throttle categories that log a line
+    // for every event; critical and fatal messages are never suppressed.  No
+    // categories are limited by default.
+    JsonField(QStringList, logRateLimits, {})
 
     // The "GA release" update channel from which we retrieve updates, such as
     // "release", "qa_release", etc.  Valid values are determined by the update
@@ -814,12 +800,9 @@ public:
     // first).  Ties are broken by country code.
     JsonField(QVector<CountryLocations>, groupedLocations, {})
 
-    // Per-interval bandwidth measurements while connected to the VPN.  Only a
-    // limited number of intervals are kept (new values past the limit will bump
-    // off the oldest value).  Older values are first.
-    //
-    // When not connected, this is an empty array.
-    JsonField(QList<IntervalBandwidth>, intervalMeasurements, {})
+    // Per-interval bandwidth measurements aren't part of DaemonState - they're
+    // sent to clients as they're added with the "bandwidth" notification (see
+    // BandwidthHistory).
     // Timestamp when the VPN connection was established - ms since system
     // startup, using a monotonic clock.  0 if we are not connected.
     //
@@ -939,28 +922,44 @@ public:
 
 #if defined(PIA_DAEMON) || defined(UNIT_TEST)
 
+class LocationTable;
+
 // Read the server locations given in the data from GET /vpninfo/servers, and
 // build a ServerLocations collection.
 //
-// ServerLocations that existed previously and still exist are cloned to
-// initialize the new ServerLocations, this preserves fields like 'latency' that
-// don't come from the data in GET /vpninfo/servers.  (Locations are matched by
-// ID.)
+// Fields that don't come from the data in GET /vpninfo/servers, like
+// 'latency', are preserved from ServerLocations that existed previously and
+// still exist.  (Locations are matched by ID.)
 //
-// Locations that don't have all required components are ignored.  If no valid
-// locations are found, this returns an empty ServerLocations.
+// Locations that don't have all required components are ignored (and logged).
+// If no valid locations are found, this returns an empty ServerLocations.
+COMMON_EXPORT ServerLocations updateServerLocations(const ServerLocations &existingLocations,
+                                                    const ServerList &serverList);
+// Parse the raw servers list with ServerListParser and build ServerLocations.
 COMMON_EXPORT ServerLocations updateServerLocations(const ServerLocations &existingLocations,
-                                                    const QJsonObject &serversObj);
+                                                    const QByteArray &serversPayload);
 
 // Read the Shadowsocks server locations from the SS server list, and build an
 // updated ServerLocations collection.  All locations are preserved (only the
 // SS server components are changed), and non-SS data in the existing locations
 // collection is preserved.
+//
+// table must describe existingLocations; it's used to find the locations that
+// have Shadowsocks now.  Only those locations and the ones in shadowsocksObj
+// are copied, the rest are shared with existingLocations.
 COMMON_EXPORT ServerLocations updateShadowsocksLocations(const ServerLocations &existingLocations,
+                                                         const LocationTable &table,
                                                          const QJsonObject &shadowsocksObj);
 
-// Build the grouped and sorted locations from the flat locations.
-COMMON_EXPORT QVector<CountryLocations> buildGroupedLocations(const ServerLocations &locations);
+// Compare two locations to sort them nearest-first - by latency, then country
+// code, then ID.  Unknown latencies sort last.
+COMMON_EXPORT bool compareEntries(const ServerLocation &first, const ServerLocation &second);
+
+// Build the grouped and sorted locations from the flat locations.  table must
+// describe the locations; its nearest-first order is used to group them
+// without sorting them again.
+COMMON_EXPORT QVector<CountryLocations> buildGroupedLocations(const LocationTable &table,
+                                                              const ServerLocations &locations);
 
 class COMMON_EXPORT NearestLocations
 {
@@ -0,0 +1,254 @@
+// Copyright (c) 2019 London Trust Media Incorporated
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#line SOURCE_FILE("workerpool.cpp")
+
+#include "workerpool.h"
+#include <algorithm>
+
+namespace
+{
+    // Limit on the default number of threads
+    const int workerPoolMaxDefaultThreads{4};
+
+    // The cancellation flag of the job running on this thread, if any
+    thread_local const std::atomic<bool> *pWorkerPoolCurrentCanceled{nullptr};
+
+    const char *workerPoolPriorityName(int priority)
+    {
+        switch(priority)
+        {
+            case WorkerPool::HighPriority:
+                return "high";
+            case WorkerPool::NormalPriority:
+                return "normal";
+            case WorkerPool::LowPriority:
+                return "low";
+            default:
+                return "unknown";
+        }
+    }
+
+    template<class Duration>
+    quint64 workerPoolMsec(Duration duration)
+    {
+        return static_cast<quint64>(std::chrono::duration_cast<std::chrono::milliseconds>(duration).count());
+    }
+}
+
+WorkerPool::WorkerPool(int threadCount)
+    : _pendingJobs{0}, _stopping{false}, _nextWorker{0}
+{
+    if(threadCount <= 0)
+    {
+        // Leave a CPU for the main thread
+        threadCount = std::min(QThread::idealThreadCount() - 1, workerPoolMaxDefaultThreads);
+        threadCount = std::max(threadCount, 1);
+    }
+
+    _workers.reserve(static_cast<std::size_t>(threadCount));
+    for(int i=0; i<threadCount; ++i)
+        _workers.push_back(std::unique_ptr<Worker>{new Worker{}});
+
+    // Start the threads after all workers exist, since they steal from each
+    // other
+    for(std::size_t i=0; i<_workers.size(); ++i)
+    {
+        _workers[i]->pThread.reset(QThread::create([this, i](){workerMain(i);}));
+        _workers[i]->pThread->setObjectName(QStringLiteral("worker %1").arg(i));
+        _workers[i]->pThread->start();
+    }
+    qInfo() << "Started" << _workers.size() << "worker threads";
+}
+
+WorkerPool::~WorkerPool()
+{
+    {
+        QMutexLocker lock{&_sleepMutex};
+        _stopping = true;
+        _workAvailable.wakeAll();
+    }
+    for(auto &pWorker : _workers)
+        pWorker->pThread->wait();
+
+    // Cancel anything that's still queued
+    for(auto &pWorker : _workers)
+    {
+        for(int priority = 0; priority < PriorityCount; ++priority)
+        {
+            for(auto &job : pWorker->queues[priority])
+            {
+                ++_counters[priority].canceled;
+                job.run(true);
+            }
+        }
+    }
+    traceMetrics();
+}
+
+void WorkerPool::submit(Priority priority, std::shared_ptr<std::atomic<bool>> pCanceled,
+                        std::function<void(bool)> run)
+{
+    Q_ASSERT(priority >= 0 && priority < PriorityCount);
+
+    // Jobs submitted by a worker go to its own queues.
+    std::size_t index = _workers.size();
+    QThread *pCurrentThread = QThread::currentThread();
+    for(std::size_t i=0; i<_workers.size(); ++i)
+    {
+        if(_workers[i]->pThread.get() == pCurrentThread)
+        {
+            index = i;
+            break;
+        }
+    }
+    if(index == _workers.size())
+        index = _nextWorker++ % _workers.size();
+
+    {
+        Worker &worker = *_workers[index];
+        QMutexLocker lock{&worker.mutex};
+        worker.queues[priority].push_back({std::move(run), std::move(pCanceled), Clock::now()});
+    }
+
+    QueueCounters &counters = _counters[priority];
+    ++counters.submitted;
+    int depth = ++counters.depth;
+    int maxDepth = counters.maxDepth;
+    while(depth > maxDepth && !counters.maxDepth.compare_exchange_weak(maxDepth, depth));
+
+    // Count the job before waking a worker - a worker only sleeps after
+    // checking this while holding _sleepMutex, so it can't miss the wakeup
+    ++_pendingJobs;
+    QMutexLocker lock{&_sleepMutex};
+    _workAvailable.wakeOne();
+}
+
+void WorkerPool::workerMain(std::size_t index)
+{
+    while(true)
+    {
+        Job job;
+        Priority priority;
+        if(takeJob(index, job, priority))
+        {
+            runJob(job, priority);
+            continue;
+        }
+
+        QMutexLocker lock{&_sleepMutex};
+        if(_stopping)
+            return;
+        if(_pendingJobs == 0)
+            _workAvailable.wait(&_sleepMutex);
+    }
+}
+
+bool WorkerPool::takeJob(std::size_t index, Job &job, Priority &priority)
+{
+    for(int p = 0; p < PriorityCount; ++p)
+    {
+        // Take this worker's newest job first, it's most likely to still be
+        // in the cache
+        {
+            Worker &worker = *_workers[index];
+            QMutexLocker lock{&worker.mutex};
+            auto &queue = worker.queues[p];
+            if(!queue.empty())
+            {
+                job = std::move(queue.back());
+                queue.pop_back();
+                priority = static_cast<Priority>(p);
+                --_pendingJobs;
+                return true;
+            }
+        }
+
+        // Otherwise steal the oldest job from another worker
+        for(std::size_t offset = 1; offset < _workers.size(); ++offset)
+        {
+            Worker &victim = *_workers[(index + offset) % _workers.size()];
+            QMutexLocker lock{&victim.mutex};
+            auto &queue = victim.queues[p];
+            if(!queue.empty())
+            {
+                job = std::move(queue.front());
+                queue.pop_front();
+                priority = static_cast<Priority>(p);
+                --_pendingJobs;
+                ++_counters[p].stolen;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void WorkerPool::runJob(Job &job, Priority priority)
+{
+    QueueCounters &counters = _counters[priority];
+    --counters.depth;
+
+    if(job.pCanceled && *job.pCanceled)
+    {
+        ++counters.canceled;
+        job.run(true);
+        return;
+    }
+
+    Clock::time_point start = Clock::now();
+    counters.waitMsec += workerPoolMsec(start - job.queued);
+
+    pWorkerPoolCurrentCanceled = job.pCanceled.get();
+    job.run(false);
+    pWorkerPoolCurrentCanceled = nullptr;
+
+    counters.runMsec += workerPoolMsec(Clock::now() - start);
+    ++counters.completed;
+}
+
+bool WorkerPool::cancellationRequested()
+{
+    return pWorkerPoolCurrentCanceled && *pWorkerPoolCurrentCanceled;
+}
+
+auto WorkerPool::metrics(Priority priority) const -> QueueMetrics
+{
+    Q_ASSERT(priority >= 0 && priority < PriorityCount);
+    const QueueCounters &counters = _counters[priority];
+    return {counters.submitted, counters.completed, counters.canceled,
+            counters.stolen, counters.waitMsec, counters.runMsec,
+            counters.depth, counters.maxDepth};
+}
+
+void WorkerPool::traceMetrics() const
+{
+    for(int priority = 0; priority < PriorityCount; ++priority)
+    {
+        QueueMetrics queue{metrics(static_cast<Priority>(priority))};
+        if(queue.submitted == 0)
+            continue;
+        qInfo() << workerPoolPriorityName(priority) << "priority:"
+            << queue.submitted << "submitted," << queue.completed
+            << "completed," << queue.canceled << "canceled,"
+            << queue.stolen << "stolen - wait" << queue.waitMsec
+            << "ms, run" << queue.runMsec << "ms total, max depth"
+            << queue.maxDepth;
+    }
+}
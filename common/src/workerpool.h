@@ -0,0 +1,281 @@
+// Copyright (c) 2019 London Trust Media Incorporated
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#line HEADER_FILE("workerpool.h")
+
+#ifndef WORKERPOOL_H
+#define WORKERPOOL_H
+#pragma once
+
+#include "async.h"
+#include <QMutex>
+#include <QThread>
+#include <QWaitCondition>
+#include <QWeakPointer>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <vector>
+
+// WorkerPool runs CPU-bound jobs on a small pool of worker threads, so they
+// don't block the thread that needs the result (usually the main thread,
+// which also handles IPC).
+//
+// run() returns an Async that resolves (or rejects if the job throws) on the
+// calling thread, which must have an event loop.  Jobs must not touch
+// QObjects or other state owned by the calling thread - capture copies of
+// the data they need and return the result.
+//
+// Each worker has its own queues.  Jobs submitted from a worker thread go to
+// that worker's queues, and jobs from other threads are spread across the
+// workers.  A worker takes its own newest job first, and an idle worker
+// steals the oldest job from another worker.  Higher-priority jobs are always
+// taken before lower-priority jobs.
+//
+// A job can be canceled with JobTask::cancel(), or by abandoning its task.
+// Jobs that haven't started are skipped; a running job can check
+// cancellationRequested() to stop early.
+class COMMON_EXPORT WorkerPool
+{
+    CLASS_LOGGING_CATEGORY("workerpool")
+
+public:
+    enum Priority
+    {
+        HighPriority,
+        NormalPriority,
+        LowPriority,
+        PriorityCount
+    };
+
+    // Counters for the jobs at one priority
+    struct QueueMetrics
+    {
+        // Jobs submitted, completed (including those that threw), and
+        // canceled before running
+        quint64 submitted, completed, canceled;
+        // Jobs taken by a worker from another worker's queue
+        quint64 stolen;
+        // Total time jobs spent waiting in the queue and running
+        quint64 waitMsec, runMsec;
+        // Jobs currently queued, and the most that have been queued at once
+        int depth, maxDepth;
+    };
+
+    template<typename Result>
+    class JobTask : public Task<Result>
+    {
+        friend class WorkerPool;
+    public:
+        // Destroying the task (such as by abandoning it) cancels the job too
+        ~JobTask() override
+        {
+            _pCanceled->store(true);
+        }
+
+        // Cancel the job.  The task rejects with TaskRejected immediately.
+        void cancel()
+        {
+            _pCanceled->store(true);
+            if (this->isPending())
+                this->reject(Error(HERE, Error::TaskRejected));
+        }
+    private:
+        std::shared_ptr<std::atomic<bool>> _pCanceled{std::make_shared<std::atomic<bool>>(false)};
+    };
+
+public:
+    // Create a pool with the given number of threads; 0 picks a number based
+    // on the number of CPUs (but only a few, the daemon doesn't do much
+    // CPU-bound work).
+    explicit WorkerPool(int threadCount = 0);
+    // Stops the workers.  Queued jobs are canceled; waits for running jobs to
+    // finish.
+    ~WorkerPool();
+    WorkerPool(const WorkerPool &) = delete;
+    WorkerPool &operator=(const WorkerPool &) = delete;
+
+public:
+    int threadCount() const {return static_cast<int>(_workers.size());}
+
+    // Run a job.  func is called with no arguments on a worker thread, and
+    // its result resolves the returned task on the calling thread.
+    template<class Func>
+    auto run(Func func, Priority priority = NormalPriority) -> Async<JobTask<decltype(func())>>;
+
+    // In a job, check whether the job has been canceled.  (Returns false
+    // outside of a job.)
+    static bool cancellationRequested();
+
+    QueueMetrics metrics(Priority priority) const;
+    // Log the metrics for all priorities
+    void traceMetrics() const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Job
+    {
+        // Run the job, or just clean up if canceled is true
+        std::function<void(bool canceled)> run;
+        std::shared_ptr<std::atomic<bool>> pCanceled;
+        Clock::time_point queued;
+    };
+
+    struct Worker
+    {
+        QMutex mutex;
+        std::array<std::deque<Job>, PriorityCount> queues;
+        std::unique_ptr<QThread> pThread;
+    };
+
+    struct QueueCounters
+    {
+        std::atomic<quint64> submitted{0}, completed{0}, canceled{0}, stolen{0};
+        std::atomic<quint64> waitMsec{0}, runMsec{0};
+        std::atomic<int> depth{0}, maxDepth{0};
+    };
+
+    template<typename Result>
+    struct JobRunner;
+
+private:
+    void submit(Priority priority, std::shared_ptr<std::atomic<bool>> pCanceled,
+                std::function<void(bool)> run);
+    void workerMain(std::size_t index);
+    bool takeJob(std::size_t index, Job &job, Priority &priority);
+    void runJob(Job &job, Priority priority);
+
+    // Deliver a job's result to its task on the task's thread, if the task
+    // still exists
+    template<typename Result, class Deliver>
+    static void deliver(const QWeakPointer<JobTask<Result>> &weakTask, Deliver deliverFunc);
+
+private:
+    std::vector<std::unique_ptr<Worker>> _workers;
+    std::array<QueueCounters, PriorityCount> _counters;
+    // Workers sleep on _workAvailable when there are no pending jobs
+    QMutex _sleepMutex;
+    QWaitCondition _workAvailable;
+    std::atomic<int> _pendingJobs;
+    bool _stopping;
+    // Next worker for jobs submitted from other threads
+    std::atomic<unsigned> _nextWorker;
+};
+
+template<typename Result, class Deliver>
+void WorkerPool::deliver(const QWeakPointer<JobTask<Result>> &weakTask, Deliver deliverFunc)
+{
+    auto pTask = weakTask.toStrongRef();
+    // If the task was abandoned, there's nothing to do
+    if(!pTask)
+        return;
+    QObject *pContext = pTask.data();
+    // The functor holds a reference to the task until it's called on the
+    // task's thread
+    QMetaObject::invokeMethod(pContext, [pTask = std::move(pTask), deliverFunc = std::move(deliverFunc)]()
+        {
+            // The task might have been canceled in the meantime
+            if(pTask->isPending())
+                deliverFunc(*pTask);
+        }, Qt::QueuedConnection);
+}
+
+template<typename Result>
+struct WorkerPool::JobRunner
+{
+    template<class Func>
+    static void run(const QWeakPointer<JobTask<Result>> &weakTask, Func &func, bool canceled)
+    {
+        if(canceled)
+        {
+            deliver(weakTask, [](JobTask<Result> &task){task.reject(Error(HERE, Error::TaskRejected));});
+            return;
+        }
+        try
+        {
+            auto pResult = std::make_shared<Result>(func());
+            deliver(weakTask, [pResult](JobTask<Result> &task){task.resolve(std::move(*pResult));});
+        }
+        catch(const Error &error)
+        {
+            deliver(weakTask, [error](JobTask<Result> &task){task.reject(error);});
+        }
+        catch(const std::exception &ex)
+        {
+            Error error{UnknownError(HERE, ex.what())};
+            deliver(weakTask, [error](JobTask<Result> &task){task.reject(error);});
+        }
+        catch(...)
+        {
+            deliver(weakTask, [](JobTask<Result> &task){task.reject(UnknownError(HERE));});
+        }
+    }
+};
+
+template<>
+struct WorkerPool::JobRunner<void>
+{
+    template<class Func>
+    static void run(const QWeakPointer<JobTask<void>> &weakTask, Func &func, bool canceled)
+    {
+        if(canceled)
+        {
+            deliver(weakTask, [](JobTask<void> &task){task.reject(Error(HERE, Error::TaskRejected));});
+            return;
+        }
+        try
+        {
+            func();
+            deliver(weakTask, [](JobTask<void> &task){task.resolve();});
+        }
+        catch(const Error &error)
+        {
+            deliver(weakTask, [error](JobTask<void> &task){task.reject(error);});
+        }
+        catch(const std::exception &ex)
+        {
+            Error error{UnknownError(HERE, ex.what())};
+            deliver(weakTask, [error](JobTask<void> &task){task.reject(error);});
+        }
+        catch(...)
+        {
+            deliver(weakTask, [](JobTask<void> &task){task.reject(UnknownError(HERE));});
+        }
+    }
+};
+
+template<class Func>
+auto WorkerPool::run(Func func, Priority priority) -> Async<JobTask<decltype(func())>>
+{
+    using Result = decltype(func());
+    auto task = Async<JobTask<Result>>::create();
+    QWeakPointer<JobTask<Result>> weakTask{task};
+    submit(priority, task->_pCanceled,
+        [weakTask, func = std::move(func)](bool canceled) mutable
+        {
+            JobRunner<Result>::run(weakTask, func, canceled);
+        });
+    return task;
+}
+
+#endif
@@ -20,7 +20,7 @@
 #line SOURCE_FILE("apiclient.cpp")
 
 #include "apiclient.h"
-#include "testshim.h"
+#include "networkpool.h"
 #include "networktaskwithretry.h"
 #include <QNetworkRequest>
 #include <QNetworkReply>
@@ -59,7 +59,7 @@ namespace
 }
 
 ApiClient::ApiClient()
-    : _pNetworkManager{TestShim::create<QNetworkAccessManager>()},
+    : _pNetworkManager{NetworkPool::get()},
       _nextApiBaseUrl{0}
 {
 }
@@ -83,13 +83,18 @@ Async<QByteArray> ApiClient::requestRetry(QNetworkAccessManager::Operation verb,
 {
     QString apiResource = apiBasePath + resource;
 
+    // Hold the current shared manager so its connections can be reused by
+    // the next request (the task gets the manager itself for each attempt)
+    _pNetworkManager = NetworkPool::get();
+
     // Create a retriable task to fetch the response body
     return Async<NetworkTaskWithRetry>::create(verb, apiBaseUris,
                                                apiResource,
                                                std::move(pRetryStrategy),
                                                data,
                                                std::move(auth),
-                                               _pNetworkManager);
+                                               NetworkTaskWithRetry::RawHeaders{},
+                                               true);
 }
 
 Async<QJsonDocument> ApiClient::get(QString resource, QByteArray auth)
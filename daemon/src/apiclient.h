@@ -107,6 +107,8 @@ public:
     static QByteArray autoAuth(const QString& username, const QString& password, const QString& token);
 
 private:
+    // The shared network manager used for the last request - keeps its
+    // connections alive between requests (see NetworkPool)
     QSharedPointer<QNetworkAccessManager> _pNetworkManager;
     // Index of the last API base URL that was successful (used to start from
     // that base next time).
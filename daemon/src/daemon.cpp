@@ -28,6 +28,7 @@
 #include "version.h"
 #include "brand.h"
 #include "util.h"
+#include "networkpool.h"
 
 #include <QFile>
 #include <QNetworkReply>
@@ -37,6 +38,8 @@
 #include <QDir>
 #include <QDateTime>
 #include <QRegularExpression>
+#include <QTextStream>
+#include <algorithm>
 
 #if defined(Q_OS_WIN)
 #include <Windows.h>
@@ -70,6 +73,21 @@ namespace
     const QString regionsResource{QStringLiteral("vpninfo/servers?version=1001&client=x-alpha")};
     const QString shadowsocksRegionsResource{QStringLiteral("vpninfo/shadowsocks_servers")};
 
+    // Names of the daemon objects in RPCs, see Daemon::getJsonObject()
+    const QString daemonJsonObjectNames[]{
+        QStringLiteral("data"),
+        QStringLiteral("account"),
+        QStringLiteral("settings"),
+        QStringLiteral("state")
+    };
+    // Huge properties that aren't watched by default (RPC_watch() with an
+    // empty filter)
+    const QSet<QString> daemonWatchDefaultExcluded{
+        QStringLiteral("certificateAuthorities"),
+        QStringLiteral("locations"),
+        QStringLiteral("groupedLocations")
+    };
+
     const QByteArray serverListPublicKey = QByteArrayLiteral(
         "-----BEGIN PUBLIC KEY-----\n"
         "MIIBIjANBgkqhkiG9w0BAQEFAAOCAQ8AMIIBCgKCAQEAzLYHwX5Ug/oUObZ5eH5P\n"
@@ -283,6 +301,15 @@ Daemon::Daemon(const QStringList& arguments, QObject* parent)
         }
     });
 
+    connect(&_settings, &DaemonSettings::binaryLoggingChanged, this, [this]() {
+        g_logger->setBinaryFormat(_settings.binaryLogging());
+    });
+    g_logger->setBinaryFormat(_settings.binaryLogging());
+    connect(&_settings, &DaemonSettings::logRateLimitsChanged, this, [this]() {
+        g_logger->setRateLimits(_settings.logRateLimits());
+    });
+    g_logger->setRateLimits(_settings.logRateLimits());
+
     // Set initial value of debug logging
     if(g_logger->logToFile())
         _settings.debugLogging(g_logger->filters());
@@ -292,8 +319,9 @@ Daemon::Daemon(const QStringList& arguments, QObject* parent)
     // Migrate/upgrade any settings to the current daemon version
     upgradeSettings(settingsFileRead);
 
-    // Build the sorted and grouped locations from the cached data
-    rebuildLocations();
+    // Build the location table, sorted, and grouped locations from the cached
+    // data
+    rebuildLocations(true);
 
     // Check whether the host supports split tunnel and record errors
     checkSplitTunnelSupport();
@@ -312,6 +340,9 @@ Daemon::Daemon(const QStringList& arguments, QObject* parent)
 
     #define RPC_METHOD(name, ...) LocalMethod(QStringLiteral(#name), this, &THIS_CLASS::RPC_##name)
     _methodRegistry->add(RPC_METHOD(handshake));
+    _methodRegistry->add(RPC_METHOD(subscribe));
+    _methodRegistry->add(RPC_METHOD(getProperties));
+    _methodRegistry->add(RPC_METHOD(watch));
     _methodRegistry->add(RPC_METHOD(applySettings).defaultArguments(false));
     _methodRegistry->add(RPC_METHOD(resetSettings));
     _methodRegistry->add(RPC_METHOD(connectVPN));
@@ -366,7 +397,7 @@ Daemon::Daemon(const QStringList& arguments, QObject* parent)
     connect(&_latencyTracker, &LatencyTracker::newMeasurements, this,
             &Daemon::newLatencyMeasurements);
     // Pass the locations loaded from the cached data to LatencyTracker
-    _latencyTracker.updateLocations(_data.locations());
+    _latencyTracker.updateLocations(LocationTable::current());
     connect(_portForwarder, &PortForwarder::portForwardUpdated, this,
             &Daemon::portForwardUpdated);
 
@@ -375,10 +406,22 @@ Daemon::Daemon(const QStringList& arguments, QObject* parent)
 
     _portForwarder->enablePortForwarding(_settings.portForward());
 
-    connect(&_regionRefresher, &JsonRefresher::contentLoaded, this,
+    // The servers list is parsed directly by ServerListParser
+    _regionRefresher.parseJson(false);
+    // Verify the lists' signatures on the worker pool
+    _regionRefresher.setWorkerPool(&_workerPool);
+    _shadowsocksRefresher.setWorkerPool(&_workerPool);
+    connect(&_regionRefresher, &JsonRefresher::payloadLoaded, this,
             &Daemon::regionsLoaded);
     connect(&_shadowsocksRefresher, &JsonRefresher::contentLoaded, this,
             &Daemon::shadowsocksRegionsLoaded);
+    // Keep the validators with the cached locations
+    _regionRefresher.setValidator(_data.regionsListValidator());
+    _shadowsocksRefresher.setValidator(_data.shadowsocksListValidator());
+    connect(&_regionRefresher, &JsonRefresher::validatorChanged, this,
+            [this](const QJsonObject &validator){_data.regionsListValidator(validator);});
+    connect(&_shadowsocksRefresher, &JsonRefresher::validatorChanged, this,
+            [this](const QJsonObject &validator){_data.shadowsocksListValidator(validator);});
 
     connect(this, &Daemon::firstClientConnected, this, [this]() {
         _latencyTracker.start();
@@ -426,6 +469,9 @@ Daemon::Daemon(const QStringList& arguments, QObject* parent)
             &Daemon::onUpdateDownloadFinished);
     connect(&_updateDownloader, &UpdateDownloader::downloadFailed, this,
             &Daemon::onUpdateDownloadFailed);
+    // Installer signatures in the update metadata are checked with the server
+    // list key
+    _updateDownloader.setInstallerSignatureKey(serverListPublicKey);
     _updateDownloader.setGaUpdateChannel(_settings.updateChannel());
     _updateDownloader.setBetaUpdateChannel(_settings.betaUpdateChannel());
     _updateDownloader.enableBetaChannel(_settings.offerBetaUpdates());
@@ -479,6 +525,94 @@ QString Daemon::RPC_handshake(const QString &version)
     return QStringLiteral(PIA_VERSION);
 }
 
+void Daemon::RPC_subscribe()
+{
+    ClientConnection *client = ClientConnection::getInvokingClient();
+    if(!client || client->getSubscribed())
+        return;
+
+    qInfo() << "Client" << client << "subscribed";
+    client->setSubscribed(true);
+
+    QJsonObject all;
+    all.insert(QStringLiteral("data"), g_data.toJsonObject());
+    all.insert(QStringLiteral("account"), g_account.toJsonObject());
+    all.insert(QStringLiteral("settings"), g_settings.toJsonObject());
+    all.insert(QStringLiteral("state"), g_state.toJsonObject());
+    client->post(QStringLiteral("data"), all);
+    client->post(QStringLiteral("bandwidth"), _connection->bandwidthHistory().toJson({}));
+}
+
+QJsonValue Daemon::RPC_getProperties(const QJsonArray &properties)
+{
+    QJsonObject result;
+    for(const auto &propertyValue : properties)
+    {
+        QString property = propertyValue.toString();
+        int dot = property.indexOf(QLatin1Char('.'));
+        QString objectName = property.left(dot);
+        QString propertyName = dot >= 0 ? property.mid(dot+1) : QString{};
+
+        const NativeJsonObject *pObject = getJsonObject(objectName);
+        QJsonValue value{QJsonValue::Undefined};
+        if(pObject && !propertyName.isEmpty())
+            value = pObject->get(propertyName);
+        if(value.isUndefined())
+        {
+            qWarning() << "Unknown property requested:" << property;
+            throw Error{HERE, Error::Code::DaemonRPCUnknownSetting};
+        }
+
+        QJsonObject objectResult = result.value(objectName).toObject();
+        objectResult.insert(propertyName, value);
+        result.insert(objectName, objectResult);
+    }
+    return result;
+}
+
+void Daemon::RPC_watch(const QJsonArray &filter)
+{
+    ClientConnection *client = ClientConnection::getInvokingClient();
+    if(!client)
+        return;
+
+    QSet<QString> watchFilter;
+    for(const auto &filterValue : filter)
+    {
+        QString entry = filterValue.toString();
+        int dot = entry.indexOf(QLatin1Char('.'));
+        const NativeJsonObject *pObject = getJsonObject(entry.left(dot));
+        if(!pObject || (dot >= 0 && !pObject->isKnownProperty(entry.mid(dot+1))))
+        {
+            qWarning() << "Unknown property in watch filter:" << entry;
+            throw Error{HERE, Error::Code::DaemonRPCUnknownSetting};
+        }
+        watchFilter.insert(entry);
+    }
+
+    qInfo() << "Client" << client << "watching" << watchFilter.size()
+        << "properties/objects";
+    client->setWatchFilter(std::move(watchFilter));
+
+    // Send the current values of the watched properties
+    QJsonObject event;
+    for(const auto &objectName : daemonJsonObjectNames)
+    {
+        const NativeJsonObject &object = *getJsonObject(objectName);
+        const QMetaObject *pMeta = object.metaObject();
+        QJsonObject values;
+        for(int i = pMeta->propertyOffset(); i < pMeta->propertyCount(); ++i)
+        {
+            QString property = QLatin1String{pMeta->property(i).name()};
+            if(client->watchesProperty(objectName, property))
+                values.insert(property, object.get(property));
+        }
+        if(!values.isEmpty())
+            event.insert(objectName, values);
+    }
+    postWatchEvent(*client, event);
+}
+
 void Daemon::RPC_applySettings(const QJsonObject &settings, bool reconnectIfNeeded)
 {
     // Filter sensitive settings for logging
@@ -536,8 +670,8 @@ void Daemon::RPC_applySettings(const QJsonObject &settings, bool reconnectIfNeed
         qInfo() << "portForward setting changed to: " << settings.value(QLatin1String("portForward"));
 
         // Toggling port forwarding may impact the bestLocation
-        NearestLocations nearest{_data.locations()};
-        _state.vpnLocations().bestLocation(nearest.getNearestSafeVpnLocation(_settings.portForward()));
+        const auto &pTable = LocationTable::current();
+        _state.vpnLocations().bestLocation(getTableLocation(*pTable, pTable->nearestSafeVpnRow(_settings.portForward())));
         // Without this a reconnect may re-use the previous auto location, not the updated one above
         updateChosenLocations();
     }
@@ -615,7 +749,7 @@ void Daemon::RPC_connectVPN()
 }
 
 DiagnosticsFile::DiagnosticsFile(const QString &filePath)
-    : _diagFile{filePath}, _currentSize{0}
+    : _diagFile{filePath}, _nextWrite{0}, _runningCommands{0}, _finishing{false}
 {
     if(!_diagFile.open(QIODevice::WriteOnly | QIODevice::Truncate))
     {
@@ -623,8 +757,33 @@ DiagnosticsFile::DiagnosticsFile(const QString &filePath)
             << "- error:" << _diagFile.error() << _diagFile.errorString();
         throw Error{HERE, Error::Code::DaemonRPCDiagnosticsFailed};
     }
+    _totalTime.start();
+}
+
+DiagnosticsFile::~DiagnosticsFile()
+{
+    // If we're destroyed before finishing, kill any commands still running
+    // instead of waiting for them.
+    for(auto &pPart : _parts)
+    {
+        if(pPart->pProcess)
+        {
+            pPart->pProcess->disconnect(this);
+            pPart->pProcess->kill();
+            releaseProcess(std::move(pPart->pProcess));
+        }
+    }
+}
 
-    _fileWriter.setDevice(&_diagFile);
+void DiagnosticsFile::releaseProcess(std::unique_ptr<QProcess> pProcess)
+{
+    if(pProcess->state() == QProcess::ProcessState::NotRunning)
+        return;
+    // Destroying a running QProcess blocks until it exits; let it finish
+    // exiting in the background instead.
+    QProcess *pExiting = pProcess.release();
+    connect(pExiting, QOverload<int, QProcess::ExitStatus>::of(&QProcess::finished),
+            pExiting, &QObject::deleteLater);
 }
 
 QString DiagnosticsFile::diagnosticsCommandHeader(const QString &commandName)
@@ -632,46 +791,194 @@ QString DiagnosticsFile::diagnosticsCommandHeader(const QString &commandName)
     return QStringLiteral("\n/PIA_PART/%1\n").arg(commandName);
 }
 
-void DiagnosticsFile::logPart(const QString &title, QElapsedTimer &commandTime)
+DiagnosticsFile::Part &DiagnosticsFile::addPart(const QString &title)
 {
-    qint64 newSize = _diagFile.size();
-    qint64 partSize = newSize - _currentSize;
-    _currentSize = newSize;
+    _parts.push_back(std::make_unique<Part>());
+    Part &part = *_parts.back();
+    part.title = title;
+    part.complete = false;
+    part.elapsedMs = 0;
+    part.outputTruncated = false;
+    part.time.start();
+    return part;
+}
 
-    auto cmdTimeNsec = commandTime.nsecsElapsed();
-    qInfo() << "Wrote" << title << "in" << (cmdTimeNsec / 1.0e9) << "sec -"
-        << partSize << "bytes";
+void DiagnosticsFile::addCommand(std::unique_ptr<QProcess> pProcess,
+                                 const QString &commandName,
+                                 const ProcessOutputFunction &processOutput)
+{
+    Part &part = addPart(commandName);
+    part.pProcess = std::move(pProcess);
+    part.processOutput = processOutput;
+    _queuedCommands.push_back(&part);
+    startCommands();
 }
 
-void DiagnosticsFile::execAndWriteOutput(QProcess &cmd, const QString &commandName,
-                                         const ProcessOutputFunction &processOutput)
+void DiagnosticsFile::startCommands()
 {
-    QElapsedTimer commandTime;
-    commandTime.start();
+    auto itQueued = _queuedCommands.begin();
+    while(_runningCommands < MaxConcurrentCommands && itQueued != _queuedCommands.end())
+    {
+        Part &part = **itQueued;
+        // Wait for any running command for the same program to finish first
+        if(_runningPrograms.contains(part.pProcess->program()))
+        {
+            ++itQueued;
+            continue;
+        }
+        itQueued = _queuedCommands.erase(itQueued);
+        startCommand(part);
+    }
+}
 
-    _fileWriter << diagnosticsCommandHeader(commandName);
+void DiagnosticsFile::startCommand(Part &part)
+{
+    Q_ASSERT(part.pProcess);
+    ++_runningCommands;
+    _runningPrograms.insert(part.pProcess->program());
+    // Time the command from when it actually starts
+    part.time.start();
+
+    QProcess &cmd = *part.pProcess;
+    connect(&cmd, &QProcess::readyReadStandardOutput, this,
+            [this, &part]() {readOutput(part);});
+    connect(&cmd, &QProcess::readyReadStandardError, this,
+            [this, &part]() {readOutput(part);});
+    connect(&cmd, QOverload<int, QProcess::ExitStatus>::of(&QProcess::finished),
+            this, [this, &part]() {completeCommand(part, {});});
+    connect(&cmd, &QProcess::errorOccurred, this,
+            [this, &part](QProcess::ProcessError error)
+            {
+                // Crashes and read/write errors are followed by finished(),
+                // only FailedToStart completes the command here.
+                if(error == QProcess::ProcessError::FailedToStart)
+                    completeCommand(part, qEnumToString(error));
+            });
+
+    part.pTimeout.reset(new QTimer{});
+    part.pTimeout->setSingleShot(true);
+    connect(part.pTimeout.get(), &QTimer::timeout, this,
+            [this, &part]() {completeCommand(part, QStringLiteral("Timed out"));});
+    part.pTimeout->start(CommandTimeoutMs);
 
     cmd.start();
-    // Only wait 5 seconds for each process.  Occasionally some commands might
-    // time out, but it's confusing for users if this takes a long time due to
-    // the current lack of feedback that we're preparing the report.
-    if(cmd.waitForFinished(5000))
-    {
-        _fileWriter << "Exit code: " << cmd.exitCode() << endl;
-        _fileWriter << "STDOUT: " << endl;
-        QByteArray output = cmd.readAllStandardOutput();
-        _fileWriter << (processOutput ? processOutput(output) : output) << endl;
-        _fileWriter << "STDERR: " << endl;
-        _fileWriter << cmd.readAllStandardError() << endl;
+}
+
+void DiagnosticsFile::readOutput(Part &part)
+{
+    auto appendCapped = [&part](QByteArray &output, const QByteArray &data)
+    {
+        int space = CommandOutputLimit - output.size();
+        if(data.size() > space)
+        {
+            output.append(data.left(std::max(space, 0)));
+            part.outputTruncated = true;
+        }
+        else
+            output.append(data);
+    };
+
+    appendCapped(part.stdOut, part.pProcess->readAllStandardOutput());
+    appendCapped(part.stdErr, part.pProcess->readAllStandardError());
+}
+
+void DiagnosticsFile::completeCommand(Part &part, const QString &failure)
+{
+    if(part.complete)
+        return;
+
+    Q_ASSERT(part.pProcess);
+    QProcess &cmd = *part.pProcess;
+    cmd.disconnect(this);
+    part.pTimeout.reset();
+
+    QByteArray content;
+    QTextStream contentWriter{&content};
+    if(failure.isEmpty())
+    {
+        readOutput(part);
+        contentWriter << "Exit code: " << cmd.exitCode() << endl;
+        contentWriter << "STDOUT: " << endl;
+        contentWriter << (part.processOutput ? part.processOutput(part.stdOut) : part.stdOut) << endl;
+        contentWriter << "STDERR: " << endl;
+        contentWriter << part.stdErr << endl;
+        if(part.outputTruncated)
+        {
+            contentWriter << "Output truncated to " << CommandOutputLimit
+                << " bytes" << endl;
+        }
+        part.status = part.outputTruncated ? QStringLiteral("truncated") : QStringLiteral("ok");
     }
     else
     {
-        _fileWriter << "Failed to run command: " << cmd.program() << endl;
-        _fileWriter << qEnumToString(cmd.error()) << endl;
-        _fileWriter << cmd.errorString() << endl;
+        contentWriter << "Failed to run command: " << cmd.program() << endl;
+        contentWriter << failure << endl;
+        contentWriter << cmd.errorString() << endl;
+        part.status = failure;
+    }
+    contentWriter.flush();
+
+    // If the command timed out, kill it.  The QProcess is destroyed when the
+    // part is written.
+    if(cmd.state() != QProcess::ProcessState::NotRunning)
+        cmd.kill();
+
+    part.content = std::move(content);
+    part.stdOut.clear();
+    part.stdErr.clear();
+    part.elapsedMs = part.time.elapsed();
+    part.complete = true;
+
+    --_runningCommands;
+    _runningPrograms.remove(cmd.program());
+    startCommands();
+    writeCompleteParts();
+}
+
+void DiagnosticsFile::writeCompleteParts()
+{
+    while(_nextWrite < _parts.size() && _parts[_nextWrite]->complete)
+    {
+        Part &part = *_parts[_nextWrite];
+        _diagFile.write(diagnosticsCommandHeader(part.title).toUtf8());
+        _diagFile.write(part.content);
+        qInfo() << "Wrote" << part.title << "in" << (part.elapsedMs / 1000.0)
+            << "sec -" << part.content.size() << "bytes";
+
+        // Release the content and process; the title and timing are kept for
+        // the summary
+        part.content.clear();
+        if(part.pProcess)
+            releaseProcess(std::move(part.pProcess));
+        ++_nextWrite;
+    }
+
+    if(_finishing && _nextWrite == _parts.size() && isPending())
+    {
+        writeTimingSummary();
+        _diagFile.close();
+        qInfo() << "Wrote" << _parts.size() << "diagnostics parts in"
+            << (_totalTime.elapsed() / 1000.0) << "sec";
+        resolve();
+    }
+}
+
+void DiagnosticsFile::writeTimingSummary()
+{
+    QByteArray summary;
+    QTextStream summaryWriter{&summary};
+    for(const auto &pPart : _parts)
+    {
+        summaryWriter << pPart->elapsedMs << " ms - " << pPart->title;
+        if(!pPart->status.isEmpty())
+            summaryWriter << " (" << pPart->status << ")";
+        summaryWriter << endl;
     }
+    summaryWriter << "Total: " << _totalTime.elapsed() << " ms" << endl;
+    summaryWriter.flush();
 
-    logPart(commandName, commandTime);
+    _diagFile.write(diagnosticsCommandHeader(QStringLiteral("Diagnostics timing")).toUtf8());
+    _diagFile.write(summary);
 }
 
 void DiagnosticsFile::writeCommand(const QString &commandName,
@@ -679,10 +986,10 @@ void DiagnosticsFile::writeCommand(const QString &commandName,
                                    const QStringList &args,
                                    const ProcessOutputFunction &processOutput)
 {
-    QProcess cmd;
-    cmd.setArguments(args);
-    cmd.setProgram(command);
-    execAndWriteOutput(cmd, commandName, processOutput);
+    std::unique_ptr<QProcess> pCmd{new QProcess{}};
+    pCmd->setArguments(args);
+    pCmd->setProgram(command);
+    addCommand(std::move(pCmd), commandName, processOutput);
 }
 
 #ifdef Q_OS_WIN
@@ -694,28 +1001,31 @@ void DiagnosticsFile::writeCommand(const QString &commandName,
                                    const QString &nativeArgs,
                                    const ProcessOutputFunction &processOutput)
 {
-    QProcess cmd;
-    cmd.setNativeArguments(nativeArgs);
-    cmd.setProgram(command);
-    execAndWriteOutput(cmd, commandName, processOutput);
+    std::unique_ptr<QProcess> pCmd{new QProcess{}};
+    pCmd->setNativeArguments(nativeArgs);
+    pCmd->setProgram(command);
+    addCommand(std::move(pCmd), commandName, processOutput);
 }
 #endif
 
 void DiagnosticsFile::writeText(const QString &title, const QString &text)
 {
-    QElapsedTimer commandTime;
-    commandTime.start();
-
-    _fileWriter << diagnosticsCommandHeader(title);
-    _fileWriter << text << endl;
+    Part &part = addPart(title);
+    part.content = text.toUtf8();
+    part.content.append('\n');
+    // The time to generate the text isn't included, but it can be calculated
+    // from the log timestamps
+    part.complete = true;
+    writeCompleteParts();
+}
 
-    // Only the size is really important for logging a text part, but log the
-    // time too for consistency (the time to generate the text isn't included,
-    // but it can be calculated from the log timestamps)
-    logPart(title, commandTime);
+void DiagnosticsFile::finish()
+{
+    _finishing = true;
+    writeCompleteParts();
 }
 
-QJsonValue Daemon::RPC_writeDiagnostics()
+Async<QJsonValue> Daemon::RPC_writeDiagnostics()
 {
     // Diagnostics can only be written when debug logging is enabled
     if(!_settings.debugLogging())
@@ -737,15 +1047,17 @@ QJsonValue Daemon::RPC_writeDiagnostics()
     // diagnostics again before the user finishes submitting the report, etc.
     const auto &nowUtc = QDateTime::currentDateTimeUtc();
     const auto &diagFileName = nowUtc.toString(QStringLiteral("'diag_'yyyyMMdd'_'hhmmsszzz'.txt'"));
-    const auto &diagFilePath = Path::DaemonDiagnosticsDir / diagFileName;
+    const QString diagFilePath = Path::DaemonDiagnosticsDir / diagFileName;
 
-    DiagnosticsFile file{diagFilePath};
+    auto pFile = Async<DiagnosticsFile>::create(diagFilePath);
 
-    writePlatformDiagnostics(file);
+    // Start the commands; they run in the background while the daemon
+    // continues to run.
+    writePlatformDiagnostics(*pFile);
 
-    auto writePrettyJson = [&file](const QString &title, QJsonObject object, QStringList keysToRemove={}) {
+    auto writePrettyJson = [&pFile](const QString &title, QJsonObject object, QStringList keysToRemove={}) {
         for (const auto &key : keysToRemove) object.remove(key);
-        file.writeText(title, QJsonDocument(object).toJson(QJsonDocument::Indented));
+        pFile->writeText(title, QJsonDocument(object).toJson(QJsonDocument::Indented));
     };
 
     writePrettyJson("DaemonState", _state.toJsonObject(), { "groupedLocations", "externalIp", "externalVpnIp", "forwardedPort" });
@@ -753,9 +1065,13 @@ QJsonValue Daemon::RPC_writeDiagnostics()
     // credentials.
     writePrettyJson("DaemonSettings", _settings.toJsonObject(), { "proxyCustom" });
 
-    qInfo() << "Finished writing diagnostics file" << diagFilePath;
+    pFile->finish();
 
-    return QJsonValue{diagFilePath};
+    return pFile->then(this, [diagFilePath]() -> QJsonValue
+    {
+        qInfo() << "Finished writing diagnostics file" << diagFilePath;
+        return QJsonValue{diagFilePath};
+    });
 }
 
 void Daemon::RPC_writeDummyLogs()
@@ -944,7 +1260,7 @@ void Daemon::start()
 
     _server = new LocalSocketIPCServer(this);
     connect(_server, &IPCServer::newConnection, this, &Daemon::clientConnected);
-    connect(_rpc, &RemoteNotificationInterface::messageReady, _server, &IPCServer::sendMessageToAllClients);
+    connect(_rpc, &RemoteNotificationInterface::messageReady, this, &Daemon::sendToSubscribedClients);
     _server->listen();
 
     connect(&_account, &DaemonAccount::loggedInChanged, this, [this]() {
@@ -1012,13 +1328,78 @@ void Daemon::clientConnected(IPCConnection* connection)
             Q_ASSERT(isActive());
         }
     });
+    // The client receives the daemon state once it subscribes
+}
 
-    QJsonObject all;
-    all.insert(QStringLiteral("data"), g_data.toJsonObject());
-    all.insert(QStringLiteral("account"), g_account.toJsonObject());
-    all.insert(QStringLiteral("settings"), g_settings.toJsonObject());
-    all.insert(QStringLiteral("state"), g_state.toJsonObject());
-    client->post(QStringLiteral("data"), all);
+const NativeJsonObject *Daemon::getJsonObject(const QString &name) const
+{
+    if(name == QStringLiteral("data"))
+        return &_data;
+    if(name == QStringLiteral("account"))
+        return &_account;
+    if(name == QStringLiteral("settings"))
+        return &_settings;
+    if(name == QStringLiteral("state"))
+        return &_state;
+    return nullptr;
+}
+
+void Daemon::notifyWatchers(const std::vector<std::pair<QString, QSet<QString>>> &changes)
+{
+    // Serialized values by "<object>.<property>"
+    QHash<QString, QJsonValue> values;
+
+    for(ClientConnection *client : _clients)
+    {
+        if(!client->getWatching())
+            continue;
+
+        QJsonObject event;
+        for(const auto &objectChanges : changes)
+        {
+            QJsonObject objectEvent;
+            for(const auto &property : objectChanges.second)
+            {
+                if(!client->watchesProperty(objectChanges.first, property))
+                    continue;
+
+                QString key = objectChanges.first + QLatin1Char('.') + property;
+                auto itValue = values.find(key);
+                if(itValue == values.end())
+                {
+                    const NativeJsonObject *pObject = getJsonObject(objectChanges.first);
+                    itValue = values.insert(key, pObject->get(property));
+                }
+                objectEvent.insert(property, itValue.value());
+            }
+            if(!objectEvent.isEmpty())
+                event.insert(objectChanges.first, objectEvent);
+        }
+
+        if(!event.isEmpty())
+            postWatchEvent(*client, event);
+    }
+}
+
+void Daemon::postWatchEvent(ClientConnection &client, QJsonObject event)
+{
+    QElapsedTimer monotonicTimer;
+    monotonicTimer.start();
+    event.insert(QStringLiteral("seq"), static_cast<double>(client.nextWatchSeq()));
+    event.insert(QStringLiteral("time"), static_cast<double>(monotonicTimer.msecsSinceReference()));
+    client.post(QStringLiteral("watch"), event);
+}
+
+void Daemon::sendToSubscribedClients(const QByteArray &msg)
+{
+    for(ClientConnection *client : _clients)
+    {
+        if(client->getSubscribed() && client->_connection &&
+           client->_connection->isConnected())
+        {
+            client->_connection->sendMessage(msg);
+        }
+    }
 }
 
 QJsonObject getProperties(const NativeJsonObject& object, const QSet<QString>& properties)
@@ -1034,27 +1415,42 @@ QJsonObject getProperties(const NativeJsonObject& object, const QSet<QString>& p
 
 void Daemon::notifyChanges()
 {
-    QJsonObject all;
+    std::vector<std::pair<QString, QSet<QString>>> changes;
     if (!_dataChanges.empty())
     {
-        all.insert(QStringLiteral("data"), getProperties(_data, std::exchange(_dataChanges, {})));
+        changes.push_back({QStringLiteral("data"), std::exchange(_dataChanges, {})});
         _pendingSerializations |= 1;
     }
     if (!_accountChanges.empty())
     {
-        all.insert(QStringLiteral("account"), getProperties(_account, std::exchange(_accountChanges, {})));
+        changes.push_back({QStringLiteral("account"), std::exchange(_accountChanges, {})});
         _pendingSerializations |= 2;
     }
     if (!_settingsChanges.empty())
     {
-        all.insert(QStringLiteral("settings"), getProperties(_settings, std::exchange(_settingsChanges, {})));
+        changes.push_back({QStringLiteral("settings"), std::exchange(_settingsChanges, {})});
         _pendingSerializations |= 4;
     }
     if (!_stateChanges.empty())
     {
-        all.insert(QStringLiteral("state"), getProperties(_state, std::exchange(_stateChanges, {})));
+        changes.push_back({QStringLiteral("state"), std::exchange(_stateChanges, {})});
     }
     serialize();
+    notifyWatchers(changes);
+
+    // Only serialize the changes for subscribed clients if there are any
+    if (std::none_of(_clients.begin(), _clients.end(),
+                     [](ClientConnection *client){return client->getSubscribed();}))
+    {
+        return;
+    }
+
+    QJsonObject all;
+    for (const auto &objectChanges : changes)
+    {
+        all.insert(objectChanges.first,
+                   getProperties(*getJsonObject(objectChanges.first), objectChanges.second));
+    }
     _rpc->post(QStringLiteral("data"), all);
 }
 
@@ -1092,6 +1488,11 @@ void Daemon::vpnStateChanged(VPNConnection::State state,
         return;
     }
 
+    // Connections cached by the shared network managers break when the VPN
+    // connects or disconnects.  New requests use new managers; requests in
+    // progress aren't interrupted.
+    NetworkPool::resetConnections();
+
     if (!_connection->needsReconnect())
         _state.needsReconnect(false);
     _state.connectionState(qEnumToString(state));
@@ -1285,7 +1686,18 @@ void Daemon::vpnByteCountsChanged()
 {
     _state.bytesReceived(_connection->bytesReceived());
     _state.bytesSent(_connection->bytesSent());
-    _state.intervalMeasurements(_connection->intervalMeasurements());
+
+    // Send just the new bandwidth points to clients, the whole history is
+    // only sent when a client connects.
+    const BandwidthHistory &history = _connection->bandwidthHistory();
+    if(history.generation() != _bandwidthPostedGeneration)
+    {
+        _bandwidthPostedSeqs = {};
+        _bandwidthPostedGeneration = history.generation();
+    }
+    QJsonObject newPoints{history.toJson(_bandwidthPostedSeqs)};
+    _bandwidthPostedSeqs = history.lastSequences();
+    _rpc->post(QStringLiteral("bandwidth"), newPoints);
 }
 
 // Find original gateway IP and interface
@@ -1356,19 +1768,17 @@ void Daemon::portForwardUpdated(int port, bool needsReconnect)
     _state.forwardedPort(port);
 }
 
-void Daemon::updateSupportedVpnPorts(const QJsonObject &serversObj)
+void Daemon::updateSupportedVpnPorts(const ServerList &serverList)
 {
-    const auto &portInfo = serversObj["info"].toObject()["vpn_ports"].toObject();
-    const QString warningMsg{"Could not find supported vpn_ports from region data. Error: %1"};
-
-    try
+    // ServerListParser leaves these empty if they weren't present or valid
+    if(serverList.udpPorts.isEmpty() || serverList.tcpPorts.isEmpty())
     {
-        _data.udpPorts(JsonCaster{portInfo["udp"]});
-        _data.tcpPorts(JsonCaster{portInfo["tcp"]});
+        qWarning() << "Could not find supported vpn_ports from region data";
     }
-    catch (const std::exception &ex)
+    else
     {
-        qWarning() << warningMsg.arg(ex.what());
+        _data.udpPorts(serverList.udpPorts);
+        _data.tcpPorts(serverList.tcpPorts);
     }
 
     // If our currently selected ports are not present in the supported ports, then reset to 0 (auto)
@@ -1376,34 +1786,78 @@ void Daemon::updateSupportedVpnPorts(const QJsonObject &serversObj)
     if (!_data.tcpPorts().contains(_settings.remotePortTCP())) _settings.remotePortTCP(0);
 }
 
-void Daemon::regionsLoaded(const QJsonDocument &regionsJsonDoc)
+void Daemon::regionsLoaded(const QByteArray &regionsPayload)
 {
-    const auto &serversObj = regionsJsonDoc.object();
+    // A newer payload replaces one that's still being parsed
+    if(_pRegionsParse)
+    {
+        _pRegionsParse->cancel();
+        _pRegionsParse.abandon();
+    }
 
+    // Parse on the worker pool - the list is large enough that this would
+    // hold up IPC on the main thread.
+    _pRegionsParse = _workerPool.run([regionsPayload]()
+        {
+            ServerList serverList;
+            // If this fails, the error is in serverList.errors, and there are
+            // no locations - updateServerLocations() logs it and the load
+            // fails in applyServerList().
+            ServerListParser::parse(regionsPayload, serverList);
+            return serverList;
+        });
+    int payloadSize = regionsPayload.size();
+    _pRegionsParse->notify(this, [this, payloadSize](const Error &error, const ServerList &serverList)
+        {
+            if(error)
+            {
+                // Canceled by a newer payload or by shutdown
+                if(error.code() != Error::TaskRejected)
+                    qWarning() << "Unable to parse regions list:" << error;
+                return;
+            }
+            applyServerList(serverList, payloadSize);
+        });
+}
+
+void Daemon::applyServerList(const ServerList &serverList, int payloadSize)
+{
     // update the available port numbers for udp/tcp
-    updateSupportedVpnPorts(serversObj);
+    updateSupportedVpnPorts(serverList);
 
-    //Build ServerLocations from the JSON document
+    //Build ServerLocations from the servers list
     ServerLocations newLocations = updateServerLocations(_data.locations(),
-                                                         serversObj);
+                                                         serverList);
 
     //If no locations were found, treat this as an error, since it would
     //prevent any connections from being made
     if(newLocations.empty())
     {
         qWarning() << "Server location data could not be loaded.  Received"
-            << regionsJsonDoc.toJson();
+            << payloadSize << "bytes";
         return;
     }
 
     // The data were loaded successfully, store it in DaemonData
     _data.locations(newLocations);
 
-    // Update the grouped locations too
-    rebuildLocations();
+    // The servers list changed, so build a new location table, then update
+    // the grouped locations too
+    rebuildLocations(true);
+
+    const auto &pTable = LocationTable::current();
+    std::size_t tableMemory = pTable->memoryUsage();
+    std::size_t objectMemory = LocationTable::estimateObjectMemory(newLocations);
+    qInfo() << "Loaded" << pTable->size() << "locations with"
+        << pTable->uniqueStrings() << "distinct strings - location table uses"
+        << tableMemory << "bytes, location objects use at least"
+        << objectMemory << "bytes, saved"
+        << (objectMemory > tableMemory ? objectMemory - tableMemory : 0)
+        << "bytes; each latency update uses" << pTable->versionMemoryUsage()
+        << "bytes";
 
     //Update the locations in LatencyTracker
-    _latencyTracker.updateLocations(newLocations);
+    _latencyTracker.updateLocations(pTable);
 
     // A load succeeded, tell JsonRefresher to switch to the long interval
     _regionRefresher.loadSucceeded();
@@ -1415,6 +1869,7 @@ void Daemon::shadowsocksRegionsLoaded(const QJsonDocument &shadowsocksRegionsJso
 
     // Build new ServerLocations
     auto newLocations = updateShadowsocksLocations(_data.locations(),
+                                                   *LocationTable::current(),
                                                    shadowsocksRegionsObj);
     _data.locations(newLocations);
 
@@ -1785,18 +2240,35 @@ void Daemon::upgradeSettings(bool existingSettingsFile)
         restrictAccountJson();
 }
 
-void Daemon::rebuildLocations()
+void Daemon::rebuildLocations(bool serversChanged)
 {
+    // Publish a new location table for the new stored locations.  Other
+    // threads (like the latency measurements) keep reading the versions they
+    // already have.
+    std::shared_ptr<const LocationTable> pTable;
+    if(serversChanged)
+        pTable = std::make_shared<const LocationTable>(_data.locations());
+    else
+        pTable = LocationTable::current()->update(_data.locations());
+    LocationTable::publish(pTable);
+
     // Update the grouped locations from the new stored locations
-    _state.groupedLocations(buildGroupedLocations(_data.locations()));
+    _state.groupedLocations(buildGroupedLocations(*pTable, _data.locations()));
 
     // Pick the best location
-    NearestLocations nearest{_data.locations()};
-    _state.vpnLocations().bestLocation(nearest.getNearestSafeVpnLocation(_settings.portForward()));
+    _state.vpnLocations().bestLocation(getTableLocation(*pTable, pTable->nearestSafeVpnRow(_settings.portForward())));
 
     updateChosenLocations();
 }
 
+QSharedPointer<ServerLocation> Daemon::getTableLocation(const LocationTable &table,
+                                                        LocationTable::Row row) const
+{
+    if(row == LocationTable::InvalidRow)
+        return {};
+    return _data.locations().value(table.id(row));
+}
+
 void Daemon::updateChosenLocations()
 {
     // Find the user's chosen location (nullptr if it's 'auto' or doesn't exist)
@@ -1837,10 +2309,9 @@ void Daemon::updateChosenLocations()
         _state.shadowsocksLocations().bestLocation(pNextLocation);
     else
     {
-        NearestLocations nearest{_data.locations()};
+        const auto &pTable = LocationTable::current();
         // If no SS locations are known, this is set to nullptr
-        _state.shadowsocksLocations().bestLocation(nearest.getNearestSafeServiceLocation(
-            [](auto loc){ return loc.shadowsocks(); }));
+        _state.shadowsocksLocations().bestLocation(getTableLocation(*pTable, pTable->nearestSafeShadowsocksRow()));
     }
 
     // Determine the next SS location
@@ -1953,6 +2424,9 @@ ClientConnection::ClientConnection(IPCConnection *connection, LocalMethodRegistr
     , _connection(connection)
     , _rpc(new ServerSideInterface(registry, this))
     , _active(false)
+    , _subscribed(false)
+    , _watching(false)
+    , _watchSeq(0)
     , _state(Connected)
 {
     auto setDisconnected = [this]() {
@@ -1976,6 +2450,27 @@ ClientConnection::ClientConnection(IPCConnection *connection, LocalMethodRegistr
 }
 ClientConnection* ClientConnection::_invokingClient = nullptr;
 
+void ClientConnection::setWatchFilter(QSet<QString> watchFilter)
+{
+    _watching = true;
+    _watchFilter = std::move(watchFilter);
+}
+
+bool ClientConnection::watchesProperty(const QString &object, const QString &property) const
+{
+    if(!_watching)
+        return false;
+
+    if(_watchFilter.isEmpty())
+    {
+        return object != QStringLiteral("account") &&
+            !daemonWatchDefaultExcluded.contains(property);
+    }
+
+    return _watchFilter.contains(object) ||
+        _watchFilter.contains(object + QLatin1Char('.') + property);
+}
+
 void ClientConnection::disconnect()
 {
     if (_state < Disconnecting)
@@ -24,19 +24,27 @@
 #pragma once
 
 #include "settings.h"
+#include "locationtable.h"
 #include "async.h"
 #include "jsonrpc.h"
 #include "latencytracker.h"
 #include "portforwarder.h"
 #include "updatedownloader.h"
 #include "vpn.h"
+#include "workerpool.h"
 #include "apiclient.h"
 
 #include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFile>
 #include <QHash>
 #include <QSet>
 #include <QTimer>
 #include <QNetworkAccessManager>
+#include <QProcess>
+#include <deque>
+#include <memory>
+#include <vector>
 
 
 class IPCConnection;
@@ -86,6 +94,24 @@ public:
     bool getActive() const {return _active;}
     void setActive(bool active) {_active = active;}
 
+    // Clients that subscribe (with RPC_subscribe()) receive the full daemon
+    // state, followed by all changes and other notifications.  Clients that
+    // don't subscribe receive nothing unless they call a method - the CLI uses
+    // this to query a few properties cheaply with RPC_getProperties().
+    bool getSubscribed() const {return _subscribed;}
+    void setSubscribed(bool subscribed) {_subscribed = subscribed;}
+
+    // Clients can also watch specific properties (with RPC_watch()).  They
+    // receive "watch" events with the changes to those properties only;
+    // other properties aren't serialized for them.
+    bool getWatching() const {return _watching;}
+    void setWatchFilter(QSet<QString> watchFilter);
+    // Check whether a watching client watches a property of a daemon object
+    // ("data", "settings", etc.)
+    bool watchesProperty(const QString &object, const QString &property) const;
+    // Get the sequence number for the next watch event
+    quint64 nextWatchSeq() {return ++_watchSeq;}
+
     void disconnect();
 
 signals:
@@ -96,6 +122,12 @@ private:
     static ClientConnection *_invokingClient;
     ServerSideInterface* _rpc;
     bool _active;
+    bool _subscribed;
+    bool _watching;
+    // Properties watched, as "<object>.<property>", or "<object>" for all
+    // properties of an object.  Empty when watching the default properties.
+    QSet<QString> _watchFilter;
+    quint64 _watchSeq;
     State _state;
 };
 
@@ -125,25 +157,80 @@ struct FirewallParams
 };
 Q_DECLARE_METATYPE(FirewallParams)
 
-class DiagnosticsFile
+// DiagnosticsFile writes a diagnostics file, which consists of parts from
+// command output or text blobs.
+//
+// Commands are run concurrently (up to MaxConcurrentCommands at a time), each
+// with a timeout and a cap on its output size.  Parts are still written in the
+// order they were added, each one as soon as it and all the parts before it
+// are complete.  After all parts are added, call finish(); the task resolves
+// once all parts have been written.  The time taken by each part is logged and
+// summarized in a final part.
+class DiagnosticsFile : public Task<void>
 {
+    CLASS_LOGGING_CATEGORY("daemon")
+
 public:
     // Function type for processing command output for diagnostics.
     using ProcessOutputFunction = std::function<QByteArray(const QByteArray&)>;
 
+    // Maximum number of commands running at once.  Commands for the same
+    // program run one at a time - some tools (like iptables, which takes the
+    // xtables lock) fail if another instance is running.
+    enum : int { MaxConcurrentCommands = 6 };
+    // Only wait 5 seconds for each process.  Occasionally some commands might
+    // time out, but it's confusing for users if this takes a long time due to
+    // the current lack of feedback that we're preparing the report.
+    enum : int { CommandTimeoutMs = 5000 };
+    // Limit on each of stdout and stderr for a command; anything more is
+    // discarded.
+    enum : int { CommandOutputLimit = 8 * 1024 * 1024 };
+
 public:
     DiagnosticsFile(const QString &filePath);
+    ~DiagnosticsFile();
 
 private:
-    QString diagnosticsCommandHeader(const QString &commandName);
+    struct Part
+    {
+        QString title;
+        // The part's content - valid once complete is set
+        QByteArray content;
+        bool complete;
+        // Status and time taken, for the timing summary
+        QString status;
+        QElapsedTimer time;
+        qint64 elapsedMs;
+        // For command parts - the process and its output so far
+        std::unique_ptr<QProcess> pProcess;
+        std::unique_ptr<QTimer> pTimeout;
+        ProcessOutputFunction processOutput;
+        QByteArray stdOut, stdErr;
+        bool outputTruncated;
+    };
 
-    // Log the time and size of the part that was just written (updates
-    // _currentSize).
-    void logPart(const QString &title, QElapsedTimer &commandTime);
+    QString diagnosticsCommandHeader(const QString &commandName);
 
-    // Execute a QProcess and write the output as a file part
-    void execAndWriteOutput(QProcess &cmd, const QString &commandName,
-                            const ProcessOutputFunction &processOutput);
+    // Add a part - it's written when it's complete
+    Part &addPart(const QString &title);
+    // Add a command part for a prepared QProcess
+    void addCommand(std::unique_ptr<QProcess> pProcess, const QString &commandName,
+                    const ProcessOutputFunction &processOutput);
+    // Start queued commands, up to the concurrency limit
+    void startCommands();
+    // Destroy a command's process.  If it's still exiting after being killed,
+    // it's destroyed once it finishes instead of waiting for it.
+    void releaseProcess(std::unique_ptr<QProcess> pProcess);
+    void startCommand(Part &part);
+    // Read output from a command, up to the limit
+    void readOutput(Part &part);
+    // Complete a command part after it finishes, fails, or times out
+    void completeCommand(Part &part, const QString &failure);
+
+    // Write all the parts that can be written now, and resolve if everything
+    // has been written.
+    void writeCompleteParts();
+    void writeTimingSummary();
 
 public:
     // Write the result of a command as a file part
@@ -162,10 +249,23 @@ public:
     // Write a text blob as a file part
     void writeText(const QString &title, const QString &text);
 
+    // Indicate that all parts have been added.  The task resolves when all
+    // parts have been written.
+    void finish();
+
 private:
     QFile _diagFile;
-    QTextStream _fileWriter;
-    qint64 _currentSize;
+    QElapsedTimer _totalTime;
+    // All parts in order.  Parts before _nextWrite have been written (their
+    // content is released).
+    std::vector<std::unique_ptr<Part>> _parts;
+    std::size_t _nextWrite;
+    // Command parts that haven't been started yet
+    std::deque<Part*> _queuedCommands;
+    int _runningCommands;
+    // Programs of the commands currently running
+    QSet<QString> _runningPrograms;
+    bool _finishing;
 };
 
 class Daemon;
@@ -239,6 +339,16 @@ protected:
     // can also remain active if an active client exits unexpectedly
     // (DaemonState::invalidClientExit).
     bool isActive() const;
+    // Send a notification message to the subscribed clients
+    void sendToSubscribedClients(const QByteArray &msg);
+    // Get the daemon object with the name used in RPCs ("data", "account",
+    // "settings", or "state"), or nullptr if the name isn't valid
+    const NativeJsonObject *getJsonObject(const QString &name) const;
+    // Send the watched properties from a set of changes to each watching
+    // client.  Each property is serialized at most once, and only if some
+    // client watches it.
+    void notifyWatchers(const std::vector<std::pair<QString, QSet<QString>>> &changes);
+    void postWatchEvent(ClientConnection &client, QJsonObject event);
 
     IMPLEMENT_NOTIFICATIONS(Daemon)
 
@@ -246,10 +356,30 @@ protected:
     // RPC functions
 
     QString RPC_handshake(const QString& version);
+    // Subscribe the invoking client to the daemon state - it receives the
+    // full state now, then all changes.  See ClientConnection::getSubscribed().
+    void RPC_subscribe();
+    // Get specific properties without subscribing.  Each property is named as
+    // "<object>.<property>", where the object is data, account, settings, or
+    // state.  The result has the same structure as a "data" notification, like
+    // {"state": {"connectionState": "Connected"}}.  Throws
+    // DaemonRPCUnknownSetting if a property doesn't exist.
+    QJsonValue RPC_getProperties(const QJsonArray &properties);
+    // Watch properties without subscribing.  The filter contains property
+    // names like RPC_getProperties(), or just an object name to watch all of
+    // its properties.  An empty filter watches all data, settings, and state
+    // properties except the largest ones (like the regions list).
+    //
+    // The client receives a "watch" event with the current values, then an
+    // event each time any of the properties change.  Events have a sequence
+    // number ("seq", starting from 1), a monotonic timestamp in milliseconds
+    // ("time"), and the changes in the same structure as RPC_getProperties().
+    // Calling this again replaces the filter.
+    void RPC_watch(const QJsonArray &filter);
     void RPC_applySettings(const QJsonObject& settings, bool reconnectIfNeeded = false);
     void RPC_resetSettings();
     void RPC_connectVPN();
-    QJsonValue RPC_writeDiagnostics();
+    Async<QJsonValue> RPC_writeDiagnostics();
     void RPC_writeDummyLogs();
     void RPC_crash();
     void RPC_disconnectVPN();
@@ -327,7 +457,9 @@ protected slots:
     void vpnScannedOriginalNetwork(const OriginalNetworkScan &netScan);
     void newLatencyMeasurements(const LatencyTracker::Latencies &measurements);
     void portForwardUpdated(int port, bool needsReconnect);
-    void regionsLoaded(const QJsonDocument &regionsJsonDoc);
+    void regionsLoaded(const QByteArray &regionsPayload);
+    // Apply a parsed servers list (on the main thread)
+    void applyServerList(const ServerList &serverList, int payloadSize);
     void shadowsocksRegionsLoaded(const QJsonDocument &shadowsocksRegionsJsonDoc);
 
     void refreshAccountInfo();
@@ -335,20 +467,30 @@ protected slots:
 
 
 private:
-    // Rebuild all location-based data (location lists, chosen/best/next
-    // locations, etc.)  Used when the entire location list changes.
-    void rebuildLocations();
+    // Rebuild all location-based data (location table, location lists,
+    // chosen/best/next locations, etc.)  Used when the entire location list
+    // changes.
+    //
+    // Publishes a new version of the location table.  If serversChanged is
+    // set, the table is built from scratch; otherwise the new version shares
+    // the rows with the current table (only latencies and Shadowsocks
+    // availability have changed).
+    void rebuildLocations(bool serversChanged = false);
     // Rebuild the chosen/best/next location selections (without rebuilding the
     // entire list).  Used when data changes that affect the location
     // selections.
     void updateChosenLocations();
+    // Get the ServerLocation for a row in a LocationTable built from the
+    // current locations (nullptr for LocationTable::InvalidRow)
+    QSharedPointer<ServerLocation> getTableLocation(const LocationTable &table,
+                                                    LocationTable::Row row) const;
     void onUpdateRefreshed(const Update &availableUpdate,
                            const Update &gaUpdate, const Update &betaUpdate);
     void onUpdateDownloadProgress(const QString &version, int progress);
     void onUpdateDownloadFinished(const QString &version,
                                   const QString &installerPath);
     void onUpdateDownloadFailed(const QString &version, bool error);
-    void updateSupportedVpnPorts(const QJsonObject &serversObj);
+    void updateSupportedVpnPorts(const ServerList &serverList);
 
     void checkSplitTunnelSupport();
 
@@ -388,6 +530,9 @@ protected:
     QSet<QString> _stateChanges;
 
     unsigned int _pendingSerializations;
+    // Last bandwidth history points sent to clients (see vpnByteCountsChanged())
+    BandwidthHistory::Sequences _bandwidthPostedSeqs{};
+    quint64 _bandwidthPostedGeneration{0};
     QTimer _serializationTimer;
 
     QTimer _accountRefreshTimer;
@@ -395,6 +540,14 @@ protected:
     // Ongoing attempt to get the VPN IP address.  This can retry for a long
     // time, so we discard it if we leave the Connected state.
     Async<void> _pVpnIpRequest;
+
+    // Regions list parse in progress, if any
+    Async<WorkerPool::JobTask<ServerList>> _pRegionsParse;
+    // Pool for CPU-bound work, like verifying and parsing the regions list
+    // (also used by the JsonRefreshers).  Declared last
+    // so it's destroyed first - pending jobs are canceled before the rest of
+    // the daemon is torn down.
+    WorkerPool _workerPool;
 };
 
 #define g_daemon (Daemon::instance())
@@ -0,0 +1,188 @@
+// Copyright (c) 2019 London Trust Media Incorporated
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#line SOURCE_FILE("deltapatch.cpp")
+
+#include "deltapatch.h"
+#include <QCryptographicHash>
+#include <QFile>
+#include <QtEndian>
+#include <algorithm>
+
+namespace
+{
+    const qint64 deltaCopyChunk = 64 * 1024;
+
+    bool readDeltaU64(QFile &delta, quint64 &value)
+    {
+        char bytes[sizeof(quint64)];
+        if(delta.read(bytes, sizeof(bytes)) != sizeof(bytes))
+            return false;
+        value = qFromLittleEndian<quint64>(bytes);
+        return true;
+    }
+
+    // Copy 'length' bytes from 'source' (at its current position) to the
+    // target, hashing them.  Fails if the source ends early.
+    bool copyDeltaData(QFile &source, quint64 length, QFile &target,
+                       QCryptographicHash &hash, SignatureVerifier *pVerifier,
+                       QByteArray &buffer)
+    {
+        while(length > 0)
+        {
+            qint64 chunk = static_cast<qint64>(std::min<quint64>(length, deltaCopyChunk));
+            if(source.read(buffer.data(), chunk) != chunk)
+                return false;
+            if(target.write(buffer.constData(), chunk) != chunk)
+                return false;
+            hash.addData(buffer.constData(), static_cast<int>(chunk));
+            if(pVerifier)
+                pVerifier->update(buffer.constData(), chunk);
+            length -= static_cast<quint64>(chunk);
+        }
+        return true;
+    }
+
+    bool applyDeltaOps(QFile &base, QFile &delta, QFile &target,
+                       QCryptographicHash &hash, SignatureVerifier *pVerifier,
+                       quint64 targetSize)
+    {
+        QByteArray buffer;
+        buffer.resize(static_cast<int>(deltaCopyChunk));
+        quint64 written = 0;
+
+        while(true)
+        {
+            char opcode;
+            if(!delta.getChar(&opcode))
+            {
+                qWarning() << "Delta ended without END operation";
+                return false;
+            }
+
+            quint64 offset{0}, length{0};
+            switch(static_cast<quint8>(opcode))
+            {
+                case DeltaPatch::End:
+                    if(written != targetSize)
+                    {
+                        qWarning() << "Delta produced" << written
+                            << "bytes, expected" << targetSize;
+                        return false;
+                    }
+                    return true;
+                case DeltaPatch::Copy:
+                    if(!readDeltaU64(delta, offset) || !readDeltaU64(delta, length))
+                    {
+                        qWarning() << "Delta truncated in COPY operation";
+                        return false;
+                    }
+                    if(offset > static_cast<quint64>(base.size()) ||
+                       length > static_cast<quint64>(base.size()) - offset)
+                    {
+                        qWarning() << "Delta copies" << length << "bytes at"
+                            << offset << "beyond end of base file ("
+                            << base.size() << "bytes)";
+                        return false;
+                    }
+                    if(length > targetSize - written)
+                    {
+                        qWarning() << "Delta exceeds target size" << targetSize;
+                        return false;
+                    }
+                    if(!base.seek(static_cast<qint64>(offset)) ||
+                       !copyDeltaData(base, length, target, hash, pVerifier, buffer))
+                    {
+                        qWarning() << "Failed to copy" << length << "bytes from base file";
+                        return false;
+                    }
+                    break;
+                case DeltaPatch::Insert:
+                    if(!readDeltaU64(delta, length))
+                    {
+                        qWarning() << "Delta truncated in INSERT operation";
+                        return false;
+                    }
+                    if(length > targetSize - written)
+                    {
+                        qWarning() << "Delta exceeds target size" << targetSize;
+                        return false;
+                    }
+                    if(!copyDeltaData(delta, length, target, hash, pVerifier, buffer))
+                    {
+                        qWarning() << "Failed to insert" << length << "bytes from delta";
+                        return false;
+                    }
+                    break;
+                default:
+                    qWarning() << "Unknown delta opcode" << static_cast<quint8>(opcode);
+                    return false;
+            }
+            written += length;
+        }
+    }
+}
+
+const QByteArray DeltaPatch::magic = QByteArrayLiteral("PIADLT01");
+
+bool DeltaPatch::apply(const QString &basePath, const QString &deltaPath,
+                       const QString &targetPath, const QByteArray &expectedSha256,
+                       SignatureVerifier *pVerifier)
+{
+    QFile base{basePath}, delta{deltaPath}, target{targetPath};
+    if(!base.open(QIODevice::ReadOnly) || !delta.open(QIODevice::ReadOnly))
+    {
+        qWarning() << "Can't open base" << basePath << "or delta" << deltaPath;
+        return false;
+    }
+    if(!target.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+        qWarning() << "Can't open target" << targetPath << "-" << target.errorString();
+        return false;
+    }
+
+    QCryptographicHash hash{QCryptographicHash::Sha256};
+    quint64 targetSize{0};
+    bool success = false;
+    if(delta.read(magic.size()) != magic)
+        qWarning() << "Delta" << deltaPath << "is not a valid delta";
+    else if(!readDeltaU64(delta, targetSize))
+        qWarning() << "Delta" << deltaPath << "is truncated";
+    else if(applyDeltaOps(base, delta, target, hash, pVerifier, targetSize))
+    {
+        QByteArray actualSha256 = hash.result().toHex();
+        if(actualSha256 == expectedSha256.toLower())
+            success = true;
+        else
+        {
+            qWarning() << "Patched installer has hash" << actualSha256
+                << "- expected" << expectedSha256;
+        }
+    }
+
+    target.close();
+    if(success && target.error() != QFileDevice::NoError)
+    {
+        qWarning() << "Failed to write" << targetPath << "-" << target.errorString();
+        success = false;
+    }
+    if(!success)
+        target.remove();
+    return success;
+}
@@ -0,0 +1,72 @@
+// Copyright (c) 2019 London Trust Media Incorporated
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#line HEADER_FILE("deltapatch.h")
+
+#ifndef DELTAPATCH_H
+#define DELTAPATCH_H
+
+#include <QByteArray>
+#include "openssl.h"
+#include <QString>
+
+// DeltaPatch reconstructs an installer from the previous installer and a
+// binary delta.
+//
+// The delta format is a sequence of copy and insert operations (all integers
+// little-endian):
+//
+//   magic        8 bytes, "PIADLT01"
+//   target size  u64
+//   operations, each beginning with a u8 opcode:
+//     0x01 COPY    u64 base offset, u64 length - copy a range of the base file
+//     0x02 INSERT  u64 length, <length> bytes - insert new data
+//     0x00 END     end of the delta
+//
+// The result is always verified against the expected SHA-256 of the full
+// installer; any problem with the delta or the base file fails the patch.
+class DeltaPatch
+{
+    CLASS_LOGGING_CATEGORY("deltapatch")
+
+public:
+    static const QByteArray magic;
+
+    enum Opcode : quint8
+    {
+        End = 0x00,
+        Copy = 0x01,
+        Insert = 0x02,
+    };
+
+public:
+    // Apply a delta to basePath, writing the result to targetPath.  Returns
+    // true if the result was written and has the expected hash (hex-encoded
+    // SHA-256).  On failure, targetPath is removed.
+    //
+    // If pVerifier is given, the result is also provided to it as it's
+    // written, so the caller can verify a signature without reading it again.
+    //
+    // Files are streamed, this can be used on a worker thread.
+    static bool apply(const QString &basePath, const QString &deltaPath,
+                      const QString &targetPath, const QByteArray &expectedSha256,
+                      SignatureVerifier *pVerifier = nullptr);
+};
+
+#endif
@@ -0,0 +1,737 @@
+// Copyright (c) 2019 London Trust Media Incorporated
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#line SOURCE_FILE("installerdownload.cpp")
+
+#include "installerdownload.h"
+#include "networkpool.h"
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSaveFile>
+#include <algorithm>
+#include <chrono>
+
+namespace
+{
+    // Save the download state after this much data is written
+    const qint64 installerStateSaveBytes = 1024 * 1024;
+    // Restart a segment if it doesn't receive any data for this long
+    const std::chrono::seconds installerIdleTimeout{60};
+    const std::chrono::seconds installerIdleCheckInterval{5};
+    // Fail the download after this many consecutive failures of one segment
+    const int installerMaxFailures = 6;
+    // Retry delays - doubled after each failure up to the maximum
+    const std::chrono::seconds installerRetryDelay{2};
+    const std::chrono::seconds installerMaxRetryDelay{60};
+    // Give up if the file on the server keeps changing during the download
+    const int installerMaxRestarts = 2;
+    // Size of reads from the network and when hashing data from the file
+    const qint64 installerReadChunk = 64 * 1024;
+
+    // Parse a Content-Range header - "bytes <first>-<last>/<total>".  total is
+    // -1 if the server doesn't know it ('*').
+    bool parseContentRange(const QByteArray &value, qint64 &first, qint64 &total)
+    {
+        if(!value.startsWith("bytes "))
+            return false;
+        int dash = value.indexOf('-');
+        int slash = value.indexOf('/');
+        if(dash < 0 || slash < dash)
+            return false;
+        bool firstOk{false}, lastOk{false}, totalOk{true};
+        first = value.mid(6, dash - 6).trimmed().toLongLong(&firstOk);
+        value.mid(dash + 1, slash - dash - 1).trimmed().toLongLong(&lastOk);
+        QByteArray totalStr = value.mid(slash + 1).trimmed();
+        total = totalStr == "*" ? -1 : totalStr.toLongLong(&totalOk);
+        return firstOk && lastOk && totalOk;
+    }
+}
+
+const qint64 InstallerDownload::ParallelThreshold = 8 * 1024 * 1024;
+const int InstallerDownload::ParallelSegments = 4;
+const QString InstallerDownload::stateFileSuffix = QStringLiteral(".partial");
+
+InstallerDownload::Segment::Segment(qint64 start, qint64 end, qint64 received)
+    : start{start}, end{end}, received{received}, failures{0},
+      timedOut{false}, headersChecked{false}
+{
+}
+
+InstallerDownload::InstallerDownload(QNetworkAccessManager &networkManager,
+                                     QUrl url, QString filePath,
+                                     QByteArray expectedSha256)
+    : _networkManager{networkManager}, _url{std::move(url)},
+      _filePath{std::move(filePath)},
+      _expectedSha256{expectedSha256.toLower()}, _total{-1},
+      _rangesSupported{false}, _hash{QCryptographicHash::Sha256},
+      _hashedEnd{0}, _unsavedBytes{0}, _restarts{0}, _finished{false}
+{
+    _readBuffer.resize(static_cast<int>(installerReadChunk));
+    _idleCheckTimer.setInterval(msec32(installerIdleCheckInterval));
+    connect(&_idleCheckTimer, &QTimer::timeout, this,
+            &InstallerDownload::checkIdleSegments);
+}
+
+InstallerDownload::~InstallerDownload()
+{
+    // If we're destroyed during a download, keep what we have so far
+    if(!_finished)
+    {
+        abortSegments();
+        saveState();
+    }
+}
+
+bool InstallerDownload::loadState()
+{
+    QFile stateFile{_filePath + stateFileSuffix};
+    if(!stateFile.open(QIODevice::ReadOnly))
+        return false;
+    QJsonObject state = QJsonDocument::fromJson(stateFile.readAll()).object();
+
+    // The state has to be for the same URL, and the file must still be
+    // allocated at its full size.
+    if(state.value(QStringLiteral("url")).toString() != _url.toString())
+    {
+        qInfo() << "Partial download is for a different URL, starting over";
+        return false;
+    }
+    qint64 total = static_cast<qint64>(state.value(QStringLiteral("total")).toDouble(-1));
+    QByteArray validator = state.value(QStringLiteral("validator")).toString().toUtf8();
+    if(total <= 0 || validator.isEmpty() || QFileInfo{_filePath}.size() != total)
+    {
+        qInfo() << "Partial download state is not valid, starting over";
+        return false;
+    }
+
+    // The segments must cover the file exactly
+    std::vector<Segment> segments;
+    qint64 nextStart = 0;
+    for(const auto &segmentVal : state.value(QStringLiteral("segments")).toArray())
+    {
+        const auto &segmentArray = segmentVal.toArray();
+        qint64 start = static_cast<qint64>(segmentArray.at(0).toDouble(-1));
+        qint64 end = static_cast<qint64>(segmentArray.at(1).toDouble(-1));
+        qint64 received = static_cast<qint64>(segmentArray.at(2).toDouble(-1));
+        if(start != nextStart || end <= start || end > total || received < 0 ||
+           received > end - start)
+        {
+            qInfo() << "Partial download segments are not valid, starting over";
+            return false;
+        }
+        segments.emplace_back(start, end, received);
+        nextStart = end;
+    }
+    if(nextStart != total)
+    {
+        qInfo() << "Partial download segments are incomplete, starting over";
+        return false;
+    }
+
+    _total = total;
+    _validator = validator;
+    _rangesSupported = true;
+    _segments = std::move(segments);
+    qInfo() << "Resuming download of" << _url << "with" << totalReceived()
+        << "of" << _total << "bytes in" << _segments.size() << "segments";
+    return true;
+}
+
+void InstallerDownload::saveState()
+{
+    // Only downloads that can be resumed are persisted
+    if(!_rangesSupported || _validator.isEmpty() || _total <= 0 || !_file.isOpen())
+        return;
+
+    // Make sure the data is written before the state that refers to it
+    _file.flush();
+
+    QJsonArray segments;
+    for(const auto &segment : _segments)
+    {
+        segments.append(QJsonArray{static_cast<double>(segment.start),
+                                   static_cast<double>(segment.end),
+                                   static_cast<double>(segment.received)});
+    }
+    QJsonObject state
+    {
+        {QStringLiteral("url"), _url.toString()},
+        {QStringLiteral("total"), static_cast<double>(_total)},
+        {QStringLiteral("validator"), QString::fromUtf8(_validator)},
+        {QStringLiteral("segments"), segments}
+    };
+
+    QSaveFile stateFile{_filePath + stateFileSuffix};
+    if(!stateFile.open(QIODevice::WriteOnly) ||
+       stateFile.write(QJsonDocument{state}.toJson(QJsonDocument::Compact)) < 0 ||
+       !stateFile.commit())
+    {
+        qWarning() << "Unable to save download state to" << stateFile.fileName()
+            << "-" << stateFile.errorString();
+    }
+    _unsavedBytes = 0;
+}
+
+void InstallerDownload::discardState()
+{
+    QFile::remove(_filePath + stateFileSuffix);
+}
+
+void InstallerDownload::resetSegments()
+{
+    _segments.clear();
+    _segments.reserve(static_cast<std::size_t>(ParallelSegments));
+    _segments.emplace_back(0, -1, 0);
+    _total = -1;
+    _validator.clear();
+    _rangesSupported = false;
+    resetHash();
+    _unsavedBytes = 0;
+}
+
+void InstallerDownload::resetHash()
+{
+    _hash.reset();
+    _hashedEnd = 0;
+    if(!_signature.isEmpty())
+        _pVerifier.reset(new SignatureVerifier{_signatureKey});
+}
+
+void InstallerDownload::hashData(const char *data, qint64 len)
+{
+    _hash.addData(data, static_cast<int>(len));
+    if(_pVerifier)
+        _pVerifier->update(data, len);
+    _hashedEnd += len;
+}
+
+void InstallerDownload::abortSegments()
+{
+    for(auto &segment : _segments)
+    {
+        if(segment.pReply)
+        {
+            // Disconnect first, we don't want the finished signal for this
+            segment.pReply->disconnect(this);
+            segment.pReply->abort();
+            segment.pReply->deleteLater();
+            segment.pReply.clear();
+        }
+    }
+}
+
+void InstallerDownload::restartDownload(const QString &reason)
+{
+    abortSegments();
+    discardState();
+    if(++_restarts > installerMaxRestarts)
+    {
+        qWarning() << "Download of" << _url << "failed -" << reason
+            << "- too many restarts";
+        finish(Result::Failed);
+        return;
+    }
+
+    qInfo() << "Restarting download of" << _url << "-" << reason;
+    _file.resize(0);
+    resetSegments();
+    startSegment(0);
+}
+
+void InstallerDownload::startSegment(std::size_t index)
+{
+    // Ignore stale retries after a restart or completion
+    if(_finished || index >= _segments.size())
+        return;
+    Segment &segment = _segments[index];
+    if(segment.pReply || segment.complete())
+        return;
+
+    QNetworkRequest request{_url};
+    NetworkPool::prepareRequest(request);
+    // Segments are downloaded in parallel to use more than one connection;
+    // HTTP/2 would multiplex them on one connection.
+    request.setAttribute(QNetworkRequest::Http2AllowedAttribute, false);
+    request.setAttribute(QNetworkRequest::FollowRedirectsAttribute, true);
+    qint64 first = segment.start + segment.received;
+    QByteArray range = "bytes=" + QByteArray::number(first) + "-";
+    if(segment.end >= 0)
+        range += QByteArray::number(segment.end - 1);
+    request.setRawHeader("Range", range);
+    // If the file has changed, the server sends all of it instead of the range
+    if(!_validator.isEmpty())
+        request.setRawHeader("If-Range", _validator);
+
+    segment.timedOut = false;
+    segment.headersChecked = false;
+    segment.idleTime.start();
+    segment.pReply = _networkManager.get(request);
+    segment.pReply->setParent(this);
+    connect(segment.pReply, &QIODevice::readyRead, this,
+            [this, index](){onSegmentReadyRead(index);});
+    connect(segment.pReply, &QNetworkReply::finished, this,
+            [this, index](){onSegmentFinished(index);});
+}
+
+InstallerDownload::HeaderCheck InstallerDownload::checkSegmentHeaders(std::size_t index)
+{
+    Segment &segment = _segments[index];
+    if(segment.headersChecked)
+        return HeaderCheck::Ok;
+
+    QNetworkReply &reply = *segment.pReply;
+    QVariant statusAttr = reply.attribute(QNetworkRequest::HttpStatusCodeAttribute);
+    // Non-HTTP URLs (no status) are treated like a normal HTTP response.
+    int status = statusAttr.isValid() ? statusAttr.toInt() : 200;
+    qint64 first = segment.start + segment.received;
+
+    if(status == 206)
+    {
+        qint64 rangeFirst{}, rangeTotal{};
+        if(!parseContentRange(reply.rawHeader("Content-Range"), rangeFirst, rangeTotal) ||
+           rangeFirst != first)
+        {
+            restartDownload(QStringLiteral("unexpected content range"));
+            return HeaderCheck::Restarted;
+        }
+
+        if(_total < 0)
+        {
+            // This is the first response for a new download.  If the server
+            // doesn't know the size, it's downloaded like a normal response.
+            _total = rangeTotal;
+            if(_total >= 0)
+            {
+                segment.end = _total;
+                _rangesSupported = true;
+                // If-Range requires a strong validator
+                QByteArray etag = reply.rawHeader("ETag");
+                if(!etag.isEmpty() && !etag.startsWith("W/"))
+                    _validator = etag;
+                else
+                    _validator = reply.rawHeader("Last-Modified");
+                if(!_file.resize(_total))
+                {
+                    qError() << "Can't allocate" << _total << "bytes for"
+                        << _filePath << "-" << _file.errorString();
+                    finish(Result::Failed);
+                    return HeaderCheck::Restarted;
+                }
+                // The segment reference is invalidated by splitting
+                segment.headersChecked = true;
+                splitSegments();
+                saveState();
+                return HeaderCheck::Ok;
+            }
+        }
+        else if(rangeTotal != _total)
+        {
+            restartDownload(QStringLiteral("file size changed"));
+            return HeaderCheck::Restarted;
+        }
+    }
+    else if(status == 200)
+    {
+        // The server sent the whole file.  That's fine for a new download,
+        // otherwise the file changed or the server no longer supports ranges.
+        if(first != 0 || _segments.size() != 1)
+        {
+            restartDownload(QStringLiteral("server sent the entire file"));
+            return HeaderCheck::Restarted;
+        }
+        _rangesSupported = false;
+        _validator.clear();
+        discardState();
+        QVariant lengthHeader = reply.header(QNetworkRequest::ContentLengthHeader);
+        _total = lengthHeader.isValid() ? lengthHeader.toLongLong() : -1;
+        segment.end = _total;
+    }
+    else if(status == 416)
+    {
+        restartDownload(QStringLiteral("range not satisfiable"));
+        return HeaderCheck::Restarted;
+    }
+    else
+    {
+        // An error response, its body isn't part of the file.  The reply
+        // will finish with an error.
+        return HeaderCheck::NoData;
+    }
+
+    segment.headersChecked = true;
+    return HeaderCheck::Ok;
+}
+
+void InstallerDownload::splitSegments()
+{
+    if(!_rangesSupported || _total < ParallelThreshold || _segments.size() != 1)
+        return;
+
+    qint64 segmentSize = _total / ParallelSegments;
+    _segments[0].end = segmentSize;
+    for(int i = 1; i < ParallelSegments; ++i)
+    {
+        qint64 end = (i == ParallelSegments - 1) ? _total : segmentSize * (i + 1);
+        _segments.emplace_back(segmentSize * i, end, 0);
+    }
+    qInfo() << "Downloading" << _total << "bytes in" << _segments.size()
+        << "segments";
+    for(std::size_t i = 1; i < _segments.size(); ++i)
+        startSegment(i);
+}
+
+bool InstallerDownload::readSegmentData(std::size_t index)
+{
+    switch(checkSegmentHeaders(index))
+    {
+        case HeaderCheck::Ok:
+            break;
+        case HeaderCheck::NoData:
+            return true;
+        case HeaderCheck::Restarted:
+            return false;
+    }
+
+    Segment &segment = _segments[index];
+    QNetworkReply &reply = *segment.pReply;
+    qint64 readBytes = 0;
+    while(reply.bytesAvailable() > 0)
+    {
+        qint64 wanted = std::min(reply.bytesAvailable(), installerReadChunk);
+        // The first segment might continue past its end after splitting
+        if(segment.end >= 0)
+            wanted = std::min(wanted, segment.size() - segment.received);
+        if(wanted <= 0)
+            break;
+        qint64 len = reply.read(_readBuffer.data(), wanted);
+        if(len <= 0)
+            break;
+        if(!writeSegmentData(segment, _readBuffer.data(), len))
+        {
+            qError() << "Failed to write to" << _filePath << "-"
+                << _file.errorString();
+            finish(Result::Failed);
+            return false;
+        }
+        readBytes += len;
+    }
+
+    if(readBytes > 0)
+    {
+        segment.idleTime.restart();
+        segment.failures = 0;
+        emit progress(totalReceived(), _total);
+    }
+    if(_unsavedBytes >= installerStateSaveBytes)
+        saveState();
+    return true;
+}
+
+void InstallerDownload::onSegmentReadyRead(std::size_t index)
+{
+    if(!readSegmentData(index))
+        return;
+
+    Segment &segment = _segments[index];
+    if(segment.complete())
+    {
+        // Done with this segment - stop the reply if it's still sending data
+        // past the end of the segment
+        if(segment.pReply)
+        {
+            segment.pReply->disconnect(this);
+            segment.pReply->abort();
+            segment.pReply->deleteLater();
+            segment.pReply.clear();
+        }
+        saveState();
+        checkComplete();
+    }
+}
+
+void InstallerDownload::onSegmentFinished(std::size_t index)
+{
+    Segment &segment = _segments[index];
+    Q_ASSERT(segment.pReply);   // Valid when connected
+    QNetworkReply::NetworkError error = segment.pReply->error();
+    int status = segment.pReply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+
+    // Read any remaining data
+    if(error == QNetworkReply::NetworkError::NoError && !readSegmentData(index))
+        return;
+
+    Segment &finishedSegment = _segments[index];
+    finishedSegment.pReply->deleteLater();
+    finishedSegment.pReply.clear();
+
+    // If the size wasn't known, the download is complete when the response
+    // ends successfully.
+    if(finishedSegment.end < 0 && error == QNetworkReply::NetworkError::NoError)
+    {
+        finishedSegment.end = finishedSegment.start + finishedSegment.received;
+        _total = finishedSegment.end;
+    }
+
+    if(finishedSegment.complete())
+    {
+        saveState();
+        checkComplete();
+        return;
+    }
+
+    if(status == 416)
+    {
+        restartDownload(QStringLiteral("range not satisfiable"));
+        return;
+    }
+
+    // Content and protocol errors (not found, access denied, etc.) won't be
+    // fixed by retrying.
+    if(!finishedSegment.timedOut &&
+       error >= QNetworkReply::NetworkError::ContentAccessDenied &&
+       error <= QNetworkReply::NetworkError::ProtocolFailure)
+    {
+        qWarning() << "Download of" << _url << "failed with error:"
+            << qEnumToString(error) << "- status" << status;
+        finish(Result::Failed);
+        return;
+    }
+
+    retrySegment(index, finishedSegment.timedOut ? QStringLiteral("timed out") :
+                        error == QNetworkReply::NetworkError::NoError ? QStringLiteral("response ended early") :
+                        QString{qEnumToString(error)});
+}
+
+void InstallerDownload::retrySegment(std::size_t index, const QString &reason)
+{
+    Segment &segment = _segments[index];
+    ++segment.failures;
+    if(segment.failures > installerMaxFailures)
+    {
+        qWarning() << "Download of" << _url << "failed -" << reason
+            << "- after" << installerMaxFailures << "retries";
+        finish(Result::Failed);
+        return;
+    }
+
+    // Without range support, the only option is to start over
+    if(!_rangesSupported && segment.received > 0)
+    {
+        segment.received = 0;
+        segment.end = -1;
+        _total = -1;
+        resetHash();
+        _file.resize(0);
+    }
+
+    std::chrono::seconds delay = std::min(installerRetryDelay * (1 << (segment.failures - 1)),
+                                          installerMaxRetryDelay);
+    qInfo() << "Segment" << index << "of" << _url << "failed -" << reason
+        << "- retrying in" << traceMsec(delay);
+    QTimer::singleShot(msec32(delay), this, [this, index](){startSegment(index);});
+}
+
+void InstallerDownload::checkIdleSegments()
+{
+    for(std::size_t i = 0; i < _segments.size() && !_finished; ++i)
+    {
+        Segment &segment = _segments[i];
+        if(segment.pReply && segment.idleTime.elapsed() > msec(installerIdleTimeout))
+        {
+            // Aborting finishes the reply, which retries the segment
+            segment.timedOut = true;
+            segment.pReply->abort();
+        }
+    }
+}
+
+bool InstallerDownload::writeSegmentData(Segment &segment, const char *data, qint64 len)
+{
+    qint64 pos = segment.start + segment.received;
+    if(!_file.seek(pos) || _file.write(data, len) != len)
+        return false;
+    segment.received += len;
+    _unsavedBytes += len;
+    return updateHash(pos, data, len);
+}
+
+bool InstallerDownload::updateHash(qint64 pos, const char *data, qint64 len)
+{
+    // Hash the new data directly if it's next.  This is the normal case for a
+    // single segment, or for the first segment.
+    if(pos == _hashedEnd && len > 0)
+        hashData(data, len);
+
+    // If this filled a gap (or if other segments were received earlier), hash
+    // the data that's now contiguous from the file.
+    qint64 end = contiguousEnd();
+    if(_hashedEnd < end)
+    {
+        if(!_file.seek(_hashedEnd))
+            return false;
+        while(_hashedEnd < end)
+        {
+            qint64 chunk = _file.read(_readBuffer.data(),
+                                      std::min(end - _hashedEnd, installerReadChunk));
+            if(chunk <= 0)
+                return false;
+            hashData(_readBuffer.constData(), chunk);
+        }
+    }
+    return true;
+}
+
+qint64 InstallerDownload::contiguousEnd() const
+{
+    qint64 end = 0;
+    for(const auto &segment : _segments)
+    {
+        if(segment.start != end)
+            break;
+        end = segment.start + segment.received;
+        if(!segment.complete())
+            break;
+    }
+    return end;
+}
+
+qint64 InstallerDownload::totalReceived() const
+{
+    qint64 received = 0;
+    for(const auto &segment : _segments)
+        received += segment.received;
+    return received;
+}
+
+void InstallerDownload::checkComplete()
+{
+    if(_finished)
+        return;
+    for(const auto &segment : _segments)
+    {
+        if(!segment.complete())
+            return;
+    }
+
+    // All data was received; the hash should cover the whole file
+    if(!updateHash(_hashedEnd, nullptr, 0) || _hashedEnd != _total)
+    {
+        qError() << "Unable to hash downloaded file" << _filePath << "-"
+            << _file.errorString();
+        finish(Result::Failed);
+        return;
+    }
+    _sha256 = _hash.result().toHex();
+    _file.close();
+    discardState();
+
+    if(!_expectedSha256.isEmpty() && _sha256 != _expectedSha256)
+    {
+        // Start over next time, the partial state evidently isn't reliable
+        qWarning() << "Download of" << _url << "has hash" << _sha256
+            << "- expected" << _expectedSha256;
+        _file.remove();
+        finish(Result::Failed);
+        return;
+    }
+
+    if(_pVerifier && !_pVerifier->verify(_signature))
+    {
+        qWarning() << "Download of" << _url << "has an invalid signature";
+        _file.remove();
+        finish(Result::Failed);
+        return;
+    }
+
+    qInfo() << "Downloaded" << _total << "bytes from" << _url << "- SHA-256"
+        << _sha256;
+    finish(Result::Succeeded);
+}
+
+void InstallerDownload::finish(Result result)
+{
+    if(_finished)
+        return;
+    _finished = true;
+    _idleCheckTimer.stop();
+    abortSegments();
+
+    if(_file.isOpen())
+    {
+        // Keep the partial file if it can be resumed, otherwise it's useless
+        saveState();
+        _file.close();
+        if(!_rangesSupported || _validator.isEmpty())
+            _file.remove();
+    }
+
+    emit finished(result);
+}
+
+void InstallerDownload::setSignature(QByteArray publicKeyPem, QByteArray signature)
+{
+    _signatureKey = std::move(publicKeyPem);
+    _signature = std::move(signature);
+}
+
+void InstallerDownload::start()
+{
+    resetHash();
+    _file.setFileName(_filePath);
+    bool resuming = loadState();
+    if(!resuming)
+    {
+        discardState();
+        QFile::remove(_filePath);
+        resetSegments();
+    }
+
+    if(!_file.open(QIODevice::ReadWrite))
+    {
+        qError() << "Can't download installer - can't open file" << _filePath
+            << "-" << _file.errorString();
+        finish(Result::Failed);
+        return;
+    }
+
+    // When resuming, hash the data that was already downloaded
+    if(resuming && !updateHash(0, nullptr, 0))
+    {
+        qWarning() << "Can't read partial download" << _filePath
+            << "- starting over";
+        _file.resize(0);
+        discardState();
+        resetSegments();
+    }
+
+    _idleCheckTimer.start();
+    emit progress(totalReceived(), _total);
+    for(std::size_t i = 0; i < _segments.size(); ++i)
+        startSegment(i);
+    // If the partial download was actually complete, finish now
+    checkComplete();
+}
+
+void InstallerDownload::cancel()
+{
+    qInfo() << "Canceling download of" << _url;
+    finish(Result::Canceled);
+}
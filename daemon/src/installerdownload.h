@@ -0,0 +1,202 @@
+// Copyright (c) 2019 London Trust Media Incorporated
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#line HEADER_FILE("installerdownload.h")
+
+#ifndef INSTALLERDOWNLOAD_H
+#define INSTALLERDOWNLOAD_H
+
+#include "openssl.h"
+#include <QObject>
+#include <QCryptographicHash>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QNetworkAccessManager>
+#include <QNetworkReply>
+#include <QPointer>
+#include <QTimer>
+#include <QUrl>
+#include <memory>
+#include <vector>
+
+// InstallerDownload downloads a file (an installer or update delta) to disk,
+// resuming partial downloads where possible.
+//
+// - The download state is persisted next to the file (<file>.partial), so a
+//   failed or canceled download, or a daemon restart, resumes where it left
+//   off using HTTP range requests.  The state is discarded if the server's
+//   file changes (detected with If-Range).
+// - Large files are downloaded in several parallel segments if the server
+//   supports range requests.
+// - Each segment is retried with backoff after transient network errors,
+//   and a segment that stops receiving data is restarted.
+// - A SHA-256 hash of the file is computed as it's written.  If an expected
+//   hash was given, the download fails if it doesn't match, and the partial
+//   file is discarded so the next attempt starts over.  A signature can be
+//   verified the same way (see setSignature()).
+class InstallerDownload : public QObject
+{
+    Q_OBJECT
+    CLASS_LOGGING_CATEGORY("installerdownload")
+
+public:
+    enum class Result
+    {
+        Succeeded,
+        Failed,
+        Canceled,
+    };
+    Q_ENUM(Result)
+
+    // Files at least this large are downloaded in parallel segments
+    static const qint64 ParallelThreshold;
+    // Number of segments used for large files
+    static const int ParallelSegments;
+
+    // Suffix of the persisted state file
+    static const QString stateFileSuffix;
+
+private:
+    // A range of the file downloaded by one request.  'end' is exclusive, or
+    // -1 if the file size isn't known yet.
+    struct Segment
+    {
+        Segment(qint64 start, qint64 end, qint64 received);
+
+        qint64 start, end, received;
+        QPointer<QNetworkReply> pReply;
+        // Number of consecutive failures, for backoff
+        int failures;
+        // Time since data was last received
+        QElapsedTimer idleTime;
+        // Set when we abort the reply due to inactivity
+        bool timedOut;
+        // Set once the response headers have been checked
+        bool headersChecked;
+
+        qint64 size() const {return end - start;}
+        bool complete() const {return end >= 0 && received >= size();}
+    };
+
+public:
+    // Download 'url' to 'filePath'.  'expectedSha256' is a hex-encoded SHA-256
+    // hash, or empty if it's not known.  Call start() to begin.
+    InstallerDownload(QNetworkAccessManager &networkManager, QUrl url,
+                      QString filePath, QByteArray expectedSha256);
+    ~InstallerDownload();
+
+private:
+    // Load the persisted state, if it's valid for this download.  Returns
+    // false if the download must start over.
+    bool loadState();
+    void saveState();
+    void discardState();
+    // Reset to an empty download of unknown size
+    void resetSegments();
+
+    void abortSegments();
+    // Discard everything and start over (the file changed on the server)
+    void restartDownload(const QString &reason);
+
+    enum class HeaderCheck
+    {
+        Ok,         // Response is valid, read the data
+        NoData,     // Error response, the body isn't file data
+        Restarted,  // Download restarted or failed; segments were reset
+    };
+    HeaderCheck checkSegmentHeaders(std::size_t index);
+    // Read available data from a segment's reply.  Returns false if the
+    // download was restarted or failed (segments are no longer valid).
+    bool readSegmentData(std::size_t index);
+
+    void startSegment(std::size_t index);
+    void onSegmentReadyRead(std::size_t index);
+    void onSegmentFinished(std::size_t index);
+    void retrySegment(std::size_t index, const QString &reason);
+    // Split the first segment into parallel segments once the size is known
+    void splitSegments();
+    void checkIdleSegments();
+
+    // Write data received for a segment.  Returns false if it can't be
+    // written.
+    bool writeSegmentData(Segment &segment, const char *data, qint64 len);
+    // Hash any newly-contiguous data from the beginning of the file.  'data'
+    // is the data just written at 'pos', it's hashed directly if it's next;
+    // any other data is read back from the file.
+    bool updateHash(qint64 pos, const char *data, qint64 len);
+    // Hash data that's next in the file
+    void hashData(const char *data, qint64 len);
+    // Restart the hash and signature from the beginning of the file
+    void resetHash();
+    qint64 contiguousEnd() const;
+    qint64 totalReceived() const;
+
+    void checkComplete();
+    void finish(Result result);
+
+public:
+    // Verify a signature of the file with a public key (PEM).  The signature
+    // is computed incrementally as the file is written, like the hash.  Call
+    // before start().
+    void setSignature(QByteArray publicKeyPem, QByteArray signature);
+    void start();
+    // Cancel the download; the partial file is kept to resume later.
+    // finished() is emitted with Result::Canceled.
+    void cancel();
+
+    const QString &filePath() const {return _filePath;}
+    // The hex-encoded SHA-256 hash; valid after finished() with Succeeded.
+    const QByteArray &sha256() const {return _sha256;}
+
+signals:
+    void progress(qint64 received, qint64 total);
+    // Emitted once when the download completes, fails, or is canceled.
+    void finished(Result result);
+
+private:
+    QNetworkAccessManager &_networkManager;
+    QUrl _url;
+    QString _filePath;
+    QByteArray _expectedSha256, _sha256;
+    QFile _file;
+    // Total size, or -1 if not known yet
+    qint64 _total;
+    // Validator (ETag or Last-Modified) for If-Range, empty if the server
+    // doesn't provide one.  Only downloads with a validator can be resumed.
+    QByteArray _validator;
+    // Whether the server supports range requests (so segments can resume)
+    bool _rangesSupported;
+    std::vector<Segment> _segments;
+    // Hash of the file from the beginning up to _hashedEnd, and the signature
+    // verifier if a signature was given (also up to _hashedEnd)
+    QCryptographicHash _hash;
+    QByteArray _signatureKey, _signature;
+    std::unique_ptr<SignatureVerifier> _pVerifier;
+    qint64 _hashedEnd;
+    // Bytes written since the state was last saved
+    qint64 _unsavedBytes;
+    // Number of times the download restarted because the file changed
+    int _restarts;
+    // Buffer used to read from replies and to hash data from the file
+    QByteArray _readBuffer;
+    QTimer _idleCheckTimer;
+    bool _finished;
+};
+
+#endif
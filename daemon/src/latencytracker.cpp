@@ -67,16 +67,11 @@ LatencyTracker::LatencyTracker()
 void LatencyTracker::onMeasureTrigger()
 {
     //Measure all known addresses (if there are any)
-    //This vector of PingLocations could in principle be built with _locations
-    //and stored, but it shouldn't be a significant cost to just build it here.
-    QVector<PingLocation> measureLocations;
-    measureLocations.reserve(_locations.size());
-    for(auto itLocation = _locations.begin(); itLocation != _locations.end();
-        ++itLocation)
-    {
-        measureLocations.push_back({itLocation.key(), itLocation->pingAddress});
-    }
-    beginMeasurement(measureLocations);
+    std::vector<LocationTable::Row> measureRows;
+    measureRows.reserve(static_cast<std::size_t>(_locations.size()));
+    for(const auto &location : _locations)
+        measureRows.push_back(location.row);
+    beginMeasurement(measureRows);
 }
 
 void LatencyTracker::onNewMeasurements(const Latencies &measurements)
@@ -104,29 +99,28 @@ void LatencyTracker::onNewMeasurements(const Latencies &measurements)
 
 void LatencyTracker::measureNewLocations()
 {
-    QVector<PingLocation> newLocations;
+    std::vector<LocationTable::Row> newRows;
 
-    for(auto itLocation = _locations.begin(); itLocation != _locations.end();
-        ++itLocation)
+    for(auto &location : _locations)
     {
         //If this location hasn't been attempted yet, ping it now.
-        if(!itLocation->pingAttempted)
+        if(!location.pingAttempted)
         {
-            itLocation->pingAttempted = true;
-            newLocations.push_back({itLocation.key(), itLocation->pingAddress});
+            location.pingAttempted = true;
+            newRows.push_back(location.row);
         }
     }
 
-    if(!newLocations.empty())
+    if(!newRows.empty())
     {
-        beginMeasurement(newLocations);
+        beginMeasurement(newRows);
     }
 }
 
-void LatencyTracker::beginMeasurement(const QVector<PingLocation> &locations)
+void LatencyTracker::beginMeasurement(const std::vector<LocationTable::Row> &rows)
 {
     //If there's at least one address to measure, start a measurement.
-    if(!locations.empty())
+    if(!rows.empty())
     {
         // Create the LatencyBatch on the worker thread so there's no
         // interference between activity on the main thread and the events that
@@ -141,7 +135,7 @@ void LatencyTracker::beginMeasurement(const QVector<PingLocation> &locations)
         {
             //Create a LatencyBatch; parent it to this object so it is cleaned up if
             //LatencyTracker is destroyed
-            LatencyBatch *pNewBatch = new LatencyBatch{locations,
+            LatencyBatch *pNewBatch = new LatencyBatch{_pTable, rows,
                                                        &_measurementThread.objectOwner()};
             //Forward newMeasurements signals from this new batch
             connect(pNewBatch, &LatencyBatch::newMeasurements, this,
@@ -150,25 +144,28 @@ void LatencyTracker::beginMeasurement(const QVector<PingLocation> &locations)
     }
 }
 
-void LatencyTracker::updateLocations(const ServerLocations &serverLocations)
+void LatencyTracker::updateLocations(std::shared_ptr<const LocationTable> pTable)
 {
+    Q_ASSERT(pTable);
+    _pTable = std::move(pTable);
+
     //Pull out the existing locations, then put back the ones that are still
     //present.
     QHash<QString, LocationData> oldLocations;
     oldLocations.swap(_locations);
 
     //Process the current locations
-    _locations.reserve(serverLocations.size());
-    for(const auto &pLocation : serverLocations)
+    _locations.reserve(static_cast<int>(_pTable->size()));
+    for(LocationTable::Row row = 0; row < _pTable->size(); ++row)
     {
-        //Create the location and store the current ping address.  No pings
-        //have been attempted yet if we don't find this location in
-        //oldLocations
-        auto itNewLocation = _locations.insert(pLocation->id(),
-                                               {pLocation->ping(), {}, false});
+        //Create the location.  No pings have been attempted yet if we don't
+        //find this location in oldLocations.  (If the ping address changed,
+        //the next measurement will use the new address.)
+        const QString &id = _pTable->id(row);
+        auto itNewLocation = _locations.insert(id, {row, {}, false});
 
         //Did we have this location before?
-        auto itOldLocation = oldLocations.find(pLocation->id());
+        auto itOldLocation = oldLocations.find(id);
         if(itOldLocation != oldLocations.end())
         {
             //It existed, so preserve its latency measurements
@@ -199,8 +196,7 @@ void LatencyTracker::stop()
     _measureTrigger.stop();
 }
 
-LatencyBatch::LatencyBatch(const QVector<LatencyTracker::PingLocation> &locations,
-                           QObject *pParent)
+LatencyBatch::LatencyBatch(QObject *pParent)
     : QObject{pParent}
 {
     _batchTimer.setInterval(std::chrono::milliseconds(latencyBatchInterval).count());
@@ -217,23 +213,47 @@ LatencyBatch::LatencyBatch(const QVector<LatencyTracker::PingLocation> &location
 
     //Start the timer before sending the ping packets
     _timeSincePing.start();
+}
 
+LatencyBatch::LatencyBatch(const QVector<LatencyTracker::PingLocation> &locations,
+                           QObject *pParent)
+    : LatencyBatch{pParent}
+{
     //Ping each address.
     for(const auto &location : locations)
+        sendPing(location.pingAddress, location.id);
+    startTimeout();
+}
+
+LatencyBatch::LatencyBatch(const std::shared_ptr<const LocationTable> &pTable,
+                           const std::vector<LocationTable::Row> &rows,
+                           QObject *pParent)
+    : LatencyBatch{pParent}
+{
+    Q_ASSERT(pTable);
+    //Ping each address.  The table is immutable, so it can be read here even
+    //though it's shared with the main thread.
+    for(auto row : rows)
+        sendPing(pTable->ping(row), pTable->id(row));
+    startTimeout();
+}
+
+void LatencyBatch::sendPing(const QString &pingAddress, const QString &id)
+{
+    QHostAddress host;
+    quint16 port;
+    if(parsePingAddress(pingAddress, host, port))
     {
-        QHostAddress host;
-        quint16 port;
-        if(parsePingAddress(location.pingAddress, host, port))
-        {
-            //This address is valid, so put it in the pending replies.
-            _pendingReplies.insert({host, port}, location.id);
+        //This address is valid, so put it in the pending replies.
+        _pendingReplies.insert({host, port}, id);
 
-            //Send a one-byte datagram to this address
-            _udpSocket.writeDatagram({1, 0x61}, host, port);
-        }
+        //Send a one-byte datagram to this address
+        _udpSocket.writeDatagram({1, 0x61}, host, port);
     }
+}
 
-
+void LatencyBatch::startTimeout()
+{
     if(_pendingReplies.size() >= 1)
     {
         //We sent at least one ping, so start the timeout timer.
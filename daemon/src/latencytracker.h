@@ -24,12 +24,15 @@
 
 #include "thread.h"
 #include "settings.h"
+#include "locationtable.h"
 #include <QObject>
 #include <QElapsedTimer>
 #include <QHostAddress>
 #include <QTimer>
 #include <QUdpSocket>
 #include <chrono>
+#include <memory>
+#include <vector>
 
 //Key for a map/set containing both a host address and a port number.  (Used in
 //both LatencyTracker and unit tests.)
@@ -76,7 +79,8 @@ class LatencyTracker : public QObject
 private:
     struct LocationData
     {
-        QString pingAddress;
+        // The location's row in _pTable
+        LocationTable::Row row;
         LatencyHistory latency;
         //Locations can sit in _locations without having been attempted if
         //measurements are not enabled.
@@ -115,16 +119,18 @@ private:
     //attempted yet
     void measureNewLocations();
 
-    //Begin a new measurement for a set of ping addresses
-    void beginMeasurement(const QVector<PingLocation> &locations);
+    //Begin a new measurement for a set of rows in _pTable
+    void beginMeasurement(const std::vector<LocationTable::Row> &rows);
 
 public:
-    //Daemon passes the current set of locations to this method.
+    //Daemon passes the current location table to this method.  The table is
+    //held and read by the measurement thread (the rows' IDs and ping
+    //addresses are not copied).
     //
     //If measurements are enabled, any new locations observed in this list will
     //be measured immediately.  If they are not enabled, new locations will be
     //measured whenever measurements are re-enabled.
-    void updateLocations(const ServerLocations &serverLocations);
+    void updateLocations(std::shared_ptr<const LocationTable> pTable);
 
     //Enable latency measurements.
     //
@@ -147,14 +153,14 @@ private:
     //servers.  This timer is running if and only if measurements have been
     //started.
     QTimer _measureTrigger;
-    //All locations received from the last call to updateLocations() are
-    //held here.  The rest of the location list isn't stored; we only keep track
-    //of the distinct addresses that are pinged.
+    //The location table received from the last call to updateLocations()
+    std::shared_ptr<const LocationTable> _pTable;
+    //All locations in _pTable are held here.
     //
     //Keys in this map are location IDs.
     //
-    //Values are LocationData objects, which contain the location's ping address
-    //and its LatencyHistory.
+    //Values are LocationData objects, which contain the location's row in
+    //_pTable and its LatencyHistory.
     QHash<QString, LocationData> _locations;
 };
 
@@ -184,6 +190,15 @@ public:
     //Create LatencyBatch with the locations that will be checked.
     LatencyBatch(const QVector<LatencyTracker::PingLocation> &locations,
                  QObject *pParent);
+    //Create LatencyBatch with rows from a location table.  The IDs and ping
+    //addresses are read from the table on the batch's thread.
+    LatencyBatch(const std::shared_ptr<const LocationTable> &pTable,
+                 const std::vector<LocationTable::Row> &rows, QObject *pParent);
+
+private:
+    //Set up the socket and timers; used by the constructors before sending
+    //pings
+    explicit LatencyBatch(QObject *pParent);
 
 signals:
     // This signal is emitted when new measurements have been calculated.
@@ -196,6 +211,11 @@ signals:
     void newMeasurements(const LatencyTracker::Latencies &measurements);
 
 private:
+    //Send a ping to a location's ping address (if it's valid)
+    void sendPing(const QString &pingAddress, const QString &id);
+    //Start the timeout after sending pings, or destroy the batch if nothing
+    //was sent
+    void startTimeout();
     void emitBatchedMeasurements();
 
 private slots:
@@ -20,8 +20,10 @@
 #include <linux/netlink.h>
 #include <linux/cn_proc.h>
 #include <linux/connector.h>
+#include <cstdio>
 #include <fcntl.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <QRegularExpression>
@@ -75,6 +77,30 @@ QString ProcFs::pathForPid(pid_t pid)
     return QFile::symLinkTarget(link);
 }
 
+bool ProcFs::executableIdForPath(const QString &path, ExecutableId &id)
+{
+    struct stat fileStat;
+    if(::stat(QFile::encodeName(path).constData(), &fileStat) != 0)
+        return false;
+    id.dev = fileStat.st_dev;
+    id.ino = fileStat.st_ino;
+    return true;
+}
+
+bool ProcFs::executableIdForPid(pid_t pid, ExecutableId &id)
+{
+    // Format the path without allocating, this is used for every exec event
+    char exeLink[32];
+    std::snprintf(exeLink, sizeof(exeLink), "/proc/%d/exe", static_cast<int>(pid));
+
+    struct stat fileStat;
+    if(::stat(exeLink, &fileStat) != 0)
+        return false;
+    id.dev = fileStat.st_dev;
+    id.ino = fileStat.st_ino;
+    return true;
+}
+
 bool ProcFs::isChildOf(pid_t parentPid, pid_t pid)
 {
     static const QRegularExpression parentPidRegex{ QStringLiteral("PPid:\\s+([0-9]+)") };
@@ -93,6 +119,223 @@ bool ProcFs::isChildOf(pid_t parentPid, pid_t pid)
     return false;
 }
 
+bool ExcludedAppRegistry::addPath(const QString &path)
+{
+    if(containsPath(path))
+        return false;
+
+    ExecutableId id;
+    if(!ProcFs::executableIdForPath(path, id))
+    {
+        qInfo() << "Excluded app" << path << "not found, will resolve it later";
+        _unresolvedPaths.insert(path);
+        return false;
+    }
+
+    _pathIds.insert(path, id);
+    auto itApp = _apps.find(id);
+    if(itApp != _apps.end())
+    {
+        // Another path already refers to this executable
+        itApp->paths.push_back(path);
+        return false;
+    }
+
+    _apps.insert(id, App{{path}, {}, {}});
+    return true;
+}
+
+QSet<pid_t> ExcludedAppRegistry::detachPath(const QString &path, const ExecutableId &id)
+{
+    auto itApp = _apps.find(id);
+    if(itApp == _apps.end())
+        return {};
+
+    itApp->paths.removeAll(path);
+    if(!itApp->paths.isEmpty() || !itApp->retiredPaths.isEmpty())
+        return {};
+
+    return eraseApp(itApp);
+}
+
+QSet<pid_t> ExcludedAppRegistry::detachRetiredPath(const QString &path)
+{
+    QSet<pid_t> removedPids;
+    for(auto itApp = _apps.begin(); itApp != _apps.end(); )
+    {
+        if(itApp->retiredPaths.removeAll(path) && itApp->paths.isEmpty() &&
+           itApp->retiredPaths.isEmpty())
+        {
+            removedPids.unite(eraseApp(itApp++));
+        }
+        else
+            ++itApp;
+    }
+    return removedPids;
+}
+
+QSet<pid_t> ExcludedAppRegistry::eraseApp(QHash<ExecutableId, App>::iterator itApp)
+{
+    QSet<pid_t> removedPids = std::move(itApp->pids);
+    _apps.erase(itApp);
+    for(pid_t pid : removedPids)
+        _pidApps.remove(pid);
+    return removedPids;
+}
+
+QSet<pid_t> ExcludedAppRegistry::removePath(const QString &path)
+{
+    // Processes of replaced binaries are un-excluded too
+    QSet<pid_t> removedPids = detachRetiredPath(path);
+
+    if(_unresolvedPaths.remove(path))
+        return removedPids;
+
+    auto itPath = _pathIds.find(path);
+    if(itPath == _pathIds.end())
+        return removedPids;
+
+    ExecutableId id = itPath.value();
+    _pathIds.erase(itPath);
+    removedPids.unite(detachPath(path, id));
+    return removedPids;
+}
+
+bool ExcludedAppRegistry::refreshPath(const QString &path)
+{
+    if(!containsPath(path))
+        return false;
+
+    ExecutableId newId;
+    bool resolved = ProcFs::executableIdForPath(path, newId);
+    auto itPath = _pathIds.find(path);
+
+    // Still unresolved, or unchanged
+    if(!resolved && itPath == _pathIds.end())
+        return false;
+    if(resolved && itPath != _pathIds.end() && itPath.value() == newId)
+        return false;
+
+    // Retire the old binary - its processes are still running and are still
+    // excluded.  /proc/<pid>/exe still refers to the old inode, so they're
+    // tracked by the old identity until they exit.
+    if(itPath != _pathIds.end())
+    {
+        auto itOldApp = _apps.find(itPath.value());
+        if(itOldApp != _apps.end())
+        {
+            itOldApp->paths.removeAll(path);
+            if(!itOldApp->pids.isEmpty())
+                itOldApp->retiredPaths.push_back(path);
+            else if(itOldApp->paths.isEmpty() && itOldApp->retiredPaths.isEmpty())
+                _apps.erase(itOldApp);
+        }
+        _pathIds.erase(itPath);
+    }
+
+    if(!resolved)
+    {
+        _unresolvedPaths.insert(path);
+        return true;
+    }
+
+    _unresolvedPaths.remove(path);
+    _pathIds.insert(path, newId);
+    _apps[newId].paths.push_back(path);
+    return true;
+}
+
+QVector<QString> ExcludedAppRegistry::paths() const
+{
+    QVector<QString> allPaths;
+    allPaths.reserve(_pathIds.size() + _unresolvedPaths.size());
+    for(auto itPath = _pathIds.begin(); itPath != _pathIds.end(); ++itPath)
+        allPaths.push_back(itPath.key());
+    for(const auto &path : _unresolvedPaths)
+        allPaths.push_back(path);
+    return allPaths;
+}
+
+QString ExcludedAppRegistry::pathFor(const ExecutableId &id) const
+{
+    auto itApp = _apps.find(id);
+    if(itApp == _apps.end())
+        return {};
+    if(!itApp->paths.isEmpty())
+        return itApp->paths.front();
+    if(!itApp->retiredPaths.isEmpty())
+        return itApp->retiredPaths.front();
+    return {};
+}
+
+bool ExcludedAppRegistry::addPid(const ExecutableId &id, pid_t pid)
+{
+    auto itApp = _apps.find(id);
+    if(itApp == _apps.end())
+        return false;
+
+    // A known pid could exec a different excluded app; move it
+    auto itPid = _pidApps.find(pid);
+    if(itPid != _pidApps.end() && itPid.value() != id)
+    {
+        auto itOldApp = _apps.find(itPid.value());
+        if(itOldApp != _apps.end())
+            itOldApp->pids.remove(pid);
+    }
+
+    itApp->pids.insert(pid);
+    _pidApps.insert(pid, id);
+    return true;
+}
+
+void ExcludedAppRegistry::removePid(pid_t pid)
+{
+    auto itPid = _pidApps.find(pid);
+    if(itPid == _pidApps.end())
+        return;
+
+    auto itApp = _apps.find(itPid.value());
+    _pidApps.erase(itPid);
+    if(itApp != _apps.end())
+    {
+        itApp->pids.remove(pid);
+        // A retired binary is forgotten once its last process exits
+        if(itApp->paths.isEmpty() && itApp->pids.isEmpty())
+            _apps.erase(itApp);
+    }
+}
+
+void ExcludedAppRegistry::replacePids(const QHash<ExecutableId, QSet<pid_t>> &scanResult)
+{
+    _pidApps.clear();
+    for(auto itApp = _apps.begin(); itApp != _apps.end(); )
+    {
+        itApp->pids = scanResult.value(itApp.key());
+        if(itApp->paths.isEmpty() && itApp->pids.isEmpty())
+        {
+            itApp = _apps.erase(itApp);
+            continue;
+        }
+        for(pid_t pid : itApp->pids)
+            _pidApps.insert(pid, itApp.key());
+        ++itApp;
+    }
+}
+
+QSet<pid_t> ExcludedAppRegistry::clear()
+{
+    QSet<pid_t> allPids;
+    allPids.reserve(_pidApps.size());
+    for(auto itPid = _pidApps.begin(); itPid != _pidApps.end(); ++itPid)
+        allPids.insert(itPid.key());
+
+    _apps.clear();
+    _pathIds.clear();
+    _unresolvedPaths.clear();
+    _pidApps.clear();
+    return allPids;
+}
+
 // Explicitly specify struct alignment
 typedef struct __attribute__((aligned(NLMSG_ALIGNTO)))
 {
@@ -106,16 +349,28 @@ typedef struct __attribute__((aligned(NLMSG_ALIGNTO)))
     };
 } NetlinkRequest;
 
-typedef struct __attribute__((aligned(NLMSG_ALIGNTO)))
+namespace
 {
-    nlmsghdr header;
+    // Size of the buffer used to receive datagrams from the proc connector.
+    // Each datagram is normally a single event, but the buffer is large enough
+    // to hold any number of messages the kernel batches together.
+    const std::size_t receiveBufferSize = 16384;
+    // Socket receive buffer requested from the kernel.  The default is small
+    // enough that a fork/exec storm (builds, browsers starting) can overflow
+    // it before we get a chance to read.
+    const int socketRcvBufSize = 4 * 1024 * 1024;
+}
 
-    struct __attribute__((__packed__))
-    {
-        cn_msg body;
-        proc_event event;
-    };
-} NetlinkResponse;
+ProcTracker::ProcTracker(QObject *pParent)
+    : QObject{pParent},
+      _sockFd{-1},
+      _eventsProcessed{0},
+      _eventsDropped{0},
+      _overflows{0}
+{
+    connect(&_executableWatcher, &QFileSystemWatcher::fileChanged, this,
+            &ProcTracker::onExecutableChanged);
+}
 
 void ProcTracker::showError(QString funcName)
 {
@@ -132,8 +387,14 @@ void ProcTracker::writePidToCGroup(pid_t pid, const QString &cGroupPath)
         return;
     }
 
-    if(cgroupFile.write(QByteArray::number(pid)) < 0)
+    // Flush so the pid has actually reached the cgroup before reporting it
+    if(cgroupFile.write(QByteArray::number(pid)) < 0 || !cgroupFile.flush())
+    {
         qWarning() << "Could not write to" << cGroupPath << cgroupFile.errorString();
+        return;
+    }
+
+    emit pidWrittenToCGroup(pid, cGroupPath);
 }
 
 void ProcTracker::addPidToExclusions(pid_t pid)
@@ -217,23 +478,28 @@ void ProcTracker::updateNetwork(const OriginalNetworkScan &updatedScan, const Fi
     _previousNetScan = updatedScan;
 }
 
-void ProcTracker::initiateConnection(const OriginalNetworkScan &netScan, const FirewallParams &params)
+bool ProcTracker::connectProcEvents()
 {
     int sock;
     qInfo() << "Attempting to connect to Netlink";
 
-    if(_sockFd != -1)
-    {
-        qInfo() << "Existing connection already exists, disconnecting first";
-        shutdownConnection();
-    }
-
     // Set SOCK_CLOEXEC to prevent socket being inherited by child processes (such as openvpn)
-    sock = ::socket(PF_NETLINK, SOCK_DGRAM|SOCK_CLOEXEC, NETLINK_CONNECTOR);
+    // SOCK_NONBLOCK allows readFromSocket() to drain the socket completely on
+    // each notification.
+    sock = ::socket(PF_NETLINK, SOCK_DGRAM|SOCK_CLOEXEC|SOCK_NONBLOCK, NETLINK_CONNECTOR);
     if(sock == -1)
     {
         showError("::socket");
-        return;
+        return false;
+    }
+
+    // Enlarge the receive buffer.  SO_RCVBUFFORCE ignores rmem_max, but it
+    // requires CAP_NET_ADMIN; fall back to SO_RCVBUF if that fails.  Either
+    // way this isn't fatal, overflows are still handled by resyncing.
+    if(::setsockopt(sock, SOL_SOCKET, SO_RCVBUFFORCE, &socketRcvBufSize, sizeof(socketRcvBufSize)) == -1 &&
+       ::setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &socketRcvBufSize, sizeof(socketRcvBufSize)) == -1)
+    {
+        showError("::setsockopt");
     }
 
     sockaddr_nl address = {};
@@ -246,74 +512,116 @@ void ProcTracker::initiateConnection(const OriginalNetworkScan &netScan, const F
     {
         showError("::bind");
         ::close(sock);
-        return;
+        return false;
     }
 
     if(subscribeToProcEvents(sock, true) == -1)
     {
         qWarning() << "Could not subscribe to proc events";
         ::close(sock);
-        return;
+        return false;
     }
 
     qInfo() << "Successfully connected to Netlink";
 
     // Save the socket FD to an ivar
     _sockFd = sock;
-    setupFirewall();
-    updateNetwork(netScan, params);
     _readNotifier = new QSocketNotifier(sock, QSocketNotifier::Read);
     connect(_readNotifier, &QSocketNotifier::activated, this, &ProcTracker::readFromSocket);
+    return true;
 }
 
-void ProcTracker::updateExcludedApps(QVector<QString> excludedApps)
+void ProcTracker::disconnectProcEvents()
 {
-    QVector<QString> removedApps;
-
-    // Find which apps have been removed from the exclusions
-    for(const auto &app : _appMap.keys())
+    if(_readNotifier)
     {
-        if(!excludedApps.contains(app))
-            removedApps.push_back(app);
+        _readNotifier->setEnabled(false);
+        delete _readNotifier;
     }
 
-    // Add new entries
-    for(auto &app : excludedApps)
+    if(_sockFd != -1)
     {
-        _appMap.insert(app, {});
-        for(pid_t pid : ProcFs::pidsForPath(app))
-        {
-            // Both these calls are no-ops if the PID is already excluded
-            addPidToExclusions(pid);
-            _appMap[app].insert(pid);
-        }
+        // Unsubscribe from proc events
+        subscribeToProcEvents(_sockFd, false);
+        if(::close(_sockFd) != 0)
+            showError("::close");
+        _sockFd = -1;
     }
 
-    removeApps(removedApps);
+    qInfo() << "Proc events processed:" << _eventsProcessed << "- dropped:"
+        << _eventsDropped << "- overflows:" << _overflows;
 }
 
-void ProcTracker::removeAllApps()
+void ProcTracker::initiateConnection(const OriginalNetworkScan &netScan, const FirewallParams &params)
 {
-    qInfo() << "Removing all apps from cgroup";
-    removeApps(QVector<QString>::fromList(_appMap.keys()));
-    _appMap.clear();
+    if(_sockFd != -1)
+    {
+        qInfo() << "Existing connection already exists, disconnecting first";
+        shutdownConnection();
+    }
+
+    if(!connectProcEvents())
+        return;
+
+    setupFirewall();
+    updateNetwork(netScan, params);
 }
 
-void ProcTracker::removeApps(const QVector<QString> &removedApps)
+void ProcTracker::updateExcludedApps(QVector<QString> excludedApps)
 {
-    // Remove existing entries
-    for(const auto &app : removedApps)
+    // Remove apps that are no longer excluded
+    for(const auto &path : _apps.paths())
     {
-        qInfo() << "Removing all pids for" << app << "from exclusions";
+        if(excludedApps.contains(path))
+            continue;
+
+        qInfo() << "Removing all pids for" << path << "from exclusions";
+        _executableWatcher.removePath(path);
         // Remove all PIDs for the app from the cgroup
-        for(pid_t pid : _appMap[app])
+        for(pid_t pid : _apps.removePath(path))
         {
             qInfo() << "Removing pid" << pid;
             removePidFromExclusions(pid);
         }
+    }
 
-        // Remove the app from our model
-        _appMap.remove(app);
+    // Add new entries
+    for(const auto &path : excludedApps)
+    {
+        if(_apps.containsPath(path))
+            continue;
+        // Paths that don't exist are resolved (and watched) again on the
+        // next update or resync
+        _apps.addPath(path);
+    }
+
+    // Find existing processes for all apps; paths that couldn't be resolved
+    // earlier might exist now too.
+    resyncExcludedApps();
+}
+
+void ProcTracker::onExecutableChanged(const QString &path)
+{
+    // Replacing the file removes it from the watcher, watch it again
+    if(!_executableWatcher.files().contains(path))
+        _executableWatcher.addPath(path);
+
+    if(_apps.refreshPath(path))
+    {
+        qInfo() << "Excluded app" << path << "was replaced, resyncing";
+        resyncExcludedApps();
+    }
+}
+
+void ProcTracker::removeAllApps()
+{
+    qInfo() << "Removing all apps from cgroup";
+    if(!_executableWatcher.files().isEmpty())
+        _executableWatcher.removePaths(_executableWatcher.files());
+    for(pid_t pid : _apps.clear())
+    {
+        qInfo() << "Removing pid" << pid;
+        removePidFromExclusions(pid);
     }
 }
 
@@ -373,19 +681,7 @@ void ProcTracker::removeRoutingPolicyForSourceIp(QString ipAddress)
 void ProcTracker::shutdownConnection()
 {
     qInfo() << "Attempting to disconnect from Netlink";
-    if(_readNotifier)
-    {
-        _readNotifier->setEnabled(false);
-        delete _readNotifier;
-    }
-
-    if(_sockFd != -1)
-    {
-        // Unsubscribe from proc events
-        subscribeToProcEvents(_sockFd, false);
-        if(::close(_sockFd) != 0)
-            showError("::close");
-    }
+    disconnectProcEvents();
 
     teardownFirewall();
     removeAllApps();
@@ -393,40 +689,76 @@ void ProcTracker::shutdownConnection()
 
     // Clear out our network info
     _previousNetScan = {};
-    _sockFd = -1;
 
     qInfo() << "Successfully disconnected from Netlink";
 }
 
-void ProcTracker::readFromSocket(int sock)
+void ProcTracker::resyncExcludedApps()
 {
-    NetlinkResponse message = {};
+    qInfo() << "Resyncing excluded apps from /proc";
 
-    ::recv(sock, &message, sizeof(message), 0);
+    // Resolve any paths that didn't exist before, and watch them once they do
+    const QStringList watchedPaths = _executableWatcher.files();
+    for(const auto &path : _apps.paths())
+    {
+        _apps.refreshPath(path);
+        if(!watchedPaths.contains(path) && QFile::exists(path))
+            _executableWatcher.addPath(path);
+    }
 
+    // Scan all processes in one pass - we may have missed exec events, and
+    // the known pids may include processes that have since exited.
+    QHash<ExecutableId, QSet<pid_t>> scanResult;
+    ProcFs::filterPids([&](pid_t pid)
+    {
+        ExecutableId id;
+        if(ProcFs::executableIdForPid(pid, id) && _apps.isExcluded(id))
+            scanResult[id].insert(pid);
+        return false;
+    });
+
+    // Excluding a pid that's already excluded is a no-op, but avoid the
+    // child process scan for pids we already knew about.
+    for(auto itApp = scanResult.begin(); itApp != scanResult.end(); ++itApp)
+    {
+        for(pid_t pid : itApp.value())
+        {
+            if(!_apps.containsPid(pid))
+            {
+                qInfo() << "Adding pid" << pid << "for" << _apps.pathFor(itApp.key());
+                addPidToExclusions(pid);
+            }
+        }
+    }
+
+    _apps.replacePids(scanResult);
+}
+
+void ProcTracker::handleProcEvent(const proc_event &event)
+{
     // shortcut
-    const auto &eventData = message.event.event_data;
+    const auto &eventData = event.event_data;
     pid_t pid;
-    QString appName;
+    ExecutableId exeId;
 
-    switch(message.event.what)
+    ++_eventsProcessed;
+
+    switch(event.what)
     {
     case proc_event::PROC_EVENT_NONE:
         qInfo() << "Listening to process events";
         break;
     case proc_event::PROC_EVENT_EXEC:
         pid = eventData.exec.process_pid;
-        // Get the launch path associated with the PID
-        appName = ProcFs::pathForPid(pid);
-        // If the path is an "excluded app" then exclude it
-        if(_appMap.contains(appName))
+        // If the executable is an "excluded app" then exclude it.  This is a
+        // stat() of /proc/<pid>/exe and a hash lookup, keep the window
+        // between exec and exclusion small.
+        if(ProcFs::executableIdForPid(pid, exeId) && _apps.addPid(exeId, pid))
         {
-            _appMap[appName].insert(pid);
-            qInfo() << "Adding" << pid << "to VPN exclusions for excluded app:" << appName;
-
             // Add the PID to the cgroup so its network traffic goes out the
             // physical uplink
             addPidToExclusions(pid);
+            qInfo() << "Added" << pid << "to VPN exclusions for excluded app:" << _apps.pathFor(exeId);
         }
 
         break;
@@ -436,16 +768,94 @@ void ProcTracker::readFromSocket(int sock)
         // Update our internal model to remove the pid from the associated app entry
         // We do not need to explicitly remove the PID from the cgroup as
         // an exiting process is removed automatically
-        for(AppMap::iterator i = _appMap.begin(); i != _appMap.end(); ++i)
-        {
-            auto &set = i.value();
-            set.remove(pid);
-        }
+        _apps.removePid(pid);
 
         break;
     default:
         // We're not interested in any other events
         break;
     }
-    _readNotifier->setEnabled(true);
+}
+
+bool ProcTracker::processDatagram(const char *pData, std::size_t len)
+{
+    bool overrun = false;
+
+    // NLMSG_OK/NLMSG_NEXT use a signed length on some libc versions
+    int remaining = static_cast<int>(len);
+    auto pHeader = reinterpret_cast<const nlmsghdr*>(pData);
+
+    for(; NLMSG_OK(pHeader, remaining); pHeader = NLMSG_NEXT(pHeader, remaining))
+    {
+        if(pHeader->nlmsg_type == NLMSG_NOOP || pHeader->nlmsg_type == NLMSG_ERROR)
+            continue;
+        if(pHeader->nlmsg_type == NLMSG_OVERRUN)
+        {
+            overrun = true;
+            continue;
+        }
+
+        auto pConnMsg = reinterpret_cast<const cn_msg*>(NLMSG_DATA(pHeader));
+        if(pHeader->nlmsg_len < NLMSG_LENGTH(sizeof(cn_msg)) ||
+           NLMSG_PAYLOAD(pHeader, sizeof(cn_msg)) < pConnMsg->len ||
+           pConnMsg->len < sizeof(proc_event))
+        {
+            ++_eventsDropped;
+            continue;
+        }
+        if(pConnMsg->id.idx != CN_IDX_PROC || pConnMsg->id.val != CN_VAL_PROC)
+            continue;
+
+        handleProcEvent(*reinterpret_cast<const proc_event*>(pConnMsg->data));
+    }
+
+    // Anything left over was a truncated message
+    if(remaining > 0)
+        ++_eventsDropped;
+
+    return overrun;
+}
+
+void ProcTracker::readFromSocket(int sock)
+{
+    alignas(nlmsghdr) char buffer[receiveBufferSize];
+    bool overflowed = false;
+
+    // Drain everything that's currently queued; the notifier only fires again
+    // for new data, and events queue up quickly during a fork/exec storm.
+    while(true)
+    {
+        ssize_t received = ::recv(sock, buffer, sizeof(buffer), MSG_DONTWAIT);
+        if(received > 0)
+        {
+            if(processDatagram(buffer, static_cast<std::size_t>(received)))
+                overflowed = true;
+            continue;
+        }
+
+        if(received == 0)
+            break;
+        if(errno == EINTR)
+            continue;
+        if(errno == EAGAIN || errno == EWOULDBLOCK)
+            break;
+        if(errno == ENOBUFS)
+        {
+            // The receive buffer overflowed and events were discarded by the
+            // kernel.  Keep reading what's left, then resync from /proc so
+            // we don't miss any excluded processes.
+            overflowed = true;
+            continue;
+        }
+
+        showError("::recv");
+        break;
+    }
+
+    if(overflowed)
+    {
+        ++_overflows;
+        qWarning() << "Proc event socket overflowed, total overflows:" << _overflows;
+        resyncExcludedApps();
+    }
 }
@@ -25,15 +25,47 @@
 #include <QSocketNotifier>
 #include <QPointer>
 #include <QDir>
+#include <QFileSystemWatcher>
+#include <sys/types.h>
+#include <linux/cn_proc.h>
 #include "daemon.h"
 #include "posix/posix_firewall_pf.h"
 #include "vpn.h"
 #include "daemon.h"
 
+// Identity of an executable file - the device and inode of the file after
+// following any symlinks.  Matching processes by identity avoids resolving
+// /proc/<pid>/exe to a path string for every exec, and matches the binary no
+// matter which link was used to launch it.
+struct ExecutableId
+{
+    dev_t dev;
+    ino_t ino;
+
+    bool operator==(const ExecutableId &other) const
+    {
+        return dev == other.dev && ino == other.ino;
+    }
+    bool operator!=(const ExecutableId &other) const {return !(*this == other);}
+};
+
+inline uint qHash(const ExecutableId &id, uint seed = 0)
+{
+    return qHash(qMakePair(static_cast<quint64>(id.dev), static_cast<quint64>(id.ino)), seed);
+}
+
 // Convenience class for working with the Linux /proc VFS
 class ProcFs
 {
 public:
+    // Get the identity of the executable at path (following symlinks).
+    // Returns false if the file can't be found.
+    static bool executableIdForPath(const QString &path, ExecutableId &id);
+
+    // Get the identity of the executable running in pid.  This is a single
+    // stat() of /proc/<pid>/exe, no path is read.
+    static bool executableIdForPid(pid_t pid, ExecutableId &id);
+
     // Return all pids for the given executable path
     static QSet<pid_t> pidsForPath(const QString &path);
 
@@ -50,23 +82,132 @@ public:
     static bool isChildOf(pid_t parentPid, pid_t pid);
 };
 
+// Registry of excluded apps used by ProcTracker.
+//
+// Each excluded path is resolved once to its executable identity, and apps are
+// indexed by that identity, so matching an exec event is a single hash probe.
+// A reverse pid->app index makes handling exit events O(1) regardless of the
+// number of apps.
+//
+// Several paths may refer to the same executable (a symlink and its target,
+// for example), they share one entry.  Paths that don't exist (yet) are kept
+// unresolved and resolved again by refreshPath().
+//
+// When a path is resolved to a new executable (the binary was replaced), the
+// old executable is retired - it keeps tracking its running processes until
+// they exit, and they're still un-excluded if the path is removed.
+class ExcludedAppRegistry
+{
+public:
+    // Add an excluded path.  Returns true if this added a new executable (the
+    // caller should scan for its existing processes).
+    bool addPath(const QString &path);
+
+    // Remove an excluded path.  Returns the pids that are no longer excluded
+    // as a result (empty if another path still refers to the same
+    // executable).
+    QSet<pid_t> removePath(const QString &path);
+
+    // Resolve a path's identity again, such as after the binary was replaced
+    // by a package update.  Pids of the old binary remain excluded and are
+    // tracked by the retired executable.  Returns true if the identity
+    // changed.
+    bool refreshPath(const QString &path);
+
+    bool containsPath(const QString &path) const {return _pathIds.contains(path) || _unresolvedPaths.contains(path);}
+    // All excluded paths, resolved or not
+    QVector<QString> paths() const;
+
+    // Whether an executable is excluded
+    bool isExcluded(const ExecutableId &id) const {return _apps.contains(id);}
+    // Get a path for an excluded executable, for tracing.  Returns an empty
+    // string if the executable isn't excluded.
+    QString pathFor(const ExecutableId &id) const;
+
+    // Add a pid for an executable.  Returns false if the executable isn't
+    // excluded.  No effect if the pid was already known.
+    bool addPid(const ExecutableId &id, pid_t pid);
+    // Remove a pid (when the process exits)
+    void removePid(pid_t pid);
+    // Whether a pid is known to belong to an excluded app
+    bool containsPid(pid_t pid) const {return _pidApps.contains(pid);}
+
+    // Replace the pids for all excluded executables (including retired ones)
+    // with the result of a complete scan.  Executables not present in
+    // scanResult have no pids; retired executables with no pids are removed.
+    void replacePids(const QHash<ExecutableId, QSet<pid_t>> &scanResult);
+
+    // Remove everything, returns all pids that were excluded
+    QSet<pid_t> clear();
+
+private:
+    struct App
+    {
+        QVector<QString> paths;
+        // Paths that referred to this executable before it was replaced
+        QVector<QString> retiredPaths;
+        QSet<pid_t> pids;
+    };
+
+    // Detach a path from the app identified by id; removes the app if it has
+    // no other paths and returns its pids.
+    QSet<pid_t> detachPath(const QString &path, const ExecutableId &id);
+    // Detach a path from all retired apps; returns the pids of the apps that
+    // were removed as a result.
+    QSet<pid_t> detachRetiredPath(const QString &path);
+    // Remove an app that has no paths left, returns its pids
+    QSet<pid_t> eraseApp(QHash<ExecutableId, App>::iterator itApp);
+
+private:
+    QHash<ExecutableId, App> _apps;
+    // Resolved identity of each excluded path
+    QHash<QString, ExecutableId> _pathIds;
+    // Excluded paths that could not be resolved
+    QSet<QString> _unresolvedPaths;
+    // App that each known pid belongs to
+    QHash<pid_t, ExecutableId> _pidApps;
+};
+
 class ProcTracker : public QObject
 {
     Q_OBJECT
     CLASS_LOGGING_CATEGORY("ProcTracker")
 
 public:
-    ProcTracker(QObject *pParent)
-        : QObject{pParent},
-          _sockFd{-1}
-    {
-    }
+    ProcTracker(QObject *pParent);
 
     ~ProcTracker()
     {
-        shutdownConnection();
+        // Only shut down if we're still connected - shutdownConnection()
+        // also tears down the firewall rules and routes.
+        if(_sockFd != -1)
+            shutdownConnection();
     }
 
+public:
+    // Connect to the proc connector and start handling process events.  This
+    // only manages the netlink socket; initiateConnection() and
+    // shutdownConnection() also manage the firewall and routing.  (Used
+    // directly by the exec latency benchmark in the unit tests, which uses
+    // stand-in cgroup files.)
+    bool connectProcEvents();
+    void disconnectProcEvents();
+
+    // Number of proc events handled since the tracker was created
+    quint64 eventsProcessed() const {return _eventsProcessed;}
+    // Number of messages that were received but could not be parsed (truncated
+    // or malformed)
+    quint64 eventsDropped() const {return _eventsDropped;}
+    // Number of times the socket's receive buffer overflowed.  The kernel does
+    // not tell us how many events were lost; each overflow causes a full resync
+    // from /proc.
+    quint64 overflows() const {return _overflows;}
+
+signals:
+    // Emitted right after a pid has been written to a cgroup.  The exec
+    // latency benchmark in the unit tests timestamps exclusions here.
+    void pidWrittenToCGroup(pid_t pid, const QString &cGroupPath);
+
 public slots:
     void initiateConnection(const OriginalNetworkScan &netScan, const FirewallParams &params);
     void readFromSocket(int socket);
@@ -78,15 +219,21 @@ private:
     void showError(QString funcName);
 
     int subscribeToProcEvents(int sock, bool enable);
+    // Parse all netlink messages in one datagram received from the socket.
+    // Returns true if the kernel reported an overrun.
+    bool processDatagram(const char *pData, std::size_t len);
+    void handleProcEvent(const proc_event &event);
+    // Rebuild the excluded pids from a full /proc scan, used after an overflow
+    // when events may have been lost
+    void resyncExcludedApps();
     void addPidToExclusions(pid_t pid);
     void removePidFromExclusions(pid_t pid);
     void addChildPidsToExclusions(pid_t parentPid);
     void removeChildPidsFromExclusions(pid_t parentPid);
-    void removeApps(const QVector<QString> &removedApps);
     void removeAllApps();
     void writePidToCGroup(pid_t pid, const QString &cGroupPath);
-    QSet<pid_t> pidsForPath(const QString &path);
-    QString pathForPid(pid_t pid);
+    // An excluded executable changed on disk (or appeared)
+    void onExecutableChanged(const QString &path);
     void updateMasquerade(QString interfaceName);
     void updateRoutes(QString gatewayIp, QString interfaceName);
     void addRoutingPolicyForSourceIp(QString ipAddress);
@@ -95,11 +242,16 @@ private:
     void teardownFirewall();
 
 private:
-    using AppMap = QHash<QString, QSet<pid_t>>;
     QPointer<QSocketNotifier> _readNotifier;
     OriginalNetworkScan _previousNetScan;
-    AppMap _appMap;
+    ExcludedAppRegistry _apps;
+    // Watches excluded executables so they can be resolved again if they're
+    // replaced (the inode changes when a package is updated)
+    QFileSystemWatcher _executableWatcher;
     int _sockFd;
+    quint64 _eventsProcessed;
+    quint64 _eventsDropped;
+    quint64 _overflows;
 };
 
 #endif
@@ -20,7 +20,7 @@
 #line SOURCE_FILE("portforwarder.cpp")
 
 #include "portforwarder.h"
-#include "testshim.h"
+#include "networkpool.h"
 #include <QJsonDocument>
 #include <QNetworkRequest>
 #include <QNetworkReply>
@@ -49,7 +49,7 @@ namespace
 PortRequester::PortRequester(const QUrl &requestUrl)
     : _attemptCount{0},
       _forwardRequest{requestUrl},
-      _pNetworkManager{TestShim::create<QNetworkAccessManager>()}
+      _pNetworkManager{NetworkPool::get()}
 {
     _requestTimeout.setSingleShot(true);
     beginNextAttempt();
@@ -68,6 +68,8 @@ void PortRequester::beginNextAttempt()
     auto attemptTimeout = initialTimeout + timeoutBackoff * _attemptCount;
     ++_attemptCount;
 
+    // Get the current shared manager for each attempt, in case it was retired
+    _pNetworkManager = NetworkPool::get();
     QPointer<QNetworkReply> pForwardReply{_pNetworkManager->get(_forwardRequest)};
     pForwardReply->setParent(this);
     // Capture pForwardReply by value, so this lambda will always use the reply
@@ -26,6 +26,7 @@
 #include <QNetworkAccessManager>
 #include <QPointer>
 #include <QScopedPointer>
+#include <QSharedPointer>
 #include <array>
 #include "settings.h"
 
@@ -71,9 +72,8 @@ private:
     QNetworkRequest _forwardRequest;
     // Timeout for each attempt
     QTimer _requestTimeout;
-    // Manager for network requests.  Dynamically allocated so it can be mocked
-    // in unit tests.
-    QScopedPointer<QNetworkAccessManager> _pNetworkManager;
+    // Shared manager for network requests (see NetworkPool)
+    QSharedPointer<QNetworkAccessManager> _pNetworkManager;
 };
 
 // PortForwarder forwards a port through the VPN connection when the VPN is
@@ -349,14 +349,16 @@ void PosixDaemon::writePlatformDiagnostics(DiagnosticsFile &file)
     file.writeCommand("OS Version", "uname", QStringList{QStringLiteral("-a")});
     file.writeCommand("Distro", "lsb_release", QStringList{QStringLiteral("-a")});
     file.writeCommand("ifconfig", "ifconfig", emptyArgs);
-    // Write iptables dumps for each table that PIA uses
+    // Write iptables dumps for each table that PIA uses.  These run one at a
+    // time, but -w is still needed in case the firewall is being updated.
     auto dumpIpTables = [&](const QString &table)
     {
         file.writeCommand(QString("iptables -t %1 -S").arg(table), "iptables",
-                          {QStringLiteral("-t"), table, QStringLiteral("-S")});
+                          {QStringLiteral("-w"), QStringLiteral("-t"), table,
+                           QStringLiteral("-S")});
         file.writeCommand(QString("iptables -t %1 -n -L").arg(table), "iptables",
-                          {QStringLiteral("-t"), table, QStringLiteral("-n"),
-                           QStringLiteral("-L")});
+                          {QStringLiteral("-w"), QStringLiteral("-t"), table,
+                           QStringLiteral("-n"), QStringLiteral("-L")});
     };
     dumpIpTables(QStringLiteral("filter"));
     dumpIpTables(QStringLiteral("nat"));
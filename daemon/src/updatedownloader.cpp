@@ -28,8 +28,9 @@
 #include "apiclient.h"
 #include "openssl.h"
 #include "brand.h"
-#include <QNetworkReply>
+#include "deltapatch.h"
 #include <QDir>
+#include <QJsonArray>
 
 // Platform name for the supported platforms
 const QString UpdateChannel::platformName =
@@ -53,20 +54,35 @@ namespace
     const std::chrono::minutes versionInitialInterval{10};
     // Refresh interval after initial load.
     const std::chrono::hours versionRefreshInterval{1};
+    // Installers downloaded by the daemon are tagged with their version in
+    // "<installer>.version", so they can be used as a delta base later
+    const QString installerVersionSuffix{QStringLiteral(".version")};
 }
 
-Update::Update(const QString &uri, const QString &version)
+Update::Update(const QString &uri, const QString &version, const QString &sha256,
+               const QString &deltaUri, const QString &deltaSha256,
+               const QString &signature)
 {
     if(!uri.isEmpty() && !version.isEmpty())
     {
         _uri = uri;
         _version = version;
+        _sha256 = sha256;
+        _signature = signature;
+        // A delta can't be verified without the installer hash
+        if(!sha256.isEmpty() && !deltaUri.isEmpty())
+        {
+            _deltaUri = deltaUri;
+            _deltaSha256 = deltaSha256;
+        }
     }
 }
 
 bool Update::operator==(const Update &other) const
 {
-    return uri() == other.uri() && version() == other.version();
+    return uri() == other.uri() && version() == other.version() &&
+        sha256() == other.sha256() && deltaUri() == other.deltaUri() &&
+        deltaSha256() == other.deltaSha256() && signature() == other.signature();
 }
 
 UpdateChannel::UpdateChannel()
@@ -105,6 +121,9 @@ void UpdateChannel::checkVersionMetadata(const QJsonDocument &regionsDoc)
     const auto &platformObj = platformVal.toObject();
     const QString &latestVersion = platformObj[QStringLiteral("version")].toString();
     const QString &downloadUrl = platformObj[QStringLiteral("download")].toString();
+    // The installer hash is optional, the download is verified if it's present
+    const QString &sha256 = platformObj[QStringLiteral("sha256")].toString();
+    const QString &signature = platformObj[QStringLiteral("signature")].toString();
 
     // If something is missing from the server data, log a warning just for
     // diagnostic purposes.
@@ -115,9 +134,24 @@ void UpdateChannel::checkVersionMetadata(const QJsonDocument &regionsDoc)
             << downloadUrl;
     }
 
+    // Deltas are optional, they're listed with the version they apply to.
+    // Only a delta from the version installed now can be used.
+    QString deltaUrl, deltaSha256;
+    for(const auto &deltaVal : platformObj[QStringLiteral("deltas")].toArray())
+    {
+        const auto &deltaObj = deltaVal.toObject();
+        if(deltaObj[QStringLiteral("from")].toString() == QStringLiteral(PIA_VERSION))
+        {
+            deltaUrl = deltaObj[QStringLiteral("download")].toString();
+            deltaSha256 = deltaObj[QStringLiteral("sha256")].toString();
+            break;
+        }
+    }
+
     // Store the update.  (Update ignores partial data if the server returned
     // only a URI or version somehow.)
-    _update = Update{downloadUrl, latestVersion};
+    _update = Update{downloadUrl, latestVersion, sha256, deltaUrl, deltaSha256,
+                     signature};
 }
 
 void UpdateChannel::run(bool newRunning)
@@ -230,7 +264,8 @@ but that's acceptable.
 */
 
 UpdateDownloader::UpdateDownloader()
-    : _daemonVersion{99999, 99999, 99999}, _running{false}, _enableBeta{false}
+    : _daemonVersion{99999, 99999, 99999}, _running{false}, _enableBeta{false},
+      _downloadProgressPct{0}
 {
     // If the daemon's version can't be parsed, we log an error and proceed with
     // the default version above that will never offer an upgrade.  This might
@@ -372,6 +407,11 @@ void UpdateDownloader::setBetaUpdateChannel(const QString &channel)
     _betaChannel.setUpdateChannel(channel, _running && _enableBeta);
 }
 
+void UpdateDownloader::setInstallerSignatureKey(QByteArray publicKeyPem)
+{
+    _installerSignatureKey = std::move(publicKeyPem);
+}
+
 void UpdateDownloader::enableBetaChannel(bool enable)
 {
     if(_enableBeta == enable)
@@ -401,6 +441,28 @@ void UpdateDownloader::enableBetaChannel(bool enable)
     }
 }
 
+QString UpdateDownloader::findDeltaBase() const
+{
+    // Installers downloaded by the daemon are tagged with their version.  The
+    // installer for the running version is the one that was installed.
+    QDir updateDir{Path::DaemonUpdateDir};
+    const auto &versionFiles = updateDir.entryInfoList({QStringLiteral("*") + installerVersionSuffix},
+                                                       QDir::Files);
+    for(const auto &versionFileInfo : versionFiles)
+    {
+        QFile versionFile{versionFileInfo.filePath()};
+        if(!versionFile.open(QIODevice::ReadOnly))
+            continue;
+        if(QString::fromUtf8(versionFile.readAll().trimmed()) != QStringLiteral(PIA_VERSION))
+            continue;
+        QString installerPath = versionFileInfo.filePath();
+        installerPath.chop(installerVersionSuffix.size());
+        if(QFile::exists(installerPath))
+            return installerPath;
+    }
+    return {};
+}
+
 Async<DownloadResult> UpdateDownloader::downloadUpdate()
 {
     Update availableUpdate = calculateAvailableUpdate();
@@ -413,162 +475,281 @@ Async<DownloadResult> UpdateDownloader::downloadUpdate()
         qWarning() << "Can't download update, no update is available";
         return Async<DownloadResult>::resolve();
     }
-    if(_pDownloadReply)
+    if(_pDownloadTask)
     {
         qWarning() << "Already downloading an update, can't start again";
         return Async<DownloadResult>::resolve(DownloadResult().version(availableUpdate.version()));
     }
 
-    // Class invariant - open when _pDownloadReply is set
-    Q_ASSERT(!_installerFile.isOpen());
-
-    QUrl reqUrl{availableUpdate.uri()};
-
-    // Open the installer file in the download location.
-    Path downloadPath{Path::DaemonUpdateDir / reqUrl.fileName()};
-    _installerFile.unsetError();
-    _installerFile.setFileName(downloadPath);
+    QUrl installerUrl{availableUpdate.uri()};
+    const QString &installerName = installerUrl.fileName();
+    _installerPath = Path::DaemonUpdateDir / installerName;
+    _downloadingUpdate = availableUpdate;
+
+    // Use a delta if there's one from the installed version, and we still have
+    // the installer for the installed version.
+    QUrl deltaUrl;
+    QString deltaPath;
+    _deltaBasePath.clear();
+    if(!availableUpdate.deltaUri().isEmpty())
+    {
+        QString basePath = findDeltaBase();
+        deltaUrl = QUrl{availableUpdate.deltaUri()};
+        if(basePath.isEmpty())
+            qInfo() << "Delta is available, but installer for" << PIA_VERSION << "is not";
+        else if(basePath == _installerPath || deltaUrl.fileName() == installerName ||
+                deltaUrl.fileName().isEmpty())
+            qWarning() << "Can't use delta" << deltaUrl << "- file names conflict";
+        else
+        {
+            _deltaBasePath = basePath;
+            deltaPath = Path::DaemonUpdateDir / deltaUrl.fileName();
+        }
+    }
 
     // Attempt to clean any old downloads that exist to limit accumulation of
-    // installers.  Failure does not prevent us from downloading the new file
-    // though.
-    // Note that QDir::removeRecursively() returns true (success) if the
-    // directory doesn't exist ("expected result already reached" per doc).
-    if(!QDir{Path::DaemonUpdateDir}.removeRecursively())
+    // installers.  Partial downloads of the files we need are kept so they can
+    // be resumed, and the delta base is kept.  Failure does not prevent us
+    // from downloading the new file though.
+    QStringList keepNames{installerName, installerName + InstallerDownload::stateFileSuffix};
+    if(!_deltaBasePath.isEmpty())
+    {
+        QString baseName = QFileInfo{_deltaBasePath}.fileName();
+        keepNames << deltaUrl.fileName()
+                  << deltaUrl.fileName() + InstallerDownload::stateFileSuffix
+                  << baseName << baseName + installerVersionSuffix;
+    }
+    QDir updateDir{Path::DaemonUpdateDir};
+    for(const auto &entry : updateDir.entryInfoList(QDir::Files|QDir::Dirs|QDir::NoDotAndDotDot|QDir::Hidden))
     {
-        qWarning() << "Unable to clean update directory:"
-            << Path::DaemonUpdateDir;
+        if(keepNames.contains(entry.fileName()))
+            continue;
+        bool removed = entry.isDir() ? QDir{entry.filePath()}.removeRecursively() :
+                                       QFile::remove(entry.filePath());
+        if(!removed)
+            qWarning() << "Unable to clean update file:" << entry.filePath();
     }
 
     Path::DaemonUpdateDir.mkpath();
-    if(!_installerFile.open(QFile::OpenModeFlag::WriteOnly | QFile::OpenModeFlag::Truncate))
+
+    _pDownloadTask = Async<DownloadResult>::create();
+    if(_deltaBasePath.isEmpty())
+        startFullDownload();
+    else
     {
-        // Can't open the file for some reason.  This could legitimately happen,
-        // ensure that it's visible if it does.
-        qError() << "Can't download installer - can't open file"
-            << downloadPath << "due to error" << _installerFile.error();
-        emit downloadFailed(availableUpdate.version(), true);
-        // This call did initiate a download, but it failed.
-        return Async<DownloadResult>::resolve(DownloadResult().version(availableUpdate.version()).failed(true));
+        qInfo() << "Downloading delta" << deltaUrl << "from" << PIA_VERSION
+            << "to" << availableUpdate.version();
+        startDownload(deltaUrl, deltaPath, availableUpdate.deltaSha256());
     }
 
-    QNetworkRequest downloadReq{availableUpdate.uri()};
-    _pDownloadReply = _networkManager.get(downloadReq);
-    _pDownloadReply->setParent(this);
-    _pDownloadTask = Async<DownloadResult>::create();
-    _downloadingVersion = availableUpdate.version();
-    // There is no timeout on this download, but the user can cancel it
-    // manually if it appears to be stuck but does not fail.
-    connect(_pDownloadReply, &QNetworkReply::downloadProgress, this,
+    return _pDownloadTask;
+}
+
+void UpdateDownloader::startDownload(const QUrl &url, const QString &filePath,
+                                     const QString &sha256, const QString &signature)
+{
+    Q_ASSERT(!_pDownload);  // Only one file at a time
+
+    _pDownload.reset(new InstallerDownload{_installerNetworkManager, url, filePath,
+                                           sha256.toLatin1()});
+    if(!signature.isEmpty() && !_installerSignatureKey.isEmpty())
+    {
+        _pDownload->setSignature(_installerSignatureKey,
+                                 QByteArray::fromBase64(signature.toLatin1()));
+    }
+    _downloadProgressPct = 0;
+    connect(_pDownload.get(), &InstallerDownload::progress, this,
             &UpdateDownloader::onDownloadProgress);
-    connect(_pDownloadReply, &QIODevice::readyRead, this,
-            &UpdateDownloader::onDownloadReadyRead);
-    connect(_pDownloadReply, &QNetworkReply::finished, this,
-            &UpdateDownloader::onDownloadFinished);
-    emit downloadProgress(_downloadingVersion, 0);
+    // The download might finish immediately (such as if the file can't be
+    // opened or was already downloaded), so queue the finished signal; the
+    // task has to be returned before it's resolved.
+    connect(_pDownload.get(), &InstallerDownload::finished, this,
+            &UpdateDownloader::onDownloadFinished, Qt::QueuedConnection);
+    emit downloadProgress(_downloadingUpdate.version(), 0);
+    _pDownload->start();
+}
 
-    return _pDownloadTask;
+void UpdateDownloader::startFullDownload()
+{
+    _deltaBasePath.clear();
+    startDownload(QUrl{_downloadingUpdate.uri()}, _installerPath,
+                  _downloadingUpdate.sha256(), _downloadingUpdate.signature());
+}
+
+void UpdateDownloader::applyDelta(const QString &deltaPath)
+{
+    if(!_pPatchThread)
+        _pPatchThread.reset(new RunningWorkerThread{});
+
+    // Patching reads and writes the whole installer, do it on the worker
+    // thread.  The captured state is copied; the result is queued back to
+    // this thread.
+    QString basePath{_deltaBasePath}, installerPath{_installerPath};
+    QByteArray sha256{_downloadingUpdate.sha256().toLatin1()};
+    // The reconstructed installer is signed like the full installer
+    QByteArray signatureKey, signature;
+    if(!_downloadingUpdate.signature().isEmpty() && !_installerSignatureKey.isEmpty())
+    {
+        signatureKey = _installerSignatureKey;
+        signature = QByteArray::fromBase64(_downloadingUpdate.signature().toLatin1());
+    }
+    _pPatchThread->queueOnThread([this, basePath, deltaPath, installerPath,
+                                  sha256, signatureKey, signature]()
+    {
+        std::unique_ptr<SignatureVerifier> pVerifier;
+        if(!signature.isEmpty())
+            pVerifier.reset(new SignatureVerifier{signatureKey});
+        bool success = DeltaPatch::apply(basePath, deltaPath, installerPath,
+                                         sha256, pVerifier.get());
+        if(success && pVerifier && !pVerifier->verify(signature))
+        {
+            qWarning() << "Reconstructed installer" << installerPath
+                << "has an invalid signature";
+            QFile::remove(installerPath);
+            success = false;
+        }
+        // The delta isn't needed any more either way
+        QFile::remove(deltaPath);
+        QMetaObject::invokeMethod(this, [this, success](){onDeltaApplied(success);},
+                                  Qt::QueuedConnection);
+    });
+}
+
+void UpdateDownloader::onDeltaApplied(bool success)
+{
+    // Class invariant - set while applying a delta
+    Q_ASSERT(_pDownloadTask);
+
+    if(success)
+    {
+        qInfo() << "Reconstructed installer" << _installerPath << "from delta";
+        _deltaBasePath.clear();
+        writeInstallerVersion(_installerPath);
+        finishDownload(InstallerDownload::Result::Succeeded);
+    }
+    else
+    {
+        qWarning() << "Unable to apply delta for" << _downloadingUpdate.version()
+            << "- downloading full installer";
+        startFullDownload();
+    }
+}
+
+void UpdateDownloader::writeInstallerVersion(const QString &installerPath)
+{
+    QFile versionFile{installerPath + installerVersionSuffix};
+    if(!versionFile.open(QIODevice::WriteOnly|QIODevice::Truncate) ||
+       versionFile.write(_downloadingUpdate.version().toUtf8()) < 0)
+    {
+        // Not fatal, a future update just can't use a delta
+        qWarning() << "Unable to write installer version file"
+            << versionFile.fileName() << "-" << versionFile.errorString();
+    }
 }
 
 void UpdateDownloader::cancelDownload()
 {
     // Client only shows this UI when a download is in progress, don't need to
-    // provide feedback for this case.
-    if(!_pDownloadReply)
+    // provide feedback for this case.  (A delta being applied can't be
+    // canceled, but that's quick.)
+    if(!_pDownload)
     {
         qWarning() << "Can't cancel download, no download is taking place";
         return;
     }
 
-    _pDownloadReply->abort();
+    _pDownload->cancel();
 }
 
 void UpdateDownloader::onDownloadProgress(qint64 bytesReceived,
                                           qint64 bytesTotal)
 {
     // Class invariant - valid when this signal is connected
-    Q_ASSERT(_pDownloadReply);
-    // Class invariant - set when _pDownloadReply is set
-    Q_ASSERT(!_downloadingVersion.isEmpty());
+    Q_ASSERT(_pDownload);
+    // Class invariant - set when _pDownloadTask is set
+    Q_ASSERT(_downloadingUpdate.isValid());
 
-    // This signal can be emitted with bytesTotal == 0 if the download fails
-    // before getting the content length from the server (or presumably if the
-    // file isn't found, etc.).
+    // The total isn't known until the server responds (and might never be
+    // known if the server doesn't provide a content length).
     int progressPct = 0;
     if(bytesTotal > 0 && bytesReceived >= 0)
         progressPct = static_cast<int>(bytesReceived * 100 / bytesTotal);
-    emit downloadProgress(_downloadingVersion, progressPct);
+    // Progress is reported for each chunk received, only emit changes
+    if(progressPct != _downloadProgressPct)
+    {
+        _downloadProgressPct = progressPct;
+        emit downloadProgress(_downloadingUpdate.version(), progressPct);
+    }
 }
 
-void UpdateDownloader::onDownloadReadyRead()
+void UpdateDownloader::onDownloadFinished(InstallerDownload::Result result)
 {
     // Class invariant - valid when this signal is connected
-    Q_ASSERT(_pDownloadReply);
-    // Class invariant - file open when _pDownloadReply is set
-    Q_ASSERT(_installerFile.isOpen());
+    Q_ASSERT(_pDownload);
+    // Class invariant - valid when _pDownload is set
+    Q_ASSERT(_pDownloadTask);
+
+    // The file download is finished, destroy it when we return
+    std::unique_ptr<InstallerDownload> pFinishedDownload;
+    _pDownload.swap(pFinishedDownload);
 
-    // Write the new data to the file.
-    // QIODevice doesn't provide any way to observe the new data without copying
-    // it, so we make a copy here just to write it and throw the copy away.
-    if(_installerFile.write(_pDownloadReply->readAll()) < 0)
+    if(!_deltaBasePath.isEmpty())
     {
-        // The write failed, cancel the download by aborting the network
-        // request.  This will cause onDownloadFinished() to be called with an
-        // error, which will close the file and emit downloadFailed().
-        qError() << "Failed to write to installer file"
-            << _installerFile.fileName() << "-" << _installerFile.error();
-        _pDownloadReply->abort();
+        switch(result)
+        {
+            case InstallerDownload::Result::Succeeded:
+                applyDelta(pFinishedDownload->filePath());
+                return;
+            case InstallerDownload::Result::Failed:
+                qWarning() << "Delta download for" << _downloadingUpdate.version()
+                    << "failed - downloading full installer";
+                startFullDownload();
+                return;
+            case InstallerDownload::Result::Canceled:
+                break;
+        }
     }
+    else if(result == InstallerDownload::Result::Succeeded)
+        writeInstallerVersion(_installerPath);
+
+    finishDownload(result);
 }
 
-void UpdateDownloader::onDownloadFinished()
+void UpdateDownloader::finishDownload(InstallerDownload::Result result)
 {
-    // Class invariant - valid when this signal is connected
-    Q_ASSERT(_pDownloadReply);
-    // Class invariant - valid when _pDownloadReply is set
-    Q_ASSERT(_pDownloadTask);
-    // Class invariant - file open when _pDownloadReply is set
-    Q_ASSERT(_installerFile.isOpen());
-    // Class invariant - set when _pDownloadReply is set
-    Q_ASSERT(!_downloadingVersion.isEmpty());
-
-    // Delete the reply when we're done here
-    _pDownloadReply->deleteLater();
-    _installerFile.close();
-
-    // Reset _pDownloadReply, _pDownloadTask, and _downloadingVersion since the
-    // download is finished and we've closed the file.
-    QPointer<QNetworkReply> pFinishedReply;
-    _pDownloadReply.swap(pFinishedReply);
+    // Reset _pDownloadTask and the download state since the download is
+    // finished.
     Async<DownloadResult> pFinishedTask;
     _pDownloadTask.swap(pFinishedTask);
-    QString finishedVersion;
-    _downloadingVersion.swap(finishedVersion);
+    Update finishedUpdate;
+    std::swap(_downloadingUpdate, finishedUpdate);
+    QString installerPath;
+    _installerPath.swap(installerPath);
+    _deltaBasePath.clear();
+    const QString &finishedVersion = finishedUpdate.version();
 
-    // Check if the download failed
     DownloadResult taskResult;
     taskResult.version(finishedVersion);
-    auto error = pFinishedReply->error();
-    if(error != QNetworkReply::NetworkError::NoError)
-    {
-        qInfo() << "Installer download of" << finishedVersion << "from"
-            << pFinishedReply->url() << "failed with error:"
-            << qEnumToString(error);
-        // Delete the partial file - failure is ignored
-        _installerFile.remove();
-        // 'OperationCanceledError' indicates that the user canceled the
-        // download (we only call abort() due to a user cancellation).
-        bool dueToError = error != QNetworkReply::NetworkError::OperationCanceledError;
-        emit downloadFailed(finishedVersion, dueToError);
-        // The result is an error if we detected an error above, canceled
-        // otherwise.
-        taskResult.failed(dueToError);
-    }
-    else
+    switch(result)
     {
-        // Otherwise, we're done, the download succeeded
-        emit downloadFinished(finishedVersion, _installerFile.fileName());
-        taskResult.succeeded(true);
+        case InstallerDownload::Result::Succeeded:
+            emit downloadFinished(finishedVersion, installerPath);
+            taskResult.succeeded(true);
+            break;
+        case InstallerDownload::Result::Failed:
+        case InstallerDownload::Result::Canceled:
+        {
+            // A partial download is kept by InstallerDownload if it can be
+            // resumed.
+            qInfo() << "Installer download of" << finishedVersion
+                << "did not complete:" << qEnumToString(result);
+            bool dueToError = result == InstallerDownload::Result::Failed;
+            emit downloadFailed(finishedVersion, dueToError);
+            // The result is an error if the download failed, canceled
+            // otherwise.
+            taskResult.failed(dueToError);
+            break;
+        }
     }
     // Resolve the existing task
     pFinishedTask->resolve(std::move(taskResult));
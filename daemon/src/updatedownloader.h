@@ -27,11 +27,11 @@
 #include "json.h"
 #include "apiclient.h"
 #include "jsonrefresher.h"
+#include "installerdownload.h"
+#include "thread.h"
 #include <QObject>
 #include <QJsonDocument>
 #include <QNetworkAccessManager>
-#include <QFile>
-#include <QPointer>
 #include <QSslKey>
 #include <QTimer>
 #include <memory>
@@ -70,19 +70,36 @@ public:
     // Construct Update with the URI and version.  If either is empty, both
     // strings are left empty in the resulting object (there is never a
     // partially-valid Update).
-    Update(const QString &uri, const QString &version);
+    //
+    // The SHA-256 hash of the installer (hex-encoded) is optional; it isn't
+    // persisted, so it's empty for a reloaded update until the channel is
+    // refreshed.
+    //
+    // The delta URI and hash are optional too - a delta from the installed
+    // version to this version, see DeltaPatch.  A delta is only used if the
+    // installer hash is known, so the result can be verified.
+    //
+    // The installer signature (base64) is optional, it's verified if
+    // UpdateDownloader has a signature key.
+    Update(const QString &uri, const QString &version,
+           const QString &sha256 = {}, const QString &deltaUri = {},
+           const QString &deltaSha256 = {}, const QString &signature = {});
 
 public:
     // A valid Update has a non-empty URI and version.
     bool isValid() const {return !_uri.isEmpty();}
     const QString &uri() const {return _uri;}
     const QString &version() const {return _version;}
+    const QString &sha256() const {return _sha256;}
+    const QString &deltaUri() const {return _deltaUri;}
+    const QString &deltaSha256() const {return _deltaSha256;}
+    const QString &signature() const {return _signature;}
 
     bool operator==(const Update &other) const;
     bool operator!=(const Update &other) const {return !(*this == other);}
 
 private:
-    QString _uri, _version;
+    QString _uri, _version, _sha256, _deltaUri, _deltaSha256, _signature;
 };
 
 inline QDebug &operator<<(QDebug &dbg, const Update &update)
@@ -221,6 +238,11 @@ public:
     void setGaUpdateChannel(const QString &channel);
     void setBetaUpdateChannel(const QString &channel);
 
+    // Set the public key (PEM) used to verify installer signatures.  If the
+    // update metadata includes a signature, the installer is verified with
+    // this key, whether it's downloaded in full or reconstructed from a delta.
+    void setInstallerSignatureKey(QByteArray publicKeyPem);
+
     // Enable or disable the beta channel.
     // This can be called while running or stopped; the beta channel is started
     // when UpdateDownloader is running and the beta channel is enabled.
@@ -231,6 +253,8 @@ public:
     // When the download completes, downloadFinished() is emitted with the path
     // to the downloaded file.  If the download fails, downloadFailed() is
     // emitted.
+    // A partial download of the same installer (from a failed or canceled
+    // attempt, or before the daemon restarted) is resumed.
     // Only one download can occur at a time.  If a download is already
     // occurring, subsequent calls to downloadUpdate() are ignored (the result
     // is as if the request was canceled).
@@ -244,9 +268,24 @@ public:
     void cancelDownload();
 
 private:
+    // Find the installer for the installed version, which can be used as the
+    // base for a delta.  Returns an empty string if there isn't one.
+    QString findDeltaBase() const;
+    // Start downloading a file for the current update - either the delta or
+    // the full installer
+    void startDownload(const QUrl &url, const QString &filePath,
+                       const QString &sha256, const QString &signature = {});
+    void startFullDownload();
+    void applyDelta(const QString &deltaPath);
+    void onDeltaApplied(bool success);
+    // Record the version of a downloaded installer, so it can be used as the
+    // base for a delta once it's installed
+    void writeInstallerVersion(const QString &installerPath);
+    // Complete the download in progress and resolve the task
+    void finishDownload(InstallerDownload::Result result);
+
     void onDownloadProgress(qint64 bytesReceived, qint64 bytesTotal);
-    void onDownloadReadyRead();
-    void onDownloadFinished();
+    void onDownloadFinished(InstallerDownload::Result result);
 
 signals:
     // Emitted when the available update version has been refreshed.
@@ -278,22 +317,37 @@ private:
     UpdateChannel _gaChannel, _betaChannel;
     // Whether the beta channel is enabled
     bool _enableBeta;
-    // Network manager used to download the installer
-    QNetworkAccessManager _networkManager;
-    // Network reply for the download in progress (prevents us from starting
-    // another download)
-    QPointer<QNetworkReply> _pDownloadReply;
-    // Task to resolve/reject for the download in progress.  Set when
-    // _pDownloadReply is set.
+    // Key used to verify installer signatures, if set
+    QByteArray _installerSignatureKey;
+    // Network manager used to download the installer.  This isn't a shared
+    // manager (see NetworkPool) - the download's parallel segments would
+    // otherwise take up the shared per-host connections for the whole
+    // download.  Its connections also aren't affected when the shared
+    // managers are retired.
+    QNetworkAccessManager _installerNetworkManager;
+    // The file download in progress.  Partial downloads are kept in the update
+    // directory and resumed by the next download of the same file.
+    std::unique_ptr<InstallerDownload> _pDownload;
+    // Task to resolve/reject for the update download in progress (prevents us
+    // from starting another download).  This remains set while a delta is
+    // being applied, when _pDownload is not set.
     Async<DownloadResult> _pDownloadTask;
-    // The version being downloaded.  Normally, this is the same as
-    // _availableVersion, but it can be different if a refresh occurs during a
-    // download, and the available version changes.  Set when _pDownloadReply is
+    // The update being downloaded.  Normally, this is the same as the
+    // available update, but it can be different if a refresh occurs during a
+    // download, and the available update changes.  Set when _pDownloadTask is
     // set.
-    QString _downloadingVersion;
-    // When a download is in progress, the file we are writing to.  This holds
-    // an open file when _pDownloadReply is set, it is closed otherwise.
-    QFile _installerFile;
+    Update _downloadingUpdate;
+    // Path to the installer for _downloadingUpdate
+    QString _installerPath;
+    // When downloading or applying a delta, the base installer.  Empty when
+    // downloading the full installer.
+    QString _deltaBasePath;
+    // Last progress percentage emitted for the download in progress
+    int _downloadProgressPct;
+    // Thread used to apply deltas; created when needed.  This is the last
+    // member so it's destroyed first, before any state used by a patch in
+    // progress.
+    std::unique_ptr<RunningWorkerThread> _pPatchThread;
 };
 
 #endif
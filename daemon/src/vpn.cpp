@@ -65,9 +65,6 @@ static std::initializer_list<const char*> g_connectionSettingNames = {
 
 namespace
 {
-    // Maximum number of measurements in _intervalMeasurements
-    const std::size_t g_maxMeasurementIntervals{32};
-
     // This seed is run by PIA Ops, this is used in addition to hnsd's
     // hard-coded seeds.  It has a static IP address but it's also resolvable
     // as hsd.londontrustmedia.com.
@@ -1062,7 +1059,6 @@ void VPNConnection::doConnect()
     // Reset traffic counters since we have a new process
     _lastReceivedByteCount = 0;
     _lastSentByteCount = 0;
-    _intervalMeasurements.clear();
     emit byteCountsChanged();
 
     // Reset any running connect timer, just in case
@@ -1558,8 +1554,8 @@ void VPNConnection::setState(State state)
     {
         if(state == State::Disconnected)
         {
-            // We have completely disconnected, drop the measurement intervals.
-            _intervalMeasurements.clear();
+            // We have completely disconnected, drop the bandwidth history.
+            _bandwidthHistory.clear();
             emit byteCountsChanged();
 
             // Stop shadowsocks if it was running.
@@ -1651,13 +1647,13 @@ void VPNConnection::updateByteCounts(quint64 received, quint64 sent)
     _receivedByteCount += intervalReceived;
     _sentByteCount += intervalSent;
 
-    // If we've reached the maximum number of measurements, discard one before
-    // adding a new one
-    if(_intervalMeasurements.size() == g_maxMeasurementIntervals)
-        _intervalMeasurements.takeFirst();
-    _intervalMeasurements.push_back({intervalReceived, intervalSent});
+    // The history has a fixed capacity, old points are discarded as needed
+    QElapsedTimer monotonicTimer;
+    monotonicTimer.start();
+    _bandwidthHistory.append(monotonicTimer.msecsSinceReference(),
+                             intervalReceived, intervalSent);
 
-    // The interval measurements always change even if the perpetual totals do
+    // The bandwidth history always changes even if the perpetual totals do
     // not (we added a 0,0 entry).
     emit byteCountsChanged();
 }
@@ -23,6 +23,7 @@
 #define CONNECTION_H
 #pragma once
 
+#include "bandwidthhistory.h"
 #include "openvpn.h"
 #include "settings.h"
 #include "processrunner.h"
@@ -386,7 +387,7 @@ public:
     State state() const { return _state; }
     quint64 bytesReceived() const { return _receivedByteCount; }
     quint64 bytesSent() const { return _sentByteCount; }
-    const QList<IntervalBandwidth> &intervalMeasurements() const {return _intervalMeasurements;}
+    const BandwidthHistory &bandwidthHistory() const {return _bandwidthHistory;}
     void activateMACE ();
 
     bool needsReconnect();
@@ -504,8 +505,9 @@ private:
     quint64 _receivedByteCount, _sentByteCount;
     // Last traffic counts received from the current OpenVPN process
     quint64 _lastReceivedByteCount, _lastSentByteCount;
-    // Interval measurements for the current OpenVPN process
-    QList<IntervalBandwidth> _intervalMeasurements;
+    // Throughput history for the current connection (kept across OpenVPN
+    // processes, cleared when we disconnect)
+    BandwidthHistory _bandwidthHistory;
     // Cached value if we already determined we need a reconnect to apply settings
     bool _needsReconnect;
 };
@@ -0,0 +1,97 @@
+// Copyright (c) 2019 London Trust Media Incorporated
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#line SOURCE_FILE("logdecode_main.cpp")
+
+#include "binarylog.h"
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QFile>
+#include <cstdio>
+
+// Decode a binary log file and write the text log to stdout (or to a file).
+// Text logs are written unchanged, so this can be used on any log file.
+int main(int argc, char *argv[])
+{
+    setUtf8LocaleCodec();
+
+    QCoreApplication app{argc, argv};
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral("Decode a binary log file to text"));
+    parser.addHelpOption();
+    QCommandLineOption outputOption{QStringLiteral("output"),
+                                    QStringLiteral("Write the decoded log to a file instead of stdout"),
+                                    QStringLiteral("file")};
+    parser.addOption(outputOption);
+    parser.addPositionalArgument(QStringLiteral("logfile"),
+                                 QStringLiteral("Log file to decode (stdin if omitted)"));
+    parser.process(app);
+
+    QFile input;
+    const auto &args = parser.positionalArguments();
+    bool inputOpen = false;
+    if(args.isEmpty())
+        inputOpen = input.open(stdin, QFile::ReadOnly);
+    else
+    {
+        input.setFileName(args.first());
+        inputOpen = input.open(QFile::ReadOnly);
+    }
+    if(!inputOpen)
+    {
+        std::fprintf(stderr, "Unable to open %s\n",
+                     args.isEmpty() ? "stdin" : qPrintable(args.first()));
+        return 1;
+    }
+
+    QByteArray data = input.readAll();
+    QByteArray text;
+    bool complete = true;
+    if(BinaryLog::isBinaryLog(data))
+        complete = BinaryLogDecoder::decode(data, text);
+    else
+        text = data;
+
+    QFile output;
+    bool outputOpen = false;
+    if(parser.isSet(outputOption))
+    {
+        output.setFileName(parser.value(outputOption));
+        outputOpen = output.open(QFile::WriteOnly | QFile::Truncate);
+    }
+    else
+        outputOpen = output.open(stdout, QFile::WriteOnly);
+    if(!outputOpen)
+    {
+        std::fprintf(stderr, "Unable to open output file\n");
+        return 1;
+    }
+    output.write(text);
+    output.close();
+
+    // Everything that could be decoded was written; indicate if the log was
+    // truncated or corrupt
+    if(!complete)
+    {
+        std::fprintf(stderr, "Log file is truncated or corrupt, output is incomplete\n");
+        return 2;
+    }
+    return 0;
+}
@@ -45,6 +45,8 @@ Item {
   property int formStatus: 0
   property string referenceId: ""
   property string networkErrorMessage: ""
+  // Upload progress percentage, or -1 if not known yet
+  property int uploadPercent: -1
 
   readonly property int page_start: 0
   readonly property int page_legal: 0
@@ -239,9 +241,10 @@ Item {
             onClicked: {
                 // create the payload and send if successful
                 if (makePayload()) {
-                    ReportHelper.sendPayload(PayloadBuilder.payloadZipContent(),
-                                             comments.text)
+                    uploadPercent = -1
                     formStatus = 1
+                    ReportHelper.sendPayload(PayloadBuilder.takePayload(),
+                                             comments.text)
                 } else {
                   formStatus = -1
                 }
@@ -252,6 +255,8 @@ Item {
         text: {
             switch (formStatus) {
             case 1:
+                if (uploadPercent >= 0)
+                  return "Sending your report (" + uploadPercent + "%). Please wait"
                 return "Sending your report. Please wait"
             case -1:
               // Show a network error message if one is set.
@@ -324,6 +329,14 @@ Item {
           formStatus = -1
         }
       }
+      // The payload zip is produced as it's uploaded
+      Connections {
+        target: PayloadBuilder
+        onProgress: function (written, total) {
+          if (formStatus === 1 && total > 0)
+            uploadPercent = Math.floor(written * 100 / total)
+        }
+      }
       Item {
         // spacer
         Layout.fillHeight: true
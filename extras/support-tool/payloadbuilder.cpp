@@ -18,15 +18,31 @@
 
 #include "payloadbuilder.h"
 #include "logging.h"
-#include <QProcess>
+#include "binarylog.h"
 #include <QUrl>
 #include <QDateTime>
 #include "path.h"
 #include "reporthelper.h"
 
-QByteArray PayloadBuilder::payloadZipContent() const
+namespace
 {
-    return _payloadZipContent;
+    // Binary logs are decoded to text so the report is readable as-is
+    QByteArray decodeLogContent(QByteArray content)
+    {
+        if(!BinaryLog::isBinaryLog(content))
+            return content;
+        QByteArray text;
+        if(!BinaryLogDecoder::decode(content, text))
+            text.append("Binary log could not be fully decoded, it may be truncated\n");
+        return text;
+    }
+}
+
+QObject *PayloadBuilder::takePayload()
+{
+    ZipStream *pPayload = _payload;
+    _payload.clear();
+    return pPayload;
 }
 
 PayloadBuilder::PayloadBuilder(QObject *parent)
@@ -46,83 +62,73 @@ void PayloadBuilder::start()
     qDebug () << "Created temporary dir " << _targetDir->path();
 
     // Create a new file in the payload called "logs.txt" which will contain all logs added via addLogFile
-    _combinedLogFile.reset(new QFile(payloadPath("logs.txt")));
+    QString combinedLogPath = _targetDir->filePath(QStringLiteral("logs.txt"));
+    _combinedLogFile.reset(new QFile(combinedLogPath));
     _combinedLogFile->open(QIODevice::WriteOnly);
-    _payloadZipContent.clear();
+    _entries.clear();
+    _entries.push_back({combinedLogPath, QStringLiteral("logs.txt")});
+    _logHistorySize = 0;
+    // Discard a payload that was never taken
+    delete _payload;
+}
+
+ZipStream *PayloadBuilder::createPayloadStream()
+{
+    ZipStream *pPayload = new ZipStream();
+    connect(pPayload, &ZipStream::progress, this, &PayloadBuilder::progress);
+
+    for(const auto &entry : _entries) {
+        // Everything goes in the payload root dir.  Zip always uses '/'.
+        QString archiveName = PAYLOAD_ROOT + '/' + entry.archiveName;
+        // A file that can't be read is skipped
+        if(pPayload->addFile(archiveName, entry.sourcePath))
+            qDebug () << "Added file: " << archiveName;
+    }
+
+    return pPayload;
 }
 
 bool PayloadBuilder::finish(const QString &copyToPath)
 {
     _combinedLogFile->close();
 
-#ifdef Q_OS_MACOS
-    QString zipCommand = "zip";
-#elif defined(Q_OS_WIN)
-    QString zipCommand = Path::ExecutableDir / "zip.exe";
-#elif defined (Q_OS_LINUX)
-    QString zipCommand("/usr/bin/zip");
-    if(!QFile::exists(zipCommand)) {
-        ReportHelper::showErrorMessage(QStringLiteral("Missing 'zip' command. Please install the appropriate package."));
-        return false;
-    }
-#endif
-
-    QStringList args;
-    args << PAYLOAD_FILE;
-    args << "-r" << PAYLOAD_ROOT;
-
-    QProcess zipProcess;
-    zipProcess.setProgram(zipCommand);
-    zipProcess.setArguments(args);
-    zipProcess.setWorkingDirectory(_targetDir->path());
-    zipProcess.start();
-    zipProcess.waitForFinished();
-
-    bool success = false;
-
-    if(zipProcess.exitStatus() == QProcess::NormalExit) {
-        QFile resultFile(_targetDir->filePath(PAYLOAD_FILE));
-        qDebug() << (_targetDir->filePath(PAYLOAD_FILE));
-        if(resultFile.exists()) {
-            resultFile.open(QIODevice::ReadOnly);
-            _payloadZipContent.append(resultFile.readAll());
-            resultFile.close();
-
-            // If we need to store a copy elsewhere (for save as zip) make a copy
-            // but success is determined by whether we could copy or not.
-            // even though the zip could be generated successfully
-            if(copyToPath.length() > 0) {
-                // Sometimes the file dialog can provide "file://" schema URLs.
-                // To reliably convert them we need to make a new path
-
-                QString copyTargetPath = copyToPath;
-                if(copyToPath.startsWith("file://")) {
-                     copyTargetPath = QUrl(copyToPath).toLocalFile();
-                }
-
-                if(!resultFile.copy(copyTargetPath)) {
-                    qWarning () << "Unable to copy to " << copyTargetPath;
-                }
-                else {
-                    success = true;
-                }
-            }
-            else {
-                success = true;
-            }
-        } else {
-            qWarning () << "Payload zip file does not exist";
+    QScopedPointer<ZipStream> payload{createPayloadStream()};
+    bool success = payload->open(QIODevice::ReadOnly);
+    qDebug () << "Payload zip size:" << payload->size();
+
+    // If we need to store a copy elsewhere (for save as zip), write the zip
+    // there.  Otherwise, it's produced as it's uploaded.
+    if(success && copyToPath.length() > 0) {
+        // Sometimes the file dialog can provide "file://" schema URLs.
+        // To reliably convert them we need to make a new path
+        QString zipPath = copyToPath;
+        if(copyToPath.startsWith("file://")) {
+             zipPath = QUrl(copyToPath).toLocalFile();
         }
-    }
-    else {
-        qWarning () << "Zip return code" << zipProcess.exitCode();
-    }
 
-    if(!success)
-    {
-        qWarning () << "Zip process failed.";
-        qWarning () << zipProcess.readAllStandardOutput();
-        qWarning () << zipProcess.readAllStandardError();
+        QFile zipFile(zipPath);
+        if(!zipFile.open(QIODevice::WriteOnly|QIODevice::Truncate)) {
+            qWarning () << "Unable to create payload zip" << zipPath << zipFile.errorString();
+            success = false;
+        }
+        else {
+            success = payload->copyTo(zipFile);
+            zipFile.close();
+            success = success && zipFile.error() == QFileDevice::NoError;
+        }
+
+        if(success) {
+            qDebug () << "Wrote payload zip" << zipPath;
+        }
+        else {
+            qWarning () << "Unable to write payload zip" << zipPath;
+            QFile::remove(zipPath);
+        }
+    }
+    else if(success) {
+        // Parent it until it's taken, so QML doesn't collect it
+        payload->setParent(this);
+        _payload = payload.take();
     }
 
     // Flag that everything is cleaned up
@@ -170,19 +176,28 @@ void PayloadBuilder::addFileToPayload(const QString &sourcePath, const QString &
         return;
     }
 
-    QString fullTargetPath = payloadPath(targetName);
-    if(QFileInfo(targetName).size() > FILE_SIZE_LIMIT) {
+    QFileInfo fi(sourcePath);
+    if(fi.size() > FILE_SIZE_LIMIT) {
         qWarning () << "Skipped large file " << targetName;
         return;
     }
-    if(QFile::copy(sourcePath, fullTargetPath)) {
-        qDebug () << "Added file: " << fullTargetPath;
+    if(fi.isFile() && fi.isReadable()) {
+        _entries.push_back({sourcePath, targetName});
+        qDebug () << "Adding file: " << sourcePath;
     }
     else {
-        qWarning() << "Unable to add file: " << fullTargetPath;
+        qWarning() << "Unable to add file: " << sourcePath;
     }
 }
 
+void PayloadBuilder::appendLogContent(const QString &fileName, QByteArray content)
+{
+    // Write it into the combined log file along with the "PIA_PART" header
+    _combinedLogFile->write((QStringLiteral("\n/PIA_PART/%1\n").arg(fileName).toUtf8()));
+
+    _combinedLogFile->write(decodeLogContent(std::move(content)));
+}
+
 void PayloadBuilder::addLogFile(const QString &fullPath)
 {
     if(!_started) {
@@ -190,28 +205,53 @@ void PayloadBuilder::addLogFile(const QString &fullPath)
         return;
     }
 
+    addLogFileOnly(fullPath);
+
+    if(QFile::exists(fullPath + oldFileSuffix)) {
+        addLogFileOnly(fullPath + oldFileSuffix);
+    }
+
+    // Add compressed history, newest first, until the history limit for the
+    // whole payload is reached.  The limit applies to the decoded text, since
+    // that's what is written to the combined log file.
+    for(const auto &historyFile : Logger::logHistoryFiles(fullPath)) {
+        QByteArray content = decodeLogContent(Logger::readLogHistoryFile(historyFile));
+        if(content.isEmpty()) {
+            qWarning () << "Cannot read log history file" << historyFile;
+            continue;
+        }
+        if(_logHistorySize + content.size() > LOG_HISTORY_LIMIT) {
+            qDebug () << "Reached log history limit, skipping" << historyFile << "and older";
+            break;
+        }
+        _logHistorySize += content.size();
+        appendLogContent(QFileInfo{historyFile}.fileName(), std::move(content));
+    }
+}
+
+void PayloadBuilder::addLogFileOnly(const QString &fullPath)
+{
+    if(!_started) {
+        qWarning () << "Not started yet";
+        return;
+    }
+
     qDebug () << "Adding log file with path: " << fullPath;
 
     QFileInfo fi(fullPath);
     if(fi.exists() && fi.isReadable()) {
-        // Read file and write it into the combined log file along with the "PIA_PART" header
-        _combinedLogFile->write((QStringLiteral("\n/PIA_PART/%1\n").arg(fi.fileName()).toUtf8()));
-
         if(fi.size() > FILE_SIZE_LIMIT) {
+            _combinedLogFile->write((QStringLiteral("\n/PIA_PART/%1\n").arg(fi.fileName()).toUtf8()));
             _combinedLogFile->write(QStringLiteral("File Too large. Skipping \n").toUtf8());
             return;
         }
 
         QFile file(fi.filePath());
         file.open(QFile::ReadOnly);
-        _combinedLogFile->write(file.readAll());
+        appendLogContent(fi.fileName(), file.readAll());
         file.close();
     }
     else {
         qWarning () << "Cannot add file" << fi.path();
     }
-
-    if(QFile::exists(fullPath + oldFileSuffix)) {
-        addLogFile(fullPath + oldFileSuffix);
-    }
 }
@@ -24,7 +24,10 @@
 #include <QDir>
 #include <QTemporaryDir>
 #include <QDebug>
+#include <QPointer>
 #include <QScopedPointer>
+#include <QVector>
+#include "zipstream.h"
 
 // The entire payload is in a single folder. The current CrashLab implementation
 // doesn't depend on this, but it's better to keep the name consistent for future
@@ -38,41 +41,44 @@ const QString PAYLOAD_FILE = QStringLiteral("payload.zip");
 // But to be on the safer side, ignore all files above 6 mb
 const qint64 FILE_SIZE_LIMIT = 6000000;
 
+// Compressed log history is decompressed into the combined log file, up to
+// this total size for all logs together.
+const qint64 LOG_HISTORY_LIMIT = 8000000;
+
 class PayloadBuilder: public QObject
 {
     Q_OBJECT
 private:
+    // A file to be written to the payload zip, and its name in the zip
+    struct PayloadEntry
+    {
+        QString sourcePath;
+        QString archiveName;
+    };
+
     QScopedPointer<QFile> _combinedLogFile;
     bool _started = false;
+    // Total size of log history added to the combined log file so far
+    qint64 _logHistorySize = 0;
 
-    // Target temp dir where we build the payload
+    // Temp dir containing the combined log file
     QScopedPointer<QTemporaryDir> _targetDir;
 
-    // A bute array containing the contents of the zip file for uploading
-    QByteArray _payloadZipContent;
-
-    // Returns a full filesystem path for a given relative file path
-    // For example, if "file" is "client-crash/bar.dmp"
-    // - if the current target dir is /tmp/foo
-    // - current payload is /tmp/foo/payload
-    // - Final file is "/tmp/foo/payload/client-crash/bar.dmp"
-    // - This function ensures that client-crash dir is created
-    //
-    // We can use _targetDir->filePath() instead of this but this function ensures
-    // the directory exists
-    //
-    // Also, it's important to note that QDir's absoluteFilePath normalizes
-    // dir seprators, so client-crash/bar.dmp becomes client-crash\bar.dmp on windows
-    QString payloadPath (const QString &fileName) {
-        QDir payloadDir(_targetDir->filePath(PAYLOAD_ROOT));
-        QFileInfo fi(payloadDir.absoluteFilePath(fileName));
-        if(!fi.dir().exists()) {
-            qDebug () << "Creating dir" << fi.dir().absolutePath();
-            fi.dir().mkpath(".");
-        }
-        return fi.absoluteFilePath();
-    }
+    // Files to write to the payload.  Files are read directly from their
+    // original location as the zip is produced, they aren't copied.
+    QVector<PayloadEntry> _entries;
+
+    // The payload zip stream created by finish() for uploading, until it's
+    // taken by takePayload()
+    QPointer<ZipStream> _payload;
+
     void addFileToPayload(const QString &sourcePath, const QString &targetPath);
+    // Add a log file without its old file or history
+    void addLogFileOnly(const QString &fullPath);
+    // Write log content to the combined log file, decoding binary logs
+    void appendLogContent(const QString &fileName, QByteArray content);
+    // Create a zip stream of the payload entries
+    ZipStream *createPayloadStream();
 
 public:
     explicit PayloadBuilder(QObject *parent = nullptr);
@@ -81,13 +87,22 @@ public:
     Q_INVOKABLE void addLogFile(const QString &fullPath);
     Q_INVOKABLE void addClientDumpFile (const QString &fullPath);
     Q_INVOKABLE void addDaemonDumpFile (const QString &fullPath);
+    // Finish the payload.  If copyToPath is given, the zip is written there;
+    // otherwise it's prepared for uploading with takePayload().
     Q_INVOKABLE bool finish (const QString &copyToPath = "");
 
     // Add any misc file (currently used for diagnostics.txt)
     Q_INVOKABLE void addFile (const QString &fullPath);
 
-    Q_INVOKABLE QByteArray payloadZipContent() const;
+    // The payload zip after finish() succeeds, for uploading.  This is a
+    // ZipStream that produces the zip as it's read, so it can be used directly
+    // as the upload body; it remains a child of the PayloadBuilder until the
+    // caller reparents it.
+    Q_INVOKABLE QObject *takePayload();
 signals:
+    // Emitted as the payload zip is produced - as it's uploaded, or as it's
+    // written by finish(); total is the size of the zip
+    void progress(qint64 written, qint64 total);
 
 public slots:
 };
@@ -45,23 +45,33 @@
 
 QObject *ReportHelper::_uiParams;
 
-void ReportHelper::sendPayload(const QByteArray &payloadContent, const QString &comment)
+void ReportHelper::sendPayload(QObject *payload, const QString &comment)
 {
+    QIODevice *payloadDevice = qobject_cast<QIODevice*>(payload);
+    if(!payloadDevice || !payloadDevice->isReadable()) {
+        qWarning () << "Payload is not available to send";
+        emit uploadFail(QStringLiteral("Unable to read the report file"));
+        return;
+    }
+
     // Set up the request
     QString url = getUrl("/api/v1/reports/upload");
-    qDebug () << "Sending payload to URL: " << url << "Payload size: " << payloadContent.size();
+    qDebug () << "Sending payload to URL: " << url << "Payload size: " << payloadDevice->size();
     _request.setUrl(url);
 
     // Create a multipart uploader. We will delete this in `onUploadFinished`
     QHttpMultiPart *uploader = new QHttpMultiPart(QHttpMultiPart::FormDataType);
 
     //
-    // Create a file part from the zip file contents from PayloadBuilder
+    // Create a file part from the zip stream created by PayloadBuilder.  The
+    // zip is produced as it's sent; the multipart owns the stream.  Its size
+    // is known up front, so Qt streams it instead of buffering it.
     //
+    payloadDevice->setParent(uploader);
     QHttpPart filePart;
     filePart.setHeader(QNetworkRequest::ContentDispositionHeader, QVariant("form-data; name=\"payload\"; filename=\""+ PAYLOAD_FILE + "\""));
     filePart.setHeader(QNetworkRequest::ContentTypeHeader, QVariant("application/octet-stream"));
-    filePart.setBody(payloadContent);
+    filePart.setBodyDevice(payloadDevice);
 
     //
     // Create parts for the version/comment/platform
@@ -33,7 +33,9 @@ class ReportHelper: public QObject
     Q_OBJECT
 
 public:
-    Q_INVOKABLE void sendPayload(const QByteArray &payloadContent, const QString &comment);
+    // Upload the payload zip from PayloadBuilder::takePayload().  The zip is
+    // produced as it's sent, it's never held in memory or written to disk.
+    Q_INVOKABLE void sendPayload(QObject *payload, const QString &comment);
     Q_INVOKABLE void restartApp(bool safeMode);
     Q_INVOKABLE void exitReporter();
     Q_INVOKABLE void showFileInSystemViewer(const QString &fullPath);
@@ -0,0 +1,382 @@
+// Copyright (c) 2019 London Trust Media Incorporated
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "zipstream.h"
+#include <QDateTime>
+#include <QDebug>
+#include <QFileInfo>
+#include <QtEndian>
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+namespace
+{
+    const quint32 zipLocalHeaderSig = 0x04034b50;
+    const quint32 zipDataDescriptorSig = 0x08074b50;
+    const quint32 zipCentralHeaderSig = 0x02014b50;
+    const quint32 zipEndOfCentralDirSig = 0x06054b50;
+    // "Version needed to extract" - 2.0 for data descriptors
+    const quint16 zipVersion = 20;
+    // General purpose flags - the CRC is in a data descriptor after the data,
+    // and file names are UTF-8
+    const quint16 zipFlags = 0x0008 | 0x0800;
+    const quint16 zipMethodStored = 0;
+    // Fixed sizes of headers, not including the name
+    const qint64 zipLocalHeaderSize = 30;
+    const qint64 zipDataDescriptorSize = 16;
+    const qint64 zipCentralHeaderSize = 46;
+    const qint64 zipEndOfCentralDirSize = 22;
+
+    const std::array<quint32, 256> &zipCrcTable()
+    {
+        static const std::array<quint32, 256> table = []
+        {
+            std::array<quint32, 256> t;
+            for(quint32 i = 0; i < 256; ++i)
+            {
+                quint32 c = i;
+                for(int k = 0; k < 8; ++k)
+                    c = (c & 1) ? (0xEDB88320u ^ (c >> 1)) : (c >> 1);
+                t[i] = c;
+            }
+            return t;
+        }();
+        return table;
+    }
+
+    // Update a CRC-32 with more data.  Start with 0.
+    quint32 zipCrc32(quint32 crc, const char *data, qint64 size)
+    {
+        const auto &table = zipCrcTable();
+        crc = ~crc;
+        for(qint64 i = 0; i < size; ++i)
+            crc = table[(crc ^ static_cast<quint8>(data[i])) & 0xFF] ^ (crc >> 8);
+        return ~crc;
+    }
+
+    void appendLe16(QByteArray &out, quint16 value)
+    {
+        char bytes[2];
+        qToLittleEndian(value, bytes);
+        out.append(bytes, sizeof(bytes));
+    }
+
+    void appendLe32(QByteArray &out, quint32 value)
+    {
+        char bytes[4];
+        qToLittleEndian(value, bytes);
+        out.append(bytes, sizeof(bytes));
+    }
+}
+
+ZipStream::ZipStream(QObject *pParent)
+    : QIODevice{pParent}, _localSize{0}, _centralSize{0},
+      _part{Part::LocalHeader}, _entryIndex{0}, _dataRemaining{0}, _crc{0},
+      _pendingPos{0}, _position{0}
+{
+}
+
+bool ZipStream::addFile(const QString &archiveName, const QString &sourcePath)
+{
+    if(isOpen())
+    {
+        qWarning() << "Can't add" << sourcePath << "- zip stream is already open";
+        return false;
+    }
+
+    QFileInfo sourceInfo{sourcePath};
+    if(!sourceInfo.isFile() || !sourceInfo.isReadable())
+    {
+        qWarning() << "Unable to read" << sourcePath << "for zip archive";
+        return false;
+    }
+
+    // Without zip64, the entry's size and offset, and the central directory
+    // offset, have to fit in 32 bits
+    QByteArray name = archiveName.toUtf8();
+    qint64 sourceSize = sourceInfo.size();
+    qint64 localSize = zipLocalHeaderSize + name.size() + sourceSize + zipDataDescriptorSize;
+    qint64 centralSize = zipCentralHeaderSize + name.size();
+    if(_entries.size() >= MaxEntries ||
+       _localSize + localSize + _centralSize + centralSize + zipEndOfCentralDirSize > ArchiveLimit)
+    {
+        qWarning() << "Skipping" << sourcePath << "- zip archive is full";
+        return false;
+    }
+
+    QDateTime modified = sourceInfo.lastModified();
+    QDate date = modified.date();
+    QTime time = modified.time();
+
+    Entry entry{};
+    entry.name = std::move(name);
+    entry.sourcePath = sourcePath;
+    // DOS dates start in 1980
+    if(date.year() >= 1980)
+    {
+        entry.dosDate = static_cast<quint16>(((date.year() - 1980) << 9) | (date.month() << 5) | date.day());
+        entry.dosTime = static_cast<quint16>((time.hour() << 11) | (time.minute() << 5) | (time.second() / 2));
+    }
+    else
+    {
+        entry.dosDate = (1 << 5) | 1;   // 1980-01-01
+        entry.dosTime = 0;
+    }
+    entry.size = static_cast<quint32>(sourceSize);
+    entry.localHeaderOffset = static_cast<quint32>(_localSize);
+
+    _localSize += localSize;
+    _centralSize += centralSize;
+    _entries.push_back(std::move(entry));
+    return true;
+}
+
+bool ZipStream::copyTo(QIODevice &output)
+{
+    QByteArray chunk{static_cast<int>(ChunkSize), Qt::Uninitialized};
+    while(!atEnd())
+    {
+        qint64 chunkSize = read(chunk.data(), chunk.size());
+        if(chunkSize <= 0)
+            return false;
+        if(output.write(chunk.constData(), chunkSize) != chunkSize)
+        {
+            qWarning() << "Unable to write zip archive:" << output.errorString();
+            return false;
+        }
+    }
+    return true;
+}
+
+bool ZipStream::open(OpenMode mode)
+{
+    if((mode & ReadWrite) != ReadOnly)
+    {
+        qWarning() << "Zip stream can only be opened for reading";
+        return false;
+    }
+    restart();
+    // The archive is produced directly into the caller's buffer, there's no
+    // need for QIODevice to buffer it again
+    return QIODevice::open(mode | Unbuffered);
+}
+
+void ZipStream::close()
+{
+    QIODevice::close();
+    _source.close();
+    _pending.clear();
+}
+
+qint64 ZipStream::size() const
+{
+    return _localSize + _centralSize + zipEndOfCentralDirSize;
+}
+
+bool ZipStream::seek(qint64 pos)
+{
+    if(pos == 0)
+        restart();
+    else if(pos != _position)
+    {
+        qWarning() << "Zip stream can't seek to" << pos << "from" << _position;
+        return false;
+    }
+    return QIODevice::seek(pos);
+}
+
+qint64 ZipStream::writeData(const char *, qint64)
+{
+    return -1;
+}
+
+QByteArray ZipStream::localHeader(const Entry &entry) const
+{
+    QByteArray header;
+    appendLe32(header, zipLocalHeaderSig);
+    appendLe16(header, zipVersion);
+    appendLe16(header, zipFlags);
+    appendLe16(header, zipMethodStored);
+    appendLe16(header, entry.dosTime);
+    appendLe16(header, entry.dosDate);
+    // The CRC follows the data.  The sizes are known, include them for
+    // readers that extract from a stream.
+    appendLe32(header, 0);
+    appendLe32(header, entry.size);
+    appendLe32(header, entry.size);
+    appendLe16(header, static_cast<quint16>(entry.name.size()));
+    appendLe16(header, 0);  // Extra field length
+    header.append(entry.name);
+    return header;
+}
+
+QByteArray ZipStream::centralHeader(const Entry &entry) const
+{
+    QByteArray header;
+    appendLe32(header, zipCentralHeaderSig);
+    appendLe16(header, zipVersion);   // Version made by
+    appendLe16(header, zipVersion);   // Version needed to extract
+    appendLe16(header, zipFlags);
+    appendLe16(header, zipMethodStored);
+    appendLe16(header, entry.dosTime);
+    appendLe16(header, entry.dosDate);
+    appendLe32(header, entry.crc);
+    appendLe32(header, entry.size);
+    appendLe32(header, entry.size);
+    appendLe16(header, static_cast<quint16>(entry.name.size()));
+    appendLe16(header, 0);    // Extra field length
+    appendLe16(header, 0);    // Comment length
+    appendLe16(header, 0);    // Disk number
+    appendLe16(header, 0);    // Internal attributes
+    appendLe32(header, 0);    // External attributes
+    appendLe32(header, entry.localHeaderOffset);
+    header.append(entry.name);
+    return header;
+}
+
+QByteArray ZipStream::endRecord() const
+{
+    QByteArray record;
+    appendLe32(record, zipEndOfCentralDirSig);
+    appendLe16(record, 0);    // Disk number
+    appendLe16(record, 0);    // Disk with central directory
+    appendLe16(record, static_cast<quint16>(_entries.size()));
+    appendLe16(record, static_cast<quint16>(_entries.size()));
+    appendLe32(record, static_cast<quint32>(_centralSize));
+    appendLe32(record, static_cast<quint32>(_localSize));   // Central directory offset
+    appendLe16(record, 0);    // Comment length
+    return record;
+}
+
+void ZipStream::restart()
+{
+    _part = Part::LocalHeader;
+    _entryIndex = 0;
+    _source.close();
+    _dataRemaining = 0;
+    _crc = 0;
+    _pending.clear();
+    _pendingPos = 0;
+    _position = 0;
+}
+
+bool ZipStream::nextPart()
+{
+    _pending.clear();
+    _pendingPos = 0;
+
+    switch(_part)
+    {
+        case Part::LocalHeader:
+            if(_entryIndex >= _entries.size())
+            {
+                _part = Part::CentralHeader;
+                _entryIndex = 0;
+                return nextPart();
+            }
+            _source.setFileName(_entries[_entryIndex].sourcePath);
+            if(!_source.open(QIODevice::ReadOnly))
+            {
+                qWarning() << "Unable to read" << _source.fileName()
+                    << "for zip archive:" << _source.errorString();
+            }
+            _dataRemaining = _entries[_entryIndex].size;
+            _crc = 0;
+            _pending = localHeader(_entries[_entryIndex]);
+            _part = Part::Data;
+            return true;
+        case Part::Data:
+        {
+            // The entry's data is complete, follow it with the data descriptor
+            _source.close();
+            Entry &entry = _entries[_entryIndex];
+            entry.crc = _crc;
+            appendLe32(_pending, zipDataDescriptorSig);
+            appendLe32(_pending, entry.crc);
+            appendLe32(_pending, entry.size);
+            appendLe32(_pending, entry.size);
+            ++_entryIndex;
+            _part = Part::LocalHeader;
+            return true;
+        }
+        case Part::CentralHeader:
+            if(_entryIndex >= _entries.size())
+            {
+                _pending = endRecord();
+                _part = Part::End;
+                return true;
+            }
+            _pending = centralHeader(_entries[_entryIndex]);
+            ++_entryIndex;
+            return true;
+        case Part::End:
+            _part = Part::Done;
+            return false;
+        case Part::Done:
+            break;
+    }
+    return false;
+}
+
+qint64 ZipStream::readEntryData(char *data, qint64 maxSize)
+{
+    qint64 chunkSize = std::min({maxSize, _dataRemaining, static_cast<qint64>(ChunkSize)});
+    qint64 readSize = _source.isOpen() ? _source.read(data, chunkSize) : -1;
+    if(readSize <= 0)
+    {
+        // The source shrank or can't be read - pad to the recorded size so
+        // the archive stays consistent with its headers
+        if(_source.isOpen())
+        {
+            qWarning() << "Zip source" << _source.fileName() << "ended"
+                << _dataRemaining << "bytes early";
+            _source.close();
+        }
+        std::memset(data, 0, static_cast<std::size_t>(chunkSize));
+        readSize = chunkSize;
+    }
+    _crc = zipCrc32(_crc, data, readSize);
+    _dataRemaining -= readSize;
+    return readSize;
+}
+
+qint64 ZipStream::readData(char *data, qint64 maxSize)
+{
+    qint64 produced = 0;
+    while(produced < maxSize)
+    {
+        if(_pendingPos < _pending.size())
+        {
+            qint64 copySize = std::min(maxSize - produced, static_cast<qint64>(_pending.size() - _pendingPos));
+            std::memcpy(data + produced, _pending.constData() + _pendingPos,
+                        static_cast<std::size_t>(copySize));
+            _pendingPos += static_cast<int>(copySize);
+            produced += copySize;
+        }
+        else if(_part == Part::Data && _dataRemaining > 0)
+            produced += readEntryData(data + produced, maxSize - produced);
+        else if(!nextPart())
+            break;
+    }
+
+    _position += produced;
+    if(produced > 0)
+        emit progress(_position, size());
+    return produced;
+}
@@ -0,0 +1,145 @@
+// Copyright (c) 2019 London Trust Media Incorporated
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#ifndef ZIPSTREAM_H
+#define ZIPSTREAM_H
+
+#include <QFile>
+#include <QIODevice>
+#include <QString>
+#include <QVector>
+
+// ZipStream is a read-only device that produces a zip archive of source files
+// as it is read.  It can be used directly as an upload body, or copied to a
+// file.
+//
+// Only each entry's name, size and time are captured when it's added; the
+// content is read from the source file in chunks as the archive is read, and
+// the CRC is computed as it goes.  Nothing is buffered beyond the current
+// header, so memory use doesn't depend on the number or size of entries.
+//
+// Entries are stored, not compressed.  This keeps the size of the archive
+// known before any of it is produced, so size() is exact - Qt's HTTP client
+// needs that to stream a body rather than buffering it in memory.  The CRC
+// of each entry follows its data in a data descriptor.
+//
+// If a source file changes after it's added, its recorded size still
+// determines the entry - a file that grew is truncated, and one that shrank
+// (or can't be read) is padded with zeros, so the archive stays consistent.
+//
+// The stream can be read again from the start with reset() (Qt does this if
+// it has to resend an upload); other seeks aren't supported.
+//
+// Zip64 isn't supported, so an entry is rejected if it would make the archive
+// exceed the 32-bit size and offset fields (ArchiveLimit), or if the archive
+// already has MaxEntries entries.  The support tool's payload is far below
+// these limits.
+class ZipStream : public QIODevice
+{
+    Q_OBJECT
+
+public:
+    // Largest archive that can be written without zip64
+    enum : qint64 { ArchiveLimit = 0xFFFFFFFFll };
+    // Most entries that can be written without zip64
+    enum : int { MaxEntries = 0xFFFF };
+    // Most data read from a source file at once
+    enum : qint64 { ChunkSize = 64 * 1024 };
+
+public:
+    explicit ZipStream(QObject *pParent = nullptr);
+
+public:
+    // Add a file to the archive.  Entries can only be added before the stream
+    // is opened.  Returns false (and skips the file) if the source can't be
+    // read or the archive would be too large.
+    bool addFile(const QString &archiveName, const QString &sourcePath);
+
+    // Copy the whole archive to a device in chunks.  The stream must be open.
+    // Returns false if it can't be written.
+    bool copyTo(QIODevice &output);
+
+    // Only ReadOnly is supported
+    virtual bool open(OpenMode mode) override;
+    virtual void close() override;
+    // The total size of the archive
+    virtual qint64 size() const override;
+    // Only seeking to the start or the current position is supported
+    virtual bool seek(qint64 pos) override;
+
+signals:
+    // Emitted as the archive is read; total is the size of the archive
+    void progress(qint64 read, qint64 total);
+
+protected:
+    virtual qint64 readData(char *data, qint64 maxSize) override;
+    virtual qint64 writeData(const char *data, qint64 maxSize) override;
+
+private:
+    struct Entry
+    {
+        QByteArray name;
+        QString sourcePath;
+        quint16 dosTime, dosDate;
+        quint32 size;
+        // Computed when the entry's data is read
+        quint32 crc;
+        quint32 localHeaderOffset;
+    };
+
+    // Parts of the archive, in order
+    enum class Part
+    {
+        LocalHeader,
+        Data,
+        CentralHeader,
+        End,
+        Done
+    };
+
+    QByteArray localHeader(const Entry &entry) const;
+    QByteArray centralHeader(const Entry &entry) const;
+    QByteArray endRecord() const;
+    // Start producing the archive from the beginning
+    void restart();
+    // Queue the next header or record after the current part is complete.
+    // Returns false at the end of the archive.
+    bool nextPart();
+    // Read the current entry's data, padding with zeros if the source ends
+    // early
+    qint64 readEntryData(char *data, qint64 maxSize);
+
+private:
+    QVector<Entry> _entries;
+    // Total size of the local headers, data, and data descriptors, and of the
+    // central directory headers
+    qint64 _localSize, _centralSize;
+
+    // Current position in the archive
+    Part _part;
+    int _entryIndex;
+    QFile _source;
+    qint64 _dataRemaining;
+    quint32 _crc;
+    // Header or record being read, and the position in it
+    QByteArray _pending;
+    int _pendingPos;
+    qint64 _position;
+};
+
+#endif // ZIPSTREAM_H
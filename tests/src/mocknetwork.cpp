@@ -34,6 +34,14 @@ void MockNetworkReplyDataless::finishRateLimit()
     finishError(QNetworkReply::NetworkError::UnknownContentError);
 }
 
+void MockNetworkReplyDataless::finishNotModified()
+{
+    setAttribute(QNetworkRequest::Attribute::HttpStatusCodeAttribute,
+                 QVariant::fromValue(304));
+    close();
+    emit finished();
+}
+
 void MockNetworkReplyDataless::finishError(QNetworkReply::NetworkError code)
 {
     close();
@@ -59,6 +59,19 @@ public:
         QTimer::singleShot(0, this, &MockNetworkReply::finished);
     }
 
+    // Set a response header
+    void setReplyHeader(const QByteArray &name, const QByteArray &value)
+    {
+        setRawHeader(name, value);
+    }
+
+    // Set the HTTP status code.  (If it's not set, the reply has no status,
+    // like a non-HTTP reply.)
+    void setHttpStatus(int status)
+    {
+        setAttribute(QNetworkRequest::HttpStatusCodeAttribute, status);
+    }
+
 protected:
     virtual qint64 readData(char *data, qint64 maxlen) override
     {
@@ -105,6 +118,8 @@ public:
     void finishNetError() {finishError(QNetworkReply::NetworkError::UnknownNetworkError);}
     // End the reply with any QNetworkReply error code.
     void finishError(QNetworkReply::NetworkError code);
+    // End the reply with a 304 Not Modified status (not an error).
+    void finishNotModified();
 };
 
 // Class used to define the MockNetworkManager::_replyConsumed() signal.
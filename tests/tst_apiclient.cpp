@@ -17,6 +17,7 @@
 // <https://www.gnu.org/licenses/>.
 
 #include "daemon/src/apiclient.h"
+#include "common/src/networktaskwithretry.h"
 #include "testshim.h"
 #include "src/mocknetwork.h"
 #include <QtTest>
@@ -337,6 +338,89 @@ private slots:
         emit pGetReply->finished();
         QVERIFY(TestData::checkSuccess(getSpy.spy()));
     }
+
+    // Test hedged requests - a slow request is also sent to the next API
+    // base, and the first response is used.  This uses its own ApiBase, so it
+    // doesn't depend on the state of the static ApiBases.
+    void testHedgedRequest()
+    {
+        using namespace std::chrono_literals;
+
+        ApiBase apiBase{{QStringLiteral("https://a.example.com/"),
+                         QStringLiteral("https://b.example.com/")}};
+        // Record a fast response so the hedge delay is the minimum (250 ms)
+        // rather than the default used when nothing has responded yet
+        apiBase.beginAttempt().attemptSucceeded(0, 1ms);
+
+        QSignalSpy consumeSpy{&MockNetworkManager::_replyConsumed, &ReplyConsumedSignal::signal};
+
+        auto pSlowReply = MockNetworkManager::enqueueReply();
+        QSignalSpy slowDestroySpy{pSlowReply.data(), &QObject::destroyed};
+        CallbackSpy getSpy;
+        auto pTask = Async<NetworkTaskWithRetry>::create(QNetworkAccessManager::Operation::GetOperation,
+                                                         apiBase, TestData::status,
+                                                         ApiRetries::counted(2),
+                                                         QJsonDocument{},
+                                                         TestData::passwordAuth(),
+                                                         NetworkTaskWithRetry::RawHeaders{},
+                                                         true);
+        pTask->notify(&getSpy, getSpy.callback());
+        QVERIFY(consumeSpy.wait(100));
+        QCOMPARE(consumeSpy.size(), 1);
+        QCOMPARE(consumeSpy[0][0].value<QNetworkRequest>().url().host(),
+                 QStringLiteral("a.example.com"));
+
+        // The hedged request is sent after the hedge delay, to the other base
+        auto pHedgeReply = MockNetworkManager::enqueueReply(TestData::success);
+        QVERIFY(consumeSpy.wait(1000));
+        QCOMPARE(consumeSpy.size(), 2);
+        QCOMPARE(consumeSpy[1][0].value<QNetworkRequest>().url().host(),
+                 QStringLiteral("b.example.com"));
+
+        // The hedged request completes the request, and the slow one is
+        // aborted
+        emit pHedgeReply->finished();
+        QVERIFY(TestData::checkError(getSpy.spy(), Error::Code::Success));
+        QCOMPARE(getSpy.spy()[0][1].value<QByteArray>(), TestData::success);
+        QVERIFY(slowDestroySpy.wait());
+    }
+
+    // Test the ordering of API bases by health
+    void testApiBaseHealth()
+    {
+        using namespace std::chrono_literals;
+        using Order = std::vector<unsigned>;
+
+        ApiBaseData data{{QStringLiteral("https://a.example.com/"),
+                          QStringLiteral("https://b.example.com/")}};
+        // Initially, use the bases in order
+        QCOMPARE(data.getAttemptOrder(), (Order{0, 1}));
+
+        // Bases that have responded are preferred, then faster ones
+        data.attemptSucceeded(1, 200ms);
+        QCOMPARE(data.getAttemptOrder(), (Order{1, 0}));
+        data.attemptSucceeded(0, 50ms);
+        QCOMPARE(data.getAttemptOrder(), (Order{0, 1}));
+
+        // Failures open the circuit breaker
+        data.attemptFailed(0);
+        data.attemptFailed(0);
+        QVERIFY(!data.inCooldown(0));
+        data.attemptFailed(0);
+        QVERIFY(data.inCooldown(0));
+        QCOMPARE(data.getAttemptOrder(), (Order{1, 0}));
+
+        // A response closes it, but the recent errors still count against
+        // the base
+        data.attemptResponded(0, 50ms);
+        QVERIFY(!data.inCooldown(0));
+        QCOMPARE(data.getAttemptOrder(), (Order{1, 0}));
+
+        // The hedge delay is the p95 response time, but not less than 250 ms
+        QCOMPARE(data.getHedgeDelay(), std::chrono::milliseconds{250});
+        data.attemptSucceeded(1, 1500ms);
+        QCOMPARE(data.getHedgeDelay(), std::chrono::milliseconds{1500});
+    }
 };
 
 QTEST_GUILESS_MAIN(tst_apiclient)
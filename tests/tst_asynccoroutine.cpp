@@ -0,0 +1,125 @@
+// Copyright (c) 2019 London Trust Media Incorporated
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#include <QtTest>
+
+#include "async.h"
+#include "asynccoroutine.h"
+
+// This test is built as C++20 (see tests.project.qbs), so the coroutine
+// support is always compiled and tested, even though the rest of the tree
+// doesn't use C++20 yet.
+#ifndef ASYNC_COROUTINES
+#error "tst_asynccoroutine must be built with C++20 coroutine support"
+#endif
+
+namespace coroutines {
+
+Async<int> addAfter(Async<int> input)
+{
+    int value = co_await input;
+    co_return value + 1;
+}
+
+Async<int> addTwice(Async<int> input)
+{
+    int value = co_await input;
+    value = co_await Async<int>::resolve(value + 1);
+    co_return value + 1;
+}
+
+Async<void> awaitVoid(Async<void> input)
+{
+    co_await input;
+}
+
+Async<int> catchRejection(Async<int> input)
+{
+    try
+    {
+        co_await input;
+    }
+    catch (const Error&)
+    {
+        co_return -1;
+    }
+    co_return 0;
+}
+
+}
+
+class tst_asynccoroutine : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void cleanup()
+    {
+        QTRY_VERIFY(BaseTask::getTaskCount() == 0);
+    }
+
+    void awaitPending()
+    {
+        auto source = Async<int>::create();
+        auto result = coroutines::addAfter(source);
+        QVERIFY(result->isPending());
+        source->resolve(5);
+        QVERIFY(result->isResolved());
+        QCOMPARE(result->result(), 6);
+
+        auto voidSource = Async<void>::create();
+        auto voidResult = coroutines::awaitVoid(voidSource);
+        QVERIFY(voidResult->isPending());
+        voidSource->resolve();
+        QVERIFY(voidResult->isResolved());
+    }
+    void awaitResolved()
+    {
+        // Nothing suspends, so the coroutine finishes before returning
+        auto result = coroutines::addTwice(Async<int>::resolve(1));
+        QVERIFY(result->isResolved());
+        QCOMPARE(result->result(), 3);
+    }
+    void rejection()
+    {
+        auto result = coroutines::addAfter(Async<int>::reject(UnknownError(HERE)));
+        QVERIFY(result->isRejected());
+        QCOMPARE(result->error().code(), Error::Unknown);
+
+        auto source = Async<int>::create();
+        auto caught = coroutines::catchRejection(source);
+        source->reject(Error(HERE, Error::TaskRejected));
+        QVERIFY(caught->isResolved());
+        QCOMPARE(caught->result(), -1);
+    }
+    void abandon()
+    {
+        auto source = Async<int>::create();
+        auto result = coroutines::addAfter(source);
+        QCOMPARE(BaseTask::getTaskCount(), 2);
+        // Abandoning the coroutine's task destroys the suspended coroutine
+        // and releases the task it was awaiting
+        result.abandon();
+        QCOMPARE(BaseTask::getTaskCount(), 1);
+        source.abandon();
+    }
+};
+
+QTEST_GUILESS_MAIN(tst_asynccoroutine)
+#include TEST_MOC
@@ -0,0 +1,149 @@
+// Copyright (c) 2019 London Trust Media Incorporated
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#include "bandwidthhistory.h"
+#include "bandwidthchart.h"
+#include <QtTest>
+#include <QSignalSpy>
+
+class tst_bandwidthhistory : public QObject
+{
+    Q_OBJECT
+
+private:
+    // Use a base timestamp that's on an hour boundary to keep the buckets
+    // simple
+    const qint64 baseTime{100 * 60 * 60 * 1000ll};
+
+private slots:
+    // Each measurement is a point in the measurements tier, old points are
+    // dropped at capacity
+    void testMeasurements()
+    {
+        BandwidthHistory history;
+        const std::size_t capacity = BandwidthHistory::capacity(BandwidthHistory::Measurements);
+        for(std::size_t i=0; i<capacity + 10; ++i)
+            history.append(baseTime + static_cast<qint64>(i) * 5000 + 250, i, i * 2);
+
+        QCOMPARE(history.size(BandwidthHistory::Measurements), capacity);
+        const auto &oldest = history.at(BandwidthHistory::Measurements, 0);
+        QCOMPARE(oldest.received, quint64{10});
+        QCOMPARE(oldest.sent, quint64{20});
+        // Each point keeps the time of its measurement
+        QCOMPARE(oldest.timestamp, baseTime + 10 * 5000 + 250);
+        const auto &newest = history.at(BandwidthHistory::Measurements, capacity-1);
+        QCOMPARE(newest.received, quint64{capacity + 9});
+        QVERIFY(newest.seq > oldest.seq);
+    }
+
+    // Minute and hour points are added when their bucket is complete
+    void testBuckets()
+    {
+        BandwidthHistory history;
+        // 2 minutes and 5 seconds of measurements, 5 seconds apart
+        for(int i=0; i<=25; ++i)
+            history.append(baseTime + i * 5000, 100, 10);
+
+        // Two complete minutes
+        QCOMPARE(history.size(BandwidthHistory::Minutes), std::size_t{2});
+        QCOMPARE(history.at(BandwidthHistory::Minutes, 0).timestamp, baseTime);
+        QCOMPARE(history.at(BandwidthHistory::Minutes, 0).received, quint64{1200});
+        QCOMPARE(history.at(BandwidthHistory::Minutes, 1).timestamp, baseTime + 60000);
+        QCOMPARE(history.at(BandwidthHistory::Minutes, 1).sent, quint64{120});
+        // The hour isn't complete yet
+        QCOMPARE(history.size(BandwidthHistory::Hours), std::size_t{0});
+
+        history.append(baseTime + 60 * 60 * 1000, 1, 1);
+        QCOMPARE(history.size(BandwidthHistory::Hours), std::size_t{1});
+        QCOMPARE(history.at(BandwidthHistory::Hours, 0).received, quint64{2600});
+    }
+
+    // toJson() only includes points after the given sequences
+    void testJsonDelta()
+    {
+        BandwidthHistory history;
+        history.append(baseTime, 1, 1);
+        history.append(baseTime + 5000, 2, 2);
+
+        QJsonObject all = history.toJson({});
+        QCOMPARE(all.value(QStringLiteral("measurements")).toArray().size(), 2);
+        QCOMPARE(all.value(QStringLiteral("minutes")).toArray().size(), 0);
+
+        auto sequences = history.lastSequences();
+        history.append(baseTime + 10000, 3, 3);
+        QJsonObject delta = history.toJson(sequences);
+        QJsonArray points = delta.value(QStringLiteral("measurements")).toArray();
+        QCOMPARE(points.size(), 1);
+        QCOMPARE(points[0].toObject().value(QStringLiteral("received")).toDouble(), 3.0);
+        QCOMPARE(delta.value(QStringLiteral("generation")).toDouble(), 0.0);
+    }
+
+    void testClear()
+    {
+        BandwidthHistory history;
+        history.append(baseTime, 1, 1);
+        auto lastSeq = history.lastSequences()[BandwidthHistory::Measurements];
+        history.clear();
+        QCOMPARE(history.generation(), quint64{1});
+        QCOMPARE(history.size(BandwidthHistory::Measurements), std::size_t{0});
+        history.append(baseTime + 5000, 1, 1);
+        // Sequence numbers aren't reused
+        QVERIFY(history.at(BandwidthHistory::Measurements, 0).seq > lastSeq);
+    }
+
+    // The client model appends new points, drops old ones, and tracks the
+    // maximum
+    void testTierModel()
+    {
+        BandwidthHistory history;
+        BandwidthTierModel model{3};
+        QSignalSpy insertSpy{&model, &BandwidthTierModel::rowsInserted};
+        QSignalSpy removeSpy{&model, &BandwidthTierModel::rowsRemoved};
+
+        const quint64 received[]{50, 10, 30, 20, 5};
+        BandwidthHistory::Sequences sent{};
+        for(int i=0; i<5; ++i)
+        {
+            history.append(baseTime + i * 5000, received[i], 0);
+            model.appendPoints(history.toJson(sent).value(QStringLiteral("measurements")).toArray());
+            sent = history.lastSequences();
+        }
+
+        QCOMPARE(insertSpy.size(), 5);
+        QCOMPARE(removeSpy.size(), 2);
+        QCOMPARE(model.count(), 3);
+        // 50 and 10 were dropped
+        QCOMPARE(model.maxReceived(), 30.0);
+        QCOMPARE(model.lastReceived(), 5.0);
+        QCOMPARE(model.data(model.index(0), BandwidthTierModel::ReceivedRole).toDouble(), 30.0);
+
+        // Resending the whole history doesn't duplicate points
+        model.appendPoints(history.toJson({}).value(QStringLiteral("measurements")).toArray());
+        QCOMPARE(insertSpy.size(), 5);
+        QCOMPARE(model.count(), 3);
+
+        model.clear();
+        QCOMPARE(model.count(), 0);
+        QCOMPARE(model.maxReceived(), 0.0);
+        QCOMPARE(model.lastReceived(), 0.0);
+    }
+};
+
+QTEST_GUILESS_MAIN(tst_bandwidthhistory)
+#include TEST_MOC
@@ -0,0 +1,120 @@
+// Copyright (c) 2019 London Trust Media Incorporated
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common/src/builtin/binarylog.h"
+#include <QtTest>
+
+class tst_binarylog : public QObject
+{
+    Q_OBJECT
+
+private:
+    qint64 testTime(const QString &time)
+    {
+        return QDateTime::fromString(time, Qt::ISODateWithMs).toMSecsSinceEpoch();
+    }
+
+private slots:
+    // Encode a few messages and verify they decode to the text log format
+    void roundTrip()
+    {
+        BinaryLogEncoder encoder;
+        QByteArray data{BinaryLog::fileMagic};
+        encoder.startSession(data, testTime("2019-01-02T03:04:05.000Z"), "1.0.0");
+
+        QCOMPARE(encoder.findSite("daemon", "src/daemon.cpp", 42), -1);
+        int daemonSite = encoder.defineSite(data, "daemon", "src/daemon.cpp", 42, "daemon.cpp");
+        QCOMPARE(encoder.findSite("daemon", "src/daemon.cpp", 42), daemonSite);
+        // Same category, different line - new site, same category
+        int otherSite = encoder.defineSite(data, "daemon", "src/daemon.cpp", 50, "daemon.cpp");
+        QVERIFY(otherSite != daemonSite);
+        // No category or file
+        int emptySite = encoder.defineSite(data, "", "", 0, {});
+
+        encoder.appendMessage(data, daemonSite, testTime("2019-01-02T03:04:05.678Z"),
+                              QtInfoMsg, 0xab, QStringLiteral("hello"));
+        // Multiple lines are rendered with the prefix on each line
+        encoder.appendMessage(data, otherSite, testTime("2019-01-02T03:04:06.001Z"),
+                              QtWarningMsg, 0x1234, QStringLiteral("first\nsecond"));
+        // Clock going backward is preserved
+        encoder.appendMessage(data, emptySite, testTime("2019-01-02T03:04:04.500Z"),
+                              QtDebugMsg, 0, QString::fromUtf8(u8"ünicode"));
+
+        QByteArray text;
+        QVERIFY(BinaryLogDecoder::decode(data, text));
+        QCOMPARE(QString::fromUtf8(text), QString::fromUtf8(
+            "[2019-01-02 03:04:05.678][00ab][daemon][daemon.cpp:42][info] hello\n"
+            "[2019-01-02 03:04:06.001][1234][daemon][daemon.cpp:50][warning] first\n"
+            "[2019-01-02 03:04:06.001][1234][daemon][daemon.cpp:50][warning] second\n"
+            u8"[2019-01-02 03:04:04.500][0000][debug] ünicode\n"));
+    }
+
+    // Sessions reset sites and are separated like text log sessions
+    void sessions()
+    {
+        BinaryLogEncoder encoder;
+        QByteArray data{BinaryLog::fileMagic};
+        encoder.startSession(data, testTime("2019-01-02T03:04:05.000Z"), "1.0.0");
+        int site = encoder.defineSite(data, "a", "a.cpp", 1, "a.cpp");
+        encoder.appendMessage(data, site, testTime("2019-01-02T03:04:05.000Z"),
+                              QtInfoMsg, 1, QStringLiteral("one"));
+
+        encoder.startSession(data, testTime("2019-01-03T00:00:00.000Z"), "1.0.0");
+        QCOMPARE(encoder.findSite("a", "a.cpp", 1), -1);
+        site = encoder.defineSite(data, "b", "b.cpp", 2, "b.cpp");
+        encoder.appendMessage(data, site, testTime("2019-01-03T00:00:00.250Z"),
+                              QtInfoMsg, 1, QStringLiteral("two"));
+
+        QByteArray text;
+        QVERIFY(BinaryLogDecoder::decode(data, text));
+        QCOMPARE(text, QByteArray{
+            "[2019-01-02 03:04:05.000][0001][a][a.cpp:1][info] one\n"
+            "\n\n\n"
+            "[2019-01-03 00:00:00.250][0001][b][b.cpp:2][info] two\n"});
+    }
+
+    // Truncated data decodes up to the last complete record
+    void truncated()
+    {
+        BinaryLogEncoder encoder;
+        QByteArray data{BinaryLog::fileMagic};
+        encoder.startSession(data, testTime("2019-01-02T03:04:05.000Z"), "1.0.0");
+        int site = encoder.defineSite(data, "a", "a.cpp", 1, "a.cpp");
+        encoder.appendMessage(data, site, testTime("2019-01-02T03:04:05.000Z"),
+                              QtInfoMsg, 1, QStringLiteral("complete"));
+        int completeSize = data.size();
+        encoder.appendMessage(data, site, testTime("2019-01-02T03:04:05.000Z"),
+                              QtInfoMsg, 1, QStringLiteral("incomplete"));
+
+        QByteArray text;
+        QVERIFY(!BinaryLogDecoder::decode(data.left(data.size() - 3), text));
+        QCOMPARE(text, QByteArray{"[2019-01-02 03:04:05.000][0001][a][a.cpp:1][info] complete\n"});
+
+        text.clear();
+        QVERIFY(BinaryLogDecoder::decode(data.left(completeSize), text));
+
+        // Text logs aren't binary logs
+        QVERIFY(!BinaryLog::isBinaryLog("[2019-01-02 03:04:05.000][0001]"));
+        text.clear();
+        QVERIFY(!BinaryLogDecoder::decode("[2019-01-02 03:04:05.000][0001]", text));
+        QVERIFY(text.isEmpty());
+    }
+};
+
+QTEST_GUILESS_MAIN(tst_binarylog)
+#include TEST_MOC
@@ -0,0 +1,181 @@
+// Copyright (c) 2019 London Trust Media Incorporated
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "daemon/src/deltapatch.h"
+#include <QtTest>
+#include <QTemporaryDir>
+
+namespace
+{
+    void appendU64(QByteArray &delta, quint64 value)
+    {
+        char bytes[sizeof(value)];
+        qToLittleEndian(value, bytes);
+        delta.append(bytes, sizeof(bytes));
+    }
+
+    QByteArray deltaHeader(quint64 targetSize)
+    {
+        QByteArray delta{DeltaPatch::magic};
+        appendU64(delta, targetSize);
+        return delta;
+    }
+
+    void appendCopy(QByteArray &delta, quint64 offset, quint64 length)
+    {
+        delta.append(static_cast<char>(DeltaPatch::Copy));
+        appendU64(delta, offset);
+        appendU64(delta, length);
+    }
+
+    void appendInsert(QByteArray &delta, const QByteArray &data)
+    {
+        delta.append(static_cast<char>(DeltaPatch::Insert));
+        appendU64(delta, static_cast<quint64>(data.size()));
+        delta.append(data);
+    }
+
+    void appendEnd(QByteArray &delta)
+    {
+        delta.append(static_cast<char>(DeltaPatch::End));
+    }
+
+    QByteArray sha256Hex(const QByteArray &data)
+    {
+        return QCryptographicHash::hash(data, QCryptographicHash::Sha256).toHex();
+    }
+}
+
+class tst_deltapatch : public QObject
+{
+    Q_OBJECT
+
+private:
+    QTemporaryDir _dir;
+    QByteArray _base;
+
+    QString writeFile(const QString &name, const QByteArray &content)
+    {
+        QString path = _dir.filePath(name);
+        QFile file{path};
+        if(!file.open(QIODevice::WriteOnly) || file.write(content) != content.size())
+            return {};
+        return path;
+    }
+
+    QByteArray readFile(const QString &path)
+    {
+        QFile file{path};
+        if(!file.open(QIODevice::ReadOnly))
+            return {};
+        return file.readAll();
+    }
+
+    bool applyDelta(const QByteArray &delta, const QByteArray &expectedSha256)
+    {
+        QString basePath = writeFile(QStringLiteral("base"), _base);
+        QString deltaPath = writeFile(QStringLiteral("delta"), delta);
+        return DeltaPatch::apply(basePath, deltaPath, targetPath(), expectedSha256);
+    }
+
+    QString targetPath() const {return _dir.filePath(QStringLiteral("target"));}
+
+private slots:
+    void init()
+    {
+        // Base file larger than the copy chunk size
+        _base.clear();
+        for(int i = 0; i < 100000; ++i)
+            _base.append(static_cast<char>(i * 7 % 251));
+        QFile::remove(targetPath());
+    }
+
+    // Copies and inserts reconstruct the target
+    void reconstruct()
+    {
+        QByteArray expected = _base.mid(90000, 10000) + QByteArrayLiteral("new data") +
+            _base.mid(0, 70000);
+        QByteArray delta = deltaHeader(static_cast<quint64>(expected.size()));
+        appendCopy(delta, 90000, 10000);
+        appendInsert(delta, QByteArrayLiteral("new data"));
+        appendCopy(delta, 0, 70000);
+        appendEnd(delta);
+
+        QVERIFY(applyDelta(delta, sha256Hex(expected)));
+        QCOMPARE(readFile(targetPath()), expected);
+    }
+
+    // A result with the wrong hash fails and is removed
+    void hashMismatch()
+    {
+        QByteArray delta = deltaHeader(10);
+        appendCopy(delta, 0, 10);
+        appendEnd(delta);
+
+        QVERIFY(!applyDelta(delta, sha256Hex(QByteArrayLiteral("0123456789"))));
+        QVERIFY(!QFile::exists(targetPath()));
+    }
+
+    // Malformed deltas fail
+    void invalidDeltas()
+    {
+        QByteArray expected = _base.left(10);
+        QByteArray expectedHash = sha256Hex(expected);
+
+        // Bad magic
+        QByteArray badMagic = deltaHeader(10);
+        badMagic[0] = 'X';
+        appendCopy(badMagic, 0, 10);
+        appendEnd(badMagic);
+        QVERIFY(!applyDelta(badMagic, expectedHash));
+
+        // Missing END
+        QByteArray noEnd = deltaHeader(10);
+        appendCopy(noEnd, 0, 10);
+        QVERIFY(!applyDelta(noEnd, expectedHash));
+
+        // Copy past the end of the base
+        QByteArray pastEnd = deltaHeader(10);
+        appendCopy(pastEnd, static_cast<quint64>(_base.size()) - 5, 10);
+        appendEnd(pastEnd);
+        QVERIFY(!applyDelta(pastEnd, expectedHash));
+
+        // Output larger than the target size
+        QByteArray tooLong = deltaHeader(10);
+        appendCopy(tooLong, 0, 10);
+        appendInsert(tooLong, QByteArrayLiteral("x"));
+        appendEnd(tooLong);
+        QVERIFY(!applyDelta(tooLong, expectedHash));
+
+        // Truncated insert
+        QByteArray truncated = deltaHeader(10);
+        appendInsert(truncated, expected);
+        truncated.chop(3);
+        QVERIFY(!applyDelta(truncated, expectedHash));
+
+        // Unknown opcode
+        QByteArray unknown = deltaHeader(10);
+        unknown.append('\x7f');
+        QVERIFY(!applyDelta(unknown, expectedHash));
+
+        QVERIFY(!QFile::exists(targetPath()));
+    }
+};
+
+QTEST_GUILESS_MAIN(tst_deltapatch)
+#include TEST_MOC
@@ -19,6 +19,7 @@
 #include "daemon/src/updatedownloader.h"
 #include "testshim.h"
 #include "src/mocknetwork.h"
+#include "workerpool.h"
 #include <QtTest>
 
 /*
@@ -107,6 +108,104 @@ private slots:
         QVERIFY(fetchSpy.empty());
         QVERIFY(!fetchSpy.wait(1000));
     }
+
+    // Test that refreshes are conditional once content has been loaded, and
+    // that unchanged content is not emitted again.
+    void testConditionalRefresh()
+    {
+        TestRefresher refresher;
+        QSignalSpy fetchSpy{&refresher, &JsonRefresher::contentLoaded};
+        QSignalSpy validatorSpy{&refresher, &JsonRefresher::validatorChanged};
+        QSignalSpy consumeSpy{&MockNetworkManager::_replyConsumed, &ReplyConsumedSignal::signal};
+
+        // Initial load - not conditional
+        auto pReply = MockNetworkManager::enqueueReply(TestData::successJson);
+        pReply->setReplyHeader("ETag", "\"v1\"");
+        refresher.start();
+        QVERIFY(consumeSpy.wait(100));
+        QVERIFY(!consumeSpy.last()[0].value<QNetworkRequest>().hasRawHeader("If-None-Match"));
+        pReply->finished();
+        QTRY_COMPARE(fetchSpy.size(), 1);
+        // The validator is only kept once the content is accepted
+        QVERIFY(validatorSpy.empty());
+        refresher.loadSucceeded();
+        QCOMPARE(validatorSpy.size(), 1);
+        QCOMPARE(refresher.validator().value(QStringLiteral("etag")).toString(),
+                 QStringLiteral("\"v1\""));
+
+        // Not modified - nothing is emitted
+        auto pNotModified = MockNetworkManager::enqueueReply();
+        refresher.refresh();
+        QVERIFY(consumeSpy.wait(100));
+        QCOMPARE(consumeSpy.last()[0].value<QNetworkRequest>().rawHeader("If-None-Match"),
+                 QByteArrayLiteral("\"v1\""));
+        pNotModified->finishNotModified();
+        QTRY_VERIFY(!refresher._pFetchTask);
+        QCOMPARE(fetchSpy.size(), 1);
+        QCOMPARE(validatorSpy.size(), 1);
+
+        // Identical content with a new ETag - not emitted, but the new ETag
+        // is kept
+        pReply = MockNetworkManager::enqueueReply(TestData::successJson);
+        pReply->setReplyHeader("ETag", "\"v2\"");
+        refresher.refresh();
+        QVERIFY(consumeSpy.wait(100));
+        pReply->finished();
+        QTRY_COMPARE(validatorSpy.size(), 2);
+        QCOMPARE(fetchSpy.size(), 1);
+        QCOMPARE(refresher.validator().value(QStringLiteral("etag")).toString(),
+                 QStringLiteral("\"v2\""));
+
+        // Changed content is emitted
+        pReply = MockNetworkManager::enqueueReply(R"({"unit_test":false})");
+        refresher.refresh();
+        QVERIFY(consumeSpy.wait(100));
+        pReply->finished();
+        QTRY_COMPARE(fetchSpy.size(), 2);
+    }
+
+    // Test verifying replies on a WorkerPool - the content is emitted
+    // asynchronously, and not at all if the refresher is stopped first.
+    void testVerifyOnWorkerPool()
+    {
+        WorkerPool pool{1};
+        TestRefresher refresher;
+        refresher.setWorkerPool(&pool);
+        QSignalSpy fetchSpy{&refresher, &JsonRefresher::contentLoaded};
+        QSignalSpy consumeSpy{&MockNetworkManager::_replyConsumed, &ReplyConsumedSignal::signal};
+
+        // Initial data are still verified synchronously
+        refresher.start(TestData::successJson);
+        QCOMPARE(fetchSpy.size(), 1);
+        QCOMPARE(pool.metrics(WorkerPool::NormalPriority).submitted, quint64{0});
+        refresher.stop();
+
+        auto pReply = MockNetworkManager::enqueueReply(R"({"unit_test":false})");
+        refresher.start();
+        QVERIFY(consumeSpy.wait(100));
+        pReply->finished();
+        QTRY_COMPARE(fetchSpy.size(), 2);
+        QCOMPARE(fetchSpy.last()[0].value<QJsonDocument>(),
+                 QJsonDocument::fromJson(R"({"unit_test":false})"));
+        QCOMPARE(pool.metrics(WorkerPool::NormalPriority).submitted, quint64{1});
+        QVERIFY(!refresher._pVerifyTask);
+
+        // Stop while the reply is waiting to be verified - it's not emitted.
+        // Keep the pool's only worker busy so the verification can't start.
+        QSemaphore workerBusy;
+        auto pBusyJob = pool.run([&workerBusy](){workerBusy.tryAcquire(1, 5000);});
+        pReply = MockNetworkManager::enqueueReply(R"({"unit_test":1})");
+        refresher.refresh();
+        QVERIFY(consumeSpy.wait(100));
+        pReply->finished();
+        QTRY_VERIFY(refresher._pVerifyTask);
+        refresher.stop();
+        QVERIFY(!refresher._pVerifyTask);
+        workerBusy.release();
+        QTRY_COMPARE(pool.metrics(WorkerPool::NormalPriority).canceled, quint64{1});
+        QVERIFY(!fetchSpy.wait(200));
+        QCOMPARE(fetchSpy.size(), 2);
+    }
 };
 
 QTEST_GUILESS_MAIN(tst_jsonrefresher)
@@ -249,7 +249,7 @@ private slots:
         //Watch for pings to be sent to all of the mock servers
         QSignalSpy pingSpy{&_mockServers, &MockPingServers::receivedPing};
 
-        tracker.updateLocations(_mockServers.mockServerList());
+        tracker.updateLocations(std::make_shared<const LocationTable>(_mockServers.mockServerList()));
 
         auto pendingServers = _mockServers.getServerAddresses();
         //Wait for a packet to be emitted for each server.  Note that
@@ -302,7 +302,7 @@ private slots:
 
             //Wait for all of the measurements to be emitted
             QSignalSpy initialLatencySpy{&splitter, &MeasurementSplitter::newMeasurement};
-            tracker.updateLocations(initialLocations);
+            tracker.updateLocations(std::make_shared<const LocationTable>(initialLocations));
             while(initialLatencySpy.size() < MockPingServerCount-1)
                 QVERIFY(initialLatencySpy.wait());
         }
@@ -314,7 +314,7 @@ private slots:
         updatedLocations.remove(QStringLiteral("mock-server-1"));
 
         QSignalSpy pingSpy{&_mockServers, &MockPingServers::receivedPing};
-        tracker.updateLocations(updatedLocations);
+        tracker.updateLocations(std::make_shared<const LocationTable>(updatedLocations));
         QVERIFY(pingSpy.wait());
         const auto &receivedPing = pingSpy.front()[0].value<ReceivedPing>();
         QCOMPARE(receivedPing.getLocationId(), QStringLiteral("mock-server-0"));
@@ -336,7 +336,7 @@ private slots:
         QSignalSpy pingSpy{&_mockServers, &MockPingServers::receivedPing};
         QSignalSpy measurementSpy{&splitter, &MeasurementSplitter::newMeasurement};
 
-        tracker.updateLocations(_mockServers.mockServerList());
+        tracker.updateLocations(std::make_shared<const LocationTable>(_mockServers.mockServerList()));
 
         //This wait *should* time out - we don't expect pings to happen yet.
         //We need to enter a message loop here to be sure, otherwise the events
@@ -370,7 +370,7 @@ private slots:
         auto initialLocations = _mockServers.mockServerList();
         //Delete a location
         initialLocations.remove(QStringLiteral("mock-server-0"));
-        tracker.updateLocations(initialLocations);
+        tracker.updateLocations(std::make_shared<const LocationTable>(initialLocations));
 
         //Expect 3 measurements
         while(measurementSpy.size() < MockPingServerCount-1)
@@ -380,8 +380,8 @@ private slots:
         //Stop measurements
         tracker.stop();
         //Add and delete the other location
-        tracker.updateLocations(_mockServers.mockServerList());
-        tracker.updateLocations(initialLocations);
+        tracker.updateLocations(std::make_shared<const LocationTable>(_mockServers.mockServerList()));
+        tracker.updateLocations(std::make_shared<const LocationTable>(initialLocations));
 
         //Start notifications again.  We don't expect to get any pings or
         //measurements, so this wait *should* time out
@@ -0,0 +1,136 @@
+// Copyright (c) 2019 London Trust Media Incorporated
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#include "linux/linux_appscanner.h"
+#include <QtTest>
+
+class tst_linux_appscanner : public QObject
+{
+    Q_OBJECT
+
+private:
+    LinuxDesktopEntry parse(const char *data, const QStringList &locales = {})
+    {
+        LinuxDesktopEntry entry;
+        if(!parseLinuxDesktopEntry(data, locales, entry))
+            return {};
+        return entry;
+    }
+
+private slots:
+    void testParse()
+    {
+        LinuxDesktopEntry entry = parse(
+            "# Comment\n"
+            "[Desktop Entry]\n"
+            "Type=Application\n"
+            "Name=Text Editor\n"
+            "Icon=org.example.Editor\n"
+            "Exec=editor --new-window %U\n"
+            "\n"
+            "[Desktop Action new-window]\n"
+            "Name=New Window\n"
+            "Exec=editor --other\n");
+        QVERIFY(entry.visible);
+        QCOMPARE(entry.name, QStringLiteral("Text Editor"));
+        QCOMPARE(entry.icon, QStringLiteral("org.example.Editor"));
+        QCOMPARE(entry.exec, QStringLiteral("editor --new-window %U"));
+
+        LinuxDesktopEntry invalid;
+        QVERIFY(!parseLinuxDesktopEntry("Name=Nothing\n", {}, invalid));
+    }
+
+    void testLocalizedName()
+    {
+        const char data[] =
+            "[Desktop Entry]\n"
+            "Type=Application\n"
+            "Name=Files\n"
+            "Name[de]=Dateien\n"
+            "Name[pt_BR]=Arquivos\n"
+            "Exec=files\n";
+        QCOMPARE(parse(data).name, QStringLiteral("Files"));
+        QCOMPARE(parse(data, {QStringLiteral("de_DE"), QStringLiteral("de")}).name,
+                 QStringLiteral("Dateien"));
+        QCOMPARE(parse(data, {QStringLiteral("pt_BR"), QStringLiteral("pt")}).name,
+                 QStringLiteral("Arquivos"));
+        QCOMPARE(parse(data, {QStringLiteral("fr_FR"), QStringLiteral("fr")}).name,
+                 QStringLiteral("Files"));
+    }
+
+    void testHidden()
+    {
+        QVERIFY(!parse("[Desktop Entry]\nType=Application\nName=A\nExec=a\nNoDisplay=true\n").visible);
+        QVERIFY(!parse("[Desktop Entry]\nType=Application\nName=A\nExec=a\nHidden=true\n").visible);
+        QVERIFY(!parse("[Desktop Entry]\nType=Link\nName=A\nURL=https://example.com\n").visible);
+        QVERIFY(!parse("[Desktop Entry]\nType=Application\nName=A\n").visible);
+        QVERIFY(parse("[Desktop Entry]\nType=Application\nName=A\nExec=a\nNoDisplay=false\n").visible);
+    }
+
+    void testSplitExec()
+    {
+        QCOMPARE(splitLinuxDesktopExec(QStringLiteral("app --flag %f")),
+                 (QStringList{QStringLiteral("app"), QStringLiteral("--flag")}));
+        QCOMPARE(splitLinuxDesktopExec(QStringLiteral("\"/opt/My App/app\" --name=\"a \\\"b\\\"\"")),
+                 (QStringList{QStringLiteral("/opt/My App/app"), QStringLiteral("--name=a \"b\"")}));
+        QCOMPARE(splitLinuxDesktopExec(QStringLiteral("app 100%% --file=%u")),
+                 (QStringList{QStringLiteral("app"), QStringLiteral("100%"), QStringLiteral("--file=")}));
+        QCOMPARE(splitLinuxDesktopExec(QStringLiteral("app \"\"")),
+                 (QStringList{QStringLiteral("app"), QString{}}));
+        QCOMPARE(splitLinuxDesktopExec(QStringLiteral("  ")), QStringList{});
+    }
+
+    void testResolveExec()
+    {
+        QString ls = QFileInfo{QStringLiteral("/bin/ls")}.canonicalFilePath();
+        if(ls.isEmpty())
+            QSKIP("/bin/ls not found");
+
+        QCOMPARE(resolveLinuxDesktopExec(QStringLiteral("/bin/ls %F")), ls);
+        QCOMPARE(resolveLinuxDesktopExec(QStringLiteral("env LANG=C -u FOO /bin/ls")), ls);
+        // Launchers can't be matched to the app they run
+        QCOMPARE(resolveLinuxDesktopExec(QStringLiteral("env FOO=1 sh -c app")), QString{});
+        QCOMPARE(resolveLinuxDesktopExec(QStringLiteral("/nonexistent/app")), QString{});
+        QCOMPARE(resolveLinuxDesktopExec(QStringLiteral("relative/app")), QString{});
+        QCOMPARE(resolveLinuxDesktopExec(QStringLiteral("env")), QString{});
+    }
+
+    void testEntryJson()
+    {
+        LinuxDesktopEntry entry = parse("[Desktop Entry]\nType=Application\nName=A\nExec=a\nIcon=a-icon\n");
+        entry.filePath = QStringLiteral("/usr/share/applications/a.desktop");
+        entry.modified = 1577836800000;
+        entry.size = 64;
+        entry.target = QStringLiteral("/usr/bin/a");
+
+        LinuxDesktopEntry loaded = LinuxDesktopEntry::fromJsonObject(entry.toJsonObject());
+        QCOMPARE(loaded.filePath, entry.filePath);
+        QCOMPARE(loaded.modified, entry.modified);
+        QCOMPARE(loaded.size, entry.size);
+        QCOMPARE(loaded.visible, entry.visible);
+        QCOMPARE(loaded.name, entry.name);
+        QCOMPARE(loaded.icon, entry.icon);
+        QCOMPARE(loaded.exec, entry.exec);
+        // The target is resolved on each scan, never loaded from the cache
+        QCOMPARE(loaded.target, QString{});
+    }
+};
+
+QTEST_GUILESS_MAIN(tst_linux_appscanner)
+#include TEST_MOC
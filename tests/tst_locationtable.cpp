@@ -0,0 +1,226 @@
+// Copyright (c) 2019 London Trust Media Incorporated
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#include "locationtable.h"
+#include <QtTest>
+#include <QThread>
+
+namespace locationtable_docs {
+
+QByteArray location(const QByteArray &id, const QByteArray &country,
+                    const QByteArray &ip, bool portForward)
+{
+    return "\"" + id + "\":{"
+        "\"name\":\"" + id + " name\","
+        "\"country\":\"" + country + "\","
+        "\"dns\":\"" + id + ".privateinternetaccess.com\","
+        "\"port_forward\":" + (portForward ? "true" : "false") + ","
+        "\"ping\":\"" + ip + ":8888\","
+        "\"openvpn_udp\":{\"best\":\"" + ip + ":8080\"},"
+        "\"openvpn_tcp\":{\"best\":\"" + ip + ":500\"}}";
+}
+
+const QByteArray servers = "{" +
+    location("us_east", "US", "10.0.0.1", false) + "," +
+    location("us_west", "US", "10.0.0.2", false) + "," +
+    location("ca", "CA", "10.0.0.3", true) + "," +
+    location("de", "DE", "10.0.0.4", true) + "," +
+    "\"info\":{\"auto_regions\":[\"us_east\",\"us_west\",\"ca\"]}}";
+
+}
+
+class tst_locationtable : public QObject
+{
+    Q_OBJECT
+
+private:
+    ServerLocations buildLocations()
+    {
+        ServerLocations locations{updateServerLocations({}, locationtable_docs::servers)};
+        locations.value(QStringLiteral("us_east"))->latency(40.0);
+        locations.value(QStringLiteral("us_west"))->latency(90.0);
+        locations.value(QStringLiteral("ca"))->latency(60.0);
+        locations.value(QStringLiteral("de"))->latency(20.0);
+        return locations;
+    }
+
+private slots:
+    void testFields()
+    {
+        ServerLocations locations{buildLocations()};
+        LocationTable table{locations};
+        QCOMPARE(table.size(), std::size_t{4});
+
+        LocationTable::Row caRow = table.find(QStringLiteral("ca"));
+        QVERIFY(caRow != LocationTable::InvalidRow);
+        QCOMPARE(table.id(caRow), QStringLiteral("ca"));
+        QCOMPARE(table.name(caRow), QStringLiteral("ca name"));
+        QCOMPARE(table.country(caRow), QStringLiteral("CA"));
+        QCOMPARE(table.ping(caRow), QStringLiteral("10.0.0.3:8888"));
+        QCOMPARE(table.openvpnUDP(caRow), QStringLiteral("10.0.0.3:8080"));
+        QCOMPARE(table.openvpnTCP(caRow), QStringLiteral("10.0.0.3:500"));
+        QCOMPARE(table.serial(caRow), QString{});
+        QCOMPARE(table.portForward(caRow), true);
+        QCOMPARE(table.isSafeForAutoConnect(caRow), true);
+        QCOMPARE(table.hasShadowsocks(caRow), false);
+        QCOMPARE(table.latency(caRow).get(), 60.0);
+
+        QCOMPARE(table.find(QStringLiteral("nowhere")), LocationTable::Row{LocationTable::InvalidRow});
+
+        // "US", "CA", "DE", and the empty serial are each stored once
+        QVERIFY(table.uniqueStrings() < table.size() * 8);
+        QVERIFY(table.memoryUsage() > table.versionMemoryUsage());
+        QVERIFY(LocationTable::estimateObjectMemory(locations) > 0);
+    }
+
+    // The nearest order and queries match NearestLocations
+    void testNearest()
+    {
+        ServerLocations locations{buildLocations()};
+        LocationTable table{locations};
+        NearestLocations nearest{locations};
+
+        QStringList tableOrder;
+        for(auto row : table.nearestRows())
+            tableOrder.push_back(table.id(row));
+        QCOMPARE(tableOrder, (QStringList{QStringLiteral("de"), QStringLiteral("us_east"),
+                                          QStringLiteral("ca"), QStringLiteral("us_west")}));
+
+        // 'de' is nearest, but it's not safe for auto
+        QCOMPARE(table.id(table.nearestSafeVpnRow(false)),
+                 nearest.getNearestSafeVpnLocation(false)->id());
+        QCOMPARE(table.id(table.nearestSafeVpnRow(false)), QStringLiteral("us_east"));
+        QCOMPARE(table.id(table.nearestSafeVpnRow(true)),
+                 nearest.getNearestSafeVpnLocation(true)->id());
+        QCOMPARE(table.id(table.nearestSafeVpnRow(true)), QStringLiteral("ca"));
+
+        // No Shadowsocks locations
+        QCOMPARE(table.nearestSafeShadowsocksRow(), LocationTable::Row{LocationTable::InvalidRow});
+
+        LocationTable empty{ServerLocations{}};
+        QCOMPARE(empty.nearestSafeVpnRow(false), LocationTable::Row{LocationTable::InvalidRow});
+    }
+
+    // Latency changes are published as a new version that shares the rows,
+    // and the nearest order still matches NearestLocations
+    void testUpdate()
+    {
+        ServerLocations locations{buildLocations()};
+        LocationTable table{locations};
+        LocationTable::Row westRow = table.find(QStringLiteral("us_west"));
+
+        locations.value(QStringLiteral("us_west"))->latency(10.0);
+        locations.value(QStringLiteral("de"))->latency({});
+        // Locations that aren't in the table are ignored
+        QSharedPointer<ServerLocation> pNew{new ServerLocation{}};
+        pNew->id(QStringLiteral("new"));
+        pNew->latency(1.0);
+        locations.insert(pNew->id(), pNew);
+        auto pUpdated = table.update(locations);
+
+        QVERIFY(pUpdated->sharesRows(table));
+        QCOMPARE(pUpdated->size(), std::size_t{4});
+        QCOMPARE(pUpdated->find(QStringLiteral("us_west")), westRow);
+        QCOMPARE(pUpdated->latency(westRow).get(), 10.0);
+        QVERIFY(!pUpdated->latency(pUpdated->find(QStringLiteral("de"))));
+        // The original version is unchanged
+        QCOMPARE(table.latency(westRow).get(), 90.0);
+
+        QStringList tableOrder;
+        for(auto row : pUpdated->nearestRows())
+            tableOrder.push_back(pUpdated->id(row));
+        QCOMPARE(tableOrder, (QStringList{QStringLiteral("us_west"), QStringLiteral("us_east"),
+                                          QStringLiteral("ca"), QStringLiteral("de")}));
+
+        NearestLocations nearest{locations};
+        QCOMPARE(pUpdated->id(pUpdated->nearestSafeVpnRow(true)),
+                 nearest.getNearestSafeVpnLocation(true)->id());
+    }
+
+    // A snapshot taken by another thread is unaffected by publishing a new
+    // table
+    void testPublish()
+    {
+        auto pTable = std::make_shared<const LocationTable>(buildLocations());
+        LocationTable::publish(pTable);
+
+        std::shared_ptr<const LocationTable> pSnapshot;
+        std::unique_ptr<QThread> pReader{QThread::create([&pSnapshot]()
+        {
+            pSnapshot = LocationTable::current();
+        })};
+        pReader->start();
+        QVERIFY(pReader->wait());
+        QVERIFY(pSnapshot == pTable);
+
+        LocationTable::publish(std::make_shared<const LocationTable>());
+        QVERIFY(LocationTable::current()->empty());
+        QCOMPARE(pSnapshot->size(), std::size_t{4});
+    }
+
+    // Grouping from the table's nearest order gives the same countries and
+    // order as sorting the locations
+    void testGroupedLocations()
+    {
+        ServerLocations locations{buildLocations()};
+        LocationTable table{locations};
+        QVector<CountryLocations> countries{buildGroupedLocations(table, locations)};
+
+        QStringList groupedIds;
+        for(const auto &country : countries)
+        {
+            groupedIds.push_back(QStringLiteral("|"));
+            for(const auto &pLocation : country.locations())
+                groupedIds.push_back(pLocation->id());
+        }
+        // 'de' is nearest, then the US (nearest 'us_east'), then CA
+        QCOMPARE(groupedIds, (QStringList{QStringLiteral("|"), QStringLiteral("de"),
+                                          QStringLiteral("|"), QStringLiteral("us_east"),
+                                          QStringLiteral("us_west"),
+                                          QStringLiteral("|"), QStringLiteral("ca")}));
+    }
+
+    // Only the locations whose Shadowsocks servers change are copied
+    void testShadowsocksLocations()
+    {
+        ServerLocations locations{buildLocations()};
+        LocationTable table{locations};
+        const QJsonObject ssObj = QJsonDocument::fromJson(R"({"ca":{"host":"10.0.1.3","port":443,"key":"k","cipher":"c"}})").object();
+
+        ServerLocations ssLocations{updateShadowsocksLocations(locations, table, ssObj)};
+        QCOMPARE(ssLocations.size(), locations.size());
+        QVERIFY(ssLocations.value(QStringLiteral("ca")) != locations.value(QStringLiteral("ca")));
+        QCOMPARE(ssLocations.value(QStringLiteral("ca"))->shadowsocks()->host(),
+                 QStringLiteral("10.0.1.3"));
+        QVERIFY(!locations.value(QStringLiteral("ca"))->shadowsocks());
+        QVERIFY(ssLocations.value(QStringLiteral("de")) == locations.value(QStringLiteral("de")));
+
+        // Removing the Shadowsocks server copies 'ca' again, using a table
+        // that describes the new locations
+        auto pSsTable = table.update(ssLocations);
+        QVERIFY(pSsTable->hasShadowsocks(pSsTable->find(QStringLiteral("ca"))));
+        ServerLocations noSsLocations{updateShadowsocksLocations(ssLocations, *pSsTable, {})};
+        QVERIFY(!noSsLocations.value(QStringLiteral("ca"))->shadowsocks());
+        QVERIFY(ssLocations.value(QStringLiteral("ca"))->shadowsocks());
+        QVERIFY(noSsLocations.value(QStringLiteral("us_east")) == locations.value(QStringLiteral("us_east")));
+    }
+};
+
+QTEST_GUILESS_MAIN(tst_locationtable)
+#include TEST_MOC
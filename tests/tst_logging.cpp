@@ -0,0 +1,241 @@
+// Copyright (c) 2019 London Trust Media Incorporated
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#include <QtTest>
+#include <QTemporaryDir>
+
+#include "common/src/builtin/logging.h"
+#include "path.h"
+
+#include <QRandomGenerator>
+#include <limits>
+#include <thread>
+#include <vector>
+
+class tst_logging : public QObject
+{
+    Q_OBJECT
+
+private:
+    QTemporaryDir _logDir;
+    Path _logFilePath;
+    Path _savedDebugFile;
+    Logger *_pLogger{nullptr};
+
+    qint64 logSize() const {return QFileInfo{_logFilePath}.size();}
+
+    // Read the lines written to the log file since 'from'
+    QStringList readLog(qint64 from) const
+    {
+        QFile logFile{_logFilePath};
+        if(!logFile.open(QFile::ReadOnly) || !logFile.seek(from))
+            return {};
+        return QString::fromUtf8(logFile.readAll()).split('\n', QString::SkipEmptyParts);
+    }
+
+    // Find the numbers in lines logged as "<prefix> <number> [...]", in order
+    static std::vector<int> loggedNumbers(const QStringList &lines, const QString &prefix)
+    {
+        QRegularExpression numberRegex{QStringLiteral("\\] %1 (\\d+)(?: |$)").arg(QRegularExpression::escape(prefix))};
+        std::vector<int> numbers;
+        for(const auto &line : lines)
+        {
+            auto match = numberRegex.match(line);
+            if(match.hasMatch())
+                numbers.push_back(match.captured(1).toInt());
+        }
+        return numbers;
+    }
+
+private slots:
+    void initTestCase()
+    {
+        QVERIFY(_logDir.isValid());
+        _savedDebugFile = Path::DebugFile;
+        Path::DebugFile = Path{_logDir.path()} / "debug.txt";
+        _logFilePath = Path{_logDir.path()} / "test.log";
+
+        Logger::initialize(false);
+        _pLogger = new Logger{_logFilePath};
+        _pLogger->configure(true, {});
+        QVERIFY(_pLogger->logToFile());
+    }
+
+    void cleanupTestCase()
+    {
+        delete _pLogger;
+        _pLogger = nullptr;
+        qInstallMessageHandler(nullptr);
+        Path::DebugFile = _savedDebugFile;
+    }
+
+    // Messages logged while the buffer is full are dropped and counted, the
+    // messages that fit are written in order followed by a drop report
+    void testDropWhenFull()
+    {
+        Logger::suspendWriter(true);
+        // Start with an empty buffer
+        Logger::flushPending();
+        qint64 logStart = logSize();
+        quint64 droppedBefore = Logger::droppedMessages();
+
+        // More messages than the buffer can hold
+        const int count = 5000;
+        for(int i=0; i<count; ++i)
+            qInfo() << "fill" << i;
+        quint64 dropped = Logger::droppedMessages() - droppedBefore;
+        // Nothing was written while suspended
+        QCOMPARE(logSize(), logStart);
+
+        Logger::flushPending();
+        Logger::suspendWriter(false);
+
+        QVERIFY(dropped > 0);
+        QStringList lines = readLog(logStart);
+        std::vector<int> written = loggedNumbers(lines, QStringLiteral("fill"));
+        QCOMPARE(static_cast<quint64>(written.size()) + dropped, static_cast<quint64>(count));
+        // The messages that didn't fit are the ones dropped
+        for(std::size_t i=0; i<written.size(); ++i)
+            QCOMPARE(written[i], static_cast<int>(i));
+        QCOMPARE(lines.filter(QStringLiteral("Log buffer full, dropped %1 messages").arg(dropped)).size(), 1);
+    }
+
+    // Messages queued by several threads are all written by a flush, each
+    // thread's messages in the order they were logged
+    void testFlushOrder()
+    {
+        Logger::suspendWriter(true);
+        Logger::flushPending();
+        qint64 logStart = logSize();
+        quint64 droppedBefore = Logger::droppedMessages();
+
+        const int threadCount = 4, perThread = 200;
+        std::vector<std::thread> threads;
+        for(int t=0; t<threadCount; ++t)
+        {
+            threads.emplace_back([t]()
+            {
+                for(int i=0; i<perThread; ++i)
+                    qInfo().noquote() << QStringLiteral("thread%1").arg(t) << i;
+            });
+        }
+        for(auto &thread : threads)
+            thread.join();
+        QCOMPARE(logSize(), logStart);
+
+        // Everything queued is written by the flush, without the writer
+        Logger::flushPending();
+        QStringList lines = readLog(logStart);
+        Logger::suspendWriter(false);
+
+        QCOMPARE(Logger::droppedMessages(), droppedBefore);
+        for(int t=0; t<threadCount; ++t)
+        {
+            std::vector<int> written = loggedNumbers(lines, QStringLiteral("thread%1").arg(t));
+            QCOMPARE(written.size(), static_cast<std::size_t>(perThread));
+            for(int i=0; i<perThread; ++i)
+                QCOMPARE(written[i], i);
+        }
+    }
+
+    // Rotate the log several times with small limits.  The oldest history
+    // generations are removed to stay within the budget, and the remaining
+    // generations decode to the text that was logged.  (This changes the
+    // limits, so it runs last.)
+    void testHistoryRotation()
+    {
+        const qint64 fileLimit = 4000, historyBudget = 6000;
+        const int rotations = 12;
+
+        Logger::suspendWriter(true);
+        Logger::flushPending();
+        _pLogger->setLogLimits(fileLimit, historyBudget);
+
+        // Random payloads so the generations don't compress to almost nothing
+        QStringList payloads;
+        for(int rotation=0; rotation<rotations; ++rotation)
+        {
+            // Write a little more than the limit in one batch, which rotates
+            // the log file once
+            qint64 batchSize = 0;
+            while(batchSize <= fileLimit)
+            {
+                QByteArray payload(32, 0);
+                QRandomGenerator::global()->fillRange(reinterpret_cast<quint32*>(payload.data()), payload.size() / 4);
+                payloads.push_back(QString::fromLatin1(payload.toHex()));
+                qInfo().noquote() << "history" << payloads.size()-1 << payloads.back();
+                batchSize += payloads.back().size() + 60;
+            }
+            Logger::flushPending();
+        }
+        Logger::suspendWriter(false);
+
+        // Wait for the archive thread to compress the pending generations and
+        // trim the history
+        auto historySize = [&]()
+        {
+            qint64 total = 0;
+            for(const auto &generation : Logger::logHistoryFiles(_logFilePath))
+            {
+                if(!generation.endsWith(QStringLiteral(".z")))
+                    return std::numeric_limits<qint64>::max();
+                total += QFileInfo{generation}.size();
+            }
+            return total;
+        };
+        QTRY_VERIFY_WITH_TIMEOUT(historySize() <= historyBudget, 10000);
+
+        // The oldest generations were removed
+        QStringList generations = Logger::logHistoryFiles(_logFilePath);
+        QVERIFY(generations.size() >= 2);
+        QVERIFY(generations.size() < rotations - 1);
+
+        // Read the history oldest first, then the old file and log file
+        QStringList lines;
+        for(auto itGeneration = generations.rbegin(); itGeneration != generations.rend(); ++itGeneration)
+        {
+            QByteArray content = Logger::readLogHistoryFile(*itGeneration);
+            QVERIFY(!content.isEmpty());
+            lines += QString::fromUtf8(content).split('\n', QString::SkipEmptyParts);
+        }
+        for(const QString &path : QStringList{_logFilePath + oldFileSuffix, _logFilePath})
+        {
+            QFile logFile{path};
+            QVERIFY(logFile.open(QFile::ReadOnly));
+            lines += QString::fromUtf8(logFile.readAll()).split('\n', QString::SkipEmptyParts);
+        }
+
+        // The retained messages are the newest ones, with nothing missing
+        // and the same text that was logged
+        std::vector<int> written = loggedNumbers(lines, QStringLiteral("history"));
+        QVERIFY(!written.empty());
+        QVERIFY(written.front() > 0);
+        QCOMPARE(written.back(), payloads.size()-1);
+        for(std::size_t i=1; i<written.size(); ++i)
+            QCOMPARE(written[i], written[i-1] + 1);
+        for(int number : written)
+        {
+            QString expected = QStringLiteral("] history %1 %2").arg(number).arg(payloads[number]);
+            QCOMPARE(lines.filter(expected).size(), 1);
+        }
+    }
+};
+
+QTEST_GUILESS_MAIN(tst_logging)
+#include TEST_MOC
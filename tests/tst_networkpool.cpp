@@ -0,0 +1,117 @@
+// Copyright (c) 2019 London Trust Media Incorporated
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "networkpool.h"
+#include <QtTest>
+#include <QThread>
+#include <memory>
+
+class tst_networkpool : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    // Clients on the same thread get the same manager
+    void sharedOnThread()
+    {
+        auto pFirst = NetworkPool::get();
+        auto pSecond = NetworkPool::get();
+        QVERIFY(pFirst);
+        QCOMPARE(pFirst, pSecond);
+        QCOMPARE(pFirst->thread(), QThread::currentThread());
+    }
+
+    // Each thread has its own manager
+    void separateThreads()
+    {
+        auto pMainManager = NetworkPool::get();
+
+        QNetworkAccessManager *pThreadManager{nullptr};
+        bool threadMatches{false};
+        std::unique_ptr<QThread> pWorker{QThread::create([&]()
+        {
+            auto pManager = NetworkPool::get();
+            pThreadManager = pManager.data();
+            threadMatches = pManager->thread() == QThread::currentThread();
+        })};
+        pWorker->start();
+        QVERIFY(pWorker->wait(5000));
+
+        QVERIFY(pThreadManager);
+        QVERIFY(threadMatches);
+        QVERIFY(pThreadManager != pMainManager.data());
+    }
+
+    // The manager is destroyed once it's released, and a new one is created
+    // the next time it's needed
+    void releasedWhenUnused()
+    {
+        auto pManager = NetworkPool::get();
+        QPointer<QNetworkAccessManager> pTracker{pManager.data()};
+        pManager.reset();
+        QTRY_VERIFY(!pTracker);
+
+        pManager = NetworkPool::get();
+        QVERIFY(pManager);
+    }
+
+    // Retiring a manager replaces it for new clients, but clients still
+    // holding it can keep using it
+    void retire()
+    {
+        auto pManager = NetworkPool::get();
+        QPointer<QNetworkAccessManager> pTracker{pManager.data()};
+        NetworkPool::retire(pManager);
+
+        auto pNewManager = NetworkPool::get();
+        QVERIFY(pNewManager);
+        QVERIFY(pNewManager != pManager);
+        QCOMPARE(NetworkPool::get(), pNewManager);
+        // Retiring the old manager again doesn't affect the new one
+        NetworkPool::retire(pManager);
+        QCOMPARE(NetworkPool::get(), pNewManager);
+
+        // The retired manager is destroyed once it's released
+        QVERIFY(pTracker);
+        pManager.reset();
+        QTRY_VERIFY(!pTracker);
+    }
+
+    // Resetting connections retires the managers on all threads
+    void resetConnections()
+    {
+        auto pManager = NetworkPool::get();
+        NetworkPool::resetConnections();
+        auto pNewManager = NetworkPool::get();
+        QVERIFY(pNewManager);
+        QVERIFY(pNewManager != pManager);
+        QCOMPARE(NetworkPool::get(), pNewManager);
+    }
+
+    // Prepared requests allow HTTP/2 and are timed for the metrics
+    void prepareRequest()
+    {
+        QNetworkRequest request{QUrl{QStringLiteral("https://www.example.com/")}};
+        NetworkPool::prepareRequest(request);
+        QVERIFY(request.attribute(QNetworkRequest::Http2AllowedAttribute).toBool());
+        QVERIFY(request.attribute(QNetworkRequest::User).isValid());
+    }
+};
+
+QTEST_GUILESS_MAIN(tst_networkpool)
+#include TEST_MOC
@@ -0,0 +1,330 @@
+// Copyright (c) 2019 London Trust Media Incorporated
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#include <QtTest>
+#include <QTemporaryDir>
+
+#include "daemon/src/linux/proc_tracker.h"
+#include "path.h"
+
+#include <algorithm>
+#include <thread>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace
+{
+    // Number of excluded processes started by the storm
+    const int stormExcludedCount = 500;
+    // Number of unrelated processes started for each excluded process
+    const int stormNoisePerExcluded = 3;
+    // How long the excluded processes run.  They have to live long enough for
+    // ProcTracker to identify them; a process that exits first is counted as
+    // missed.
+    const char excludedRunTime[] = "2";
+    // How long to wait for ProcTracker to catch up after the storm
+    const int settleTimeoutMs = 10000;
+    // Regression gates - the number of excluded pids that may be missed, and
+    // the 99th percentile exec-to-exclusion latency.  These can be overridden
+    // with PIA_BENCH_MAX_MISSED and PIA_BENCH_MAX_P99_US for slower machines.
+    const int defaultMaxMissed = 0;
+    const int defaultMaxP99LatencyUs = 100000;
+
+    int benchLimit(const char *pName, int defaultValue)
+    {
+        bool ok{false};
+        int value = qEnvironmentVariableIntValue(pName, &ok);
+        return ok ? value : defaultValue;
+    }
+
+    qint64 monotonicUs()
+    {
+        timespec now;
+        ::clock_gettime(CLOCK_MONOTONIC, &now);
+        return static_cast<qint64>(now.tv_sec) * 1000000 + now.tv_nsec / 1000;
+    }
+}
+
+// Starts a storm of fork/exec pairs on a separate thread.  Each child records
+// the time just before it calls execv() in a shared mapping, so the latency
+// can be measured from the actual exec rather than from the fork.
+class ExecStorm
+{
+public:
+    ExecStorm(QByteArray excludedPath, int excludedCount, int noisePerExcluded)
+        : _excludedPath{std::move(excludedPath)},
+          _excludedCount{excludedCount},
+          _noisePerExcluded{noisePerExcluded},
+          _pExecTimes{nullptr}
+    {
+        void *pMapping = ::mmap(nullptr, sizeof(qint64) * _excludedCount,
+                                PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS,
+                                -1, 0);
+        if(pMapping != MAP_FAILED)
+            _pExecTimes = reinterpret_cast<qint64*>(pMapping);
+    }
+
+    ~ExecStorm()
+    {
+        if(_thread.joinable())
+            _thread.join();
+        for(pid_t pid : _allPids)
+            ::waitpid(pid, nullptr, 0);
+        if(_pExecTimes)
+            ::munmap(_pExecTimes, sizeof(qint64) * _excludedCount);
+    }
+
+private:
+    static pid_t spawn(const char *pPath, const char *pArg, qint64 *pExecTime)
+    {
+        pid_t pid = ::fork();
+        if(pid == 0)
+        {
+            // Only async-signal-safe calls in the child
+            if(pExecTime)
+                *pExecTime = monotonicUs();
+            const char *args[]{pPath, pArg, nullptr};
+            ::execv(pPath, const_cast<char *const*>(args));
+            ::_exit(127);
+        }
+        return pid;
+    }
+
+    void run()
+    {
+        for(int i=0; i<_excludedCount; ++i)
+        {
+            pid_t pid = spawn(_excludedPath.constData(), excludedRunTime,
+                              &_pExecTimes[i]);
+            if(pid > 0)
+            {
+                _excludedPids.push_back({pid, i});
+                _allPids.push_back(pid);
+            }
+
+            for(int n=0; n<_noisePerExcluded; ++n)
+            {
+                pid = spawn("/bin/true", nullptr, nullptr);
+                if(pid > 0)
+                    _allPids.push_back(pid);
+            }
+        }
+    }
+
+public:
+    bool valid() const {return _pExecTimes;}
+
+    void start() {_thread = std::thread{[this]{run();}};}
+    void join() {_thread.join();}
+
+    // Valid after join()
+    const std::vector<std::pair<pid_t, int>> &excludedPids() const {return _excludedPids;}
+    qint64 execTime(int index) const {return _pExecTimes[index];}
+
+private:
+    QByteArray _excludedPath;
+    int _excludedCount;
+    int _noisePerExcluded;
+    qint64 *_pExecTimes;
+    std::thread _thread;
+    // Excluded pids and their indices in _pExecTimes
+    std::vector<std::pair<pid_t, int>> _excludedPids;
+    std::vector<pid_t> _allPids;
+};
+
+class tst_proc_tracker : public QObject
+{
+    Q_OBJECT
+
+private:
+    QTemporaryDir _cgroupDir;
+    Path _savedExclusionsFile, _savedParentExclusionsFile;
+
+private slots:
+    void initTestCase()
+    {
+        // Stand-in cgroup files - ProcTracker just writes pids to these
+        QVERIFY(_cgroupDir.isValid());
+        Path cgroupRoot{_cgroupDir.path()};
+        QVERIFY(QDir{cgroupRoot}.mkpath(QStringLiteral("vpnexclusions")));
+
+        _savedExclusionsFile = Path::VpnExclusionsFile;
+        _savedParentExclusionsFile = Path::ParentVpnExclusionsFile;
+        Path::VpnExclusionsFile = cgroupRoot / "vpnexclusions" / "cgroup.procs";
+        Path::ParentVpnExclusionsFile = cgroupRoot / "cgroup.procs";
+    }
+
+    void cleanupTestCase()
+    {
+        Path::VpnExclusionsFile = _savedExclusionsFile;
+        Path::ParentVpnExclusionsFile = _savedParentExclusionsFile;
+    }
+
+    // Replacing an excluded binary retires its old identity - its processes
+    // stay tracked until they exit, and are un-excluded if the app is removed
+    void testRefreshRetiresPids()
+    {
+        Path app = Path{_cgroupDir.path()} / "replaced-app";
+        QVERIFY(QFile::copy(QStringLiteral("/bin/true"), app));
+
+        ExcludedAppRegistry registry;
+        QVERIFY(registry.addPath(app));
+        ExecutableId oldId;
+        QVERIFY(ProcFs::executableIdForPath(app, oldId));
+        const pid_t oldPid = 100001, exitedPid = 100002;
+        QVERIFY(registry.addPid(oldId, oldPid));
+        QVERIFY(registry.addPid(oldId, exitedPid));
+
+        // Replace the binary the way a package update does (new inode)
+        Path replacement = Path{_cgroupDir.path()} / "replaced-app.new";
+        QVERIFY(QFile::copy(QStringLiteral("/bin/true"), replacement));
+        QCOMPARE(::rename(QFile::encodeName(replacement).constData(),
+                          QFile::encodeName(app).constData()), 0);
+        QVERIFY(registry.refreshPath(app));
+        ExecutableId newId;
+        QVERIFY(ProcFs::executableIdForPath(app, newId));
+        QVERIFY(newId != oldId);
+        QVERIFY(registry.isExcluded(newId));
+
+        // A resync still finds the old process by the old identity
+        registry.replacePids({{oldId, {oldPid}}});
+        QVERIFY(registry.containsPid(oldPid));
+        QVERIFY(!registry.containsPid(exitedPid));
+        QVERIFY(registry.isExcluded(oldId));
+
+        // Removing the app un-excludes the old process
+        QCOMPARE(registry.removePath(app), QSet<pid_t>{oldPid});
+        QVERIFY(!registry.containsPid(oldPid));
+        QVERIFY(!registry.isExcluded(oldId));
+        QVERIFY(!registry.isExcluded(newId));
+    }
+
+    // The retired identity is forgotten once its last process exits
+    void testRetiredAppExit()
+    {
+        Path app = Path{_cgroupDir.path()} / "exiting-app";
+        QVERIFY(QFile::copy(QStringLiteral("/bin/true"), app));
+
+        ExcludedAppRegistry registry;
+        QVERIFY(registry.addPath(app));
+        ExecutableId oldId;
+        QVERIFY(ProcFs::executableIdForPath(app, oldId));
+        const pid_t oldPid = 100003;
+        QVERIFY(registry.addPid(oldId, oldPid));
+
+        Path replacement = Path{_cgroupDir.path()} / "exiting-app.new";
+        QVERIFY(QFile::copy(QStringLiteral("/bin/true"), replacement));
+        QCOMPARE(::rename(QFile::encodeName(replacement).constData(),
+                          QFile::encodeName(app).constData()), 0);
+        QVERIFY(registry.refreshPath(app));
+
+        registry.removePid(oldPid);
+        QVERIFY(!registry.isExcluded(oldId));
+        QVERIFY(registry.removePath(app).isEmpty());
+    }
+
+    // Measure the latency from exec() of an excluded app to ProcTracker
+    // writing its pid to the exclusions cgroup during a fork/exec storm, and
+    // fail if the missed pids or p99 latency exceed the regression gates.
+    void benchExecToExclusion()
+    {
+        if(::geteuid() != 0)
+            QSKIP("Proc connector requires root (CAP_NET_ADMIN)");
+
+        // Use a private copy of a binary as the excluded app, so its identity
+        // doesn't match anything else running on the system
+        Path excludedApp = Path{_cgroupDir.path()} / "excluded-app";
+        QVERIFY(QFile::copy(QStringLiteral("/bin/sleep"), excludedApp));
+
+        ProcTracker tracker{nullptr};
+        if(!tracker.connectProcEvents())
+            QSKIP("Can't subscribe to proc events in this environment");
+        tracker.updateExcludedApps({excludedApp});
+
+        // Timestamp each pid when it's written to the exclusions cgroup.  This
+        // is a direct connection, so it runs right after the write.
+        QHash<pid_t, qint64> excludedTimes;
+        connect(&tracker, &ProcTracker::pidWrittenToCGroup, this,
+                [&](pid_t pid, const QString &cGroupPath)
+                {
+                    if(cGroupPath == Path::VpnExclusionsFile &&
+                       !excludedTimes.contains(pid))
+                    {
+                        excludedTimes.insert(pid, monotonicUs());
+                    }
+                }, Qt::DirectConnection);
+
+        ExecStorm storm{QFile::encodeName(excludedApp), stormExcludedCount,
+                        stormNoisePerExcluded};
+        QVERIFY(storm.valid());
+        storm.start();
+
+        // The storm runs on its own thread, handle events here until every
+        // excluded process has been seen or the timeout elapses
+        QElapsedTimer settleTime;
+        settleTime.start();
+        while(excludedTimes.size() < stormExcludedCount &&
+              settleTime.elapsed() < settleTimeoutMs)
+        {
+            QCoreApplication::processEvents(QEventLoop::AllEvents, 10);
+        }
+        storm.join();
+
+        std::vector<qint64> latencies;
+        latencies.reserve(storm.excludedPids().size());
+        int missed = 0;
+        for(const auto &excluded : storm.excludedPids())
+        {
+            auto itExcluded = excludedTimes.find(excluded.first);
+            if(itExcluded == excludedTimes.end())
+                ++missed;
+            else
+                latencies.push_back(itExcluded.value() - storm.execTime(excluded.second));
+        }
+
+        tracker.updateExcludedApps({});
+        tracker.disconnectProcEvents();
+
+        QVERIFY(!latencies.empty());
+        std::sort(latencies.begin(), latencies.end());
+        auto percentile = [&](std::size_t pct)
+        {
+            return latencies[(latencies.size() - 1) * pct / 100];
+        };
+        qint64 p50 = percentile(50), p99 = percentile(99), max = latencies.back();
+
+        qInfo() << "Exec-to-exclusion latency (us) for" << latencies.size()
+            << "processes - p50:" << p50 << "p99:" << p99 << "max:" << max;
+        qInfo() << "Missed pids:" << missed << "- events processed:"
+            << tracker.eventsProcessed() << "dropped:" << tracker.eventsDropped()
+            << "overflows:" << tracker.overflows();
+
+        int maxMissed = benchLimit("PIA_BENCH_MAX_MISSED", defaultMaxMissed);
+        int maxP99 = benchLimit("PIA_BENCH_MAX_P99_US", defaultMaxP99LatencyUs);
+        QVERIFY2(missed <= maxMissed, qPrintable(QStringLiteral("%1 pids missed, limit is %2").arg(missed).arg(maxMissed)));
+        QVERIFY2(p99 <= maxP99, qPrintable(QStringLiteral("p99 latency %1 us exceeds %2 us").arg(p99).arg(maxP99)));
+    }
+};
+
+QTEST_GUILESS_MAIN(tst_proc_tracker)
+#include TEST_MOC
@@ -0,0 +1,200 @@
+// Copyright (c) 2019 London Trust Media Incorporated
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#include "regionlistmodel.h"
+#include <QtTest>
+#include <QSignalSpy>
+
+namespace regionlistmodel_rows {
+
+QVariantMap location(const QString &id, const QString &country, double latency)
+{
+    return {
+        {QStringLiteral("id"), id},
+        {QStringLiteral("country"), country},
+        {QStringLiteral("latency"), latency}
+    };
+}
+
+QVariantMap single(const QString &id, const QString &country, double latency)
+{
+    return {
+        {QStringLiteral("region"), location(id, country, latency)},
+        {QStringLiteral("regionCountry"), country},
+        {QStringLiteral("regionChildren"), QVariantList{}}
+    };
+}
+
+QVariantMap group(const QString &country, const QVariantList &children)
+{
+    QVariantList subregions;
+    for(const auto &child : children)
+        subregions.push_back(QVariantMap{{QStringLiteral("subregion"), child}});
+    return {
+        {QStringLiteral("region"), QVariant{}},
+        {QStringLiteral("regionCountry"), country},
+        {QStringLiteral("regionChildren"), subregions}
+    };
+}
+
+}
+
+using namespace regionlistmodel_rows;
+
+class tst_regionlistmodel : public QObject
+{
+    Q_OBJECT
+
+private:
+    QStringList keys(const RegionListModel &model)
+    {
+        QStringList result;
+        for(int i=0; i<model.rowCount(); ++i)
+            result.push_back(model.data(model.index(i), RegionListModel::RowKeyRole).toString());
+        return result;
+    }
+
+    const QVariantList initialRows{
+        single(QStringLiteral("ca"), QStringLiteral("ca"), 40),
+        group(QStringLiteral("us"), {location(QStringLiteral("us_east"), QStringLiteral("us"), 30),
+                                     location(QStringLiteral("us_west"), QStringLiteral("us"), 80)}),
+        single(QStringLiteral("de"), QStringLiteral("de"), 90)
+    };
+
+private slots:
+    void testInitial()
+    {
+        RegionListModel model;
+        QSignalSpy insertSpy{&model, &RegionListModel::rowsInserted};
+        model.setRegions(initialRows);
+        QCOMPARE(keys(model), (QStringList{QStringLiteral("ca"), QStringLiteral("us/"), QStringLiteral("de")}));
+        QCOMPARE(insertSpy.size(), 3);
+        QCOMPARE(model.revision(), 1);
+        QCOMPARE(model.regions(), initialRows);
+        QCOMPARE(model.data(model.index(1), RegionListModel::RegionCountryRole).toString(), QStringLiteral("us"));
+        QVERIFY(!model.data(model.index(1), RegionListModel::RegionRole).isValid());
+    }
+
+    // Setting the same rows again does nothing
+    void testUnchanged()
+    {
+        RegionListModel model;
+        model.setRegions(initialRows);
+        QSignalSpy dataSpy{&model, &RegionListModel::dataChanged};
+        QSignalSpy revisionSpy{&model, &RegionListModel::revisionChanged};
+        model.setRegions(initialRows);
+        QCOMPARE(dataSpy.size(), 0);
+        QCOMPARE(revisionSpy.size(), 0);
+    }
+
+    // Latency changes only emit dataChanged for the affected rows
+    void testDataChanged()
+    {
+        RegionListModel model;
+        model.setRegions(initialRows);
+        QSignalSpy dataSpy{&model, &RegionListModel::dataChanged};
+        QSignalSpy insertSpy{&model, &RegionListModel::rowsInserted};
+        QSignalSpy removeSpy{&model, &RegionListModel::rowsRemoved};
+        QSignalSpy resetSpy{&model, &RegionListModel::modelReset};
+
+        QVariantList rows{initialRows};
+        rows[2] = single(QStringLiteral("de"), QStringLiteral("de"), 50);
+        model.setRegions(rows);
+
+        QCOMPARE(dataSpy.size(), 1);
+        QCOMPARE(dataSpy[0][0].toModelIndex().row(), 2);
+        QCOMPARE(dataSpy[0][2].value<QVector<int>>(), QVector<int>{RegionListModel::RegionRole});
+        QCOMPARE(insertSpy.size(), 0);
+        QCOMPARE(removeSpy.size(), 0);
+        QCOMPARE(resetSpy.size(), 0);
+        QCOMPARE(model.regions(), rows);
+    }
+
+    // Re-sorted rows are moved, not recreated
+    void testMove()
+    {
+        RegionListModel model;
+        model.setRegions(initialRows);
+        QSignalSpy moveSpy{&model, &RegionListModel::rowsMoved};
+        QSignalSpy insertSpy{&model, &RegionListModel::rowsInserted};
+        QSignalSpy removeSpy{&model, &RegionListModel::rowsRemoved};
+
+        QVariantList rows{initialRows[2], initialRows[0], initialRows[1]};
+        model.setRegions(rows);
+
+        QCOMPARE(keys(model), (QStringList{QStringLiteral("de"), QStringLiteral("ca"), QStringLiteral("us/")}));
+        QCOMPARE(moveSpy.size(), 1);
+        QCOMPARE(insertSpy.size(), 0);
+        QCOMPARE(removeSpy.size(), 0);
+        QCOMPARE(model.regions(), rows);
+    }
+
+    // Filtered rows are removed and come back as inserts
+    void testInsertRemove()
+    {
+        RegionListModel model;
+        model.setRegions(initialRows);
+        QSignalSpy insertSpy{&model, &RegionListModel::rowsInserted};
+        QSignalSpy removeSpy{&model, &RegionListModel::rowsRemoved};
+
+        model.setRegions({initialRows[1]});
+        QCOMPARE(keys(model), QStringList{QStringLiteral("us/")});
+        QCOMPARE(removeSpy.size(), 2);
+
+        QVariantList rows{initialRows[0], initialRows[1],
+                          single(QStringLiteral("jp"), QStringLiteral("jp"), 200)};
+        model.setRegions(rows);
+        QCOMPARE(keys(model), (QStringList{QStringLiteral("ca"), QStringLiteral("us/"), QStringLiteral("jp")}));
+        QCOMPARE(insertSpy.size(), 2);
+        QCOMPARE(model.regions(), rows);
+    }
+
+    // A country that becomes a single region (due to a filter) is a different
+    // row
+    void testGroupToSingle()
+    {
+        RegionListModel model;
+        model.setRegions(initialRows);
+        QSignalSpy removeSpy{&model, &RegionListModel::rowsRemoved};
+        QSignalSpy insertSpy{&model, &RegionListModel::rowsInserted};
+
+        QVariantList rows{initialRows[0],
+                          single(QStringLiteral("us_east"), QStringLiteral("us"), 30),
+                          initialRows[2]};
+        model.setRegions(rows);
+        QCOMPARE(keys(model), (QStringList{QStringLiteral("ca"), QStringLiteral("us_east"), QStringLiteral("de")}));
+        QCOMPARE(removeSpy.size(), 1);
+        QCOMPARE(insertSpy.size(), 1);
+    }
+
+    // Duplicate rows can't be diffed, the model is reset instead
+    void testDuplicates()
+    {
+        RegionListModel model;
+        model.setRegions(initialRows);
+        QSignalSpy resetSpy{&model, &RegionListModel::modelReset};
+        QVariantList rows{initialRows[0], initialRows[0]};
+        model.setRegions(rows);
+        QCOMPARE(resetSpy.size(), 1);
+        QCOMPARE(model.rowCount(), 2);
+    }
+};
+
+QTEST_GUILESS_MAIN(tst_regionlistmodel)
+#include TEST_MOC
@@ -0,0 +1,297 @@
+// Copyright (c) 2019 London Trust Media Incorporated
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#include "settings.h"
+#include "serverlistparser.h"
+#include <QtTest>
+
+namespace serverlist_docs {
+
+const QByteArray validList = R"(
+{
+  "us_california": {
+    "name": "US California",
+    "country": "US",
+    "dns": "us-california.privateinternetaccess.com",
+    "port_forward": false,
+    "ping": "198.8.80.174:8888",
+    "serial": "abc123",
+    "openvpn_udp": {"best": "198.8.80.174:8080"},
+    "openvpn_tcp": {"best": "198.8.80.174:500"},
+    "ips": ["198.8.80.174", "198.8.80.175"]
+  },
+  "ca": {
+    "name": "CA \"Montr\u00e9al\"\n",
+    "country": "CA",
+    "dns": "ca.privateinternetaccess.com",
+    "port_forward": true,
+    "ping": "173.199.65.36:8888",
+    "openvpn_udp": {"best": "173.199.65.36:8080", "other": [1, 2.5e3, null]},
+    "openvpn_tcp": {"best": "173.199.65.36:500"}
+  },
+  "web_ips": ["1.2.3.4"],
+  "vpn_ports": {"udp": [1], "tcp": [2]},
+  "info": {
+    "auto_regions": ["ca"],
+    "vpn_ports": {"udp": [1194, 8080, 9201, 53], "tcp": [443, 110, 80]},
+    "extra": {"nested": [[[]]]}
+  }
+}
+)";
+
+const QByteArray invalidLocations = R"(
+{
+  "missing_ping": {
+    "name": "Missing Ping",
+    "country": "US",
+    "dns": "missing.privateinternetaccess.com",
+    "port_forward": false,
+    "openvpn_udp": {"best": "1.1.1.1:8080"},
+    "openvpn_tcp": {"best": "1.1.1.1:500"}
+  },
+  "wrong_type": {
+    "name": 42,
+    "country": "US",
+    "dns": "wrong.privateinternetaccess.com",
+    "port_forward": false,
+    "ping": "1.1.1.2:8888",
+    "openvpn_udp": {"best": "1.1.1.2:8080"},
+    "openvpn_tcp": {"best": "1.1.1.2:500"}
+  },
+  "not_object": "nope",
+  "info": {
+    "auto_regions": "all",
+    "vpn_ports": {"udp": [1194, -1], "tcp": [443, 80.5]}
+  }
+}
+)";
+
+// Generate a servers list with the given number of regions, similar to the
+// real list
+QByteArray generateList(int regionCount)
+{
+    QByteArray payload{"{"};
+    QByteArray autoRegions;
+    for(int i=0; i<regionCount; ++i)
+    {
+        QByteArray id = "region_" + QByteArray::number(i);
+        QByteArray ip = "10.0." + QByteArray::number(i / 256) + "." + QByteArray::number(i % 256);
+        payload += "\"" + id + "\":{"
+            "\"name\":\"Region " + QByteArray::number(i) + "\","
+            "\"country\":\"US\","
+            "\"dns\":\"" + id + ".privateinternetaccess.com\","
+            "\"port_forward\":" + ((i % 3) ? "false" : "true") + ","
+            "\"ping\":\"" + ip + ":8888\","
+            "\"serial\":\"" + QByteArray::number(i * 7919, 16) + "\","
+            "\"openvpn_udp\":{\"best\":\"" + ip + ":8080\"},"
+            "\"openvpn_tcp\":{\"best\":\"" + ip + ":500\"},"
+            "\"ips\":[\"" + ip + "\"]},";
+        if(i)
+            autoRegions += ",";
+        autoRegions += "\"" + id + "\"";
+    }
+    payload += "\"info\":{\"auto_regions\":[" + autoRegions + "],"
+        "\"vpn_ports\":{\"udp\":[1194,8080,9201,53],\"tcp\":[443,110,80]}}}";
+    return payload;
+}
+
+// Build ServerLocations by parsing a QJsonDocument - the baseline for the
+// streaming parser benchmark
+ServerLocations buildFromDocument(const QByteArray &payload)
+{
+    const auto &serversObj = QJsonDocument::fromJson(payload).object();
+    QVector<QString> autoRegions;
+    try
+    {
+        autoRegions = JsonCaster{serversObj["info"].toObject()["auto_regions"]};
+    }
+    catch(const std::exception &)
+    {
+    }
+
+    ServerLocations locations;
+    for(auto itAttr = serversObj.begin(); itAttr != serversObj.end(); ++itAttr)
+    {
+        if(itAttr.key() == QStringLiteral("info"))
+            continue;
+        try
+        {
+            const auto &serverObj = itAttr.value().toObject();
+            QSharedPointer<ServerLocation> pLocation{new ServerLocation{}};
+            pLocation->id(itAttr.key());
+            pLocation->name(JsonCaster{serverObj.value(QStringLiteral("name"))});
+            pLocation->country(JsonCaster{serverObj.value(QStringLiteral("country"))});
+            pLocation->dns(JsonCaster{serverObj.value(QStringLiteral("dns"))});
+            pLocation->portForward(JsonCaster{serverObj.value(QStringLiteral("port_forward"))});
+            pLocation->openvpnUDP(JsonCaster{serverObj.value(QStringLiteral("openvpn_udp")).toObject().value(QStringLiteral("best"))});
+            pLocation->openvpnTCP(JsonCaster{serverObj.value(QStringLiteral("openvpn_tcp")).toObject().value(QStringLiteral("best"))});
+            pLocation->ping(JsonCaster{serverObj.value(QStringLiteral("ping"))});
+            pLocation->serial(serverObj.value(QStringLiteral("serial")).toString());
+            pLocation->isSafeForAutoConnect(autoRegions.empty() || autoRegions.contains(itAttr.key()));
+            locations.insert(itAttr.key(), pLocation);
+        }
+        catch(const std::exception &ex)
+        {
+            qWarning() << "Can't load location" << itAttr.key() << "-" << ex.what();
+        }
+    }
+    return locations;
+}
+
+}
+
+class tst_serverlist : public QObject
+{
+    Q_OBJECT
+
+private:
+    const ServerListLocation *findLocation(const ServerList &list, const QString &id)
+    {
+        for(const auto &location : list.locations)
+        {
+            if(location.id == id)
+                return &location;
+        }
+        return nullptr;
+    }
+
+private slots:
+    // Parse a valid list, including fields that are skipped
+    void testValid()
+    {
+        ServerList list;
+        QVERIFY(ServerListParser::parse(serverlist_docs::validList, list));
+        QCOMPARE(list.locations.size(), std::size_t{2});
+        QVERIFY(list.errors.empty());
+
+        // Locations are in the order they appear
+        QCOMPARE(list.locations[0].id, QStringLiteral("us_california"));
+        QCOMPARE(list.locations[1].id, QStringLiteral("ca"));
+
+        const auto *pUsCal = findLocation(list, QStringLiteral("us_california"));
+        QVERIFY(pUsCal);
+        QCOMPARE(pUsCal->name, QStringLiteral("US California"));
+        QCOMPARE(pUsCal->country, QStringLiteral("US"));
+        QCOMPARE(pUsCal->dns, QStringLiteral("us-california.privateinternetaccess.com"));
+        QCOMPARE(pUsCal->portForward, false);
+        QCOMPARE(pUsCal->ping, QStringLiteral("198.8.80.174:8888"));
+        QCOMPARE(pUsCal->serial, QStringLiteral("abc123"));
+        QCOMPARE(pUsCal->openvpnUDP, QStringLiteral("198.8.80.174:8080"));
+        QCOMPARE(pUsCal->openvpnTCP, QStringLiteral("198.8.80.174:500"));
+
+        // Escapes are decoded
+        const auto *pCa = findLocation(list, QStringLiteral("ca"));
+        QVERIFY(pCa);
+        QCOMPARE(pCa->name, QString::fromUtf8("CA \"Montr\xC3\xA9" "al\"\n"));
+        QCOMPARE(pCa->portForward, true);
+        QCOMPARE(pCa->serial, QString{});
+        QCOMPARE(pCa->openvpnUDP, QStringLiteral("173.199.65.36:8080"));
+
+        QCOMPARE(list.autoRegions, (QVector<QString>{QStringLiteral("ca")}));
+        QCOMPARE(list.udpPorts, (QVector<uint>{1194, 8080, 9201, 53}));
+        QCOMPARE(list.tcpPorts, (QVector<uint>{443, 110, 80}));
+    }
+
+    // Invalid locations and info fields are skipped and described
+    void testInvalidEntries()
+    {
+        ServerList list;
+        QVERIFY(ServerListParser::parse(serverlist_docs::invalidLocations, list));
+        QVERIFY(list.locations.empty());
+        QVERIFY(list.autoRegions.isEmpty());
+        QVERIFY(list.udpPorts.isEmpty());
+        QVERIFY(list.tcpPorts.isEmpty());
+
+        QStringList errors;
+        for(const auto &error : list.errors)
+            errors.push_back(error);
+        QVERIFY(errors.contains(QStringLiteral("Can't load location missing_ping: missing ping")));
+        QVERIFY(errors.contains(QStringLiteral("Can't load location wrong_type: name is not a string")));
+        QVERIFY(errors.contains(QStringLiteral("Can't load location not_object: not an object")));
+        QVERIFY(errors.contains(QStringLiteral("info.auto_regions is not valid")));
+        QVERIFY(errors.contains(QStringLiteral("info.vpn_ports.udp is not valid")));
+        QVERIFY(errors.contains(QStringLiteral("info.vpn_ports.tcp is not valid")));
+    }
+
+    // Payloads that aren't valid JSON objects fail entirely
+    void testSyntaxErrors()
+    {
+        const QByteArray payloads[]
+        {
+            "",
+            R"(["foo", 2, false])",
+            R"({"ca": {"name": "CA")",
+            R"({"ca": {"name": "CA",}})",
+            R"({"ca": {"name": "C\qA"}})",
+            R"({"ca": {}} trailing)",
+            QByteArray(100, '[').prepend(R"({"ca": )"),
+        };
+        for(const auto &payload : payloads)
+        {
+            ServerList list;
+            QVERIFY(!ServerListParser::parse(payload, list));
+            QVERIFY(list.locations.empty());
+            QCOMPARE(list.errors.size(), std::size_t{1});
+        }
+    }
+
+    // updateServerLocations() applies auto_regions and preserves data that
+    // doesn't come from the servers list
+    void testUpdateLocations()
+    {
+        ServerLocations locs{updateServerLocations({}, serverlist_docs::validList)};
+        QCOMPARE(locs.size(), 2);
+        QCOMPARE(locs.value(QStringLiteral("ca"))->isSafeForAutoConnect(), true);
+        QCOMPARE(locs.value(QStringLiteral("us_california"))->isSafeForAutoConnect(), false);
+
+        locs.value(QStringLiteral("ca"))->latency(75.0);
+        ServerLocations updated{updateServerLocations(locs, serverlist_docs::validList)};
+        QCOMPARE(updated.value(QStringLiteral("ca"))->latency().get(), 75.0);
+        QVERIFY(!updated.value(QStringLiteral("us_california"))->latency());
+    }
+
+    // Compare the streaming parser to building a QJsonDocument for a list
+    // about 10x the size of the current servers list
+    void benchmarkStreaming()
+    {
+        const QByteArray payload{serverlist_docs::generateList(500)};
+        ServerLocations locs;
+        QBENCHMARK
+        {
+            locs = updateServerLocations({}, payload);
+        }
+        QCOMPARE(locs.size(), 500);
+    }
+
+    // Baseline - parse a QJsonDocument and build ServerLocations from it, as
+    // updateServerLocations() did before the streaming parser
+    void benchmarkJsonDocument()
+    {
+        const QByteArray payload{serverlist_docs::generateList(500)};
+        ServerLocations locs;
+        QBENCHMARK
+        {
+            locs = serverlist_docs::buildFromDocument(payload);
+        }
+        QCOMPARE(locs.size(), 500);
+    }
+};
+
+QTEST_GUILESS_MAIN(tst_serverlist)
+#include TEST_MOC
@@ -22,13 +22,13 @@
 
 namespace sample_docs {
 
-const auto emptyJson = QJsonDocument::fromJson("{}").object();
+const QByteArray emptyJson{"{}"};
 
 //JSON doesn't have to have an object at the top level, it could be any JSON
 //value
-const auto arrayJson = QJsonDocument::fromJson(R"(["foo", 2, false])").object();
+const QByteArray arrayJson{R"(["foo", 2, false])"};
 
-const auto twoLocations = QJsonDocument::fromJson(R"(
+const QByteArray twoLocations{R"(
 {
   "us_california": {
     "name": "US California",
@@ -59,9 +59,9 @@ const auto twoLocations = QJsonDocument::fromJson(R"(
     "ips": []
   }
 }
-)").object();
+)"};
 
-const auto oneLocation = QJsonDocument::fromJson(R"(
+const QByteArray oneLocation{R"(
 {
   "ca": {
     "name": "CA Montreal",
@@ -78,10 +78,10 @@ const auto oneLocation = QJsonDocument::fromJson(R"(
     "ips": []
   }
 }
-)").object();
+)"};
 
 //The CA Montreal location again with new IP addresses
-const auto oneLocationNewIps = QJsonDocument::fromJson(R"(
+const QByteArray oneLocationNewIps{R"(
 {
   "ca": {
     "name": "CA Montreal",
@@ -98,9 +98,9 @@ const auto oneLocationNewIps = QJsonDocument::fromJson(R"(
     "ips": []
   }
 }
-)").object();
+)"};
 
-const auto partialInvalid = QJsonDocument::fromJson(R"(
+const QByteArray partialInvalid{R"(
 {
   "nz": {
     "name": "New Zealand",
@@ -119,10 +119,10 @@ const auto partialInvalid = QJsonDocument::fromJson(R"(
   "missing_everything": {
   }
 }
-)").object();
+)"};
 
 //Each of these locations is missing one field - none of them are valid.
-const auto invalidLocations = QJsonDocument::fromJson(R"(
+const QByteArray invalidLocations{R"(
 {
   "missing_name": {
     "country": "US",
@@ -238,7 +238,7 @@ const auto invalidLocations = QJsonDocument::fromJson(R"(
     "ips": []
   }
 }
-)").object();
+)"};
 
 }
 
@@ -20,6 +20,8 @@
 #include <QtTest>
 
 #include "async.h"
+#include "jsonrpc.h"
+#include <QJsonValue>
 
 class tst_tasks : public QObject
 {
@@ -508,6 +510,85 @@ private slots:
         QVERIFY(result->isResolved());
         QCOMPARE(result->result(), 6);
     }
+    void taskPoolReuse()
+    {
+        // Warm up the pool for this size, then check that a freed task's
+        // block is reused for the next task of the same size
+        Async<int>::resolve(0).reset();
+        quint64 hits = BaseTask::getTaskPoolHits();
+        quint64 misses = BaseTask::getTaskPoolMisses();
+        auto first = Async<int>::resolve(1);
+        first.reset();
+        auto second = Async<int>::resolve(2);
+        QCOMPARE(second->result(), 2);
+        QCOMPARE(BaseTask::getTaskPoolHits(), hits + 2);
+        QCOMPARE(BaseTask::getTaskPoolMisses(), misses);
+    }
+
+    // Benchmarks for the common task paths.  Each iteration has to release
+    // all of its tasks, since cleanup() checks that none are left.
+    void benchmarkResolve()
+    {
+        int sum = 0;
+        QBENCHMARK
+        {
+            auto task = Async<int>::resolve(1);
+            sum += task->result();
+        }
+        QVERIFY(sum > 0);
+    }
+    void benchmarkThenAlreadyResolved()
+    {
+        int sum = 0;
+        QBENCHMARK
+        {
+            auto task = Async<int>::resolve(1)->then(add)->then(add);
+            sum += task->result();
+        }
+        QVERIFY(sum > 0);
+    }
+    void benchmarkThenPending()
+    {
+        int sum = 0;
+        QBENCHMARK
+        {
+            auto source = Async<int>::create();
+            auto task = source->then(add)->then(add);
+            source->resolve(1);
+            sum += task->result();
+        }
+        QVERIFY(sum > 0);
+    }
+    // A synchronous RPC method completes without creating any task
+    void rpcResultNoTask()
+    {
+        LocalMethodRegistry registry{
+            { QStringLiteral("answer"), []() { return 42; } },
+        };
+        quint64 hits = BaseTask::getTaskPoolHits();
+        quint64 misses = BaseTask::getTaskPoolMisses();
+        QJsonValue result;
+        auto task = registry.invoke(QStringLiteral("answer"), {}, result);
+        QVERIFY(!task);
+        QCOMPARE(result.toInt(), 42);
+        QCOMPARE(BaseTask::getTaskPoolHits(), hits);
+        QCOMPARE(BaseTask::getTaskPoolMisses(), misses);
+    }
+    void benchmarkRpcResult()
+    {
+        // The path taken by LocalCallInterface for a synchronous method
+        LocalMethodRegistry registry{
+            { QStringLiteral("answer"), []() { return 42; } },
+        };
+        int responses = 0;
+        QBENCHMARK
+        {
+            QJsonValue result;
+            if(!registry.invoke(QStringLiteral("answer"), {}, result))
+                responses += result.toInt();
+        }
+        QVERIFY(responses > 0);
+    }
 };
 
 QTEST_GUILESS_MAIN(tst_tasks)
@@ -17,11 +17,18 @@
 // <https://www.gnu.org/licenses/>.
 
 #include "daemon/src/updatedownloader.h"
+#include "daemon/src/installerdownload.h"
+#include "openssl.h"
 #include "testshim.h"
 #include "version.h"
 #include "brand.h"
 #include "src/mocknetwork.h"
 #include <QtTest>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QSslSocket>
+#include <QTemporaryDir>
 
 /*
 
@@ -34,6 +41,10 @@ and toggling the beta-related settings.
 These tests are not intended to provide coverage of SemVersion or JsonRefresher,
 which have separate tests.
 
+The installer signature tests check SignatureVerifier and InstallerDownload's
+signature verification, including when resuming a partial download.
+
+
 */
 
 namespace TestData {
@@ -45,6 +56,14 @@ const QString &betaChannel = QStringLiteral("beta");
 // The UpdateDownloader uses the actual version even in unit tests, so the
 // 'newer' version is set really high.
 const Update newerGa{QStringLiteral("https://unit.test/v100"), QStringLiteral("100.0.0")};
+// Newer release with an installer hash
+const Update newerGaHash{QStringLiteral("https://unit.test/v100"), QStringLiteral("100.0.0"),
+                         QStringLiteral("9f86d081884c7d659a2feaa0c55ad015a3bf4f1b2b0b822cd15d6c15b0f00a08")};
+// Newer release with a delta from the current version
+const Update newerGaDelta{QStringLiteral("https://unit.test/v100"), QStringLiteral("100.0.0"),
+                          QStringLiteral("9f86d081884c7d659a2feaa0c55ad015a3bf4f1b2b0b822cd15d6c15b0f00a08"),
+                          QStringLiteral("https://unit.test/v100-delta"),
+                          QStringLiteral("60303ae22b998861bce3b28f33eec1be758a213c86c93c076dbe9f558c11c752")};
 // Older release
 const Update olderGa{QStringLiteral("https://unit.test/v080"), QStringLiteral("0.8.0")};
 // The same release.
@@ -66,19 +85,61 @@ const QByteArray &noBuildPayload = QByteArrayLiteral("{\"" BRAND_UPDATE_JSON_KEY
 SemVersion buildVersion{0, 0, 0};
 bool buildIsBeta = false;
 
+// Test installer content, signed (SHA-256) with the private key for
+// installerKey.  (The private key is not kept, these are only used to verify.)
+QByteArray installerData()
+{
+    QByteArray data;
+    for(int i = 0; i < 20000; ++i)
+        data += "PIA installer test data line " + QByteArray::number(i) + "\n";
+    return data;
+}
+
+const QByteArray installerKey = QByteArrayLiteral(
+    "-----BEGIN PUBLIC KEY-----\n"
+    "MIIBIjANBgkqhkiG9w0BAQEFAAOCAQ8AMIIBCgKCAQEAkVQzLw8JdPNZ6E9A9xPT\n"
+    "3GBy1/Mlz4boI+eBR7Efz+PAGtcb5m7AicV62DBlhZXbC/LsJhDg5ojXUuK6qj26\n"
+    "qg7bga66HR2v68dTeMFAa0uLeox1VYzEdqBg6dveth3xdl8UnVSHJ8dzG1o/oweG\n"
+    "IriccMtT8ItmY8QvCX5eaPgWhi+f3wfn/9LHys1LnbIZjoQ71X5QKTZuUX1/EsZw\n"
+    "jgb6UrdDs4TkbJr37xjOMPhALA0wANFTQOinWRrE4WdLfMMq7FvYKXshPsM8lUwA\n"
+    "OpfcXjShAaX1Ph8VUs5UIRrERuAjoRjMH2p8eGn63gvltNH4Bqtois0ZOa14GEvM\n"
+    "UwIDAQAB\n"
+    "-----END PUBLIC KEY-----\n");
+
+const QByteArray installerSignature = QByteArray::fromBase64(
+    "ZJ0mQlOXhclvq0uc7uOjWo8UYLmwNwgj5MswnR8XIR8rk4nKnhp68A2OQqI+6zGE"
+    "NicvptVVPQYfnucJQmcIJ29ihpyXp1lHqkE7bme8dyu1tSHqkK5RolelucUf9B5v"
+    "w+bGFYYa/661Fi1Rb46SHdeMheqMHq2fth3zAzow9ezR/MLJiC+2dY/RnmQPla/D"
+    "+hJhWov8cPV49firjHhUickg+fpwshvOuT95EGjj02b/9uVFfVniimcWfFDCSeXh"
+    "PxqXmYPoeUP7UzGuIjfQF60YUlNHfqgbkT5l7HmW3PBM8V9LGguCDzx09TVKYZYO"
+    "Iq2x3OxMjZ2mteslgec58A==");
+
 }
 
 // Build the update payload JSON from an Update object.
-// The platform name, update version, and update URI are assumed not to contain
-// characters that would have to be escaped in JSON; no escaping is performed.
+// The platform name, update version, update URI, and hashes are assumed not to
+// contain characters that would have to be escaped in JSON; no escaping is
+// performed.  The hash and delta are only included if they're set.  A delta is
+// listed along with a delta from another version, which should be ignored.
 QByteArray buildUpdatePayload(const Update &update)
 {
+    QString hashField;
+    if(!update.sha256().isEmpty())
+        hashField = R"(,
+            "sha256": ")" + update.sha256() + R"(")";
+    if(!update.deltaUri().isEmpty())
+        hashField += R"(,
+            "deltas": [
+                {"from": "0.0.1", "download": "https://unit.test/wrong-delta", "sha256": ""},
+                {"from": ")" PIA_VERSION R"(", "download": ")" + update.deltaUri() +
+                    R"(", "sha256": ")" + update.deltaSha256() + R"("}
+            ])";
     return (R"(
 {
     ")" + QStringLiteral(BRAND_UPDATE_JSON_KEY_NAME) + R"(": {
         ")" + UpdateChannel::platformName + R"(": {
             "version": ")" + update.version() + R"(",
-            "download": ")" + update.uri() + R"("
+            "download": ")" + update.uri() + R"(")" + hashField + R"(
         }
     }
 })").toUtf8();
@@ -174,6 +235,52 @@ private slots:
         QCOMPARE(fixture._updateSpy[0][2].value<Update>(), Update{});
     }
 
+    // The installer hash is provided with the update if the metadata has it
+    void testGaHash()
+    {
+        DownloaderFixture fixture;
+        QSignalSpy consumeSpy{&MockNetworkManager::_replyConsumed, &ReplyConsumedSignal::signal};
+
+        auto pGaReply = enqueueUpdateReply(TestData::newerGaHash);
+        fixture._downloader.run(true);
+        QVERIFY(consumeSpy.wait(100));
+
+        pGaReply->queueFinished();
+        QVERIFY(fixture._updateSpy.wait());
+        QCOMPARE(fixture._updateSpy[0][0].value<Update>(), TestData::newerGaHash);
+        QCOMPARE(fixture._updateSpy[0][0].value<Update>().sha256(), TestData::newerGaHash.sha256());
+        // The hash is part of the update
+        QVERIFY(fixture._updateSpy[0][0].value<Update>() != TestData::newerGa);
+    }
+
+    // A delta from the current version is provided with the update
+    void testGaDelta()
+    {
+        DownloaderFixture fixture;
+        QSignalSpy consumeSpy{&MockNetworkManager::_replyConsumed, &ReplyConsumedSignal::signal};
+
+        auto pGaReply = enqueueUpdateReply(TestData::newerGaDelta);
+        fixture._downloader.run(true);
+        QVERIFY(consumeSpy.wait(100));
+
+        pGaReply->queueFinished();
+        QVERIFY(fixture._updateSpy.wait());
+        const Update &update = fixture._updateSpy[0][0].value<Update>();
+        QCOMPARE(update, TestData::newerGaDelta);
+        QCOMPARE(update.deltaUri(), TestData::newerGaDelta.deltaUri());
+        QCOMPARE(update.deltaSha256(), TestData::newerGaDelta.deltaSha256());
+    }
+
+    // A delta is ignored if the installer hash isn't known, since the result
+    // couldn't be verified
+    void deltaRequiresHash()
+    {
+        Update update{QStringLiteral("https://unit.test/v100"), QStringLiteral("100.0.0"),
+                      {}, QStringLiteral("https://unit.test/v100-delta")};
+        QVERIFY(update.isValid());
+        QVERIFY(update.deltaUri().isEmpty());
+    }
+
     // An older release in GA should be offered as a downgrade only if the
     // current build is a beta.
     void testGaOlder()
@@ -399,6 +506,167 @@ private slots:
         QCOMPARE(fixture._updateSpy[3][1].value<Update>(), TestData::newerGa);
         QCOMPARE(fixture._updateSpy[3][2].value<Update>(), TestData::newerBeta2);
     }
+
+    // SignatureVerifier gives the same result whether data is provided at
+    // once or in chunks, and rejects modified data and invalid keys.
+    void testIncrementalSignature()
+    {
+        if(!QSslSocket::supportsSsl())
+            QSKIP("OpenSSL is not available, signatures are not checked");
+
+        const QByteArray &data = TestData::installerData();
+        QVERIFY(verifySignature(TestData::installerKey, TestData::installerSignature, data));
+
+        SignatureVerifier chunked{TestData::installerKey};
+        for(int pos = 0; pos < data.size(); pos += 4099)
+        {
+            chunked.update(data.mid(pos, 4099));
+            // Empty updates are ignored
+            chunked.update(QByteArray{});
+        }
+        QVERIFY(chunked.verify(TestData::installerSignature));
+
+        QByteArray modified{data};
+        modified[1000] = 'X';
+        SignatureVerifier modifiedVerifier{TestData::installerKey};
+        modifiedVerifier.update(modified);
+        QVERIFY(!modifiedVerifier.verify(TestData::installerSignature));
+
+        SignatureVerifier truncatedVerifier{TestData::installerKey};
+        truncatedVerifier.update(data.left(data.size() - 1));
+        QVERIFY(!truncatedVerifier.verify(TestData::installerSignature));
+
+        SignatureVerifier badKeyVerifier{QByteArrayLiteral("not a key")};
+        badKeyVerifier.update(data);
+        QVERIFY(!badKeyVerifier.verify(TestData::installerSignature));
+    }
+
+    // A downloaded installer with a valid signature succeeds
+    void testInstallerSignature()
+    {
+        if(!QSslSocket::supportsSsl())
+            QSKIP("OpenSSL is not available, signatures are not checked");
+
+        const QByteArray &data = TestData::installerData();
+        QTemporaryDir dir;
+        QString installerPath = dir.filePath(QStringLiteral("installer"));
+        MockNetworkManager networkManager;
+        InstallerDownload download{networkManager, QUrl{QStringLiteral("https://unit.test/v100")},
+                                   installerPath, {}};
+        download.setSignature(TestData::installerKey, TestData::installerSignature);
+
+        auto pReply = MockNetworkManager::enqueueReply(data);
+        QCOMPARE(runDownload(download, pReply), InstallerDownload::Result::Succeeded);
+        QCOMPARE(readFile(installerPath), data);
+    }
+
+    // An installer that doesn't match its signature fails, and the file is
+    // removed
+    void testInstallerBadSignature()
+    {
+        if(!QSslSocket::supportsSsl())
+            QSKIP("OpenSSL is not available, signatures are not checked");
+
+        QByteArray data = TestData::installerData();
+        data[data.size() / 2] = 'X';
+        QTemporaryDir dir;
+        QString installerPath = dir.filePath(QStringLiteral("installer"));
+        MockNetworkManager networkManager;
+        InstallerDownload download{networkManager, QUrl{QStringLiteral("https://unit.test/v100")},
+                                   installerPath, {}};
+        download.setSignature(TestData::installerKey, TestData::installerSignature);
+
+        auto pReply = MockNetworkManager::enqueueReply(data);
+        QCOMPARE(runDownload(download, pReply), InstallerDownload::Result::Failed);
+        QVERIFY(!QFile::exists(installerPath));
+        QVERIFY(!QFile::exists(installerPath + InstallerDownload::stateFileSuffix));
+    }
+
+    // When a partial download is resumed, the data already on disk is
+    // included in the signature
+    void testInstallerSignatureResume()
+    {
+        if(!QSslSocket::supportsSsl())
+            QSKIP("OpenSSL is not available, signatures are not checked");
+
+        const QByteArray &data = TestData::installerData();
+        const int half = data.size() / 2;
+        const QUrl url{QStringLiteral("https://unit.test/v100")};
+        QTemporaryDir dir;
+        QString installerPath = dir.filePath(QStringLiteral("installer"));
+
+        // Write the first half of the file and the state for a partial
+        // download
+        {
+            QFile partialFile{installerPath};
+            QVERIFY(partialFile.open(QIODevice::WriteOnly));
+            QCOMPARE(partialFile.write(data.left(half)), static_cast<qint64>(half));
+            QVERIFY(partialFile.resize(data.size()));
+        }
+        QJsonObject state
+        {
+            {QStringLiteral("url"), url.toString()},
+            {QStringLiteral("total"), data.size()},
+            {QStringLiteral("validator"), QStringLiteral("\"test-etag\"")},
+            {QStringLiteral("segments"), QJsonArray{QJsonArray{0, data.size(), half}}}
+        };
+        {
+            QFile stateFile{installerPath + InstallerDownload::stateFileSuffix};
+            QVERIFY(stateFile.open(QIODevice::WriteOnly));
+            stateFile.write(QJsonDocument{state}.toJson());
+        }
+
+        MockNetworkManager networkManager;
+        InstallerDownload download{networkManager, url, installerPath, {}};
+        download.setSignature(TestData::installerKey, TestData::installerSignature);
+
+        // Only the rest of the file is requested
+        QList<QByteArray> requestRanges;
+        QObject::connect(&MockNetworkManager::_replyConsumed, &ReplyConsumedSignal::signal,
+                         &download, [&](const QNetworkRequest &request)
+                         {
+                             requestRanges.push_back(request.rawHeader("Range"));
+                         });
+        auto pReply = MockNetworkManager::enqueueReply(data.mid(half));
+        pReply->setHttpStatus(206);
+        pReply->setReplyHeader("Content-Range", "bytes " + QByteArray::number(half) +
+                               "-" + QByteArray::number(data.size() - 1) + "/" +
+                               QByteArray::number(data.size()));
+        QCOMPARE(runDownload(download, pReply), InstallerDownload::Result::Succeeded);
+        QCOMPARE(requestRanges.size(), 1);
+        QCOMPARE(requestRanges[0], "bytes=" + QByteArray::number(half) + "-" +
+                                   QByteArray::number(data.size() - 1));
+        QCOMPARE(readFile(installerPath), data);
+    }
+
+private:
+    // Start a download, finish its reply, and wait for the result
+    InstallerDownload::Result runDownload(InstallerDownload &download,
+                                          const QPointer<MockNetworkReply> &pReply)
+    {
+        bool finished = false;
+        InstallerDownload::Result result{InstallerDownload::Result::Canceled};
+        QObject::connect(&download, &InstallerDownload::finished, this,
+            [&](InstallerDownload::Result downloadResult)
+            {
+                finished = true;
+                result = downloadResult;
+            });
+        download.start();
+        if(pReply)
+            pReply->queueFinished();
+        // If this times out, Canceled is returned, which fails the test
+        QTest::qWaitFor([&]() {return finished;}, 5000);
+        return result;
+    }
+
+    QByteArray readFile(const QString &path)
+    {
+        QFile file{path};
+        if(!file.open(QIODevice::ReadOnly))
+            return {};
+        return file.readAll();
+    }
 };
 
 QTEST_GUILESS_MAIN(tst_updatedownloader)
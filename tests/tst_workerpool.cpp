@@ -0,0 +1,228 @@
+// Copyright (c) 2019 London Trust Media Incorporated
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#include "workerpool.h"
+#include <QtTest>
+#include <QSemaphore>
+#include <QThread>
+
+class tst_workerpool : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    // Results are computed on a worker and delivered on the calling thread
+    void testRun()
+    {
+        WorkerPool pool{2};
+        QThread *pMainThread = QThread::currentThread();
+        QThread *pJobThread = nullptr;
+        auto pJob = pool.run([&pJobThread]()
+        {
+            pJobThread = QThread::currentThread();
+            return 6 * 7;
+        });
+
+        bool resolved = false;
+        pJob->notify(this, [&](const Error &error, const int &result)
+        {
+            QVERIFY(!error);
+            QCOMPARE(result, 42);
+            QCOMPARE(QThread::currentThread(), pMainThread);
+            resolved = true;
+        });
+        QTRY_VERIFY(resolved);
+        QVERIFY(pJobThread);
+        QVERIFY(pJobThread != pMainThread);
+        QCOMPARE(pool.metrics(WorkerPool::NormalPriority).completed, quint64{1});
+    }
+
+    // Exceptions thrown by a job reject its task
+    void testException()
+    {
+        WorkerPool pool{1};
+        auto pJob = pool.run([]() -> int
+        {
+            throw Error{HERE, Error::Unknown};
+        });
+        auto pVoidJob = pool.run([]()
+        {
+            throw std::runtime_error{"failed"};
+        });
+
+        QTRY_VERIFY(pJob->isRejected());
+        QCOMPARE(pJob->error().code(), Error::Unknown);
+        QTRY_VERIFY(pVoidJob->isRejected());
+    }
+
+    // Canceling a queued job rejects it immediately, and the job never runs
+    void testCancelQueued()
+    {
+        WorkerPool pool{1};
+        QSemaphore started, release;
+        auto pBlocker = pool.run([&]()
+        {
+            started.release();
+            release.acquire();
+        });
+        started.acquire();
+
+        std::atomic<bool> ran{false};
+        auto pJob = pool.run([&ran](){ran = true;});
+        pJob->cancel();
+        QVERIFY(pJob->isRejected());
+        QCOMPARE(pJob->error().code(), Error::TaskRejected);
+
+        release.release();
+        QTRY_VERIFY(pBlocker->isResolved());
+        QTRY_COMPARE(pool.metrics(WorkerPool::NormalPriority).canceled, quint64{1});
+        QVERIFY(!ran);
+    }
+
+    // A running job can observe cancellation
+    void testCancelRunning()
+    {
+        WorkerPool pool{1};
+        QSemaphore started;
+        auto pJob = pool.run([&started]()
+        {
+            started.release();
+            while(!WorkerPool::cancellationRequested())
+                QThread::msleep(1);
+            return true;
+        });
+        started.acquire();
+        pJob->cancel();
+        QVERIFY(pJob->isRejected());
+        QTRY_COMPARE(pool.metrics(WorkerPool::NormalPriority).completed, quint64{1});
+        QVERIFY(!WorkerPool::cancellationRequested());
+    }
+
+    // Higher-priority jobs run first
+    void testPriority()
+    {
+        WorkerPool pool{1};
+        QSemaphore started, release;
+        auto pBlocker = pool.run([&]()
+        {
+            started.release();
+            release.acquire();
+        });
+        started.acquire();
+
+        QMutex orderMutex;
+        QStringList order;
+        auto record = [&](const QString &name)
+        {
+            return [&, name]()
+            {
+                QMutexLocker lock{&orderMutex};
+                order.push_back(name);
+            };
+        };
+        auto pLow = pool.run(record(QStringLiteral("low")), WorkerPool::LowPriority);
+        auto pNormal = pool.run(record(QStringLiteral("normal")), WorkerPool::NormalPriority);
+        auto pHigh = pool.run(record(QStringLiteral("high")), WorkerPool::HighPriority);
+        QCOMPARE(pool.metrics(WorkerPool::LowPriority).depth, 1);
+
+        release.release();
+        QTRY_VERIFY(pLow->isResolved());
+        QVERIFY(pNormal->isResolved());
+        QVERIFY(pHigh->isResolved());
+        QCOMPARE(order, (QStringList{QStringLiteral("high"), QStringLiteral("normal"), QStringLiteral("low")}));
+        QCOMPARE(pool.metrics(WorkerPool::LowPriority).depth, 0);
+        QCOMPARE(pool.metrics(WorkerPool::LowPriority).maxDepth, 1);
+    }
+
+    // Idle workers steal jobs queued to a busy worker
+    void testSteal()
+    {
+        WorkerPool pool{2};
+        QSemaphore started, release;
+        auto pBlocker = pool.run([&]()
+        {
+            started.release();
+            release.acquire();
+        });
+        started.acquire();
+
+        // Jobs are spread across both workers, so some are queued to the
+        // busy worker.  They all have to finish while it's still blocked.
+        std::vector<Async<WorkerPool::JobTask<int>>> jobs;
+        for(int i=0; i<4; ++i)
+            jobs.push_back(pool.run([i](){return i;}));
+        for(const auto &pJob : jobs)
+            QTRY_VERIFY(pJob->isResolved());
+        QVERIFY(pBlocker->isPending());
+        QVERIFY(pool.metrics(WorkerPool::NormalPriority).stolen > 0);
+
+        release.release();
+        QTRY_VERIFY(pBlocker->isResolved());
+    }
+
+    // Abandoning a task cancels the job if it hasn't started
+    void testAbandon()
+    {
+        WorkerPool pool{1};
+        QSemaphore started, release;
+        auto pBlocker = pool.run([&]()
+        {
+            started.release();
+            release.acquire();
+        });
+        started.acquire();
+
+        std::atomic<bool> ran{false};
+        pool.run([&ran]()
+        {
+            ran = true;
+            return 1;
+        }).abandon();
+
+        release.release();
+        QTRY_VERIFY(pBlocker->isResolved());
+        QTRY_COMPARE(pool.metrics(WorkerPool::NormalPriority).canceled, quint64{1});
+        QCOMPARE(pool.metrics(WorkerPool::NormalPriority).completed, quint64{1});
+        QVERIFY(!ran);
+    }
+
+    // Queued jobs are canceled when the pool is destroyed
+    void testDestroy()
+    {
+        Async<WorkerPool::JobTask<int>> pQueued;
+        {
+            WorkerPool pool{1};
+            QSemaphore started, release;
+            auto pBlocker = pool.run([&]()
+            {
+                started.release();
+                release.acquire();
+            });
+            started.acquire();
+            pQueued = pool.run([](){return 1;});
+            release.release();
+            // Destroy the pool before the worker can take the queued job -
+            // either way the task must finish.
+        }
+        QTRY_VERIFY(pQueued->isFinished());
+    }
+};
+
+QTEST_GUILESS_MAIN(tst_workerpool)
+#include TEST_MOC
@@ -0,0 +1,228 @@
+// Copyright (c) 2019 London Trust Media Incorporated
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "extras/support-tool/zipstream.h"
+#include <QtTest>
+#include <QTemporaryDir>
+#include <QProcess>
+#include <QStandardPaths>
+
+class tst_zipstream : public QObject
+{
+    Q_OBJECT
+
+private:
+    QTemporaryDir _dir;
+
+    QString writeFile(const QString &name, const QByteArray &content)
+    {
+        QString path = _dir.filePath(name);
+        QFile file{path};
+        if(!file.open(QIODevice::WriteOnly) || file.write(content) != content.size())
+            return {};
+        return path;
+    }
+
+    // Read the whole stream in small reads, like an upload would
+    QByteArray readAll(ZipStream &zip)
+    {
+        QByteArray archive;
+        char chunk[4000];
+        while(!zip.atEnd())
+        {
+            qint64 chunkSize = zip.read(chunk, sizeof(chunk));
+            if(chunkSize <= 0)
+                break;
+            archive.append(chunk, static_cast<int>(chunkSize));
+        }
+        return archive;
+    }
+
+    // Read the entry count from the end of central directory record
+    int entryCount(const QByteArray &archive)
+    {
+        if(archive.size() < 22)
+            return -1;
+        const char *pEndRecord = archive.constData() + archive.size() - 22;
+        if(qFromLittleEndian<quint32>(pEndRecord) != 0x06054b50)
+            return -1;
+        return qFromLittleEndian<quint16>(pEndRecord + 10);
+    }
+
+    // Extract an entry with unzip
+    QByteArray unzipEntry(const QString &zipPath, const QString &name)
+    {
+        QProcess unzip;
+        unzip.start(QStringLiteral("unzip"), {QStringLiteral("-p"), zipPath, name});
+        if(!unzip.waitForFinished() || unzip.exitCode() != 0)
+            return {};
+        return unzip.readAllStandardOutput();
+    }
+
+    // Test an archive with unzip
+    bool unzipTest(const QString &zipPath)
+    {
+        QProcess test;
+        test.start(QStringLiteral("unzip"), {QStringLiteral("-t"), zipPath});
+        return test.waitForFinished() && test.exitCode() == 0;
+    }
+
+private slots:
+    // Stream text, binary, and empty entries, and read them back with unzip
+    void roundTrip()
+    {
+        QByteArray text;
+        for(int i = 0; i < 10000; ++i)
+            text.append(QStringLiteral("[daemon.cpp:%1][debug] Log line %1\n").arg(i).toUtf8());
+        QByteArray random;
+        random.resize(300000);
+        for(auto &byte : random)
+            byte = static_cast<char>(qrand());
+
+        QString textPath = writeFile(QStringLiteral("text.txt"), text);
+        QString randomPath = writeFile(QStringLiteral("random.bin"), random);
+        QString emptyPath = writeFile(QStringLiteral("empty.txt"), {});
+        QVERIFY(!textPath.isEmpty());
+        QVERIFY(!randomPath.isEmpty());
+        QVERIFY(!emptyPath.isEmpty());
+
+        ZipStream zip;
+        QVERIFY(zip.addFile(QStringLiteral("pia_files/logs.txt"), textPath));
+        QVERIFY(zip.addFile(QStringLiteral("pia_files/random.bin"), randomPath));
+        QVERIFY(zip.addFile(QString::fromUtf8(u8"pia_files/ünicode.txt"), emptyPath));
+        // Missing files are skipped
+        QVERIFY(!zip.addFile(QStringLiteral("missing.txt"), _dir.filePath(QStringLiteral("missing.txt"))));
+
+        qint64 lastProgress = 0, progressTotal = 0;
+        connect(&zip, &ZipStream::progress, this, [&](qint64 read, qint64 total)
+        {
+            QVERIFY(read > lastProgress);
+            lastProgress = read;
+            progressTotal = total;
+        });
+
+        QVERIFY(zip.open(QIODevice::ReadOnly));
+        // Entries can't be added once the stream is open
+        QVERIFY(!zip.addFile(QStringLiteral("late.txt"), textPath));
+        qint64 expectedSize = zip.size();
+        QByteArray archive = readAll(zip);
+        QVERIFY(zip.atEnd());
+        // The size was exact before anything was read
+        QCOMPARE(static_cast<qint64>(archive.size()), expectedSize);
+        QCOMPARE(lastProgress, expectedSize);
+        QCOMPARE(progressTotal, expectedSize);
+        QCOMPARE(entryCount(archive), 3);
+
+        if(QStandardPaths::findExecutable(QStringLiteral("unzip")).isEmpty())
+            QSKIP("unzip is not available to verify the archive");
+
+        QString zipPath = writeFile(QStringLiteral("roundtrip.zip"), archive);
+        QVERIFY(!zipPath.isEmpty());
+        QVERIFY(unzipTest(zipPath));
+        QCOMPARE(unzipEntry(zipPath, QStringLiteral("pia_files/logs.txt")), text);
+        QCOMPARE(unzipEntry(zipPath, QStringLiteral("pia_files/random.bin")), random);
+    }
+
+    // reset() produces the same archive again, as when an upload is resent
+    void restart()
+    {
+        QByteArray content{"restart content\n"};
+        content = content.repeated(10000);
+        QString path = writeFile(QStringLiteral("restart.txt"), content);
+        QVERIFY(!path.isEmpty());
+
+        ZipStream zip;
+        QVERIFY(zip.addFile(QStringLiteral("restart.txt"), path));
+        QVERIFY(zip.open(QIODevice::ReadOnly));
+
+        // Read part of the archive, then start over
+        char partial[1000];
+        QCOMPARE(zip.read(partial, sizeof(partial)), static_cast<qint64>(sizeof(partial)));
+        // Only the current position or the start can be sought to
+        QVERIFY(!zip.seek(100));
+        QVERIFY(zip.seek(sizeof(partial)));
+        QVERIFY(zip.reset());
+        QCOMPARE(zip.pos(), qint64{0});
+        QByteArray first = readAll(zip);
+        QCOMPARE(first.left(sizeof(partial)), QByteArray(partial, sizeof(partial)));
+
+        QVERIFY(zip.reset());
+        QCOMPARE(readAll(zip), first);
+        QCOMPARE(static_cast<qint64>(first.size()), zip.size());
+    }
+
+    // A source that shrinks after it's added is padded to its recorded size,
+    // and one that grows is truncated, so the archive still matches its
+    // headers
+    void changedSources()
+    {
+        QByteArray original{"0123456789abcdef"};
+        original = original.repeated(1000);
+        QString shrinkPath = writeFile(QStringLiteral("shrink.txt"), original);
+        QString growPath = writeFile(QStringLiteral("grow.txt"), original);
+        QVERIFY(!shrinkPath.isEmpty());
+        QVERIFY(!growPath.isEmpty());
+
+        ZipStream zip;
+        QVERIFY(zip.addFile(QStringLiteral("shrink.txt"), shrinkPath));
+        QVERIFY(zip.addFile(QStringLiteral("grow.txt"), growPath));
+        qint64 expectedSize = zip.size();
+
+        QVERIFY(!writeFile(QStringLiteral("shrink.txt"), original.left(100)).isEmpty());
+        QVERIFY(!writeFile(QStringLiteral("grow.txt"), original + original).isEmpty());
+
+        QVERIFY(zip.open(QIODevice::ReadOnly));
+        QByteArray archive = readAll(zip);
+        QCOMPARE(static_cast<qint64>(archive.size()), expectedSize);
+        QCOMPARE(entryCount(archive), 2);
+
+        if(QStandardPaths::findExecutable(QStringLiteral("unzip")).isEmpty())
+            QSKIP("unzip is not available to verify the archive");
+
+        QString zipPath = writeFile(QStringLiteral("changed.zip"), archive);
+        QVERIFY(!zipPath.isEmpty());
+        QVERIFY(unzipTest(zipPath));
+        QCOMPARE(unzipEntry(zipPath, QStringLiteral("shrink.txt")),
+                 original.left(100) + QByteArray(original.size() - 100, '\0'));
+        QCOMPARE(unzipEntry(zipPath, QStringLiteral("grow.txt")), original);
+    }
+
+    // copyTo() writes the same archive to a file
+    void copyToFile()
+    {
+        QString path = writeFile(QStringLiteral("copy.txt"), QByteArray{"copy\n"}.repeated(50000));
+        QVERIFY(!path.isEmpty());
+
+        ZipStream zip;
+        QVERIFY(zip.addFile(QStringLiteral("copy.txt"), path));
+        QVERIFY(zip.open(QIODevice::ReadOnly));
+        QByteArray archive = readAll(zip);
+        QVERIFY(zip.reset());
+
+        QString zipPath = _dir.filePath(QStringLiteral("copy.zip"));
+        QFile zipFile{zipPath};
+        QVERIFY(zipFile.open(QIODevice::WriteOnly | QIODevice::Truncate));
+        QVERIFY(zip.copyTo(zipFile));
+        zipFile.close();
+        QVERIFY(zipFile.open(QIODevice::ReadOnly));
+        QCOMPARE(zipFile.readAll(), archive);
+    }
+};
+
+QTEST_GUILESS_MAIN(tst_zipstream)
+#include TEST_MOC